@@ -76,19 +76,22 @@
 #define DEFAULT_BLACKBOX_DEVICE     BLACKBOX_DEVICE_SERIAL
 #endif
 
-PG_REGISTER_WITH_RESET_TEMPLATE(blackboxConfig_t, blackboxConfig, PG_BLACKBOX_CONFIG, 0);
+PG_REGISTER_WITH_RESET_TEMPLATE(blackboxConfig_t, blackboxConfig, PG_BLACKBOX_CONFIG, 1);
 
 PG_RESET_TEMPLATE(blackboxConfig_t, blackboxConfig,
     .device = DEFAULT_BLACKBOX_DEVICE,
     .rate_num = 1,
     .rate_denom = 1,
     .on_motor_test = 0, // default off
-    .record_acc = 1
+    .record_acc = 1,
+    .rate_adaptive = 0
 );
 
 #define BLACKBOX_I_INTERVAL 32
 #define BLACKBOX_SHUTDOWN_TIMEOUT_MILLIS 200
 #define SLOW_FRAME_INTERVAL 4096
+// How long the device has to keep up before an adaptive P interval is stepped back up
+#define BLACKBOX_RATE_RECOVERY_US 2000000
 
 #define STATIC_ASSERT(condition, name ) \
     typedef char assert_failed_ ## name [(condition) ? 1 : -1 ]
@@ -353,6 +356,27 @@ static uint16_t blackboxPFrameIndex, blackboxIFrameIndex;
 static uint16_t blackboxSlowFrameIterationTimer;
 static bool blackboxLoggedAnyFrames;
 
+// Frames that had to be discarded because the device didn't have room for them, since the start of the log
+static struct {
+    uint32_t intraframes;
+    uint32_t interframes;
+    uint32_t slowFrames;
+    uint32_t bytes;
+} blackboxDropped;
+
+static bool blackboxDroppedSinceEvent;
+static bool blackboxDroppedSinceIntraframe;
+// P-frames can't be decoded without the main frame before them, so none are logged until the next I-frame
+static bool blackboxMainFrameDropped;
+
+/*
+ * The P interval actually being logged is rate_num / (rate_denom << blackboxRateShift), where the shift is only
+ * raised from 0 by blackbox_rate_adaptive.
+ */
+static uint8_t blackboxRateShift;
+static uint16_t blackboxPIntervalDenom;
+static timeUs_t blackboxRateChangeTimeUs;
+
 /*
  * We store voltages in I-frames relative to this, which was the voltage when the blackbox was activated.
  * This helps out since the voltage is only expected to fall from that point and we can reduce our diffs
@@ -381,7 +405,7 @@ bool blackboxMayEditConfig(void)
 
 static bool blackboxIsOnlyLoggingIntraframes(void)
 {
-    return blackboxConfig()->rate_num == 1 && blackboxConfig()->rate_denom == 32;
+    return blackboxConfig()->rate_num * BLACKBOX_I_INTERVAL <= blackboxPIntervalDenom;
 }
 
 static bool testBlackboxConditionUncached(FlightLogFieldCondition condition)
@@ -439,7 +463,8 @@ static bool testBlackboxConditionUncached(FlightLogFieldCondition condition)
         return rxConfig()->rssi_channel > 0 || feature(FEATURE_RSSI_ADC);
 
     case FLIGHT_LOG_FIELD_CONDITION_NOT_LOGGING_EVERY_FRAME:
-        return blackboxConfig()->rate_num < blackboxConfig()->rate_denom;
+        // An adaptive P interval can start at every frame but won't stay there
+        return blackboxConfig()->rate_num < blackboxConfig()->rate_denom || blackboxConfig()->rate_adaptive;
 
     case FLIGHT_LOG_FIELD_CONDITION_ACC:
         return sensors(SENSOR_ACC) && blackboxConfig()->record_acc;
@@ -504,6 +529,29 @@ static void blackboxSetState(BlackboxState newState)
     blackboxState = newState;
 }
 
+/**
+ * Call after writing each frame, to count the frame against the given total if the device didn't have room for it.
+ *
+ * Returns true if the frame was kept.
+ */
+static bool blackboxFinishFrame(uint32_t *droppedFrames)
+{
+    const int droppedBytes = blackboxEndFrame();
+
+    if (droppedBytes == 0) {
+        return true;
+    }
+
+    if (droppedFrames) {
+        (*droppedFrames)++;
+    }
+    blackboxDropped.bytes += droppedBytes;
+    blackboxDroppedSinceEvent = true;
+    blackboxDroppedSinceIntraframe = true;
+
+    return false;
+}
+
 static void writeIntraframe(void)
 {
     blackboxMainState_t *blackboxCurrent = blackboxHistory[0];
@@ -597,6 +645,8 @@ static void writeIntraframe(void)
     blackboxHistory[1] = blackboxHistory[0];
     //And since we have no other history, we also use it for the "before, before" state
     blackboxHistory[2] = blackboxHistory[0];
+    blackboxMainFrameDropped = !blackboxFinishFrame(&blackboxDropped.intraframes);
+
     //And advance the current state over to a blank space ready to be filled
     blackboxHistory[0] = ((blackboxHistory[0] - blackboxHistoryRing + 1) % 3) + blackboxHistoryRing;
 
@@ -715,6 +765,10 @@ static void writeInterframe(void)
         blackboxWriteSignedVB(blackboxCurrent->servo[5] - blackboxLast->servo[5]);
     }
 
+    if (!blackboxFinishFrame(&blackboxDropped.interframes)) {
+        blackboxMainFrameDropped = true;
+    }
+
     //Rotate our history buffers
     blackboxHistory[2] = blackboxHistory[1];
     blackboxHistory[1] = blackboxHistory[0];
@@ -742,7 +796,12 @@ static void writeSlowFrame(void)
     values[2] = slowHistory.rxFlightChannelsValid ? 1 : 0;
     blackboxWriteTag2_3S32(values);
 
-    blackboxSlowFrameIterationTimer = 0;
+    if (blackboxFinishFrame(&blackboxDropped.slowFrames)) {
+        blackboxSlowFrameIterationTimer = 0;
+    } else {
+        // Try again on the next main frame
+        blackboxSlowFrameIterationTimer = SLOW_FRAME_INTERVAL;
+    }
 }
 
 /**
@@ -862,6 +921,13 @@ static void blackboxStart(void)
 
     blackboxResetIterationTimers();
 
+    memset(&blackboxDropped, 0, sizeof(blackboxDropped));
+    blackboxDroppedSinceEvent = false;
+    blackboxDroppedSinceIntraframe = false;
+    blackboxMainFrameDropped = false;
+    blackboxRateShift = 0;
+    blackboxPIntervalDenom = blackboxConfig()->rate_denom;
+
     /*
      * Record the beeper's current idea of the last arming beep time, so that we can detect it changing when
      * it finally plays the beep for this arming event.
@@ -872,6 +938,25 @@ static void blackboxStart(void)
     blackboxSetState(BLACKBOX_STATE_PREPARE_LOG_FILE);
 }
 
+/**
+ * Write the totals of what has been dropped so far to the log, along with the P interval in use.
+ */
+static void blackboxLogDataDropped(void)
+{
+    flightLogEvent_dataDropped_t eventData;
+
+    eventData.intraframes = blackboxDropped.intraframes;
+    eventData.interframes = blackboxDropped.interframes;
+    eventData.slowFrames = blackboxDropped.slowFrames;
+    eventData.bytes = blackboxDropped.bytes;
+    eventData.pIntervalNum = blackboxConfig()->rate_num;
+    eventData.pIntervalDenom = blackboxPIntervalDenom;
+
+    // If the event doesn't fit either, blackboxFinishFrame() leaves it pending for next time
+    blackboxDroppedSinceEvent = false;
+    blackboxLogEvent(FLIGHT_LOG_EVENT_DATA_DROPPED, (flightLogEventData_t *) &eventData);
+}
+
 /**
  * Begin Blackbox shutdown.
  */
@@ -886,6 +971,10 @@ void blackboxFinish(void)
 
     case BLACKBOX_STATE_RUNNING:
     case BLACKBOX_STATE_PAUSED:
+        // Leave the totals of anything that was dropped at the end of the log
+        if (blackboxDropped.bytes > 0 || blackboxDropped.interframes > 0) {
+            blackboxLogDataDropped();
+        }
         blackboxLogEvent(FLIGHT_LOG_EVENT_LOG_END, NULL);
 
         // Fall through
@@ -968,8 +1057,11 @@ static void writeGPSHomeFrame(void)
     blackboxWriteSignedVB(GPS_home[1]);
     //TODO it'd be great if we could grab the GPS current time and write that too
 
-    gpsHistory.GPS_home[0] = GPS_home[0];
-    gpsHistory.GPS_home[1] = GPS_home[1];
+    // If the frame was dropped the history is left alone, so that it is written again next time
+    if (blackboxFinishFrame(NULL)) {
+        gpsHistory.GPS_home[0] = GPS_home[0];
+        gpsHistory.GPS_home[1] = GPS_home[1];
+    }
 }
 
 static void writeGPSFrame(timeUs_t currentTimeUs)
@@ -994,9 +1086,11 @@ static void writeGPSFrame(timeUs_t currentTimeUs)
     blackboxWriteUnsignedVB(GPS_speed);
     blackboxWriteUnsignedVB(GPS_ground_course);
 
-    gpsHistory.GPS_numSat = GPS_numSat;
-    gpsHistory.GPS_coord[0] = GPS_coord[0];
-    gpsHistory.GPS_coord[1] = GPS_coord[1];
+    if (blackboxFinishFrame(NULL)) {
+        gpsHistory.GPS_numSat = GPS_numSat;
+        gpsHistory.GPS_coord[0] = GPS_coord[0];
+        gpsHistory.GPS_coord[1] = GPS_coord[1];
+    }
 }
 #endif
 
@@ -1196,6 +1290,8 @@ static bool blackboxWriteSysinfo(void)
         BLACKBOX_PRINT_HEADER_LINE("Firmware date", "%s %s",                 buildDate, buildTime);
         BLACKBOX_PRINT_HEADER_LINE("Craft name", "%s",                       systemConfig()->name);
         BLACKBOX_PRINT_HEADER_LINE("P interval", "%d/%d",                    blackboxConfig()->rate_num, blackboxConfig()->rate_denom);
+        BLACKBOX_PRINT_HEADER_LINE("P interval adaptive", "%d",              blackboxConfig()->rate_adaptive);
+        BLACKBOX_PRINT_HEADER_LINE("Data dropped event", "%d",               FLIGHT_LOG_EVENT_DATA_DROPPED);
         BLACKBOX_PRINT_HEADER_LINE("minthrottle", "%d",                      motorConfig()->minthrottle);
         BLACKBOX_PRINT_HEADER_LINE("maxthrottle", "%d",                      motorConfig()->maxthrottle);
         BLACKBOX_PRINT_HEADER_LINE("gyro_scale","0x%x",                     castFloatBytesToInt(1.0f));
@@ -1307,6 +1403,7 @@ static bool blackboxWriteSysinfo(void)
         BLACKBOX_PRINT_HEADER_LINE("dshot_idle_value", "%d",                 motorConfig()->digitalIdleOffsetValue);
         BLACKBOX_PRINT_HEADER_LINE("debug_mode", "%d",                       systemConfig()->debug_mode);
         BLACKBOX_PRINT_HEADER_LINE("features", "%d",                         featureConfig()->enabledFeatures);
+        BLACKBOX_PRINT_HEADER_LINE("rate_adaptive", "%d",                    blackboxConfig()->rate_adaptive);
 
         default:
             return true;
@@ -1352,10 +1449,63 @@ void blackboxLogEvent(FlightLogEvent event, flightLogEventData_t *data)
         blackboxWriteUnsignedVB(data->loggingResume.logIteration);
         blackboxWriteUnsignedVB(data->loggingResume.currentTime);
         break;
+    case FLIGHT_LOG_EVENT_DATA_DROPPED:
+        blackboxWriteUnsignedVB(data->dataDropped.intraframes);
+        blackboxWriteUnsignedVB(data->dataDropped.interframes);
+        blackboxWriteUnsignedVB(data->dataDropped.slowFrames);
+        blackboxWriteUnsignedVB(data->dataDropped.bytes);
+        blackboxWriteUnsignedVB(data->dataDropped.pIntervalNum);
+        blackboxWriteUnsignedVB(data->dataDropped.pIntervalDenom);
+        break;
     case FLIGHT_LOG_EVENT_LOG_END:
         blackboxPrint("End of log");
         blackboxWrite(0);
-        break;
+        // Handed to the device even if it is short of room, since the log is finished either way
+        return;
+    }
+
+    blackboxFinishFrame(NULL);
+}
+
+/*
+ * Halve the P-frame rate when frames were dropped during the last I interval, and double it again (up to the
+ * configured rate) once the device has kept up for BLACKBOX_RATE_RECOVERY_US.
+ *
+ * Returns true if the rate changed.
+ */
+static bool blackboxAdaptLoggingRate(timeUs_t currentTimeUs)
+{
+    if (blackboxDroppedSinceIntraframe) {
+        blackboxRateChangeTimeUs = currentTimeUs;
+
+        // Stop at logging I-frames only
+        if ((blackboxConfig()->rate_denom << (blackboxRateShift + 1)) > blackboxConfig()->rate_num * BLACKBOX_I_INTERVAL) {
+            return false;
+        }
+        blackboxRateShift++;
+    } else if (blackboxRateShift > 0 && cmpTimeUs(currentTimeUs, blackboxRateChangeTimeUs) >= BLACKBOX_RATE_RECOVERY_US) {
+        blackboxRateChangeTimeUs = currentTimeUs;
+        blackboxRateShift--;
+    } else {
+        return false;
+    }
+
+    blackboxPIntervalDenom = blackboxConfig()->rate_denom << blackboxRateShift;
+    return true;
+}
+
+/*
+ * Called before each I-frame. Rate changes only happen here, so that the decoder has the event that announces them
+ * before the P-frames they apply to.
+ */
+static void blackboxCheckAndLogDataDropped(timeUs_t currentTimeUs)
+{
+    const bool rateChanged = blackboxConfig()->rate_adaptive && blackboxAdaptLoggingRate(currentTimeUs);
+
+    blackboxDroppedSinceIntraframe = false;
+
+    if (blackboxDroppedSinceEvent || rateChanged) {
+        blackboxLogDataDropped();
     }
 }
 
@@ -1398,7 +1548,7 @@ static bool blackboxShouldLogPFrame(uint32_t pFrameIndex)
     /* Adding a magic shift of "blackboxConfig()->rate_num - 1" in here creates a better spread of
      * recorded / skipped frames when the I frame's position is considered:
      */
-    return (pFrameIndex + blackboxConfig()->rate_num - 1) % blackboxConfig()->rate_denom < blackboxConfig()->rate_num;
+    return (pFrameIndex + blackboxConfig()->rate_num - 1) % blackboxPIntervalDenom < blackboxConfig()->rate_num;
 }
 
 static bool blackboxShouldLogIFrame(void)
@@ -1442,6 +1592,8 @@ static void blackboxLogIteration(timeUs_t currentTimeUs)
 {
     // Write a keyframe every BLACKBOX_I_INTERVAL frames so we can resynchronise upon missing frames
     if (blackboxShouldLogIFrame()) {
+        blackboxCheckAndLogDataDropped(currentTimeUs);
+
         /*
          * Don't log a slow frame if the slow data didn't change ("I" frames are already large enough without adding
          * an additional item to write at the same time). Unless we're *only* logging "I" frames, then we have no choice.
@@ -1457,14 +1609,18 @@ static void blackboxLogIteration(timeUs_t currentTimeUs)
         blackboxCheckAndLogFlightMode(); // Check for FlightMode status change event
 
         if (blackboxShouldLogPFrame(blackboxPFrameIndex)) {
-            /*
-             * We assume that slow frames are only interesting in that they aid the interpretation of the main data stream.
-             * So only log slow frames during loop iterations where we log a main frame.
-             */
-            writeSlowFrameIfNeeded();
-
-            loadMainState(currentTimeUs);
-            writeInterframe();
+            if (blackboxMainFrameDropped) {
+                blackboxDropped.interframes++;
+            } else {
+                /*
+                 * We assume that slow frames are only interesting in that they aid the interpretation of the main data stream.
+                 * So only log slow frames during loop iterations where we log a main frame.
+                 */
+                writeSlowFrameIfNeeded();
+
+                loadMainState(currentTimeUs);
+                writeInterframe();
+            }
         }
 #ifdef GPS
         if (feature(FEATURE_GPS)) {
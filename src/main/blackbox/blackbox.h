@@ -38,6 +38,7 @@ typedef struct blackboxConfig_s {
     uint8_t device;
     uint8_t on_motor_test;
     uint8_t record_acc;
+    uint8_t rate_adaptive;      // lower the P interval while the device can't keep up, and raise it again when it can
 } blackboxConfig_t;
 
 PG_DECLARE(blackboxConfig_t, blackboxConfig);
@@ -12,6 +12,7 @@
 #include "blackbox_io.h"
 
 #include "common/encoding.h"
+#include "common/maths.h"
 #include "common/printf.h"
 
 
@@ -65,6 +66,47 @@ void blackboxPrintfHeaderLine(const char *name, const char *fmt, ...)
     blackboxHeaderBudget -= written + 3;
 }
 
+/*
+ * Number of bits needed to hold the signed value, in the range 2 to 33. Values that fit in 1 bit are reported as 2
+ * bits, since none of the encodings below have a field narrower than that.
+ */
+static inline unsigned signedBitWidth(int32_t value)
+{
+    // Fold negative values onto the positive ones, the sign bit is then the one above the highest set bit
+    const uint32_t magnitude = (uint32_t) (value ^ (value >> 31));
+
+    return 33 - __builtin_clz(magnitude | 1);
+}
+
+// Number of bytes (minus 1) needed by a field of the given bit width
+static const uint8_t byteCountSelector[34] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0,              // 0-8 bits
+    1, 1, 1, 1, 1, 1, 1, 1,                 // 9-16 bits
+    2, 2, 2, 2, 2, 2, 2, 2,                 // 17-24 bits
+    3, 3, 3, 3, 3, 3, 3, 3, 3               // 25-33 bits
+};
+
+/*
+ * Write the byte count selectors for three fields followed by the fields themselves, with the number of bytes the
+ * selectors specify. The first field is in the low bits of the selector byte.
+ */
+static void blackboxWriteTag2_3ByteFields(int selector, int32_t *values)
+{
+    const int selector2 = byteCountSelector[signedBitWidth(values[0])]
+        | (byteCountSelector[signedBitWidth(values[1])] << 2)
+        | (byteCountSelector[signedBitWidth(values[2])] << 4);
+
+    blackboxWrite((selector << 6) | selector2);
+
+    for (int x = 0; x < 3; x++) {
+        const int byteCount = ((selector2 >> (2 * x)) & 0x03) + 1;
+
+        for (int i = 0; i < byteCount; i++) {
+            blackboxWrite(values[x] >> (8 * i));
+        }
+    }
+}
+
 /**
  * Write an unsigned integer to the blackbox serial port using variable byte encoding.
  */
@@ -112,9 +154,6 @@ void blackboxWriteS16(int16_t value)
  */
 void blackboxWriteTag2_3S32(int32_t *values)
 {
-    static const int NUM_FIELDS = 3;
-
-    //Need to be enums rather than const ints if we want to switch on them (due to being C)
     enum {
         BITS_2  = 0,
         BITS_4  = 1,
@@ -122,18 +161,19 @@ void blackboxWriteTag2_3S32(int32_t *values)
         BITS_32 = 3
     };
 
-    enum {
-        BYTES_1  = 0,
-        BYTES_2  = 1,
-        BYTES_3  = 2,
-        BYTES_4  = 3
+    // Packing scheme for the width of the widest field
+    static const uint8_t selectorForBitWidth[34] = {
+        BITS_2, BITS_2, BITS_2,                 // 0-2 bits
+        BITS_4, BITS_4,                         // 3-4 bits
+        BITS_6, BITS_6,                         // 5-6 bits
+        BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32,
+        BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32,
+        BITS_32, BITS_32, BITS_32               // 7-33 bits
     };
 
-    int selector = BITS_2, selector2;
-
     /*
-     * Find out how many bits the largest value requires to encode, and use it to choose one of the packing schemes
-     * below:
+     * The widest field decides which of the packing schemes below is used. Folding the fields onto positive values
+     * and OR-ing them together gives the width of the widest field in a single count-leading-zeros.
      *
      * Selector possibilities
      *
@@ -142,24 +182,8 @@ void blackboxWriteTag2_3S32(int32_t *values)
      * 6 bits per field  ss11 1111 0022 2222 0033 3333
      * 32 bits per field sstt tttt followed by fields of various byte counts
      */
-    for (int x = 0; x < NUM_FIELDS; x++) {
-        //Require more than 6 bits?
-        if (values[x] >= 32 || values[x] < -32) {
-            selector = BITS_32;
-            break;
-        }
-
-        //Require more than 4 bits?
-        if (values[x] >= 8 || values[x] < -8) {
-             if (selector < BITS_6) {
-                 selector = BITS_6;
-             }
-        } else if (values[x] >= 2 || values[x] < -2) { //Require more than 2 bits?
-            if (selector < BITS_4) {
-                selector = BITS_4;
-            }
-        }
-    }
+    const int32_t widest = (values[0] ^ (values[0] >> 31)) | (values[1] ^ (values[1] >> 31)) | (values[2] ^ (values[2] >> 31));
+    const int selector = selectorForBitWidth[signedBitWidth(widest)];
 
     switch (selector) {
     case BITS_2:
@@ -175,58 +199,7 @@ void blackboxWriteTag2_3S32(int32_t *values)
         blackboxWrite((uint8_t)values[2]);
         break;
     case BITS_32:
-        /*
-         * Do another round to compute a selector for each field, assuming that they are at least 8 bits each
-         *
-         * Selector2 field possibilities
-         * 0 - 8 bits
-         * 1 - 16 bits
-         * 2 - 24 bits
-         * 3 - 32 bits
-         */
-        selector2 = 0;
-
-        //Encode in reverse order so the first field is in the low bits:
-        for (int x = NUM_FIELDS - 1; x >= 0; x--) {
-            selector2 <<= 2;
-
-            if (values[x] < 128 && values[x] >= -128) {
-                selector2 |= BYTES_1;
-            } else if (values[x] < 32768 && values[x] >= -32768) {
-                selector2 |= BYTES_2;
-            } else if (values[x] < 8388608 && values[x] >= -8388608) {
-                selector2 |= BYTES_3;
-            } else {
-                selector2 |= BYTES_4;
-            }
-        }
-
-        //Write the selectors
-        blackboxWrite((selector << 6) | selector2);
-
-        //And now the values according to the selectors we picked for them
-        for (int x = 0; x < NUM_FIELDS; x++, selector2 >>= 2) {
-            switch (selector2 & 0x03) {
-            case BYTES_1:
-                blackboxWrite(values[x]);
-                break;
-            case BYTES_2:
-                blackboxWrite(values[x]);
-                blackboxWrite(values[x] >> 8);
-                break;
-            case BYTES_3:
-                blackboxWrite(values[x]);
-                blackboxWrite(values[x] >> 8);
-                blackboxWrite(values[x] >> 16);
-                break;
-            case BYTES_4:
-                blackboxWrite(values[x]);
-                blackboxWrite(values[x] >> 8);
-                blackboxWrite(values[x] >> 16);
-                blackboxWrite(values[x] >> 24);
-                break;
-            }
-        }
+        blackboxWriteTag2_3ByteFields(selector, values);
         break;
     }
 }
@@ -236,7 +209,6 @@ void blackboxWriteTag2_3S32(int32_t *values)
  */
 int blackboxWriteTag2_3SVariable(int32_t *values)
 {
-    static const int FIELD_COUNT = 3;
     enum {
         BITS_2  = 0,
         BITS_554  = 1,
@@ -244,17 +216,27 @@ int blackboxWriteTag2_3SVariable(int32_t *values)
         BITS_32 = 3
     };
 
-    enum {
-        BYTES_1  = 0,
-        BYTES_2  = 1,
-        BYTES_3  = 2,
-        BYTES_4  = 3
+    // Smallest packing scheme that can hold each field, by field and bit width
+    static const uint8_t selectorForBitWidth[3][34] = {
+        {
+            BITS_2, BITS_2, BITS_2, BITS_554, BITS_554, BITS_554, BITS_877, BITS_877, BITS_877, BITS_877,
+            BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32,
+            BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32
+        },
+        {
+            BITS_2, BITS_2, BITS_2, BITS_554, BITS_554, BITS_554, BITS_877, BITS_877, BITS_877, BITS_32,
+            BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32,
+            BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32
+        },
+        {
+            BITS_2, BITS_2, BITS_2, BITS_554, BITS_554, BITS_877, BITS_877, BITS_877, BITS_877, BITS_32,
+            BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32,
+            BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32, BITS_32
+        }
     };
 
-
     /*
-     * Find out how many bits the largest value requires to encode, and use it to choose one of the packing schemes
-     * below:
+     * The packing scheme is the smallest one that can hold all three fields:
      *
      * Selector possibilities
      *
@@ -263,24 +245,10 @@ int blackboxWriteTag2_3SVariable(int32_t *values)
      * 877 bits per field  ss11 1111 1122 2222 2333 3333
      * 32 bits per field sstt tttt followed by fields of various byte counts
      */
-    int selector = BITS_2;
-    int selector2 = 0;
-    // Require more than 877 bits?
-    if (values[0] >= 256 || values[0] < -256
-            || values[1] >= 128 || values[1] < -128
-            || values[2] >= 128 || values[2] < -128) {
-        selector = BITS_32;
-   // Require more than 554 bits?
-    } else if (values[0] >= 16 || values[0] < -16
-            || values[1] >= 16 || values[1] < -16
-            || values[2] >= 8 || values[2] < -8) {
-        selector = BITS_877;
-        // Require more than 2 bits?
-    } else if (values[0] >= 2 || values[0] < -2
-            || values[1] >= 2 || values[1] < -2
-            || values[2] >= 2 || values[2] < -2) {
-        selector = BITS_554;
-    }
+    const int selector = MAX(MAX(
+        selectorForBitWidth[0][signedBitWidth(values[0])],
+        selectorForBitWidth[1][signedBitWidth(values[1])]),
+        selectorForBitWidth[2][signedBitWidth(values[2])]);
 
     switch (selector) {
     case BITS_2:
@@ -298,58 +266,8 @@ int blackboxWriteTag2_3SVariable(int32_t *values)
         blackboxWrite(((values[1] & 0x01) << 7) | (values[2] & 0x7F));
         break;
     case BITS_32:
-        /*
-         * Do another round to compute a selector for each field, assuming that they are at least 8 bits each
-         *
-         * Selector2 field possibilities
-         * 0 - 8 bits
-         * 1 - 16 bits
-         * 2 - 24 bits
-         * 3 - 32 bits
-         */
-        selector2 = 0;
-        //Encode in reverse order so the first field is in the low bits:
-        for (int x = FIELD_COUNT - 1; x >= 0; x--) {
-            selector2 <<= 2;
-
-            if (values[x] < 128 && values[x] >= -128) {
-                selector2 |= BYTES_1;
-            } else if (values[x] < 32768 && values[x] >= -32768) {
-                selector2 |= BYTES_2;
-            } else if (values[x] < 8388608 && values[x] >= -8388608) {
-                selector2 |= BYTES_3;
-            } else {
-                selector2 |= BYTES_4;
-            }
-        }
-
-        //Write the selectors
-        blackboxWrite((selector << 6) | selector2);
-
-        //And now the values according to the selectors we picked for them
-        for (int x = 0; x < FIELD_COUNT; x++, selector2 >>= 2) {
-            switch (selector2 & 0x03) {
-            case BYTES_1:
-                blackboxWrite(values[x]);
-                break;
-            case BYTES_2:
-                blackboxWrite(values[x]);
-                blackboxWrite(values[x] >> 8);
-                break;
-            case BYTES_3:
-                blackboxWrite(values[x]);
-                blackboxWrite(values[x] >> 8);
-                blackboxWrite(values[x] >> 16);
-                break;
-            case BYTES_4:
-                blackboxWrite(values[x]);
-                blackboxWrite(values[x] >> 8);
-                blackboxWrite(values[x] >> 16);
-                blackboxWrite(values[x] >> 24);
-                break;
-            }
-        }
-    break;
+        blackboxWriteTag2_3ByteFields(selector, values);
+        break;
     }
     return selector;
 }
@@ -359,8 +277,6 @@ int blackboxWriteTag2_3SVariable(int32_t *values)
  */
 void blackboxWriteTag8_4S16(int32_t *values)
 {
-
-    //Need to be enums rather than const ints if we want to switch on them (due to being C)
     enum {
         FIELD_ZERO  = 0,
         FIELD_4BIT  = 1,
@@ -368,70 +284,43 @@ void blackboxWriteTag8_4S16(int32_t *values)
         FIELD_16BIT = 3
     };
 
+    // Field size for a non-zero value of the given bit width
+    static const uint8_t fieldForBitWidth[34] = {
+        FIELD_4BIT, FIELD_4BIT, FIELD_4BIT, FIELD_4BIT, FIELD_4BIT,             // 0-4 bits
+        FIELD_8BIT, FIELD_8BIT, FIELD_8BIT, FIELD_8BIT,                         // 5-8 bits
+        FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT,
+        FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT,
+        FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT, FIELD_16BIT,
+        FIELD_16BIT                                                             // 9-33 bits
+    };
+    static const uint8_t nibbleCount[4] = { 0, 1, 2, 4 };
+
+    /*
+     * The fields are packed high nibble first into a stream of nibbles which is padded to a whole byte at the end, so
+     * collect the stream in one word and write it out in one go (at most 4 fields of 4 nibbles).
+     */
     uint8_t selector = 0;
-    //Encode in reverse order so the first field is in the low bits:
-    for (int x = 3; x >= 0; x--) {
-        selector <<= 2;
-
-        if (values[x] == 0) {
-            selector |= FIELD_ZERO;
-        } else if (values[x] < 8 && values[x] >= -8) {
-            selector |= FIELD_4BIT;
-        } else if (values[x] < 128 && values[x] >= -128) {
-            selector |= FIELD_8BIT;
-        } else {
-            selector |= FIELD_16BIT;
-        }
+    uint64_t nibbles = 0;
+    int nibbleTotal = 0;
+
+    for (int x = 0; x < 4; x++) {
+        const int field = values[x] ? fieldForBitWidth[signedBitWidth(values[x])] : FIELD_ZERO;
+        const int count = nibbleCount[field];
+
+        // First field in the low bits of the selector
+        selector |= field << (2 * x);
+        nibbles = (nibbles << (4 * count)) | ((uint32_t) values[x] & ((1U << (4 * count)) - 1));
+        nibbleTotal += count;
     }
 
     blackboxWrite(selector);
 
-    int nibbleIndex = 0;
-    uint8_t buffer = 0;
-    for (int x = 0; x < 4; x++, selector >>= 2) {
-        switch (selector & 0x03) {
-        case FIELD_ZERO:
-            //No-op
-            break;
-        case FIELD_4BIT:
-            if (nibbleIndex == 0) {
-                //We fill high-bits first
-                buffer = values[x] << 4;
-                nibbleIndex = 1;
-            } else {
-                blackboxWrite(buffer | (values[x] & 0x0F));
-                nibbleIndex = 0;
-            }
-            break;
-        case FIELD_8BIT:
-            if (nibbleIndex == 0) {
-                blackboxWrite(values[x]);
-            } else {
-                //Write the high bits of the value first (mask to avoid sign extension)
-                blackboxWrite(buffer | ((values[x] >> 4) & 0x0F));
-                //Now put the leftover low bits into the top of the next buffer entry
-                buffer = values[x] << 4;
-            }
-            break;
-        case FIELD_16BIT:
-            if (nibbleIndex == 0) {
-                //Write high byte first
-                blackboxWrite(values[x] >> 8);
-                blackboxWrite(values[x]);
-            } else {
-                //First write the highest 4 bits
-                blackboxWrite(buffer | ((values[x] >> 12) & 0x0F));
-                // Then the middle 8
-                blackboxWrite(values[x] >> 4);
-                //Only the smallest 4 bits are still left to write
-                buffer = values[x] << 4;
-            }
-            break;
-        }
+    if (nibbleTotal & 1) {
+        nibbles <<= 4;
+        nibbleTotal++;
     }
-    //Anything left over to write?
-    if (nibbleIndex == 1) {
-        blackboxWrite(buffer);
+    for (int shift = 4 * nibbleTotal - 8; shift >= 0; shift -= 8) {
+        blackboxWrite(nibbles >> shift);
     }
 }
 
@@ -443,31 +332,22 @@ void blackboxWriteTag8_4S16(int32_t *values)
  */
 void blackboxWriteTag8_8SVB(int32_t *values, int valueCount)
 {
-    uint8_t header;
-
-    if (valueCount > 0) {
-        //If we're only writing one field then we can skip the header
-        if (valueCount == 1) {
-            blackboxWriteSignedVB(values[0]);
-        } else {
-            //First write a one-byte header that marks which fields are non-zero
-            header = 0;
-
-            // First field should be in low bits of header
-            for (int i = valueCount - 1; i >= 0; i--) {
-                header <<= 1;
-
-                if (values[i] != 0) {
-                    header |= 0x01;
-                }
-            }
+    //If we're only writing one field then we can skip the header
+    if (valueCount == 1) {
+        blackboxWriteSignedVB(values[0]);
+    } else if (valueCount > 1) {
+        //First write a one-byte header that marks which fields are non-zero, the first field in the low bit
+        uint8_t header = 0;
+
+        for (int i = 0; i < valueCount; i++) {
+            header |= (values[i] != 0) << i;
+        }
 
-            blackboxWrite(header);
+        blackboxWrite(header);
 
-            for (int i = 0; i < valueCount; i++) {
-                if (values[i] != 0) {
-                    blackboxWriteSignedVB(values[i]);
-                }
+        for (int i = 0; i < valueCount; i++) {
+            if (values[i] != 0) {
+                blackboxWriteSignedVB(values[i]);
             }
         }
     }
@@ -110,6 +110,7 @@ typedef enum FlightLogEvent {
     FLIGHT_LOG_EVENT_SYNC_BEEP = 0,
     FLIGHT_LOG_EVENT_INFLIGHT_ADJUSTMENT = 13,
     FLIGHT_LOG_EVENT_LOGGING_RESUME = 14,
+    FLIGHT_LOG_EVENT_DATA_DROPPED = 15,
     FLIGHT_LOG_EVENT_FLIGHTMODE = 30, // Add new event type for flight mode status.
     FLIGHT_LOG_EVENT_LOG_END = 255
 } FlightLogEvent;
@@ -135,6 +136,16 @@ typedef struct flightLogEvent_loggingResume_s {
     uint32_t currentTime;
 } flightLogEvent_loggingResume_t;
 
+// Totals since the start of the log, along with the P interval that is being logged from here on
+typedef struct flightLogEvent_dataDropped_s {
+    uint32_t intraframes;
+    uint32_t interframes;
+    uint32_t slowFrames;
+    uint32_t bytes;
+    uint16_t pIntervalNum;
+    uint16_t pIntervalDenom;
+} flightLogEvent_dataDropped_t;
+
 #define FLIGHT_LOG_EVENT_INFLIGHT_ADJUSTMENT_FUNCTION_FLOAT_VALUE_FLAG 128
 
 typedef struct flightLogEvent_gtuneCycleResult_s {
@@ -148,6 +159,7 @@ typedef union flightLogEventData_u {
     flightLogEvent_flightMode_t flightMode; // New event data
     flightLogEvent_inflightAdjustment_t inflightAdjustment;
     flightLogEvent_loggingResume_t loggingResume;
+    flightLogEvent_dataDropped_t dataDropped;
     flightLogEvent_gtuneCycleResult_t gtuneCycleResult;
 } flightLogEventData_t;
 
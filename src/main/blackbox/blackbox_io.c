@@ -13,6 +13,8 @@
 
 #include "common/maths.h"
 
+#include "drivers/sdcard_latency.h"
+
 #include "flight/pid.h"
 
 #include "io/asyncfatfs/asyncfatfs.h"
@@ -32,6 +34,15 @@ int32_t blackboxHeaderBudget;
 static serialPort_t *blackboxPort = NULL;
 static portSharing_e blackboxPortSharing;
 
+/*
+ * Frames are encoded into this buffer and committed to the device in bulk whenever the device is flushed, rather than
+ * dispatching every byte to the device as it is encoded.
+ */
+static uint8_t blackboxFrameBuffer[BLACKBOX_FRAME_BUFFER_SIZE];
+static int blackboxFrameBufferLength;
+// Offset of the frame being encoded, everything before it is complete frames that the device has room for
+static int blackboxFrameStart;
+
 #ifdef USE_SDCARD
 
 static struct {
@@ -63,60 +74,133 @@ void blackboxOpen()
     }
 }
 
-void blackboxWrite(uint8_t value)
+static void blackboxDeviceWrite(const uint8_t *data, int length)
 {
     switch (blackboxConfig()->device) {
 #ifdef USE_FLASHFS
     case BLACKBOX_DEVICE_FLASH:
-        flashfsWriteByte(value); // Write byte asynchronously
+        flashfsWrite(data, length, false); // Write asynchronously
         break;
-#endif
+#endif // USE_FLASHFS
+
 #ifdef USE_SDCARD
     case BLACKBOX_DEVICE_SDCARD:
-        afatfs_fputc(blackboxSDCard.logFile, value);
-        break;
+    {
+        // Failures due to buffers filling up are ignored, but counted against the SD card's write latency
+        const uint32_t written = afatfs_fwrite(blackboxSDCard.logFile, data, length);
+#ifdef USE_SDCARD_LATENCY_STATS
+        if (written < (uint32_t) length) {
+            sdcardLatencyNoteDroppedData(length - written);
+        }
+#else
+        UNUSED(written);
 #endif
+        break;
+    }
+#endif // USE_SDCARD
+
     case BLACKBOX_DEVICE_SERIAL:
     default:
-        serialWrite(blackboxPort, value);
+        /*
+         * serialWriteBuf() waits for room in the Tx buffer, which we must never do from the flight loop, so whatever
+         * doesn't fit is dropped (the decoder resynchronises on the next frame) instead of overwriting data that is
+         * still waiting to be sent.
+         */
+        serialWriteBuf(blackboxPort, data, MIN(length, (int) serialTxBytesFree(blackboxPort)));
         break;
     }
 }
 
-// Print the null-terminated string 's' to the blackbox device and return the number of bytes written
-int blackboxPrint(const char *s)
+/**
+ * Hand the frame buffer over to the device with a single bulk write.
+ */
+static void blackboxFrameBufferCommit(void)
+{
+    if (blackboxFrameBufferLength > 0) {
+        blackboxDeviceWrite(blackboxFrameBuffer, blackboxFrameBufferLength);
+        blackboxFrameBufferLength = 0;
+    }
+    blackboxFrameStart = 0;
+}
+
+void blackboxWrite(uint8_t value)
 {
-    int length;
-    const uint8_t *pos;
+    if (blackboxFrameBufferLength >= BLACKBOX_FRAME_BUFFER_SIZE) {
+        if (blackboxFrameStart > 0) {
+            // Only hand over the complete frames, so that the frame being encoded can still be discarded as a whole
+            const int partialLength = blackboxFrameBufferLength - blackboxFrameStart;
+
+            blackboxDeviceWrite(blackboxFrameBuffer, blackboxFrameStart);
+            memmove(blackboxFrameBuffer, blackboxFrameBuffer + blackboxFrameStart, partialLength);
+            blackboxFrameBufferLength = partialLength;
+            blackboxFrameStart = 0;
+        } else {
+            blackboxFrameBufferCommit();
+        }
+    }
+    blackboxFrameBuffer[blackboxFrameBufferLength++] = value;
+}
 
+static int32_t blackboxDeviceGetFreeSpace(void)
+{
     switch (blackboxConfig()->device) {
-
+    case BLACKBOX_DEVICE_SERIAL:
+        return serialTxBytesFree(blackboxPort);
 #ifdef USE_FLASHFS
     case BLACKBOX_DEVICE_FLASH:
-        length = strlen(s);
-        flashfsWrite((const uint8_t*) s, length, false); // Write asynchronously
-        break;
-#endif // USE_FLASHFS
-
+        return flashfsGetWriteBufferFreeSpace();
+#endif
 #ifdef USE_SDCARD
     case BLACKBOX_DEVICE_SDCARD:
-        length = strlen(s);
-        afatfs_fwrite(blackboxSDCard.logFile, (const uint8_t*) s, length); // Ignore failures due to buffers filling up
-        break;
-#endif // USE_SDCARD
-
-    case BLACKBOX_DEVICE_SERIAL:
+        // Only counts whole free sectors, so this errs on the side of discarding a frame that would have just fit
+        return afatfs_getFreeBufferSpace();
+#endif
     default:
-        pos = (uint8_t*) s;
-        while (*pos) {
-            serialWrite(blackboxPort, *pos);
-            pos++;
-        }
+        return 0;
+    }
+}
 
-        length = pos - (uint8_t*) s;
-        break;
+/**
+ * Call after each frame has been written with blackboxWrite(). If the device doesn't have room for the frame (along
+ * with the frames before it that are still waiting in the frame buffer), the frame is discarded as a whole, so that
+ * the device never has to drop part of a frame and the log stays parseable.
+ *
+ * Returns the size of the frame if it was discarded, or 0 if it was kept.
+ */
+int blackboxEndFrame(void)
+{
+    if (blackboxFrameBufferLength > blackboxDeviceGetFreeSpace()) {
+        const int frameLength = blackboxFrameBufferLength - blackboxFrameStart;
+
+        blackboxFrameBufferLength = blackboxFrameStart;
+        return frameLength;
     }
 
+    blackboxFrameStart = blackboxFrameBufferLength;
+    return 0;
+}
+
+static void blackboxWriteBuf(const uint8_t *data, int length)
+{
+    if (blackboxFrameBufferLength + length > BLACKBOX_FRAME_BUFFER_SIZE) {
+        blackboxFrameBufferCommit();
+
+        if (length > BLACKBOX_FRAME_BUFFER_SIZE) {
+            blackboxDeviceWrite(data, length);
+            return;
+        }
+    }
+    memcpy(blackboxFrameBuffer + blackboxFrameBufferLength, data, length);
+    blackboxFrameBufferLength += length;
+}
+
+// Print the null-terminated string 's' to the blackbox device and return the number of bytes written
+int blackboxPrint(const char *s)
+{
+    const int length = strlen(s);
+
+    blackboxWriteBuf((const uint8_t *) s, length);
+
     return length;
 }
 
@@ -127,6 +211,8 @@ int blackboxPrint(const char *s)
  */
 void blackboxDeviceFlush(void)
 {
+    blackboxFrameBufferCommit();
+
     switch (blackboxConfig()->device) {
 #ifdef USE_FLASHFS
         /*
@@ -134,7 +220,7 @@ void blackboxDeviceFlush(void)
          * devices will progressively write in the background without Blackbox calling anything.
          */
     case BLACKBOX_DEVICE_FLASH:
-        flashfsFlushAsync();
+        flashfsFlushPagesAsync();
         break;
 #endif // USE_FLASHFS
 
@@ -150,6 +236,8 @@ void blackboxDeviceFlush(void)
  */
 bool blackboxDeviceFlushForce(void)
 {
+    blackboxFrameBufferCommit();
+
     switch (blackboxConfig()->device) {
     case BLACKBOX_DEVICE_SERIAL:
         // Nothing to speed up flushing on serial, as serial is continuously being drained out of its buffer
@@ -178,6 +266,9 @@ bool blackboxDeviceFlushForce(void)
  */
 bool blackboxDeviceOpen(void)
 {
+    // Don't carry over anything left from a previous log
+    blackboxFrameBufferLength = 0;
+
     switch (blackboxConfig()->device) {
     case BLACKBOX_DEVICE_SERIAL:
         {
@@ -302,6 +393,8 @@ bool isBlackboxErased(void)
  */
 void blackboxDeviceClose(void)
 {
+    blackboxFrameBufferCommit();
+
     switch (blackboxConfig()->device) {
     case BLACKBOX_DEVICE_SERIAL:
         // Since the serial port could be shared with other processes, we have to give it back here
@@ -470,6 +563,8 @@ bool blackboxDeviceEndLog(bool retainLog)
     UNUSED(retainLog);
 #endif
 
+    blackboxFrameBufferCommit();
+
     switch (blackboxConfig()->device) {
 #ifdef USE_SDCARD
     case BLACKBOX_DEVICE_SDCARD:
@@ -485,6 +580,11 @@ bool blackboxDeviceEndLog(bool retainLog)
         }
         return false;
 #endif // USE_SDCARD
+#ifdef USE_FLASHFS
+    case BLACKBOX_DEVICE_FLASH:
+        // Record the log in the flash's log index once it has all been written
+        return flashfsCloseLog();
+#endif // USE_FLASHFS
     default:
         return true;
     }
@@ -517,25 +617,11 @@ bool isBlackboxDeviceFull(void)
  */
 void blackboxReplenishHeaderBudget()
 {
-    int32_t freeSpace;
+    // Header bytes written last iteration are still in the frame buffer, the device must see them to report its space
+    blackboxFrameBufferCommit();
+
+    const int32_t freeSpace = blackboxDeviceGetFreeSpace();
 
-    switch (blackboxConfig()->device) {
-    case BLACKBOX_DEVICE_SERIAL:
-        freeSpace = serialTxBytesFree(blackboxPort);
-        break;
-#ifdef USE_FLASHFS
-    case BLACKBOX_DEVICE_FLASH:
-        freeSpace = flashfsGetWriteBufferFreeSpace();
-        break;
-#endif
-#ifdef USE_SDCARD
-    case BLACKBOX_DEVICE_SDCARD:
-        freeSpace = afatfs_getFreeBufferSpace();
-        break;
-#endif
-    default:
-        freeSpace = 0;
-    }
     blackboxHeaderBudget = MIN(MIN(freeSpace, blackboxHeaderBudget + blackboxMaxHeaderBytesPerIteration), BLACKBOX_MAX_ACCUMULATED_HEADER_BUDGET);
 }
 
@@ -587,7 +673,7 @@ blackboxBufferReserveStatus_e blackboxDeviceReserveBufferSpace(int32_t bytes)
              * that the Blackbox header writing code doesn't have to guess about the best time to ask flashfs to
              * flush, and doesn't stall waiting for a flush that would otherwise not automatically be called.
              */
-            flashfsFlushAsync();
+            flashfsFlushPagesAsync();
         }
         return BLACKBOX_RESERVE_TEMPORARY_FAILURE;
 #endif // USE_FLASHFS
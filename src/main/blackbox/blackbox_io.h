@@ -35,10 +35,17 @@ typedef enum {
  */
 #define BLACKBOX_TARGET_HEADER_BUDGET_PER_ITERATION 64
 
+/*
+ * Frames are assembled in a buffer of this size before being written to the device. Larger frames are simply written
+ * in several pieces.
+ */
+#define BLACKBOX_FRAME_BUFFER_SIZE 256
+
 extern int32_t blackboxHeaderBudget;
 
 void blackboxOpen(void);
 void blackboxWrite(uint8_t value);
+int blackboxEndFrame(void);
 
 void blackboxDeviceFlush(void);
 bool blackboxDeviceFlushForce(void);
@@ -982,6 +982,14 @@ void cmsUpdate(uint32_t currentTimeUs)
         }
 
         cmsDrawMenu(pCurrentDisplay, currentTimeUs);
+#ifdef MAX7456_DMA_CHANNEL_TX
+        // don't touch buffers if DMA transaction is in progress
+        if (displayIsTransferInProgress(pCurrentDisplay)) {
+            return;
+        }
+#endif // MAX7456_DMA_CHANNEL_TX
+        // send what was drawn, for displays that hold the writes until then
+        displayDrawScreen(pCurrentDisplay);
 
         if (currentTimeMs > lastCmsHeartBeatMs + 500) {
             // Heart beat for external CMS display device @ 500msec
@@ -20,10 +20,22 @@
 #include <string.h>
 #include <math.h>
 
+#include "platform.h"
+
+#include "build/build_config.h"
+
 #include "common/filter.h"
 #include "common/maths.h"
 #include "common/utils.h"
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#define USE_FILTER_BANK_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define USE_FILTER_BANK_NEON
+#endif
+
 #define M_LN2_FLOAT 0.69314718055994530942f
 #define M_PI_FLOAT  3.14159265358979323846f
 #define BIQUAD_BANDWIDTH 1.9f     /* bandwidth in octaves */
@@ -292,3 +304,149 @@ float firFilterDenoiseUpdate(firFilterDenoise_t *filter, float input)
         return filter->movingSum / ++filter->filledCount + 1;
 }
 
+/*
+ * Filter bank
+ * Holds a cascade of filters for all axes in struct-of-arrays form, so that each stage is applied
+ * to all the axes at once. The host (SITL) build uses SSE or NEON, other builds use the scalar
+ * implementation, which keeps each coefficient row in registers while processing all the axes.
+ * Both produce exactly the same results as biquadFilterApply and pt1FilterApply.
+ */
+void filterBankInit(filterBank_t *bank)
+{
+    memset(bank, 0, sizeof(filterBank_t));
+}
+
+static filterBankStage_t *filterBankAddStage(filterBank_t *bank, filterBankStageType_e type)
+{
+    if (bank->stageCount >= FILTER_BANK_MAX_STAGES) {
+        return NULL;
+    }
+    bank->stageType[bank->stageCount] = type;
+    filterBankStage_t *stage = &bank->stage[bank->stageCount++];
+    memset(stage, 0, sizeof(filterBankStage_t));
+    return stage;
+}
+
+/* adds a stage using the coefficients of an initialised biquad filter for all axes */
+bool filterBankAddBiquad(filterBank_t *bank, const biquadFilter_t *filter)
+{
+    filterBankStage_t *stage = filterBankAddStage(bank, FILTER_BANK_STAGE_BIQUAD);
+    if (!stage) {
+        return false;
+    }
+    for (int axis = 0; axis < FILTER_BANK_AXIS_COUNT; axis++) {
+        stage->b0[axis] = filter->b0;
+        stage->b1[axis] = filter->b1;
+        stage->b2[axis] = filter->b2;
+        stage->a1[axis] = filter->a1;
+        stage->a2[axis] = filter->a2;
+    }
+    return true;
+}
+
+/* adds a stage using the gain of an initialised pt1 filter for all axes, state is kept in d1 */
+bool filterBankAddPt1(filterBank_t *bank, const pt1Filter_t *filter)
+{
+    filterBankStage_t *stage = filterBankAddStage(bank, FILTER_BANK_STAGE_PT1);
+    if (!stage) {
+        return false;
+    }
+    for (int axis = 0; axis < FILTER_BANK_AXIS_COUNT; axis++) {
+        stage->b0[axis] = filter->k;
+    }
+    return true;
+}
+
+#if defined(UNIT_TEST) || !(defined(USE_FILTER_BANK_SSE) || defined(USE_FILTER_BANK_NEON))
+STATIC_UNIT_TESTED void filterBankApplyStagesScalar(filterBank_t *bank, float *values, int firstStage, int lastStage)
+{
+    for (int ii = firstStage; ii < lastStage; ii++) {
+        filterBankStage_t *stage = &bank->stage[ii];
+        if (bank->stageType[ii] == FILTER_BANK_STAGE_PT1) {
+            for (int axis = 0; axis < FILTER_BANK_AXIS_COUNT; axis++) {
+                stage->d1[axis] = stage->d1[axis] + stage->b0[axis] * (values[axis] - stage->d1[axis]);
+                values[axis] = stage->d1[axis];
+            }
+        } else {
+            for (int axis = 0; axis < FILTER_BANK_AXIS_COUNT; axis++) {
+                const float input = values[axis];
+                const float result = stage->b0[axis] * input + stage->d1[axis];
+                stage->d1[axis] = stage->b1[axis] * input - stage->a1[axis] * result + stage->d2[axis];
+                stage->d2[axis] = stage->b2[axis] * input - stage->a2[axis] * result;
+                values[axis] = result;
+            }
+        }
+    }
+}
+#endif
+
+#if defined(USE_FILTER_BANK_SSE)
+STATIC_UNIT_TESTED void filterBankApplyStagesVector(filterBank_t *bank, float *values, int firstStage, int lastStage)
+{
+    __m128 x = _mm_set_ps(0.0f, values[2], values[1], values[0]);
+    for (int ii = firstStage; ii < lastStage; ii++) {
+        filterBankStage_t *stage = &bank->stage[ii];
+        __m128 d1 = _mm_loadu_ps(stage->d1);
+        if (bank->stageType[ii] == FILTER_BANK_STAGE_PT1) {
+            d1 = _mm_add_ps(d1, _mm_mul_ps(_mm_loadu_ps(stage->b0), _mm_sub_ps(x, d1)));
+            _mm_storeu_ps(stage->d1, d1);
+            x = d1;
+        } else {
+            const __m128 result = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(stage->b0), x), d1);
+            d1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(stage->b1), x), _mm_mul_ps(_mm_loadu_ps(stage->a1), result)), _mm_loadu_ps(stage->d2));
+            const __m128 d2 = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(stage->b2), x), _mm_mul_ps(_mm_loadu_ps(stage->a2), result));
+            _mm_storeu_ps(stage->d1, d1);
+            _mm_storeu_ps(stage->d2, d2);
+            x = result;
+        }
+    }
+    float result[FILTER_BANK_LANES];
+    _mm_storeu_ps(result, x);
+    values[0] = result[0];
+    values[1] = result[1];
+    values[2] = result[2];
+}
+#elif defined(USE_FILTER_BANK_NEON)
+STATIC_UNIT_TESTED void filterBankApplyStagesVector(filterBank_t *bank, float *values, int firstStage, int lastStage)
+{
+    const float input[FILTER_BANK_LANES] = { values[0], values[1], values[2], 0.0f };
+    float32x4_t x = vld1q_f32(input);
+    for (int ii = firstStage; ii < lastStage; ii++) {
+        filterBankStage_t *stage = &bank->stage[ii];
+        float32x4_t d1 = vld1q_f32(stage->d1);
+        // separate multiply and add, rather than vmlaq_f32, to round exactly as the scalar implementation
+        if (bank->stageType[ii] == FILTER_BANK_STAGE_PT1) {
+            d1 = vaddq_f32(d1, vmulq_f32(vld1q_f32(stage->b0), vsubq_f32(x, d1)));
+            vst1q_f32(stage->d1, d1);
+            x = d1;
+        } else {
+            const float32x4_t result = vaddq_f32(vmulq_f32(vld1q_f32(stage->b0), x), d1);
+            d1 = vaddq_f32(vsubq_f32(vmulq_f32(vld1q_f32(stage->b1), x), vmulq_f32(vld1q_f32(stage->a1), result)), vld1q_f32(stage->d2));
+            const float32x4_t d2 = vsubq_f32(vmulq_f32(vld1q_f32(stage->b2), x), vmulq_f32(vld1q_f32(stage->a2), result));
+            vst1q_f32(stage->d1, d1);
+            vst1q_f32(stage->d2, d2);
+            x = result;
+        }
+    }
+    float result[FILTER_BANK_LANES];
+    vst1q_f32(result, x);
+    values[0] = result[0];
+    values[1] = result[1];
+    values[2] = result[2];
+}
+#endif
+
+/* applies stages firstStage up to, but not including, lastStage to values[FILTER_BANK_AXIS_COUNT] in place */
+void filterBankApplyStages(filterBank_t *bank, float *values, int firstStage, int lastStage)
+{
+#if defined(USE_FILTER_BANK_SSE) || defined(USE_FILTER_BANK_NEON)
+    filterBankApplyStagesVector(bank, values, firstStage, lastStage);
+#else
+    filterBankApplyStagesScalar(bank, values, firstStage, lastStage);
+#endif
+}
+
+void filterBankApply(filterBank_t *bank, float *values)
+{
+    filterBankApplyStages(bank, values, 0, bank->stageCount);
+}
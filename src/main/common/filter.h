@@ -67,6 +67,29 @@ typedef struct firFilter_s {
     uint8_t coeffsLength;
 } firFilter_t;
 
+#define FILTER_BANK_MAX_STAGES 3
+#define FILTER_BANK_AXIS_COUNT 3
+#define FILTER_BANK_LANES 4 // axis count padded so that each coefficient and state row fits a 4 float vector
+
+typedef enum {
+    FILTER_BANK_STAGE_BIQUAD = 0,
+    FILTER_BANK_STAGE_PT1
+} filterBankStageType_e;
+
+/* one stage of a filter bank, holds the coefficients and state of all axes contiguously */
+typedef struct filterBankStage_s {
+    float b0[FILTER_BANK_LANES], b1[FILTER_BANK_LANES], b2[FILTER_BANK_LANES];
+    float a1[FILTER_BANK_LANES], a2[FILTER_BANK_LANES];
+    float d1[FILTER_BANK_LANES], d2[FILTER_BANK_LANES];
+} filterBankStage_t;
+
+/* cascade of biquad (direct form 2) and pt1 filters applied to all axes in a single call */
+typedef struct filterBank_s {
+    filterBankStage_t stage[FILTER_BANK_MAX_STAGES];
+    uint8_t stageType[FILTER_BANK_MAX_STAGES];
+    uint8_t stageCount;
+} filterBank_t;
+
 typedef float (*filterApplyFnPtr)(void *filter, float input);
 
 float nullFilterApply(void *filter, float input);
@@ -98,3 +121,8 @@ float firFilterLastInput(const firFilter_t *filter);
 void firFilterDenoiseInit(firFilterDenoise_t *filter, uint8_t gyroSoftLpfHz, uint16_t targetLooptime);
 float firFilterDenoiseUpdate(firFilterDenoise_t *filter, float input);
 
+void filterBankInit(filterBank_t *bank);
+bool filterBankAddBiquad(filterBank_t *bank, const biquadFilter_t *filter);
+bool filterBankAddPt1(filterBank_t *bank, const pt1Filter_t *filter);
+void filterBankApplyStages(filterBank_t *bank, float *values, int firstStage, int lastStage);
+void filterBankApply(filterBank_t *bank, float *values);
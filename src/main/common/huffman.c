@@ -0,0 +1,339 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Huffman coding of a block of bytes, with a code built for the symbol counts of that block.
+ *
+ * The code is canonical (as in Deflate), so the decoder only needs the code length of each symbol to rebuild it.
+ * Codes are written most significant bit first, and the last byte is padded with zero bits.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common/huffman.h"
+
+// The histogram given to huffmanBuildTable() must total less than 65536, which keeps the codes below this length
+#define HUFFMAN_MAX_UNLIMITED_CODE_LENGTH 24
+
+void huffmanCountSymbols(uint32_t *histogram, const uint8_t *data, int len)
+{
+    for (int i = 0; i < len; i++) {
+        histogram[data[i]]++;
+    }
+}
+
+/**
+ * Replace the weights of a set of symbols, sorted in ascending order, with the lengths of their minimum-redundancy
+ * codes, in place. The code lengths come out in descending order. n must be at least 2.
+ *
+ * This is the algorithm from Moffat and Katajainen, "In-Place Calculation of Minimum-Redundancy Codes".
+ */
+static void huffmanCalculateCodeLengths(uint32_t *a, int n)
+{
+    int root, leaf, next;
+
+    // First pass, left to right, combining the two lightest nodes and setting parent pointers
+    a[0] += a[1];
+    root = 0;
+    leaf = 2;
+    for (next = 1; next < n - 1; next++) {
+        if (leaf >= n || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = next;
+        } else {
+            a[next] = a[leaf++];
+        }
+
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = next;
+        } else {
+            a[next] += a[leaf++];
+        }
+    }
+
+    // Second pass, right to left, setting the depth of internal nodes
+    a[n - 2] = 0;
+    for (next = n - 3; next >= 0; next--) {
+        a[next] = a[a[next]] + 1;
+    }
+
+    // Third pass, right to left, setting the depth of the leaves
+    int available = 1;
+    int used = 0;
+    uint32_t depth = 0;
+    root = n - 2;
+    next = n - 1;
+    while (available > 0) {
+        while (root >= 0 && a[root] == depth) {
+            used++;
+            root--;
+        }
+        while (available > used) {
+            a[next--] = depth;
+            available--;
+        }
+        available = 2 * used;
+        depth++;
+        used = 0;
+    }
+}
+
+/**
+ * Move leaves up from below the maximum code length, keeping the code complete (this is the procedure from Annex K.3
+ * of the JPEG standard).
+ */
+static void huffmanLimitCodeLengths(uint16_t *lengthCount)
+{
+    for (int length = HUFFMAN_MAX_UNLIMITED_CODE_LENGTH; length > HUFFMAN_MAX_CODE_LENGTH; length--) {
+        while (lengthCount[length] > 0) {
+            int shorter = length - 2;
+            while (lengthCount[shorter] == 0) {
+                shorter--;
+            }
+
+            // A pair of leaves at this length is replaced by one of them, and a leaf at a shorter length gets two
+            lengthCount[length] -= 2;
+            lengthCount[length - 1]++;
+            lengthCount[shorter + 1] += 2;
+            lengthCount[shorter]--;
+        }
+    }
+}
+
+/**
+ * Assign the canonical code of each symbol from the code lengths.
+ */
+static void huffmanAssignCodes(huffmanTable_t *table)
+{
+    uint16_t lengthCount[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint16_t nextCode[HUFFMAN_MAX_CODE_LENGTH + 1];
+
+    memset(lengthCount, 0, sizeof(lengthCount));
+    for (int symbol = 0; symbol < HUFFMAN_SYMBOL_COUNT; symbol++) {
+        lengthCount[table->codeLength[symbol]]++;
+    }
+    lengthCount[0] = 0;
+
+    uint16_t code = 0;
+    for (int length = 1; length <= HUFFMAN_MAX_CODE_LENGTH; length++) {
+        code = (code + lengthCount[length - 1]) << 1;
+        nextCode[length] = code;
+    }
+
+    for (int symbol = 0; symbol < HUFFMAN_SYMBOL_COUNT; symbol++) {
+        const uint8_t length = table->codeLength[symbol];
+        table->code[symbol] = length ? nextCode[length]++ : 0;
+    }
+}
+
+/**
+ * Build the code for data with the given symbol counts, which must total less than 65536. The histogram is used as
+ * work space and is overwritten.
+ */
+void huffmanBuildTable(huffmanTable_t *table, uint32_t *histogram)
+{
+    memset(table->codeLength, 0, sizeof(table->codeLength));
+
+    // Keep the symbols that appear, with the symbol in the low byte so that sorting by weight keeps it attached
+    int n = 0;
+    for (int symbol = 0; symbol < HUFFMAN_SYMBOL_COUNT; symbol++) {
+        if (histogram[symbol] > 0) {
+            histogram[n++] = (histogram[symbol] << 8) | symbol;
+        }
+    }
+
+    if (n == 0) {
+        return;
+    }
+    if (n == 1) {
+        table->codeLength[histogram[0] & 0xFF] = 1;
+        huffmanAssignCodes(table);
+        return;
+    }
+
+    for (int i = 1; i < n; i++) {
+        const uint32_t key = histogram[i];
+        int j = i;
+        while (j > 0 && histogram[j - 1] > key) {
+            histogram[j] = histogram[j - 1];
+            j--;
+        }
+        histogram[j] = key;
+    }
+
+    // The code table holds the sorted symbols while the histogram turns from weights into code lengths
+    for (int i = 0; i < n; i++) {
+        table->code[i] = histogram[i] & 0xFF;
+        histogram[i] >>= 8;
+    }
+
+    huffmanCalculateCodeLengths(histogram, n);
+
+    uint16_t lengthCount[HUFFMAN_MAX_UNLIMITED_CODE_LENGTH + 1];
+    memset(lengthCount, 0, sizeof(lengthCount));
+    for (int i = 0; i < n; i++) {
+        lengthCount[histogram[i]]++;
+    }
+    huffmanLimitCodeLengths(lengthCount);
+
+    // Hand out the lengths again, shortest first to the most common symbols at the end of the sorted list
+    int i = n - 1;
+    for (int length = 1; length <= HUFFMAN_MAX_CODE_LENGTH; length++) {
+        for (int count = lengthCount[length]; count > 0; count--) {
+            table->codeLength[table->code[i--]] = length;
+        }
+    }
+
+    huffmanAssignCodes(table);
+}
+
+void huffmanPackCodeLengths(uint8_t *out, const huffmanTable_t *table)
+{
+    for (int i = 0; i < HUFFMAN_CODE_LENGTHS_SIZE; i++) {
+        out[i] = (table->codeLength[2 * i] << 4) | table->codeLength[2 * i + 1];
+    }
+}
+
+void huffmanUnpackCodeLengths(huffmanTable_t *table, const uint8_t *in)
+{
+    for (int i = 0; i < HUFFMAN_CODE_LENGTHS_SIZE; i++) {
+        table->codeLength[2 * i] = in[i] >> 4;
+        table->codeLength[2 * i + 1] = in[i] & 0x0F;
+    }
+
+    huffmanAssignCodes(table);
+}
+
+void huffmanInitState(huffmanState_t *state, uint8_t *outBuf, int outBufLen)
+{
+    state->outBuf = outBuf;
+    state->outBufLen = outBufLen;
+    state->bytesWritten = 0;
+    state->bits = 0;
+    state->bitCount = 0;
+}
+
+/**
+ * Append the codes for the given data to the output.
+ *
+ * Returns false if the output buffer is full, the output is incomplete in that case.
+ */
+bool huffmanEncode(huffmanState_t *state, const huffmanTable_t *table, const uint8_t *data, int len)
+{
+    uint32_t bits = state->bits;
+    int bitCount = state->bitCount;
+    int bytesWritten = state->bytesWritten;
+
+    for (int i = 0; i < len; i++) {
+        const uint8_t symbol = data[i];
+
+        bits = (bits << table->codeLength[symbol]) | table->code[symbol];
+        bitCount += table->codeLength[symbol];
+
+        while (bitCount >= 8) {
+            if (bytesWritten >= state->outBufLen) {
+                return false;
+            }
+            bitCount -= 8;
+            state->outBuf[bytesWritten++] = bits >> bitCount;
+        }
+        bits &= (1 << bitCount) - 1;
+    }
+
+    state->bits = bits;
+    state->bitCount = bitCount;
+    state->bytesWritten = bytesWritten;
+
+    return true;
+}
+
+/**
+ * Write out the last partial byte of codes.
+ *
+ * Returns false if the output buffer is full.
+ */
+bool huffmanEncodeFinish(huffmanState_t *state)
+{
+    if (state->bitCount > 0) {
+        if (state->bytesWritten >= state->outBufLen) {
+            return false;
+        }
+        state->outBuf[state->bytesWritten++] = state->bits << (8 - state->bitCount);
+        state->bits = 0;
+        state->bitCount = 0;
+    }
+
+    return true;
+}
+
+/**
+ * Decode outLen symbols from the coded input.
+ *
+ * Returns the number of symbols decoded, or -1 if the input is not valid for the code.
+ */
+int huffmanDecode(uint8_t *out, int outLen, const uint8_t *in, int inLen, const huffmanTable_t *table)
+{
+    uint16_t lengthCount[HUFFMAN_MAX_CODE_LENGTH + 1];
+    uint8_t symbols[HUFFMAN_SYMBOL_COUNT];
+
+    // List the symbols in order of their canonical codes
+    memset(lengthCount, 0, sizeof(lengthCount));
+    int symbolCount = 0;
+    for (int length = 1; length <= HUFFMAN_MAX_CODE_LENGTH; length++) {
+        for (int symbol = 0; symbol < HUFFMAN_SYMBOL_COUNT; symbol++) {
+            if (table->codeLength[symbol] == length) {
+                symbols[symbolCount++] = symbol;
+                lengthCount[length]++;
+            }
+        }
+    }
+
+    int outCount = 0;
+    int bitIndex = 0;
+    while (outCount < outLen) {
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        int length;
+
+        for (length = 1; length <= HUFFMAN_MAX_CODE_LENGTH; length++) {
+            if (bitIndex >= inLen * 8) {
+                return -1;
+            }
+            code |= (in[bitIndex >> 3] >> (7 - (bitIndex & 7))) & 1;
+            bitIndex++;
+
+            const int count = lengthCount[length];
+            if (code - first < count) {
+                out[outCount++] = symbols[index + code - first];
+                break;
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+
+        if (length > HUFFMAN_MAX_CODE_LENGTH) {
+            return -1;
+        }
+    }
+
+    return outCount;
+}
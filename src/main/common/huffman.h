@@ -0,0 +1,52 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HUFFMAN_SYMBOL_COUNT 256
+#define HUFFMAN_MAX_CODE_LENGTH 15
+
+// The code lengths are sent ahead of the coded data, packed two to a byte
+#define HUFFMAN_CODE_LENGTHS_SIZE (HUFFMAN_SYMBOL_COUNT / 2)
+
+typedef struct huffmanTable_s {
+    uint16_t code[HUFFMAN_SYMBOL_COUNT];
+    uint8_t codeLength[HUFFMAN_SYMBOL_COUNT]; // 0 for symbols that don't appear in the data
+} huffmanTable_t;
+
+typedef struct huffmanState_s {
+    uint8_t *outBuf;
+    uint16_t outBufLen;
+    uint16_t bytesWritten;
+    uint32_t bits;
+    uint8_t bitCount;
+} huffmanState_t;
+
+void huffmanCountSymbols(uint32_t *histogram, const uint8_t *data, int len);
+void huffmanBuildTable(huffmanTable_t *table, uint32_t *histogram);
+
+void huffmanPackCodeLengths(uint8_t *out, const huffmanTable_t *table);
+void huffmanUnpackCodeLengths(huffmanTable_t *table, const uint8_t *in);
+
+void huffmanInitState(huffmanState_t *state, uint8_t *outBuf, int outBufLen);
+bool huffmanEncode(huffmanState_t *state, const huffmanTable_t *table, const uint8_t *data, int len);
+bool huffmanEncodeFinish(huffmanState_t *state);
+
+int huffmanDecode(uint8_t *out, int outLen, const uint8_t *in, int inLen, const huffmanTable_t *table);
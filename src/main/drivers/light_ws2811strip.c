@@ -40,21 +40,39 @@
 #include "drivers/io.h"
 #include "light_ws2811strip.h"
 
-#if defined(STM32F1) || defined(STM32F3)
-uint8_t ledStripDMABuffer[WS2811_DMA_BUFFER_SIZE];
-#else
-uint32_t ledStripDMABuffer[WS2811_DMA_BUFFER_SIZE];
-#endif
+ledStripDMAElement_t ledStripDMABuffer[WS2811_DMA_BUFFER_SIZE];
 volatile uint8_t ws2811LedDataTransferInProgress = 0;
 
 uint16_t BIT_COMPARE_1 = 0;
 uint16_t BIT_COMPARE_0 = 0;
 
+// The compare values for the 4 bits of each nibble, most significant bit first
+static ledStripDMAElement_t nibbleBitCompares[16][4];
+
 static hsvColor_t ledColorBuffer[WS2811_LED_STRIP_LENGTH];
 
+// The colour of each LED as it is in the DMA buffer, so ws2811UpdateStrip() only converts and encodes the LEDs that
+// changed since the last update.
+static hsvColor_t ledEncodedHsv[WS2811_LED_STRIP_LENGTH];
+static rgbColor24bpp_t ledEncodedRgb[WS2811_LED_STRIP_LENGTH];
+static uint32_t ledDirty[(WS2811_LED_STRIP_LENGTH + 31) / 32];
+static bool ledEncodedValid = false;
+
+#define SET_LED_DIRTY(index) (ledDirty[(index) / 32] |= 1U << ((index) % 32))
+#define CLR_LED_DIRTY(index) (ledDirty[(index) / 32] &= ~(1U << ((index) % 32)))
+#define IS_LED_DIRTY(index) (ledDirty[(index) / 32] & (1U << ((index) % 32)))
+
+static bool hsvEqual(const hsvColor_t *a, const hsvColor_t *b)
+{
+    return a->h == b->h && a->s == b->s && a->v == b->v;
+}
+
 void setLedHsv(uint16_t index, const hsvColor_t *color)
 {
-    ledColorBuffer[index] = *color;
+    if (!hsvEqual(&ledColorBuffer[index], color)) {
+        ledColorBuffer[index] = *color;
+        SET_LED_DIRTY(index);
+    }
 }
 
 void getLedHsv(uint16_t index, hsvColor_t *color)
@@ -64,12 +82,15 @@ void getLedHsv(uint16_t index, hsvColor_t *color)
 
 void setLedValue(uint16_t index, const uint8_t value)
 {
-    ledColorBuffer[index].v = value;
+    if (ledColorBuffer[index].v != value) {
+        ledColorBuffer[index].v = value;
+        SET_LED_DIRTY(index);
+    }
 }
 
 void scaleLedValue(uint16_t index, const uint8_t scalePercent)
 {
-    ledColorBuffer[index].v = ((uint16_t)ledColorBuffer[index].v * scalePercent / 100);
+    setLedValue(index, (uint16_t)ledColorBuffer[index].v * scalePercent / 100);
 }
 
 void setStripColor(const hsvColor_t *color)
@@ -91,6 +112,7 @@ void setStripColors(const hsvColor_t *colors)
 void ws2811LedStripInit(ioTag_t ioTag)
 {
     memset(ledStripDMABuffer, 0, sizeof(ledStripDMABuffer));
+    ledEncodedValid = false;
     ws2811LedStripHardwareInit(ioTag);
 
     const hsvColor_t hsv_white = { 0, 255, 255 };
@@ -103,39 +125,37 @@ bool isWS2811LedStripReady(void)
     return !ws2811LedDataTransferInProgress;
 }
 
-STATIC_UNIT_TESTED uint16_t dmaBufferOffset;
 static int16_t ledIndex;
 
-#define USE_FAST_DMA_BUFFER_IMPL
-#ifdef USE_FAST_DMA_BUFFER_IMPL
-
-STATIC_UNIT_TESTED void fastUpdateLEDDMABuffer(rgbColor24bpp_t *color)
+/*
+ * Called by the timer backends with the period of a bit in timer ticks, a 1 is high for 2/3 of that and a 0 for 1/3.
+ */
+void ws2811SetBitCompare(uint16_t period)
 {
-    uint32_t grb = (color->rgb.g << 16) | (color->rgb.r << 8) | (color->rgb.b);
+    BIT_COMPARE_1 = period / 3 * 2;
+    BIT_COMPARE_0 = period / 3;
 
-    for (int8_t index = 23; index >= 0; index--) {
-        ledStripDMABuffer[dmaBufferOffset++] = (grb & (1 << index)) ? BIT_COMPARE_1 : BIT_COMPARE_0;
+    for (int nibble = 0; nibble < 16; nibble++) {
+        for (int bit = 0; bit < 4; bit++) {
+            nibbleBitCompares[nibble][bit] = (nibble & (0x08 >> bit)) ? BIT_COMPARE_1 : BIT_COMPARE_0;
+        }
     }
 }
-#else
-STATIC_UNIT_TESTED void updateLEDDMABuffer(uint8_t componentValue)
+
+/*
+ * Expand the colour of a LED into the compare values of its 24 bits, green, red then blue, most significant bit first.
+ * The compare values of each nibble are copied as a block from nibbleBitCompares.
+ */
+STATIC_UNIT_TESTED void ws2811EncodeLed(ledStripDMAElement_t *dst, const rgbColor24bpp_t *color)
 {
-    uint8_t bitIndex;
+    const uint8_t components[3] = { color->rgb.g, color->rgb.r, color->rgb.b };
 
-    for (bitIndex = 0; bitIndex < 8; bitIndex++)
-    {
-        if ((componentValue << bitIndex) & 0x80 )    // data sent MSB first, j = 0 is MSB j = 7 is LSB
-        {
-            ledStripDMABuffer[dmaBufferOffset] = BIT_COMPARE_1;
-        }
-        else
-        {
-            ledStripDMABuffer[dmaBufferOffset] = BIT_COMPARE_0;   // compare value for logical 0
-        }
-        dmaBufferOffset++;
+    for (int i = 0; i < 3; i++) {
+        memcpy(dst, nibbleBitCompares[components[i] >> 4], sizeof(nibbleBitCompares[0]));
+        memcpy(dst + 4, nibbleBitCompares[components[i] & 0x0f], sizeof(nibbleBitCompares[0]));
+        dst += 8;
     }
 }
-#endif
 
 /*
  * This method is non-blocking unless an existing LED update is in progress.
@@ -150,25 +170,29 @@ void ws2811UpdateStrip(void)
         return;
     }
 
-    dmaBufferOffset = 0;                // reset buffer memory index
-    ledIndex = 0;                       // reset led index
-
     // fill transmit buffer with correct compare values to achieve
-    // correct pulse widths according to color values
-    while (ledIndex < WS2811_LED_STRIP_LENGTH)
-    {
-        rgb24 = hsvToRgb24(&ledColorBuffer[ledIndex]);
+    // correct pulse widths according to color values, for the LEDs whose colour changed
+    for (ledIndex = 0; ledIndex < WS2811_LED_STRIP_LENGTH; ledIndex++) {
+        if (ledEncodedValid && !IS_LED_DIRTY(ledIndex)) {
+            continue;
+        }
+        CLR_LED_DIRTY(ledIndex);
 
-#ifdef USE_FAST_DMA_BUFFER_IMPL
-        fastUpdateLEDDMABuffer(rgb24);
-#else
-        updateLEDDMABuffer(rgb24->rgb.g);
-        updateLEDDMABuffer(rgb24->rgb.r);
-        updateLEDDMABuffer(rgb24->rgb.b);
-#endif
+        if (ledEncodedValid && hsvEqual(&ledEncodedHsv[ledIndex], &ledColorBuffer[ledIndex])) {
+            continue;
+        }
+        ledEncodedHsv[ledIndex] = ledColorBuffer[ledIndex];
+
+        rgb24 = hsvToRgb24(&ledColorBuffer[ledIndex]);
+        // different colours can convert to the same RGB, black in particular
+        if (ledEncodedValid && memcmp(&ledEncodedRgb[ledIndex], rgb24, sizeof(*rgb24)) == 0) {
+            continue;
+        }
+        ledEncodedRgb[ledIndex] = *rgb24;
 
-        ledIndex++;
+        ws2811EncodeLed(&ledStripDMABuffer[ledIndex * WS2811_BITS_PER_LED], rgb24);
     }
+    ledEncodedValid = true;
 
     ws2811LedDataTransferInProgress = 1;
     ws2811LedStripDMAEnable();
@@ -35,6 +35,7 @@ void ws2811LedStripInit(ioTag_t ioTag);
 
 void ws2811LedStripHardwareInit(ioTag_t ioTag);
 void ws2811LedStripDMAEnable(void);
+void ws2811SetBitCompare(uint16_t period);
 
 void ws2811UpdateStrip(void);
 
@@ -49,11 +50,14 @@ void setStripColors(const hsvColor_t *colors);
 
 bool isWS2811LedStripReady(void);
 
+// The timer compare value for each bit sent, the DMA transfers are bytes on F1 and F3
 #if defined(STM32F1) || defined(STM32F3)
-extern uint8_t ledStripDMABuffer[WS2811_DMA_BUFFER_SIZE];
+typedef uint8_t ledStripDMAElement_t;
 #else
-extern uint32_t ledStripDMABuffer[WS2811_DMA_BUFFER_SIZE];
+typedef uint32_t ledStripDMAElement_t;
 #endif
+
+extern ledStripDMAElement_t ledStripDMABuffer[WS2811_DMA_BUFFER_SIZE];
 extern volatile uint8_t ws2811LedDataTransferInProgress;
 
 extern uint16_t BIT_COMPARE_1;
@@ -85,8 +85,7 @@ void ws2811LedStripHardwareInit(ioTag_t ioTag)
     uint16_t prescaler = timerGetPrescalerByDesiredMhz(timer, WS2811_TIMER_MHZ);
     uint16_t period = timerGetPeriodByPrescaler(timer, prescaler, WS2811_CARRIER_HZ);
 
-    BIT_COMPARE_1 = period / 3 * 2;
-    BIT_COMPARE_0 = period / 3;
+    ws2811SetBitCompare(period);
 
     /* Time base configuration */
     TIM_TimeBaseStructInit(&TIM_TimeBaseStructure);
@@ -105,6 +105,7 @@
 #define MAX7456_SIGNAL_CHECK_INTERVAL_MS 1000 // msec
 
 // DMM special bits
+#define AUTO_INCREMENT 0x01
 #define CLEAR_DISPLAY 0x04
 #define CLEAR_DISPLAY_VERT 0x06
 
@@ -172,7 +173,14 @@ uint16_t maxScreenSize = VIDEO_BUFFER_CHARS_PAL;
 static uint8_t screenBuffer[VIDEO_BUFFER_CHARS_PAL+40]; // For faster writes we use memcpy so we need some space to don't overwrite buffer
 static uint8_t shadowBuffer[VIDEO_BUFFER_CHARS_PAL];
 
-//Max chars to update in one idle
+// A bit for each char of screenBuffer that was changed since it was compared with shadowBuffer, so only those
+// are compared.
+
+static uint32_t dirtyChars[(VIDEO_BUFFER_CHARS_PAL + 31) / 32];
+#define SET_DIRTY(pos) (dirtyChars[(pos) / 32] |= 1U << ((pos) % 32))
+#define CLR_DIRTY(pos) (dirtyChars[(pos) / 32] &= ~(1U << ((pos) % 32)))
+
+//Max chars to update in one idle, when each is written on its own
 
 #define MAX_CHARS2UPDATE    100
 #ifdef MAX7456_DMA_CHANNEL_TX
@@ -181,6 +189,11 @@ volatile bool dmaTransactionInProgress = false;
 
 static uint8_t spiBuff[MAX_CHARS2UPDATE*6];
 
+// Runs of changed chars at least this long are written in auto-increment mode, which takes 2 bytes a char plus
+// 10 bytes to set up and end the run, instead of 6 bytes a char.
+
+#define MIN_BURST_LENGTH    3
+
 static uint8_t  videoSignalCfg;
 static uint8_t  videoSignalReg  = OSD_ENABLE; // OSD_ENABLE required to trigger first ReInit
 
@@ -376,6 +389,7 @@ void max7456ReInit(void)
     // Clear shadow to force redraw all screen in non-dma mode.
 
     memset(shadowBuffer, 0, maxScreenSize);
+    memset(dirtyChars, 0xff, sizeof(dirtyChars));
     if (firstInit)
     {
         max7456RefreshAll();
@@ -419,8 +433,12 @@ void max7456ClearScreen(void)
 {
     uint16_t x;
     uint32_t *p = (uint32_t*)&screenBuffer[0];
-    for (x = 0; x < VIDEO_BUFFER_CHARS_PAL/4; x++)
-        p[x] = 0x20202020;
+    for (x = 0; x < VIDEO_BUFFER_CHARS_PAL/4; x++) {
+        if (p[x] != 0x20202020) {
+            p[x] = 0x20202020;
+            dirtyChars[x / 8] |= 0xF << ((x % 8) * 4);
+        }
+    }
 }
 
 uint8_t* max7456GetScreenBuffer(void) {
@@ -429,7 +447,11 @@ uint8_t* max7456GetScreenBuffer(void) {
 
 void max7456WriteChar(uint8_t x, uint8_t y, uint8_t c)
 {
-    screenBuffer[y*CHARS_PER_LINE+x] = c;
+    const uint16_t pos = y*CHARS_PER_LINE+x;
+    if (pos < VIDEO_BUFFER_CHARS_PAL && screenBuffer[pos] != c) {
+        screenBuffer[pos] = c;
+        SET_DIRTY(pos);
+    }
 }
 
 void max7456Write(uint8_t x, uint8_t y, const char *buff)
@@ -437,7 +459,7 @@ void max7456Write(uint8_t x, uint8_t y, const char *buff)
     uint8_t i = 0;
     for (i = 0; *(buff+i); i++)
         if (x+i < CHARS_PER_LINE) // Do not write over screen
-            screenBuffer[y*CHARS_PER_LINE+x+i] = *(buff+i);
+            max7456WriteChar(x+i, y, *(buff+i));
 }
 
 bool max7456DmaInProgress(void)
@@ -451,6 +473,49 @@ bool max7456DmaInProgress(void)
 
 #include "build/debug.h"
 
+static int max7456RunBytes(int len)
+{
+    return len < MIN_BURST_LENGTH ? len * 6 : len * 2 + 10;
+}
+
+/*
+ * Add the SPI bytes that write a run of consecutive chars of screenBuffer to spiBuff.
+ * Returns the number of bytes added.
+ */
+static int max7456EncodeRun(uint8_t *buff, uint16_t pos, int len)
+{
+    int buff_len = 0;
+
+    if (len < MIN_BURST_LENGTH) {
+        for (int i = 0; i < len; i++, pos++) {
+            buff[buff_len++] = MAX7456ADD_DMAH;
+            buff[buff_len++] = pos >> 8;
+            buff[buff_len++] = MAX7456ADD_DMAL;
+            buff[buff_len++] = pos & 0xff;
+            buff[buff_len++] = MAX7456ADD_DMDI;
+            buff[buff_len++] = screenBuffer[pos];
+        }
+    } else {
+        // Set the address once, the MAX7456 moves on to the next char after each write
+        buff[buff_len++] = MAX7456ADD_DMAH;
+        buff[buff_len++] = pos >> 8;
+        buff[buff_len++] = MAX7456ADD_DMAL;
+        buff[buff_len++] = pos & 0xff;
+        buff[buff_len++] = MAX7456ADD_DMM;
+        buff[buff_len++] = AUTO_INCREMENT;
+        for (int i = 0; i < len; i++, pos++) {
+            buff[buff_len++] = MAX7456ADD_DMDI;
+            buff[buff_len++] = screenBuffer[pos];
+        }
+        buff[buff_len++] = MAX7456ADD_DMDI;
+        buff[buff_len++] = END_STRING;
+        buff[buff_len++] = MAX7456ADD_DMM;
+        buff[buff_len++] = 0;
+    }
+
+    return buff_len;
+}
+
 void max7456DrawScreen(void)
 {
     uint8_t stallCheck;
@@ -460,6 +525,8 @@ void max7456DrawScreen(void)
     static uint32_t videoDetectTimeMs = 0;
     static uint16_t pos = 0;
     int k = 0, buff_len=0;
+    uint16_t runPos = 0;
+    int runLen = 0;
 
     if (!max7456Lock && !fontIsLoading) {
 
@@ -514,24 +581,54 @@ void max7456DrawScreen(void)
 
         //------------   end of (re)init-------------------------------------
 
-        for (k=0; k< MAX_CHARS2UPDATE; k++) {
-            if (screenBuffer[pos] != shadowBuffer[pos]) {
-                spiBuff[buff_len++] = MAX7456ADD_DMAH;
-                spiBuff[buff_len++] = pos >> 8;
-                spiBuff[buff_len++] = MAX7456ADD_DMAL;
-                spiBuff[buff_len++] = pos & 0xff;
-                spiBuff[buff_len++] = MAX7456ADD_DMDI;
-                spiBuff[buff_len++] = screenBuffer[pos];
-                shadowBuffer[pos] = screenBuffer[pos];
+        // Go through the dirty chars from where the last call stopped, skipping 32 clean chars at a time, and
+        // group the changed chars into runs. Stop when spiBuff might not take another char.
+
+        for (k = 0; k < maxScreenSize; ) {
+            const uint32_t dirty = dirtyChars[pos / 32] >> (pos % 32);
+            const int skip = dirty ? __builtin_ctz(dirty) : 32 - (pos % 32);
+            pos += skip;
+            k += skip;
+
+            if (dirty && pos < maxScreenSize) {
+                if (buff_len + max7456RunBytes(runLen) + 6 > (int)sizeof(spiBuff)) {
+                    break;
+                }
+                CLR_DIRTY(pos);
+                if (screenBuffer[pos] != shadowBuffer[pos]) {
+                    // END_STRING can't be written in auto-increment mode
+                    if (runLen && (pos != runPos + runLen || screenBuffer[pos] == END_STRING)) {
+                        buff_len += max7456EncodeRun(&spiBuff[buff_len], runPos, runLen);
+                        runLen = 0;
+                    }
+                    if (screenBuffer[pos] == END_STRING) {
+                        buff_len += max7456EncodeRun(&spiBuff[buff_len], pos, 1);
+                    } else {
+                        if (!runLen) {
+                            runPos = pos;
+                        }
+                        runLen++;
+                    }
+                    shadowBuffer[pos] = screenBuffer[pos];
+                }
+                pos++;
                 k++;
             }
 
-            if (++pos >= maxScreenSize) {
+            if (pos >= maxScreenSize) {
+                // A run doesn't wrap around to the start of the screen
+                if (runLen) {
+                    buff_len += max7456EncodeRun(&spiBuff[buff_len], runPos, runLen);
+                    runLen = 0;
+                }
                 pos = 0;
-                break;
             }
         }
 
+        if (runLen) {
+            buff_len += max7456EncodeRun(&spiBuff[buff_len], runPos, runLen);
+        }
+
         if (buff_len) {
             #ifdef MAX7456_DMA_CHANNEL_TX
             if (buff_len > 0)
@@ -567,6 +664,7 @@ void max7456RefreshAll(void)
             max7456Send(MAX7456ADD_DMDI, screenBuffer[xx]);
             shadowBuffer[xx] = screenBuffer[xx];
         }
+        memset(dirtyChars, 0, sizeof(dirtyChars));
 
         max7456Send(MAX7456ADD_DMDI, 0xFF);
         max7456Send(MAX7456ADD_DMM, 0);
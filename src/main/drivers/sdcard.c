@@ -32,7 +32,7 @@
 #include "sdcard.h"
 #include "sdcard_standard.h"
 
-#ifdef AFATFS_USE_INTROSPECTIVE_LOGGING
+#if defined(AFATFS_USE_INTROSPECTIVE_LOGGING) || defined(USE_SDCARD_LATENCY_STATS)
     #define SDCARD_PROFILING
 #endif
 
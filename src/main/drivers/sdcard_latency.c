@@ -0,0 +1,153 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Collects the time the SD card takes for each block read and write into a log-scale histogram, so that cards whose
+ * occasional long writes are too much for high rate logging can be found.
+ *
+ * Blackbox reports when it had to drop data because the asyncfatfs buffers were full, the write that finishes next is
+ * the one that held everything up and is counted as a stall.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "platform.h"
+
+#ifdef USE_SDCARD_LATENCY_STATS
+
+#ifdef AFATFS_USE_INTROSPECTIVE_LOGGING
+#error "SD card latency stats and asyncfatfs introspective logging both need the SD card profiler callback"
+#endif
+
+#include "common/maths.h"
+#include "common/utils.h"
+
+#include "drivers/sdcard.h"
+#include "drivers/sdcard_latency.h"
+
+static sdcardLatencyStats_t sdcardLatencyStats;
+
+// Set when blackbox dropped data, until the write that caused it finishes
+static bool sdcardLatencyDropPending;
+
+static int sdcardLatencyBucket(uint32_t durationUs)
+{
+    const uint32_t scaled = durationUs >> SDCARD_LATENCY_BUCKET_0_SHIFT;
+
+    if (scaled == 0) {
+        return 0;
+    }
+
+    return MIN(32 - __builtin_clz(scaled), SDCARD_LATENCY_BUCKET_COUNT - 1);
+}
+
+static void sdcardLatencyProfilerCallback(sdcardBlockOperation_e operation, uint32_t blockIndex, uint32_t duration)
+{
+    UNUSED(blockIndex);
+
+    sdcardLatencyOperation_e latencyOperation;
+
+    switch (operation) {
+    case SDCARD_BLOCK_OPERATION_READ:
+        latencyOperation = SDCARD_LATENCY_READ;
+        break;
+    case SDCARD_BLOCK_OPERATION_WRITE:
+        latencyOperation = SDCARD_LATENCY_WRITE;
+
+        if (sdcardLatencyDropPending) {
+            sdcardLatencyDropPending = false;
+            sdcardLatencyStats.stalls++;
+            sdcardLatencyStats.stallMaxUs = MAX(sdcardLatencyStats.stallMaxUs, duration);
+        }
+        break;
+    default:
+        return;
+    }
+
+    sdcardLatencyStats.count[latencyOperation][sdcardLatencyBucket(duration)]++;
+    sdcardLatencyStats.maxUs[latencyOperation] = MAX(sdcardLatencyStats.maxUs[latencyOperation], duration);
+}
+
+void sdcardLatencyInit(void)
+{
+    sdcardLatencyReset();
+
+    sdcard_setProfilerCallback(sdcardLatencyProfilerCallback);
+}
+
+void sdcardLatencyReset(void)
+{
+    memset(&sdcardLatencyStats, 0, sizeof(sdcardLatencyStats));
+    sdcardLatencyDropPending = false;
+}
+
+/**
+ * Call when data for the SD card had to be dropped because the card was too slow to accept it.
+ */
+void sdcardLatencyNoteDroppedData(uint32_t bytes)
+{
+    sdcardLatencyStats.droppedBytes += bytes;
+    sdcardLatencyDropPending = true;
+}
+
+const sdcardLatencyStats_t *sdcardLatencyGetStats(void)
+{
+    return &sdcardLatencyStats;
+}
+
+uint32_t sdcardLatencyGetCount(sdcardLatencyOperation_e operation)
+{
+    uint32_t count = 0;
+
+    for (int bucket = 0; bucket < SDCARD_LATENCY_BUCKET_COUNT; bucket++) {
+        count += sdcardLatencyStats.count[operation][bucket];
+    }
+
+    return count;
+}
+
+/**
+ * Get the time below which operations fall into the given bucket, the last bucket has no upper limit.
+ */
+uint32_t sdcardLatencyBucketUpperUs(int bucket)
+{
+    return (1 << SDCARD_LATENCY_BUCKET_0_SHIFT) << bucket;
+}
+
+/**
+ * Get the time that the given percentage of operations finished within, to the resolution of the histogram.
+ */
+uint32_t sdcardLatencyPercentileUs(sdcardLatencyOperation_e operation, int percent)
+{
+    const uint32_t count = sdcardLatencyGetCount(operation);
+    // Round up so that e.g. the 99th percentile of a few operations is the slowest of them
+    const uint32_t target = ((uint64_t)count * percent + 99) / 100;
+    uint32_t sum = 0;
+
+    for (int bucket = 0; bucket < SDCARD_LATENCY_BUCKET_COUNT - 1; bucket++) {
+        sum += sdcardLatencyStats.count[operation][bucket];
+        if (sum >= target) {
+            return MIN(sdcardLatencyBucketUpperUs(bucket), sdcardLatencyStats.maxUs[operation]);
+        }
+    }
+
+    return sdcardLatencyStats.maxUs[operation];
+}
+
+#endif
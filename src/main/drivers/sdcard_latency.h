@@ -0,0 +1,47 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Bucket 0 holds operations that took less than 2^7us, each following bucket covers twice the time of the one before
+#define SDCARD_LATENCY_BUCKET_0_SHIFT 7
+#define SDCARD_LATENCY_BUCKET_COUNT 12
+
+typedef enum {
+    SDCARD_LATENCY_READ = 0,
+    SDCARD_LATENCY_WRITE,
+    SDCARD_LATENCY_OPERATION_COUNT
+} sdcardLatencyOperation_e;
+
+typedef struct sdcardLatencyStats_s {
+    uint32_t count[SDCARD_LATENCY_OPERATION_COUNT][SDCARD_LATENCY_BUCKET_COUNT];
+    uint32_t maxUs[SDCARD_LATENCY_OPERATION_COUNT];
+    uint32_t stalls;        // Writes during which blackbox had to drop data
+    uint32_t stallMaxUs;    // The longest of those writes
+    uint32_t droppedBytes;
+} sdcardLatencyStats_t;
+
+void sdcardLatencyInit(void);
+void sdcardLatencyReset(void);
+void sdcardLatencyNoteDroppedData(uint32_t bytes);
+
+const sdcardLatencyStats_t *sdcardLatencyGetStats(void);
+uint32_t sdcardLatencyGetCount(sdcardLatencyOperation_e operation);
+uint32_t sdcardLatencyBucketUpperUs(int bucket);
+uint32_t sdcardLatencyPercentileUs(sdcardLatencyOperation_e operation, int percent);
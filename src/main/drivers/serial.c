@@ -71,6 +71,25 @@ uint8_t serialRead(serialPort_t *instance)
     return instance->vTable->serialRead(instance);
 }
 
+/*
+ * Read up to count bytes that have already been received, without waiting for more. Returns the number of bytes read.
+ */
+int serialReadBuf(serialPort_t *instance, uint8_t *data, int count)
+{
+    if (instance->vTable->readBuf) {
+        return instance->vTable->readBuf(instance, data, count);
+    }
+
+    const int bytesWaiting = serialRxBytesWaiting(instance);
+    if (count > bytesWaiting) {
+        count = bytesWaiting;
+    }
+    for (int i = 0; i < count; i++) {
+        data[i] = serialRead(instance);
+    }
+    return count;
+}
+
 void serialSetBaudRate(serialPort_t *instance, uint32_t baudRate)
 {
     instance->vTable->serialSetBaudRate(instance, baudRate);
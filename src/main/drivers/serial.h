@@ -102,6 +102,8 @@ struct serialPortVTable {
     void (*setMode)(serialPort_t *instance, portMode_t mode);
 
     void (*writeBuf)(serialPort_t *instance, const void *data, int count);
+    // Optional, copies up to count of the received bytes at once and returns how many were copied.
+    int (*readBuf)(serialPort_t *instance, uint8_t *data, int count);
     // Optional functions used to buffer large writes.
     void (*beginWrite)(serialPort_t *instance);
     void (*endWrite)(serialPort_t *instance);
@@ -112,6 +114,7 @@ uint32_t serialRxBytesWaiting(const serialPort_t *instance);
 uint32_t serialTxBytesFree(const serialPort_t *instance);
 void serialWriteBuf(serialPort_t *instance, const uint8_t *data, int count);
 uint8_t serialRead(serialPort_t *instance);
+int serialReadBuf(serialPort_t *instance, uint8_t *data, int count);
 void serialSetBaudRate(serialPort_t *instance, uint32_t baudRate);
 void serialSetMode(serialPort_t *instance, portMode_t mode);
 bool isSerialTransmitBufferEmpty(const serialPort_t *instance);
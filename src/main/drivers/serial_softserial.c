@@ -22,6 +22,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "platform.h"
 
@@ -32,6 +33,7 @@
 
 #include "build/debug.h"
 
+#include "common/maths.h"
 #include "common/utils.h"
 
 #include "drivers/nvic.h"
@@ -598,6 +600,22 @@ uint8_t softSerialReadByte(serialPort_t *instance)
     return ch;
 }
 
+int softSerialReadBuf(serialPort_t *instance, uint8_t *data, int count)
+{
+    const int bytesWaiting = softSerialRxBytesWaiting(instance);
+    if (count > bytesWaiting) {
+        count = bytesWaiting;
+    }
+
+    // The buffer size is a power of 2, so the copy is at most two runs
+    const int chunk = MIN(count, (int)(instance->rxBufferSize - instance->rxBufferTail));
+    memcpy(data, (uint8_t *)&instance->rxBuffer[instance->rxBufferTail], chunk);
+    memcpy(data + chunk, (uint8_t *)instance->rxBuffer, count - chunk);
+    instance->rxBufferTail = (instance->rxBufferTail + count) % instance->rxBufferSize;
+
+    return count;
+}
+
 void softSerialWriteByte(serialPort_t *s, uint8_t ch)
 {
     if ((s->mode & MODE_TX) == 0) {
@@ -636,6 +654,7 @@ static const struct serialPortVTable softSerialVTable = {
     .isSerialTransmitBufferEmpty = isSoftSerialTransmitBufferEmpty,
     .setMode = softSerialSetMode,
     .writeBuf = NULL,
+    .readBuf = softSerialReadBuf,
     .beginWrite = NULL,
     .endWrite = NULL
 };
@@ -24,12 +24,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <errno.h>
+#include <string.h>
 
 #include "platform.h"
 
 #include "build/build_config.h"
 
+#include "common/maths.h"
 #include "common/utils.h"
 
 #include "io/serial.h"
@@ -37,6 +38,9 @@
 
 #define BASE_PORT 5760
 
+#define TCP_TX_FULL_POLL_US     100
+#define TCP_TX_FULL_TIMEOUT_US  100000
+
 static const struct serialPortVTable tcpVTable; // Forward
 static tcpPort_t tcpSerialPorts[SERIAL_PORT_COUNT];
 static bool tcpPortInitialized[SERIAL_PORT_COUNT];
@@ -81,24 +85,23 @@ static tcpPort_t* tcpReconfigure(tcpPort_t *s, int id)
 		return s;
 	}
 
-    if (pthread_mutex_init(&s->txLock, NULL) != 0) {
-		fprintf(stderr, "TX mutex init failed - %d\n", errno);
-		// TODO: clean up & re-init
-		return NULL;
-	}
-    if (pthread_mutex_init(&s->rxLock, NULL) != 0) {
-		fprintf(stderr, "RX mutex init failed - %d\n", errno);
-		// TODO: clean up & re-init
-		return NULL;
-	}
-
 	tcpStart = true;
-	tcpPortInitialized[id] = true;
 
 	s->connected = false;
 	s->clientCount = 0;
 	s->id = id;
+	s->serv = NULL;     // dyad is not thread safe, the listening stream is created by tcpUpdate()
 	s->conn = NULL;
+	s->txBufferPending = 0;
+	s->rxDropped = 0;
+	s->txDropped = 0;
+	return s;
+}
+
+static void tcpListen(tcpPort_t *s)
+{
+	const int id = s->id;
+
 	s->serv = dyad_newStream();
 	dyad_setNoDelay(s->serv, 1);
 	dyad_addListener(s->serv, DYAD_EVENT_ACCEPT, onAccept, s);
@@ -108,7 +111,6 @@ static tcpPort_t* tcpReconfigure(tcpPort_t *s, int id)
 	} else {
 		fprintf(stderr, "bind port %u for UART%u failed!!\n", (unsigned)BASE_PORT + id + 1, (unsigned)id + 1);
 	}
-	return s;
 }
 
 serialPort_t *serTcpOpen(int id, serialReceiveCallbackPtr rxCallback, uint32_t baudRate, portMode_t mode, portOptions_t options)
@@ -139,119 +141,195 @@ serialPort_t *serTcpOpen(int id, serialReceiveCallbackPtr rxCallback, uint32_t b
     s->port.baudRate = baudRate;
     s->port.options = options;
 
+    // publish the port to the dyad thread only once it is fully set up
+    __atomic_store_n(&tcpPortInitialized[id], true, __ATOMIC_RELEASE);
+
     return (serialPort_t *)s;
 }
 
-uint32_t tcpTotalRxBytesWaiting(const serialPort_t *instance)
+/*
+ * Both rings are single-producer/single-consumer and shared between the main loop and the
+ * dyad thread without locks. Each index is only ever written by one side: the producer owns
+ * the head and publishes it with release semantics, the consumer owns the tail and hands
+ * space back the same way.
+ *
+ * All dyad calls are made from the dyad thread, the main loop only touches the rings.
+ *
+ * RX: produced by the dyad thread in tcpDataIn(), consumed by the main loop.
+ * TX: produced by the main loop into txBufferPending, published by tcpFlush() at the end of
+ *     each scheduler pass and drained by the dyad thread in tcpDataOut().
+ */
+static uint32_t tcpRingUsed(uint32_t head, uint32_t tail, uint32_t size)
 {
-    tcpPort_t *s = (tcpPort_t*)instance;
-    uint32_t count;
-    pthread_mutex_lock(&s->rxLock);
-    if (s->port.rxBufferHead >= s->port.rxBufferTail) {
-        count = s->port.rxBufferHead - s->port.rxBufferTail;
-    } else {
-        count = s->port.rxBufferSize + s->port.rxBufferHead - s->port.rxBufferTail;
-    }
-    pthread_mutex_unlock(&s->rxLock);
+    return (head - tail) & (size - 1);
+}
 
-    return count;
+static uint32_t tcpTxFree(const tcpPort_t *s)
+{
+    const uint32_t tail = __atomic_load_n(&s->port.txBufferTail, __ATOMIC_ACQUIRE);
+    return (TX_BUFFER_SIZE - 1) - tcpRingUsed(s->txBufferPending, tail, TX_BUFFER_SIZE);
 }
 
-uint32_t tcpTotalTxBytesFree(const serialPort_t *instance)
+static void tcpPublishTx(tcpPort_t *s)
 {
-    tcpPort_t *s = (tcpPort_t*)instance;
-    uint32_t bytesUsed;
-
-    pthread_mutex_lock(&s->txLock);
-    if (s->port.txBufferHead >= s->port.txBufferTail) {
-        bytesUsed = s->port.txBufferHead - s->port.txBufferTail;
-    } else {
-        bytesUsed = s->port.txBufferSize + s->port.txBufferHead - s->port.txBufferTail;
+    __atomic_store_n(&s->port.txBufferHead, s->txBufferPending, __ATOMIC_RELEASE);
+}
+
+// The TX ring is full: hand what we have to the dyad thread and give it a bounded time to drain.
+static bool tcpWaitTxFree(tcpPort_t *s)
+{
+    tcpPublishTx(s);
+    for (int waitUs = 0; waitUs < TCP_TX_FULL_TIMEOUT_US; waitUs += TCP_TX_FULL_POLL_US) {
+        delayMicroseconds_real(TCP_TX_FULL_POLL_US);
+        if (tcpTxFree(s) > 0) {
+            return true;
+        }
     }
-    uint32_t bytesFree = (s->port.txBufferSize - 1) - bytesUsed;
-    pthread_mutex_unlock(&s->txLock);
+    return false;
+}
 
-    return bytesFree;
+uint32_t tcpTotalRxBytesWaiting(const serialPort_t *instance)
+{
+    const uint32_t head = __atomic_load_n(&instance->rxBufferHead, __ATOMIC_ACQUIRE);
+    return tcpRingUsed(head, instance->rxBufferTail, RX_BUFFER_SIZE);
+}
+
+uint32_t tcpTotalTxBytesFree(const serialPort_t *instance)
+{
+    return tcpTxFree((const tcpPort_t *)instance);
 }
 
 bool isTcpTransmitBufferEmpty(const serialPort_t *instance)
 {
-    tcpPort_t *s = (tcpPort_t *)instance;
-    pthread_mutex_lock(&s->txLock);
-    bool isEmpty = s->port.txBufferTail == s->port.txBufferHead;
-    pthread_mutex_unlock(&s->txLock);
-    return isEmpty;
+    const tcpPort_t *s = (const tcpPort_t *)instance;
+    return __atomic_load_n(&s->port.txBufferTail, __ATOMIC_ACQUIRE) == s->txBufferPending;
 }
 
 uint8_t tcpRead(serialPort_t *instance)
 {
-    uint8_t ch;
-    tcpPort_t *s = (tcpPort_t *)instance;
-    pthread_mutex_lock(&s->rxLock);
-
-    ch = s->port.rxBuffer[s->port.rxBufferTail];
-    if (s->port.rxBufferTail + 1 >= s->port.rxBufferSize) {
-        s->port.rxBufferTail = 0;
-    } else {
-        s->port.rxBufferTail++;
-    }
-    pthread_mutex_unlock(&s->rxLock);
+    const uint32_t tail = instance->rxBufferTail;
+    const uint8_t ch = instance->rxBuffer[tail];
+    __atomic_store_n(&instance->rxBufferTail, (tail + 1) & (RX_BUFFER_SIZE - 1), __ATOMIC_RELEASE);
 
     return ch;
 }
 
+int tcpReadBuf(serialPort_t *instance, uint8_t *data, int count)
+{
+    const uint32_t tail = instance->rxBufferTail;
+    count = MIN((uint32_t)count, tcpTotalRxBytesWaiting(instance));
+
+    // copy up to the end of the ring, then the remainder from the start
+    const uint32_t chunk = MIN((uint32_t)count, RX_BUFFER_SIZE - tail);
+    memcpy(data, (uint8_t *)&instance->rxBuffer[tail], chunk);
+    memcpy(data + chunk, (uint8_t *)instance->rxBuffer, count - chunk);
+    __atomic_store_n(&instance->rxBufferTail, (tail + count) & (RX_BUFFER_SIZE - 1), __ATOMIC_RELEASE);
+
+    return count;
+}
+
 void tcpWrite(serialPort_t *instance, uint8_t ch)
 {
     tcpPort_t *s = (tcpPort_t *)instance;
-    pthread_mutex_lock(&s->txLock);
 
-    s->port.txBuffer[s->port.txBufferHead] = ch;
-    if (s->port.txBufferHead + 1 >= s->port.txBufferSize) {
-        s->port.txBufferHead = 0;
-    } else {
-        s->port.txBufferHead++;
+    if (tcpTxFree(s) == 0 && !tcpWaitTxFree(s)) {
+        s->txDropped++;
+        return;
+    }
+    s->txBuffer[s->txBufferPending] = ch;
+    s->txBufferPending = (s->txBufferPending + 1) & (TX_BUFFER_SIZE - 1);
+}
+
+void tcpWriteBuf(serialPort_t *instance, const void *data, int count)
+{
+    tcpPort_t *s = (tcpPort_t *)instance;
+    const uint8_t *p = data;
+
+    while (count > 0) {
+        uint32_t free = tcpTxFree(s);
+        if (free == 0) {
+            if (!tcpWaitTxFree(s)) {
+                s->txDropped += count;
+                return;
+            }
+            free = tcpTxFree(s);
+        }
+        // copy up to the end of the ring, the remainder wraps on the next iteration
+        const uint32_t chunk = MIN(MIN((uint32_t)count, free), TX_BUFFER_SIZE - s->txBufferPending);
+        memcpy(&s->txBuffer[s->txBufferPending], p, chunk);
+        s->txBufferPending = (s->txBufferPending + chunk) & (TX_BUFFER_SIZE - 1);
+        p += chunk;
+        count -= chunk;
     }
-    pthread_mutex_unlock(&s->txLock);
+}
 
-    tcpDataOut(s);
+void tcpFlush(void)
+{
+    for (int id = 0; id < SERIAL_PORT_COUNT; id++) {
+        if (tcpPortInitialized[id]) {
+            tcpPublishTx(&tcpSerialPorts[id]);
+        }
+    }
 }
 
 void tcpDataOut(tcpPort_t *instance)
 {
     tcpPort_t *s = (tcpPort_t *)instance;
-    if(s->conn == NULL) return;
-    pthread_mutex_lock(&s->txLock);
-
-    if (s->port.txBufferHead < s->port.txBufferTail) {
-        // send data till end of buffer
-        int chunk = s->port.txBufferSize - s->port.txBufferTail;
-        dyad_write(s->conn, (const void *)&s->port.txBuffer[s->port.txBufferTail], chunk);
-        s->port.txBufferTail = 0;
-    }
-    int chunk = s->port.txBufferHead - s->port.txBufferTail;
-    if(chunk)
-        dyad_write(s->conn, (const void*)&s->port.txBuffer[s->port.txBufferTail], chunk);
-    s->port.txBufferTail = s->port.txBufferHead;
+    const uint32_t head = __atomic_load_n(&s->port.txBufferHead, __ATOMIC_ACQUIRE);
+    const uint32_t tail = s->port.txBufferTail;
 
-    pthread_mutex_unlock(&s->txLock);
+    if (head == tail) {
+        return;
+    }
+    // without a client the data is discarded, so the main loop never stalls on a full ring
+    if (s->conn) {
+        if (head < tail) {
+            // send data till end of buffer
+            dyad_write(s->conn, &s->txBuffer[tail], TX_BUFFER_SIZE - tail);
+            if (head) {
+                dyad_write(s->conn, &s->txBuffer[0], head);
+            }
+        } else {
+            dyad_write(s->conn, &s->txBuffer[tail], head - tail);
+        }
+    }
+    __atomic_store_n(&s->port.txBufferTail, head, __ATOMIC_RELEASE);
 }
 
 void tcpDataIn(tcpPort_t *instance, uint8_t* ch, int size)
 {
     tcpPort_t *s = (tcpPort_t *)instance;
-	pthread_mutex_lock(&s->rxLock);
-
-	while(size--) {
-//		printf("%c", *ch);
-		s->port.rxBuffer[s->port.rxBufferHead] = *(ch++);
-		if (s->port.rxBufferHead + 1 >= s->port.rxBufferSize) {
-		    s->port.rxBufferHead = 0;
-		} else {
-		    s->port.rxBufferHead++;
-		}
-	}
-	pthread_mutex_unlock(&s->rxLock);
-//	printf("\n");
+    const uint32_t tail = __atomic_load_n(&s->port.rxBufferTail, __ATOMIC_ACQUIRE);
+    uint32_t head = s->port.rxBufferHead;
+    const uint32_t free = (RX_BUFFER_SIZE - 1) - tcpRingUsed(head, tail, RX_BUFFER_SIZE);
+
+    if ((uint32_t)size > free) {
+        s->rxDropped += size - free;
+        size = free;
+    }
+    while (size > 0) {
+        const uint32_t chunk = MIN((uint32_t)size, RX_BUFFER_SIZE - head);
+        memcpy(&s->rxBuffer[head], ch, chunk);
+        head = (head + chunk) & (RX_BUFFER_SIZE - 1);
+        ch += chunk;
+        size -= chunk;
+    }
+    __atomic_store_n(&s->port.rxBufferHead, head, __ATOMIC_RELEASE);
+}
+
+void tcpUpdate(void)
+{
+    dyad_update();
+
+    for (int id = 0; id < SERIAL_PORT_COUNT; id++) {
+        if (__atomic_load_n(&tcpPortInitialized[id], __ATOMIC_ACQUIRE)) {
+            tcpPort_t *s = &tcpSerialPorts[id];
+            if (!s->serv) {
+                tcpListen(s);
+            }
+            tcpDataOut(s);
+        }
+    }
 }
 
 static const struct serialPortVTable tcpVTable = {
@@ -262,7 +340,8 @@ static const struct serialPortVTable tcpVTable = {
         .serialSetBaudRate = NULL,
         .isSerialTransmitBufferEmpty = isTcpTransmitBufferEmpty,
         .setMode = NULL,
-        .writeBuf = NULL,
+        .writeBuf = tcpWriteBuf,
+        .readBuf = tcpReadBuf,
         .beginWrite = NULL,
         .endWrite = NULL,
 };
@@ -18,11 +18,11 @@
 #pragma once
 
 #include <netinet/in.h>
-#include <pthread.h>
 #include "dyad.h"
 
-#define RX_BUFFER_SIZE    1400
-#define TX_BUFFER_SIZE    1400
+// ring sizes must be powers of two
+#define RX_BUFFER_SIZE    4096
+#define TX_BUFFER_SIZE    16384
 
 typedef struct {
     serialPort_t port;
@@ -31,8 +31,9 @@ typedef struct {
 
 	dyad_Stream *serv;
 	dyad_Stream *conn;
-	pthread_mutex_t txLock;
-	pthread_mutex_t rxLock;
+	uint32_t txBufferPending;   // TX head written by the main loop, published by tcpFlush()
+	uint32_t rxDropped;
+	uint32_t txDropped;
 	bool connected;
 	uint16_t clientCount;
 	uint8_t id;
@@ -43,6 +44,8 @@ serialPort_t *serTcpOpen(int id, serialReceiveCallbackPtr rxCallback, uint32_t b
 // tcpPort API
 void tcpDataIn(tcpPort_t *instance, uint8_t* ch, int size);
 void tcpDataOut(tcpPort_t *instance);
+void tcpFlush(void);     // main loop, end of each scheduler pass
+void tcpUpdate(void);    // dyad thread, runs dyad and sends the published TX data of all ports
 
 bool tcpIsStart(void);
 bool* tcpGetUsed(void);
@@ -22,6 +22,7 @@
 */
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "platform.h"
 
@@ -285,10 +286,11 @@ uint32_t uartTotalRxBytesWaiting(const serialPort_t *instance)
     if (s->rxDMAChannel) {
         uint32_t rxDMAHead = s->rxDMAChannel->CNDTR;
 #endif
-        if (rxDMAHead >= s->rxDMAPos) {
-            return rxDMAHead - s->rxDMAPos;
+        // rxDMAHead and rxDMAPos are both distances from the end of the buffer, they count down as they advance
+        if (s->rxDMAPos >= rxDMAHead) {
+            return s->rxDMAPos - rxDMAHead;
         } else {
-            return s->port.rxBufferSize + rxDMAHead - s->rxDMAPos;
+            return s->port.rxBufferSize + s->rxDMAPos - rxDMAHead;
         }
     }
 
@@ -380,16 +382,49 @@ uint8_t uartRead(serialPort_t *instance)
     return ch;
 }
 
-void uartWrite(serialPort_t *instance, uint8_t ch)
+/*
+ * Copies the received bytes a contiguous run of the ring at a time, instead of going through uartRead() for each byte.
+ */
+int uartReadBuf(serialPort_t *instance, uint8_t *data, int count)
 {
     uartPort_t *s = (uartPort_t *)instance;
-    s->port.txBuffer[s->port.txBufferHead] = ch;
-    if (s->port.txBufferHead + 1 >= s->port.txBufferSize) {
-        s->port.txBufferHead = 0;
-    } else {
-        s->port.txBufferHead++;
+    int bytesRead = 0;
+
+    count = MIN((uint32_t)count, uartTotalRxBytesWaiting(instance));
+
+    while (bytesRead < count) {
+#ifdef STM32F4
+        if (s->rxDMAStream) {
+#else
+        if (s->rxDMAChannel) {
+#endif
+            // rxDMAPos counts the bytes from the read position to the end of the buffer
+            const uint32_t tail = s->port.rxBufferSize - s->rxDMAPos;
+            const uint32_t chunk = MIN((uint32_t)(count - bytesRead), s->rxDMAPos);
+            memcpy(data + bytesRead, (uint8_t *)&s->port.rxBuffer[tail], chunk);
+            s->rxDMAPos -= chunk;
+            if (s->rxDMAPos == 0) {
+                s->rxDMAPos = s->port.rxBufferSize;
+            }
+            bytesRead += chunk;
+        } else {
+            const uint32_t tail = s->port.rxBufferTail;
+            const uint32_t chunk = MIN((uint32_t)(count - bytesRead), s->port.rxBufferSize - tail);
+            memcpy(data + bytesRead, (uint8_t *)&s->port.rxBuffer[tail], chunk);
+            if (tail + chunk >= s->port.rxBufferSize) {
+                s->port.rxBufferTail = 0;
+            } else {
+                s->port.rxBufferTail = tail + chunk;
+            }
+            bytesRead += chunk;
+        }
     }
 
+    return bytesRead;
+}
+
+static void uartStartTx(uartPort_t *s)
+{
 #ifdef STM32F4
     if (s->txDMAStream) {
         if (!(s->txDMAStream->CR & 1))
@@ -403,6 +438,48 @@ void uartWrite(serialPort_t *instance, uint8_t ch)
     }
 }
 
+void uartWrite(serialPort_t *instance, uint8_t ch)
+{
+    uartPort_t *s = (uartPort_t *)instance;
+    s->port.txBuffer[s->port.txBufferHead] = ch;
+    if (s->port.txBufferHead + 1 >= s->port.txBufferSize) {
+        s->port.txBufferHead = 0;
+    } else {
+        s->port.txBufferHead++;
+    }
+
+    uartStartTx(s);
+}
+
+/*
+ * Like the generic serialWriteBuf() fallback this waits for room in the Tx buffer, but copies as much as fits at once
+ * and starts the transmission once per copy instead of once per byte.
+ */
+void uartWriteBuf(serialPort_t *instance, const void *data, int count)
+{
+    uartPort_t *s = (uartPort_t *)instance;
+    const uint8_t *p = data;
+
+    while (count > 0) {
+        const uint32_t bytesFree = serialTxBytesFree(instance);
+        if (bytesFree == 0) {
+            continue;
+        }
+        // copy up to the end of the ring, the remainder wraps on the next iteration
+        const uint32_t chunk = MIN(MIN((uint32_t)count, bytesFree), s->port.txBufferSize - s->port.txBufferHead);
+        memcpy((uint8_t *)&s->port.txBuffer[s->port.txBufferHead], p, chunk);
+        if (s->port.txBufferHead + chunk >= s->port.txBufferSize) {
+            s->port.txBufferHead = 0;
+        } else {
+            s->port.txBufferHead += chunk;
+        }
+        p += chunk;
+        count -= chunk;
+
+        uartStartTx(s);
+    }
+}
+
 const struct serialPortVTable uartVTable[] = {
     {
         .serialWrite = uartWrite,
@@ -412,7 +489,8 @@ const struct serialPortVTable uartVTable[] = {
         .serialSetBaudRate = uartSetBaudRate,
         .isSerialTransmitBufferEmpty = isUartTransmitBufferEmpty,
         .setMode = uartSetMode,
-        .writeBuf = NULL,
+        .writeBuf = uartWriteBuf,
+        .readBuf = uartReadBuf,
         .beginWrite = NULL,
         .endWrite = NULL,
     }
@@ -87,8 +87,10 @@ serialPort_t *uartOpen(UARTDevice device, serialReceiveCallbackPtr rxCallback, u
 
 // serialPort API
 void uartWrite(serialPort_t *instance, uint8_t ch);
+void uartWriteBuf(serialPort_t *instance, const void *data, int count);
 uint32_t uartTotalRxBytesWaiting(const serialPort_t *instance);
 uint32_t uartTotalTxBytesFree(const serialPort_t *instance);
 uint8_t uartRead(serialPort_t *instance);
+int uartReadBuf(serialPort_t *instance, uint8_t *data, int count);
 void uartSetBaudRate(serialPort_t *s, uint32_t baudRate);
 bool isUartTransmitBufferEmpty(const serialPort_t *s);
@@ -90,6 +90,13 @@ static uint8_t usbVcpRead(serialPort_t *instance)
     }
 }
 
+static int usbVcpReadBuf(serialPort_t *instance, uint8_t *data, int count)
+{
+    UNUSED(instance);
+
+    return CDC_Receive_DATA(data, count);
+}
+
 static void usbVcpWriteBuf(serialPort_t *instance, const void *data, int count)
 {
     UNUSED(instance);
@@ -176,6 +183,7 @@ static const struct serialPortVTable usbVTable[] = {
         .isSerialTransmitBufferEmpty = isUsbVcpTransmitBufferEmpty,
         .setMode = usbVcpSetMode,
         .writeBuf = usbVcpWriteBuf,
+        .readBuf = usbVcpReadBuf,
         .beginWrite = usbVcpBeginWrite,
         .endWrite = usbVcpEndWrite
     }
@@ -65,6 +65,7 @@ extern uint8_t __config_end;
 #include "drivers/inverter.h"
 #include "drivers/rx_pwm.h"
 #include "drivers/sdcard.h"
+#include "drivers/sdcard_latency.h"
 #include "drivers/sensor.h"
 #include "drivers/serial.h"
 #include "drivers/serial_escserial.h"
@@ -1670,6 +1671,44 @@ static void cliSdInfo(char *cmdline)
     cliPrintLinefeed();
 }
 
+#ifdef USE_SDCARD_LATENCY_STATS
+
+static void cliSdLatency(char *cmdline)
+{
+    static const char * const operationNames[SDCARD_LATENCY_OPERATION_COUNT] = { "Read", "Write" };
+
+    if (strcasecmp(cmdline, "reset") == 0) {
+        sdcardLatencyReset();
+        cliPrintLine("Reset");
+        return;
+    }
+
+    const sdcardLatencyStats_t *stats = sdcardLatencyGetStats();
+
+    for (int operation = 0; operation < SDCARD_LATENCY_OPERATION_COUNT; operation++) {
+        cliPrintLinef("%s: %u blocks, p50 %uus, p99 %uus, max %uus",
+            operationNames[operation],
+            sdcardLatencyGetCount(operation),
+            sdcardLatencyPercentileUs(operation, 50),
+            sdcardLatencyPercentileUs(operation, 99),
+            stats->maxUs[operation]
+        );
+
+        for (int bucket = 0; bucket < SDCARD_LATENCY_BUCKET_COUNT; bucket++) {
+            if (bucket < SDCARD_LATENCY_BUCKET_COUNT - 1) {
+                cliPrintf("  <%6uus", sdcardLatencyBucketUpperUs(bucket));
+            } else {
+                cliPrintf(" >=%6uus", sdcardLatencyBucketUpperUs(bucket - 1));
+            }
+            cliPrintLinef(" %u", stats->count[operation][bucket]);
+        }
+    }
+
+    cliPrintLinef("Stalls: %u, longest %uus, %u bytes dropped", stats->stalls, stats->stallMaxUs, stats->droppedBytes);
+}
+
+#endif
+
 #endif
 
 #ifdef USE_FLASHFS
@@ -1682,6 +1721,11 @@ static void cliFlashInfo(char *cmdline)
 
     cliPrintLinef("Flash sectors=%u, sectorSize=%u, pagesPerSector=%u, pageSize=%u, totalSize=%u, usedSize=%u",
             layout->sectors, layout->sectorSize, layout->pagesPerSector, layout->pageSize, layout->totalSize, flashfsGetOffset());
+
+    flashfsLog_t log;
+    for (int i = 0; flashfsGetLog(i, &log); i++) {
+        cliPrintLinef("Log %d: start=%u, end=%u", i + 1, log.start, log.end);
+    }
 }
 
 
@@ -3256,6 +3300,9 @@ const clicmd_t cmdTable[] = {
     CLI_COMMAND_DEF("save", "save and reboot", NULL, cliSave),
 #ifdef USE_SDCARD
     CLI_COMMAND_DEF("sd_info", "sdcard info", NULL, cliSdInfo),
+#ifdef USE_SDCARD_LATENCY_STATS
+    CLI_COMMAND_DEF("sd_latency", "sdcard block read/write times", "[reset]", cliSdLatency),
+#endif
 #endif
     CLI_COMMAND_DEF("serial", "configure serial ports", NULL, cliSerial),
 #ifndef SKIP_SERIAL_PASSTHROUGH
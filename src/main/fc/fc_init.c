@@ -61,6 +61,7 @@
 #include "drivers/flash_m25p16.h"
 #include "drivers/sonar_hcsr04.h"
 #include "drivers/sdcard.h"
+#include "drivers/sdcard_latency.h"
 #include "drivers/usb_io.h"
 #include "drivers/transponder_ir.h"
 #include "drivers/exti.h"
@@ -546,7 +547,10 @@ void init(void)
     if (blackboxConfig()->device == BLACKBOX_DEVICE_SDCARD) {
         sdcardInsertionDetectInit();
         sdcard_init(sdcardConfig()->useDma);
-        afatfs_init();
+        afatfs_init(&afatfsSdcardBlockDevice);
+#ifdef USE_SDCARD_LATENCY_STATS
+        sdcardLatencyInit();
+#endif
     }
 #endif
 
@@ -30,6 +30,7 @@
 
 #include "common/axis.h"
 #include "common/color.h"
+#include "common/huffman.h"
 #include "common/maths.h"
 #include "common/streambuf.h"
 
@@ -46,6 +47,7 @@
 #include "drivers/max7456.h"
 #include "drivers/pwm_output.h"
 #include "drivers/sdcard.h"
+#include "drivers/sdcard_latency.h"
 #include "drivers/serial.h"
 #include "drivers/serial_escserial.h"
 #include "drivers/system.h"
@@ -459,6 +461,27 @@ static uint32_t packFlightModeFlags(void)
     return mspBoxEnabledMask;
 }
 
+#ifdef USE_SDCARD_LATENCY_STATS
+static void serializeSDCardLatencyReply(sbuf_t *dst)
+{
+    const sdcardLatencyStats_t *stats = sdcardLatencyGetStats();
+
+    sbufWriteU8(dst, SDCARD_LATENCY_BUCKET_COUNT);
+    sbufWriteU8(dst, SDCARD_LATENCY_BUCKET_0_SHIFT); // Bucket n holds times below 2^(shift + n) microseconds
+
+    for (int operation = 0; operation < SDCARD_LATENCY_OPERATION_COUNT; operation++) {
+        for (int bucket = 0; bucket < SDCARD_LATENCY_BUCKET_COUNT; bucket++) {
+            sbufWriteU32(dst, stats->count[operation][bucket]);
+        }
+        sbufWriteU32(dst, stats->maxUs[operation]);
+    }
+
+    sbufWriteU32(dst, stats->stalls);
+    sbufWriteU32(dst, stats->stallMaxUs);
+    sbufWriteU32(dst, stats->droppedBytes);
+}
+#endif
+
 static void serializeSDCardSummaryReply(sbuf_t *dst)
 {
 #ifdef USE_SDCARD
@@ -513,6 +536,9 @@ static void serializeDataflashSummaryReply(sbuf_t *dst)
 #ifdef USE_FLASHFS
     const flashGeometry_t *geometry = flashfsGetGeometry();
     uint8_t flags = (flashfsIsReady() ? 1 : 0) | 2 /* FlashFS is supported */;
+#ifdef USE_HUFFMAN
+    flags |= 4; // Reads can be compressed
+#endif
 
     sbufWriteU8(dst, flags);
     sbufWriteU32(dst, geometry->sectors);
@@ -527,7 +553,70 @@ static void serializeDataflashSummaryReply(sbuf_t *dst)
 }
 
 #ifdef USE_FLASHFS
-static void serializeDataflashReadReply(sbuf_t *dst, uint32_t address, const uint16_t size, bool useLegacyFormat)
+typedef enum {
+    DATAFLASH_COMPRESSION_NONE = 0,
+    DATAFLASH_COMPRESSION_HUFFMAN = 1,
+} dataflashCompression_e;
+
+#ifdef USE_HUFFMAN
+#define DATAFLASH_COMPRESSION_READ_CHUNK_SIZE 256
+
+/**
+ * Write the payload of a compressed read reply: the data size, the compression format, then the number of bytes the
+ * data decodes to, the Huffman code length of each symbol (see huffmanPackCodeLengths()) and the coded data.
+ *
+ * Returns false if the coded data wouldn't be smaller than the raw data, in which case nothing is written.
+ */
+static bool serializeDataflashCompressedData(sbuf_t *dst, uint32_t address, uint16_t readLen)
+{
+    static huffmanTable_t table;
+    static uint32_t histogram[HUFFMAN_SYMBOL_COUNT];
+    uint8_t readBuffer[DATAFLASH_COMPRESSION_READ_CHUNK_SIZE];
+
+    enum {
+        HEADER_SIZE = sizeof(uint16_t) + sizeof(uint8_t),
+        HUFFMAN_INFO_SIZE = sizeof(uint16_t) + HUFFMAN_CODE_LENGTHS_SIZE
+    };
+
+    const int codedDataSizeMax = MIN(readLen, sbufBytesRemaining(dst) - HEADER_SIZE) - HUFFMAN_INFO_SIZE;
+    if (codedDataSizeMax <= 0) {
+        return false;
+    }
+
+    // The data is read from the flash twice, once to build the code and once to code it
+    memset(histogram, 0, sizeof(histogram));
+    for (uint16_t offset = 0; offset < readLen; offset += DATAFLASH_COMPRESSION_READ_CHUNK_SIZE) {
+        const int chunkLen = MIN(readLen - offset, DATAFLASH_COMPRESSION_READ_CHUNK_SIZE);
+        if (flashfsReadAbs(address + offset, readBuffer, chunkLen) != chunkLen) {
+            return false;
+        }
+        huffmanCountSymbols(histogram, readBuffer, chunkLen);
+    }
+    huffmanBuildTable(&table, histogram);
+
+    huffmanState_t state;
+    huffmanInitState(&state, sbufPtr(dst) + HEADER_SIZE + HUFFMAN_INFO_SIZE, codedDataSizeMax);
+    for (uint16_t offset = 0; offset < readLen; offset += DATAFLASH_COMPRESSION_READ_CHUNK_SIZE) {
+        const int chunkLen = MIN(readLen - offset, DATAFLASH_COMPRESSION_READ_CHUNK_SIZE);
+        if (flashfsReadAbs(address + offset, readBuffer, chunkLen) != chunkLen || !huffmanEncode(&state, &table, readBuffer, chunkLen)) {
+            return false;
+        }
+    }
+    if (!huffmanEncodeFinish(&state)) {
+        return false;
+    }
+
+    sbufWriteU16(dst, HUFFMAN_INFO_SIZE + state.bytesWritten);
+    sbufWriteU8(dst, DATAFLASH_COMPRESSION_HUFFMAN);
+    sbufWriteU16(dst, readLen);
+    huffmanPackCodeLengths(sbufPtr(dst), &table);
+    sbufAdvance(dst, HUFFMAN_CODE_LENGTHS_SIZE + state.bytesWritten);
+
+    return true;
+}
+#endif
+
+static void serializeDataflashReadReply(sbuf_t *dst, uint32_t address, const uint16_t size, bool useLegacyFormat, bool allowCompression)
 {
     BUILD_BUG_ON(MSP_PORT_DATAFLASH_INFO_SIZE < 16);
 
@@ -542,10 +631,20 @@ static void serializeDataflashReadReply(sbuf_t *dst, uint32_t address, const uin
         readLen = flashfsGetSize() - address;
     }
     sbufWriteU32(dst, address);
+
+#ifdef USE_HUFFMAN
+    // legacy format does not support compression
+    if (allowCompression && !useLegacyFormat && serializeDataflashCompressedData(dst, address, readLen)) {
+        return;
+    }
+#else
+    UNUSED(allowCompression);
+#endif
+
     if (!useLegacyFormat) {
         // new format supports variable read lengths
         sbufWriteU16(dst, readLen);
-        sbufWriteU8(dst, 0); // placeholder for compression format
+        sbufWriteU8(dst, DATAFLASH_COMPRESSION_NONE);
     }
 
     // bytesRead will equal readLen
@@ -566,7 +665,7 @@ static void serializeDataflashReadReply(sbuf_t *dst, uint32_t address, const uin
  * Returns true if the command was processd, false otherwise.
  * May set mspPostProcessFunc to a function to be called once the command has been processed
  */
-static bool mspCommonProcessOutCommand(uint8_t cmdMSP, sbuf_t *dst, mspPostProcessFnPtr *mspPostProcessFn)
+static bool mspCommonProcessOutCommand(uint16_t cmdMSP, sbuf_t *dst, mspPostProcessFnPtr *mspPostProcessFn)
 {
     switch (cmdMSP) {
     case MSP_API_VERSION:
@@ -824,7 +923,7 @@ static bool mspCommonProcessOutCommand(uint8_t cmdMSP, sbuf_t *dst, mspPostProce
 }
 
 #ifdef USE_OSD_SLAVE
-static bool mspOsdSlaveProcessOutCommand(uint8_t cmdMSP, sbuf_t *dst, mspPostProcessFnPtr *mspPostProcessFn)
+static bool mspOsdSlaveProcessOutCommand(uint16_t cmdMSP, sbuf_t *dst, mspPostProcessFnPtr *mspPostProcessFn)
 {
     UNUSED(mspPostProcessFn);
 
@@ -866,7 +965,7 @@ static bool mspOsdSlaveProcessOutCommand(uint8_t cmdMSP, sbuf_t *dst, mspPostPro
 #endif
 
 #ifndef USE_OSD_SLAVE
-static bool mspFcProcessOutCommand(uint8_t cmdMSP, sbuf_t *dst, mspPostProcessFnPtr *mspPostProcessFn)
+static bool mspFcProcessOutCommand(uint16_t cmdMSP, sbuf_t *dst, mspPostProcessFnPtr *mspPostProcessFn)
 {
     UNUSED(mspPostProcessFn);
 
@@ -1238,6 +1337,12 @@ static bool mspFcProcessOutCommand(uint8_t cmdMSP, sbuf_t *dst, mspPostProcessFn
         serializeSDCardSummaryReply(dst);
         break;
 
+#ifdef USE_SDCARD_LATENCY_STATS
+    case MSP_SDCARD_LATENCY:
+        serializeSDCardLatencyReply(dst);
+        break;
+#endif
+
     case MSP_MOTOR_3D_CONFIG:
         sbufWriteU16(dst, flight3DConfig()->deadband3d_low);
         sbufWriteU16(dst, flight3DConfig()->deadband3d_high);
@@ -1375,21 +1480,38 @@ static void mspFcDataFlashReadCommand(sbuf_t *dst, sbuf_t *src)
     const unsigned int dataSize = sbufBytesRemaining(src);
     const uint32_t readAddress = sbufReadU32(src);
     uint16_t readLength;
+    bool allowCompression = false;
     bool useLegacyFormat;
     if (dataSize >= sizeof(uint32_t) + sizeof(uint16_t)) {
         readLength = sbufReadU16(src);
+        if (sbufBytesRemaining(src)) {
+            allowCompression = sbufReadU8(src);
+        }
         useLegacyFormat = false;
     } else {
         readLength = 128;
         useLegacyFormat = true;
     }
 
-    serializeDataflashReadReply(dst, readAddress, readLength, useLegacyFormat);
+    serializeDataflashReadReply(dst, readAddress, readLength, useLegacyFormat, allowCompression);
+}
+
+static void mspFcDataFlashLogCommand(sbuf_t *dst, sbuf_t *src)
+{
+    const uint16_t logIndex = sbufBytesRemaining(src) >= sizeof(uint16_t) ? sbufReadU16(src) : 0;
+    flashfsLog_t log;
+
+    sbufWriteU16(dst, flashfsGetLogCount());
+    sbufWriteU16(dst, logIndex);
+    if (flashfsGetLog(logIndex, &log)) {
+        sbufWriteU32(dst, log.start);
+        sbufWriteU32(dst, log.end);
+    }
 }
 #endif
 
 #ifdef USE_OSD_SLAVE
-static mspResult_e mspOsdSlaveProcessInCommand(uint8_t cmdMSP, sbuf_t *src) {
+static mspResult_e mspOsdSlaveProcessInCommand(uint16_t cmdMSP, sbuf_t *src) {
     UNUSED(cmdMSP);
     UNUSED(src);
     return MSP_RESULT_ERROR;
@@ -1397,7 +1519,7 @@ static mspResult_e mspOsdSlaveProcessInCommand(uint8_t cmdMSP, sbuf_t *src) {
 #endif
 
 #ifndef USE_OSD_SLAVE
-static mspResult_e mspFcProcessInCommand(uint8_t cmdMSP, sbuf_t *src)
+static mspResult_e mspFcProcessInCommand(uint16_t cmdMSP, sbuf_t *src)
 {
     uint32_t i;
     uint8_t value;
@@ -1960,7 +2082,7 @@ static mspResult_e mspFcProcessInCommand(uint8_t cmdMSP, sbuf_t *src)
 }
 #endif
 
-static mspResult_e mspCommonProcessInCommand(uint8_t cmdMSP, sbuf_t *src)
+static mspResult_e mspCommonProcessInCommand(uint16_t cmdMSP, sbuf_t *src)
 {
     const unsigned int dataSize = sbufBytesRemaining(src);
     UNUSED(dataSize); // maybe unused due to compiler options
@@ -2132,7 +2254,7 @@ mspResult_e mspFcProcessCommand(mspPacket_t *cmd, mspPacket_t *reply, mspPostPro
     int ret = MSP_RESULT_ACK;
     sbuf_t *dst = &reply->buf;
     sbuf_t *src = &cmd->buf;
-    const uint8_t cmdMSP = cmd->cmd;
+    const uint16_t cmdMSP = cmd->cmd;
     // initialize reply by default
     reply->cmd = cmd->cmd;
 
@@ -2160,6 +2282,9 @@ mspResult_e mspFcProcessCommand(mspPacket_t *cmd, mspPacket_t *reply, mspPostPro
     } else if (cmdMSP == MSP_DATAFLASH_READ) {
         mspFcDataFlashReadCommand(dst, src);
         ret = MSP_RESULT_ACK;
+    } else if (cmdMSP == MSP_DATAFLASH_LOG) {
+        mspFcDataFlashLogCommand(dst, src);
+        ret = MSP_RESULT_ACK;
 #endif
     } else {
         ret = mspCommonProcessInCommand(cmdMSP, src);
@@ -2168,6 +2293,26 @@ mspResult_e mspFcProcessCommand(mspPacket_t *cmd, mspPacket_t *reply, mspPostPro
     return ret;
 }
 
+/*
+ * Serialize the reply to an out command for an MSP stream.
+ * Returns false for commands that aren't out commands, there is no request for them to read.
+ */
+bool mspFcProcessOutCommandForStream(uint16_t cmdMSP, sbuf_t *dst)
+{
+    if (mspCommonProcessOutCommand(cmdMSP, dst, NULL)) {
+        return true;
+#ifndef USE_OSD_SLAVE
+    } else if (mspFcProcessOutCommand(cmdMSP, dst, NULL)) {
+        return true;
+#endif
+#ifdef USE_OSD_SLAVE
+    } else if (mspOsdSlaveProcessOutCommand(cmdMSP, dst, NULL)) {
+        return true;
+#endif
+    }
+    return false;
+}
+
 void mspFcProcessReply(mspPacket_t *reply)
 {
     sbuf_t *src = &reply->buf;
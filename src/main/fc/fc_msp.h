@@ -33,5 +33,6 @@ void mspFcInit(void);
 void mspOsdSlaveInit(void);
 mspResult_e mspFcProcessCommand(mspPacket_t *cmd, mspPacket_t *reply, mspPostProcessFnPtr *mspPostProcessFn);
 void mspFcProcessReply(mspPacket_t *reply);
+bool mspFcProcessOutCommandForStream(uint16_t cmdMSP, sbuf_t *dst);
 
 void mspSerialProcessStreamSchedule(void);
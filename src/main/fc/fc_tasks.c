@@ -103,15 +103,13 @@ static void taskUpdateAccelerometer(timeUs_t currentTimeUs)
 #endif
 
 bool taskSerialCheck(timeUs_t currentTimeUs, timeDelta_t currentDeltaTimeUs) {
-    UNUSED(currentTimeUs);
     UNUSED(currentDeltaTimeUs);
 
-    return mspSerialWaiting();
+    return mspSerialWaiting() || mspSerialStreamDue(currentTimeUs);
 }
 
 static void taskHandleSerial(timeUs_t currentTimeUs)
 {
-    UNUSED(currentTimeUs);
 #ifdef USE_CLI
     // in cli mode, all serial stuff goes to here. enter cli mode by sending #
     if (cliMode) {
@@ -125,6 +123,7 @@ static void taskHandleSerial(timeUs_t currentTimeUs)
     bool evaluateMspData = osdSlaveIsLocked ?  MSP_SKIP_NON_MSP_DATA : MSP_EVALUATE_NON_MSP_DATA;;
 #endif
     mspSerialProcess(evaluateMspData, mspFcProcessCommand, mspFcProcessReply);
+    mspSerialProcessStreams(currentTimeUs, mspFcProcessOutCommandForStream);
 }
 
 void taskBatteryAlerts(timeUs_t currentTimeUs)
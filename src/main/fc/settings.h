@@ -56,6 +56,7 @@ typedef enum {
     TABLE_LOWPASS_TYPE,
     TABLE_FAILSAFE,
     TABLE_CRASH_RECOVERY,
+    TABLE_GYRO_FUSION,
 #ifdef OSD
     TABLE_OSD,
 #endif
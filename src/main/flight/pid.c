@@ -149,10 +149,10 @@ void pidStabilisationState(pidStabilisationState_e pidControllerState)
 
 const angle_index_t rcAliasToAngleIndexMap[] = { AI_ROLL, AI_PITCH };
 
-static filterApplyFnPtr dtermNotchFilterApplyFn;
-static void *dtermFilterNotch[2];
-static filterApplyFnPtr dtermLpfApplyFn;
-static void *dtermFilterLpf[2];
+// D-term notch and lowpass filters for roll and pitch, the yaw lane of the filter bank is unused
+static filterBank_t dtermFilterBank;
+static bool dtermLpfDenoise;
+static firFilterDenoise_t dtermLpfDenoiseState[2];
 static filterApplyFnPtr ptermYawFilterApplyFn;
 static void *ptermYawFilter;
 
@@ -160,10 +160,6 @@ void pidInitFilters(const pidProfile_t *pidProfile)
 {
     BUILD_BUG_ON(FD_YAW != 2); // only setting up Dterm filters on roll and pitch axes, so ensure yaw axis is 2
 
-    static biquadFilter_t biquadFilterNotch[2];
-    static pt1Filter_t pt1Filter[2];
-    static biquadFilter_t biquadFilter[2];
-    static firFilterDenoise_t denoisingFilter[2];
     static pt1Filter_t pt1FilterYaw;
 
     uint32_t pidFrequencyNyquist = (1.0f / dT) / 2; // No rounding needed
@@ -179,43 +175,36 @@ void pidInitFilters(const pidProfile_t *pidProfile)
         }
     }
 
-    if (!dTermNotchHz) {
-        dtermNotchFilterApplyFn = nullFilterApply;
-    } else {
-        dtermNotchFilterApplyFn = (filterApplyFnPtr)biquadFilterApply;
+    filterBankInit(&dtermFilterBank);
+    if (dTermNotchHz) {
+        biquadFilter_t notchFilter;
         const float notchQ = filterGetNotchQ(dTermNotchHz, pidProfile->dterm_notch_cutoff);
-        for (int axis = FD_ROLL; axis <= FD_PITCH; axis++) {
-            dtermFilterNotch[axis] = &biquadFilterNotch[axis];
-            biquadFilterInit(dtermFilterNotch[axis], dTermNotchHz, targetPidLooptime, notchQ, FILTER_NOTCH);
-        }
+        biquadFilterInit(&notchFilter, dTermNotchHz, targetPidLooptime, notchQ, FILTER_NOTCH);
+        filterBankAddBiquad(&dtermFilterBank, &notchFilter);
     }
 
-    if (pidProfile->dterm_lpf_hz == 0 || pidProfile->dterm_lpf_hz > pidFrequencyNyquist) {
-        dtermLpfApplyFn = nullFilterApply;
-    } else {
+    dtermLpfDenoise = false;
+    if (pidProfile->dterm_lpf_hz && pidProfile->dterm_lpf_hz <= pidFrequencyNyquist) {
         switch (pidProfile->dterm_filter_type) {
         default:
-            dtermLpfApplyFn = nullFilterApply;
             break;
-        case FILTER_PT1:
-            dtermLpfApplyFn = (filterApplyFnPtr)pt1FilterApply;
-            for (int axis = FD_ROLL; axis <= FD_PITCH; axis++) {
-                dtermFilterLpf[axis] = &pt1Filter[axis];
-                pt1FilterInit(dtermFilterLpf[axis], pidProfile->dterm_lpf_hz, dT);
-            }
+        case FILTER_PT1: {
+            pt1Filter_t pt1Filter;
+            pt1FilterInit(&pt1Filter, pidProfile->dterm_lpf_hz, dT);
+            filterBankAddPt1(&dtermFilterBank, &pt1Filter);
             break;
-        case FILTER_BIQUAD:
-            dtermLpfApplyFn = (filterApplyFnPtr)biquadFilterApply;
-            for (int axis = FD_ROLL; axis <= FD_PITCH; axis++) {
-                dtermFilterLpf[axis] = &biquadFilter[axis];
-                biquadFilterInitLPF(dtermFilterLpf[axis], pidProfile->dterm_lpf_hz, targetPidLooptime);
-            }
+        }
+        case FILTER_BIQUAD: {
+            biquadFilter_t biquadFilter;
+            biquadFilterInitLPF(&biquadFilter, pidProfile->dterm_lpf_hz, targetPidLooptime);
+            filterBankAddBiquad(&dtermFilterBank, &biquadFilter);
             break;
+        }
         case FILTER_FIR:
-            dtermLpfApplyFn = (filterApplyFnPtr)firFilterDenoiseUpdate;
+            dtermLpfDenoise = true;
+            memset(dtermLpfDenoiseState, 0, sizeof(dtermLpfDenoiseState));
             for (int axis = FD_ROLL; axis <= FD_PITCH; axis++) {
-                dtermFilterLpf[axis] = &denoisingFilter[axis];
-                firFilterDenoiseInit(dtermFilterLpf[axis], pidProfile->dterm_lpf_hz, targetPidLooptime);
+                firFilterDenoiseInit(&dtermLpfDenoiseState[axis], pidProfile->dterm_lpf_hz, targetPidLooptime);
             }
             break;
         }
@@ -379,6 +368,10 @@ void pidController(const pidProfile_t *pidProfile, const rollAndPitchTrims_t *an
     // Dynamic ki component to gradually scale back integration when above windup point
     const float dynKi = MIN((1.0f - motorMixRange) * ITermWindupPointInv, 1.0f);
 
+    // filter the D-term gyro rates for roll and pitch together
+    float dtermGyroRate[XYZ_AXIS_COUNT] = { gyro.gyroADCf[FD_ROLL], gyro.gyroADCf[FD_PITCH], 0.0f };
+    filterBankApply(&dtermFilterBank, dtermGyroRate);
+
     // ----------PID controller----------
     for (int axis = FD_ROLL; axis <= FD_YAW; axis++) {
         float currentPidSetpoint = getSetpointRate(axis);
@@ -433,8 +426,10 @@ void pidController(const pidProfile_t *pidProfile, const rollAndPitchTrims_t *an
         // -----calculate D component
         if (axis != FD_YAW) {
             // apply filters
-            float gyroRateFiltered = dtermNotchFilterApplyFn(dtermFilterNotch[axis], gyroRate);
-            gyroRateFiltered = dtermLpfApplyFn(dtermFilterLpf[axis], gyroRateFiltered);
+            float gyroRateFiltered = dtermGyroRate[axis];
+            if (dtermLpfDenoise) {
+                gyroRateFiltered = firFilterDenoiseUpdate(&dtermLpfDenoiseState[axis], gyroRateFiltered);
+            }
 
             float dynC = dtermSetpointWeight;
             if (pidProfile->setpointRelaxRatio < 100) {
@@ -27,7 +27,6 @@
 #include "asyncfatfs.h"
 
 #include "fat_standard.h"
-#include "drivers/sdcard.h"
 
 #ifdef AFATFS_DEBUG
     #define ONLY_EXPOSE_FOR_TESTING
@@ -35,7 +34,17 @@
     #define ONLY_EXPOSE_FOR_TESTING static
 #endif
 
+// Targets with RAM to spare can define a larger cache, of at most 255 sectors
+#ifndef AFATFS_NUM_CACHE_SECTORS
 #define AFATFS_NUM_CACHE_SECTORS 8
+#endif
+
+#if AFATFS_NUM_CACHE_SECTORS > 255
+#error "AFATFS_NUM_CACHE_SECTORS must be at most 255"
+#endif
+
+// Cached sectors are found through a hash table, consecutive sectors fall into consecutive buckets
+#define AFATFS_CACHE_HASH_BUCKETS (AFATFS_NUM_CACHE_SECTORS * 2)
 
 // FAT filesystems are allowed to differ from these parameters, but we choose not to support those weird filesystems:
 #define AFATFS_SECTOR_SIZE  512
@@ -191,6 +200,15 @@ typedef struct afatfsCacheBlockDescriptor_t {
      * is overridden by the locked and retainCount flags.
      */
     unsigned discardable:1;
+
+    // Set when the sectorIndex of this block has been entered into the cache hash table
+    unsigned hashed:1;
+
+    // Set when this block was read ahead, until the first caller asks for it
+    unsigned readAhead:1;
+
+    // The index + 1 of the next block in the same hash bucket, or zero at the end of the chain
+    uint8_t hashNext;
 } afatfsCacheBlockDescriptor_t;
 
 typedef enum {
@@ -424,6 +442,8 @@ typedef enum {
 } afatfsInitializationPhase_e;
 
 typedef struct afatfs_t {
+    const afatfsBlockDevice_t *blockDevice;
+
     fatFilesystemType_e filesystemType;
 
     afatfsFilesystemState_e filesystemState;
@@ -439,10 +459,15 @@ typedef struct afatfs_t {
 
     uint8_t cache[AFATFS_SECTOR_SIZE * AFATFS_NUM_CACHE_SECTORS];
     afatfsCacheBlockDescriptor_t cacheDescriptor[AFATFS_NUM_CACHE_SECTORS];
+    uint8_t cacheHash[AFATFS_CACHE_HASH_BUCKETS]; // The index + 1 of the first block in each bucket, zero if empty
     uint32_t cacheTimer;
 
     int cacheDirtyEntries; // The number of cache entries in the AFATFS_CACHE_STATE_DIRTY state
     bool cacheFlushInProgress;
+    uint32_t cacheFlushNextSector; // The sector which would continue the device's current multi-block write
+    uint32_t multiWriteBlocksRemain; // The blocks left in the device's pre-erased multi-block write, zero if none is open
+
+    afatfsCacheStats_t cacheStats;
 
     afatfsFile_t openFiles[AFATFS_MAX_OPEN_FILES];
 
@@ -602,9 +627,57 @@ static void afatfs_cacheSectorMarkDirty(afatfsCacheBlockDescriptor_t *descriptor
     }
 }
 
+/**
+ * Find the index of the cache entry which has been assigned to the given physical sector, or -1 if there isn't one.
+ * Note that the cached sector could be in any state including completely empty.
+ */
+static int afatfs_cacheHashFind(uint32_t sectorIndex)
+{
+    for (int entry = afatfs.cacheHash[sectorIndex % AFATFS_CACHE_HASH_BUCKETS]; entry; entry = afatfs.cacheDescriptor[entry - 1].hashNext) {
+        if (afatfs.cacheDescriptor[entry - 1].sectorIndex == sectorIndex) {
+            return entry - 1;
+        }
+    }
+
+    return -1;
+}
+
+static void afatfs_cacheHashRemove(int cacheIndex)
+{
+    afatfsCacheBlockDescriptor_t *descriptor = &afatfs.cacheDescriptor[cacheIndex];
+
+    if (!descriptor->hashed) {
+        return;
+    }
+
+    uint8_t *link = &afatfs.cacheHash[descriptor->sectorIndex % AFATFS_CACHE_HASH_BUCKETS];
+
+    while (*link != cacheIndex + 1) {
+        link = &afatfs.cacheDescriptor[*link - 1].hashNext;
+    }
+
+    *link = descriptor->hashNext;
+    descriptor->hashNext = 0;
+    descriptor->hashed = 0;
+}
+
+static void afatfs_cacheHashInsert(int cacheIndex)
+{
+    afatfsCacheBlockDescriptor_t *descriptor = &afatfs.cacheDescriptor[cacheIndex];
+    uint8_t *bucket = &afatfs.cacheHash[descriptor->sectorIndex % AFATFS_CACHE_HASH_BUCKETS];
+
+    descriptor->hashNext = *bucket;
+    descriptor->hashed = 1;
+    *bucket = cacheIndex + 1;
+}
+
 static void afatfs_cacheSectorInit(afatfsCacheBlockDescriptor_t *descriptor, uint32_t sectorIndex, bool locked)
 {
+    const int cacheIndex = descriptor - afatfs.cacheDescriptor;
+
+    afatfs_cacheHashRemove(cacheIndex);
     descriptor->sectorIndex = sectorIndex;
+    afatfs_cacheHashInsert(cacheIndex);
 
     descriptor->accessTimestamp = descriptor->writeTimestamp = ++afatfs.cacheTimer;
 
@@ -615,65 +688,84 @@ static void afatfs_cacheSectorInit(afatfsCacheBlockDescriptor_t *descriptor, uin
     descriptor->locked = locked;
     descriptor->retainCount = 0;
     descriptor->discardable = 0;
+    descriptor->readAhead = 0;
 }
 
 /**
- * Called by the SD card driver when one of our read operations completes.
+ * Called by the block device when one of our read operations completes.
  */
-static void afatfs_sdcardReadComplete(sdcardBlockOperation_e operation, uint32_t sectorIndex, uint8_t *buffer, uint32_t callbackData)
+static void afatfs_blockReadComplete(sdcardBlockOperation_e operation, uint32_t sectorIndex, uint8_t *buffer, uint32_t callbackData)
 {
     (void) operation;
     (void) callbackData;
 
-    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
-        if (afatfs.cacheDescriptor[i].state != AFATFS_CACHE_STATE_EMPTY
-            && afatfs.cacheDescriptor[i].sectorIndex == sectorIndex
-        ) {
-            if (buffer == NULL) {
-                // Read failed, mark the sector as empty and whoever asked for it will ask for it again later to retry
-                afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_EMPTY;
-            } else {
-                afatfs_assert(afatfs_cacheSectorGetMemory(i) == buffer && afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_READING);
+    const int i = afatfs_cacheHashFind(sectorIndex);
 
-                afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_IN_SYNC;
-            }
+    if (i > -1 && afatfs.cacheDescriptor[i].state != AFATFS_CACHE_STATE_EMPTY) {
+        if (buffer == NULL) {
+            // Read failed, mark the sector as empty and whoever asked for it will ask for it again later to retry
+            afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_EMPTY;
+        } else {
+            afatfs_assert(afatfs_cacheSectorGetMemory(i) == buffer && afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_READING);
 
-            break;
+            afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_IN_SYNC;
         }
     }
 }
 
 /**
- * Called by the SD card driver when one of our write operations completes.
+ * Called by the block device when one of our write operations completes.
  */
-static void afatfs_sdcardWriteComplete(sdcardBlockOperation_e operation, uint32_t sectorIndex, uint8_t *buffer, uint32_t callbackData)
+static void afatfs_blockWriteComplete(sdcardBlockOperation_e operation, uint32_t sectorIndex, uint8_t *buffer, uint32_t callbackData)
 {
     (void) operation;
     (void) callbackData;
 
     afatfs.cacheFlushInProgress = false;
 
-    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
-        /* Keep in mind that someone may have marked the sector as dirty after writing had already begun. In this case we must leave
-         * it marked as dirty because those modifications may have been made too late to make it to the disk!
-         */
-        if (afatfs.cacheDescriptor[i].sectorIndex == sectorIndex
-            && afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_WRITING
-        ) {
-            if (buffer == NULL) {
-                // Write failed, remark the sector as dirty
-                afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_DIRTY;
-                afatfs.cacheDirtyEntries++;
-            } else {
-                afatfs_assert(afatfs_cacheSectorGetMemory(i) == buffer);
+    if (buffer == NULL) {
+        // The device resets after a failed write, which ends any multi-block write
+        afatfs.multiWriteBlocksRemain = 0;
+    }
 
-                afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_IN_SYNC;
-            }
-            break;
+    const int i = afatfs_cacheHashFind(sectorIndex);
+
+    /* Keep in mind that someone may have marked the sector as dirty after writing had already begun. In this case we must leave
+     * it marked as dirty because those modifications may have been made too late to make it to the disk!
+     */
+    if (i > -1 && afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_WRITING) {
+        if (buffer == NULL) {
+            // Write failed, remark the sector as dirty
+            afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_DIRTY;
+            afatfs.cacheDirtyEntries++;
+        } else {
+            afatfs_assert(afatfs_cacheSectorGetMemory(i) == buffer);
+
+            afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_IN_SYNC;
         }
     }
 }
 
+static bool afatfs_cacheSectorIsFlushable(int cacheIndex)
+{
+    return afatfs.cacheDescriptor[cacheIndex].state == AFATFS_CACHE_STATE_DIRTY && !afatfs.cacheDescriptor[cacheIndex].locked;
+}
+
+/**
+ * Keep track of the device's multi-block write after the given sector has been handed to it.
+ */
+static void afatfs_cacheSectorWritten(uint32_t sectorIndex)
+{
+    if (afatfs.multiWriteBlocksRemain > 0 && sectorIndex == afatfs.cacheFlushNextSector) {
+        afatfs.multiWriteBlocksRemain--;
+    } else {
+        // Writing anywhere else ends the multi-block write
+        afatfs.multiWriteBlocksRemain = 0;
+    }
+
+    afatfs.cacheFlushNextSector = sectorIndex + 1;
+}
+
 /**
  * Attempt to flush the dirty cache entry with the given index to the SDcard.
  */
@@ -682,27 +774,41 @@ static void afatfs_cacheFlushSector(int cacheIndex)
     afatfsCacheBlockDescriptor_t *cacheDescriptor = &afatfs.cacheDescriptor[cacheIndex];
 
 #ifdef AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT
-    if (cacheDescriptor->consecutiveEraseBlockCount) {
-        sdcard_beginWriteBlocks(cacheDescriptor->sectorIndex, cacheDescriptor->consecutiveEraseBlockCount);
+    /*
+     * Only file data carries an erase hint. FAT and directory sectors are written a block at a time, since a pre-erased
+     * run which is cut short leaves the rest of its blocks undefined.
+     */
+    if (cacheDescriptor->consecutiveEraseBlockCount
+        && !(afatfs.multiWriteBlocksRemain > 0 && cacheDescriptor->sectorIndex == afatfs.cacheFlushNextSector)
+        && afatfs.blockDevice->beginWriteBlocks(cacheDescriptor->sectorIndex, cacheDescriptor->consecutiveEraseBlockCount) == SDCARD_OPERATION_SUCCESS
+    ) {
+        afatfs.multiWriteBlocksRemain = cacheDescriptor->consecutiveEraseBlockCount;
+        afatfs.cacheFlushNextSector = cacheDescriptor->sectorIndex;
     }
 #endif
 
-    switch (sdcard_writeBlock(cacheDescriptor->sectorIndex, afatfs_cacheSectorGetMemory(cacheIndex), afatfs_sdcardWriteComplete, 0)) {
+    switch (afatfs.blockDevice->writeBlock(cacheDescriptor->sectorIndex, afatfs_cacheSectorGetMemory(cacheIndex), afatfs_blockWriteComplete, 0)) {
         case SDCARD_OPERATION_IN_PROGRESS:
             // The card will call us back later when the buffer transmission finishes
             afatfs.cacheDirtyEntries--;
             cacheDescriptor->state = AFATFS_CACHE_STATE_WRITING;
             afatfs.cacheFlushInProgress = true;
+            afatfs_cacheSectorWritten(cacheDescriptor->sectorIndex);
             break;
 
         case SDCARD_OPERATION_SUCCESS:
             // Buffer is already transmitted
             afatfs.cacheDirtyEntries--;
             cacheDescriptor->state = AFATFS_CACHE_STATE_IN_SYNC;
+            afatfs_cacheSectorWritten(cacheDescriptor->sectorIndex);
             break;
 
-        case SDCARD_OPERATION_BUSY:
         case SDCARD_OPERATION_FAILURE:
+            // The device resets, which ends any multi-block write
+            afatfs.multiWriteBlocksRemain = 0;
+            break;
+
+        case SDCARD_OPERATION_BUSY:
         default:
             ;
     }
@@ -714,13 +820,9 @@ static void afatfs_cacheFlushSector(int cacheIndex)
  */
 static afatfsCacheBlockDescriptor_t* afatfs_findCacheSector(uint32_t sectorIndex)
 {
-    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
-        if (afatfs.cacheDescriptor[i].sectorIndex == sectorIndex) {
-            return &afatfs.cacheDescriptor[i];
-        }
-    }
+    int cacheIndex = afatfs_cacheHashFind(sectorIndex);
 
-    return NULL;
+    return cacheIndex > -1 ? &afatfs.cacheDescriptor[cacheIndex] : NULL;
 }
 
 /**
@@ -751,22 +853,24 @@ static int afatfs_allocateCacheSector(uint32_t sectorIndex)
         return -1;
     }
 
-    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
-        if (afatfs.cacheDescriptor[i].sectorIndex == sectorIndex) {
-            /*
-             * If the sector is actually empty then do a complete re-init of it just like the standard
-             * empty case. (Sectors marked as empty should be treated as if they don't have a block index assigned)
-             */
-            if (afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_EMPTY) {
-                emptyIndex = i;
-                break;
-            }
+    int cachedIndex = afatfs_cacheHashFind(sectorIndex);
 
+    if (cachedIndex > -1) {
+        /*
+         * If the sector is actually empty then do a complete re-init of it just like the standard
+         * empty case. (Sectors marked as empty should be treated as if they don't have a block index assigned)
+         */
+        if (afatfs.cacheDescriptor[cachedIndex].state == AFATFS_CACHE_STATE_EMPTY) {
+            emptyIndex = cachedIndex;
+        } else {
             // Bump the last access time
-            afatfs.cacheDescriptor[i].accessTimestamp = ++afatfs.cacheTimer;
-            return i;
+            afatfs.cacheDescriptor[cachedIndex].accessTimestamp = ++afatfs.cacheTimer;
+
+            return cachedIndex;
         }
+    }
 
+    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS && emptyIndex == -1; i++) {
         switch (afatfs.cacheDescriptor[i].state) {
             case AFATFS_CACHE_STATE_EMPTY:
                 emptyIndex = i;
@@ -811,12 +915,24 @@ static int afatfs_allocateCacheSector(uint32_t sectorIndex)
 bool afatfs_flush()
 {
     if (afatfs.cacheDirtyEntries > 0) {
-        // Flush the oldest flushable sector
+        /*
+         * Rather than strictly flushing in write-order, continue the multi-block write we're in the middle of if the
+         * next sector is ready, since breaking the write up makes the card stall to finish it off.
+         */
+        int nextSectorIndex = afatfs_cacheHashFind(afatfs.cacheFlushNextSector);
+
+        if (nextSectorIndex > -1 && afatfs_cacheSectorIsFlushable(nextSectorIndex)) {
+            afatfs_cacheFlushSector(nextSectorIndex);
+
+            return false;
+        }
+
+        // Otherwise flush the oldest flushable sector
         uint32_t earliestSectorTime = 0xFFFFFFFF;
         int earliestSectorIndex = -1;
 
         for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
-            if (afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_DIRTY && !afatfs.cacheDescriptor[i].locked
+            if (afatfs_cacheSectorIsFlushable(i)
                 && (earliestSectorIndex == -1 || afatfs.cacheDescriptor[i].writeTimestamp < earliestSectorTime)
             ) {
                 earliestSectorIndex = i;
@@ -916,8 +1032,9 @@ static afatfsOperationStatus_e afatfs_cacheSector(uint32_t physicalSectorIndex,
 
         case AFATFS_CACHE_STATE_EMPTY:
             if ((sectorFlags & AFATFS_CACHE_READ) != 0) {
-                if (sdcard_readBlock(physicalSectorIndex, afatfs_cacheSectorGetMemory(cacheSectorIndex), afatfs_sdcardReadComplete, 0)) {
+                if (afatfs.blockDevice->readBlock(physicalSectorIndex, afatfs_cacheSectorGetMemory(cacheSectorIndex), afatfs_blockReadComplete, 0)) {
                     afatfs.cacheDescriptor[cacheSectorIndex].state = AFATFS_CACHE_STATE_READING;
+                    afatfs.cacheStats.misses++;
                 }
                 return AFATFS_OPERATION_IN_PROGRESS;
             }
@@ -946,6 +1063,10 @@ static afatfsOperationStatus_e afatfs_cacheSector(uint32_t physicalSectorIndex,
             // Fall through
 
         case AFATFS_CACHE_STATE_DIRTY:
+            if ((sectorFlags & AFATFS_CACHE_READ) != 0 && afatfs.cacheDescriptor[cacheSectorIndex].readAhead) {
+                afatfs.cacheDescriptor[cacheSectorIndex].readAhead = 0;
+                afatfs.cacheStats.hits++;
+            }
             if ((sectorFlags & AFATFS_CACHE_LOCK) != 0) {
                 afatfs.cacheDescriptor[cacheSectorIndex].locked = 1;
             }
@@ -965,6 +1086,54 @@ static afatfsOperationStatus_e afatfs_cacheSector(uint32_t physicalSectorIndex,
     }
 }
 
+/**
+ * Start reading the given sector into the cache in anticipation of it being requested soon. This only happens if the
+ * device is idle and a cache entry is available which holds nothing of value (empty, or synced and discardable), so
+ * it never delays other operations. The sector with index inUseSectorIndex is never evicted to make room.
+ *
+ * Nothing is read while a multi-block write is open, since the read would end it.
+ */
+ONLY_EXPOSE_FOR_TESTING
+void afatfs_cacheReadAhead(uint32_t sectorIndex, uint32_t inUseSectorIndex)
+{
+    if (afatfs.multiWriteBlocksRemain > 0) {
+        return;
+    }
+
+    int cacheIndex = afatfs_cacheHashFind(sectorIndex);
+
+    if (cacheIndex > -1) {
+        if (afatfs.cacheDescriptor[cacheIndex].state != AFATFS_CACHE_STATE_EMPTY) {
+            return; // Already cached or on its way
+        }
+    } else {
+        for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
+            afatfsCacheBlockDescriptor_t *descriptor = &afatfs.cacheDescriptor[i];
+
+            if (descriptor->state == AFATFS_CACHE_STATE_EMPTY) {
+                cacheIndex = i;
+                break;
+            }
+            if (descriptor->state == AFATFS_CACHE_STATE_IN_SYNC && descriptor->discardable && !descriptor->locked
+                && descriptor->retainCount == 0 && descriptor->sectorIndex != inUseSectorIndex
+            ) {
+                cacheIndex = i;
+            }
+        }
+
+        if (cacheIndex == -1) {
+            return;
+        }
+    }
+
+    if (afatfs.blockDevice->readBlock(sectorIndex, afatfs_cacheSectorGetMemory(cacheIndex), afatfs_blockReadComplete, 0)) {
+        afatfs_cacheSectorInit(&afatfs.cacheDescriptor[cacheIndex], sectorIndex, false);
+        afatfs.cacheDescriptor[cacheIndex].state = AFATFS_CACHE_STATE_READING;
+        afatfs.cacheDescriptor[cacheIndex].discardable = 1;
+        afatfs.cacheDescriptor[cacheIndex].readAhead = 1;
+    }
+}
+
 /**
  * Parse the details out of the given MBR sector (512 bytes long). Return true if a compatible filesystem was found.
  */
@@ -1227,10 +1396,19 @@ static afatfsFindClusterStatus_e afatfs_findClusterWithCondition(afatfsClusterSe
         }
 #endif
 
-        afatfsOperationStatus_e status = afatfs_cacheSector(afatfs_fatSectorToPhysical(0, fatSectorIndex), &sector.bytes, AFATFS_CACHE_READ | AFATFS_CACHE_DISCARDABLE, 0);
+        uint32_t fatPhysicalSector = afatfs_fatSectorToPhysical(0, fatSectorIndex);
+        afatfsOperationStatus_e status = afatfs_cacheSector(fatPhysicalSector, &sector.bytes, AFATFS_CACHE_READ | AFATFS_CACHE_DISCARDABLE, 0);
 
         switch (status) {
             case AFATFS_OPERATION_SUCCESS:
+                /*
+                 * If we're searching from the start of this sector then the search is likely to be a long one, so have
+                 * the device fetch the next FAT sector while we search this one.
+                 */
+                if (fatSectorEntryIndex == 0 && fatSectorIndex + 1 < afatfs.fatSectors) {
+                    afatfs_cacheReadAhead(fatPhysicalSector + 1, fatPhysicalSector);
+                }
+
                 do {
                     uint32_t clusterNumber;
 
@@ -3496,7 +3674,7 @@ static void afatfs_initContinue()
 void afatfs_poll()
 {
     // Only attempt to continue FS operations if the card is present & ready, otherwise we would just be wasting time
-    if (sdcard_poll()) {
+    if (afatfs.blockDevice && afatfs.blockDevice->poll()) {
         afatfs_flush();
 
         switch (afatfs.filesystemState) {
@@ -3566,8 +3744,9 @@ afatfsError_e afatfs_getLastError()
     return afatfs.lastError;
 }
 
-void afatfs_init()
+void afatfs_init(const afatfsBlockDevice_t *blockDevice)
 {
+    afatfs.blockDevice = blockDevice;
     afatfs.filesystemState = AFATFS_FILESYSTEM_STATE_INITIALIZATION;
     afatfs.initPhase = AFATFS_INITIALIZATION_READ_MBR;
     afatfs.lastClusterAllocated = FAT_SMALLEST_LEGAL_CLUSTER_NUMBER;
@@ -3645,6 +3824,63 @@ bool afatfs_destroy(bool dirty)
     return true;
 }
 
+/**
+ * Get the number of sector reads which had already been read ahead when they were requested, and which had to wait
+ * for the device, since the filesystem was initialised.
+ */
+const afatfsCacheStats_t *afatfs_getCacheStats()
+{
+    return &afatfs.cacheStats;
+}
+
+#ifdef AFATFS_DEBUG
+/**
+ * Check the cache hash table and dirty entry count against the cache descriptors: every entry that has been given a
+ * sector can be found through its hash bucket, and the buckets hold nothing else.
+ *
+ * Returns the number of dirty entries, or -1 if the cache is inconsistent.
+ */
+int afatfs_cacheCheck()
+{
+    int hashedEntries = 0;
+    int dirtyEntries = 0;
+
+    for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
+        const afatfsCacheBlockDescriptor_t *descriptor = &afatfs.cacheDescriptor[i];
+
+        if (descriptor->hashed) {
+            hashedEntries++;
+
+            if (afatfs_cacheHashFind(descriptor->sectorIndex) != i) {
+                return -1;
+            }
+        } else if (descriptor->state != AFATFS_CACHE_STATE_EMPTY) {
+            return -1;
+        }
+
+        if (descriptor->state == AFATFS_CACHE_STATE_DIRTY) {
+            dirtyEntries++;
+        }
+    }
+
+    int chainedEntries = 0;
+
+    for (int bucket = 0; bucket < AFATFS_CACHE_HASH_BUCKETS; bucket++) {
+        for (int entry = afatfs.cacheHash[bucket]; entry; entry = afatfs.cacheDescriptor[entry - 1].hashNext) {
+            if (++chainedEntries > hashedEntries || afatfs.cacheDescriptor[entry - 1].sectorIndex % AFATFS_CACHE_HASH_BUCKETS != (uint32_t) bucket) {
+                return -1;
+            }
+        }
+    }
+
+    if (chainedEntries != hashedEntries || dirtyEntries != afatfs.cacheDirtyEntries) {
+        return -1;
+    }
+
+    return dirtyEntries;
+}
+#endif
+
 /**
  * Get a pessimistic estimate of the amount of buffer space that we have available to write to immediately.
  */
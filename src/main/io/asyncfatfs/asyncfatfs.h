@@ -22,6 +22,8 @@
 
 #include "fat_standard.h"
 
+#include "drivers/sdcard.h"
+
 typedef struct afatfsFile_t *afatfsFilePtr_t;
 
 typedef enum {
@@ -60,6 +62,24 @@ typedef enum {
 typedef void (*afatfsFileCallback_t)(afatfsFilePtr_t file);
 typedef void (*afatfsCallback_t)();
 
+/*
+ * The block device that the filesystem is stored on. Blocks are 512 bytes long and reads and writes complete
+ * asynchronously with the same semantics as the SD card driver (see sdcard.h), which is what the flight controller uses.
+ */
+typedef struct afatfsBlockDevice_s {
+    bool (*poll)(void); // Returns true if the device is ready to accept a new operation
+    bool (*readBlock)(uint32_t blockIndex, uint8_t *buffer, sdcard_operationCompleteCallback_c callback, uint32_t callbackData);
+    sdcardOperationStatus_e (*beginWriteBlocks)(uint32_t blockIndex, uint32_t blockCount);
+    sdcardOperationStatus_e (*writeBlock)(uint32_t blockIndex, uint8_t *buffer, sdcard_operationCompleteCallback_c callback, uint32_t callbackData);
+} afatfsBlockDevice_t;
+
+typedef struct afatfsCacheStats_s {
+    uint32_t hits;   // Sector reads that had been read ahead by the time they were requested
+    uint32_t misses; // Sector reads that had to wait for the device to read the sector
+} afatfsCacheStats_t;
+
+extern const afatfsBlockDevice_t afatfsSdcardBlockDevice;
+
 bool afatfs_fopen(const char *filename, const char *mode, afatfsFileCallback_t complete);
 bool afatfs_ftruncate(afatfsFilePtr_t file, afatfsFileCallback_t callback);
 bool afatfs_fclose(afatfsFilePtr_t file, afatfsCallback_t callback);
@@ -80,7 +100,7 @@ afatfsOperationStatus_e afatfs_findNext(afatfsFilePtr_t directory, afatfsFinder_
 void afatfs_findLast(afatfsFilePtr_t directory);
 
 bool afatfs_flush();
-void afatfs_init();
+void afatfs_init(const afatfsBlockDevice_t *blockDevice);
 bool afatfs_destroy(bool dirty);
 void afatfs_poll();
 
@@ -88,5 +108,7 @@ uint32_t afatfs_getFreeBufferSpace();
 uint32_t afatfs_getContiguousFreeSpace();
 bool afatfs_isFull();
 
+const afatfsCacheStats_t *afatfs_getCacheStats();
+
 afatfsFilesystemState_e afatfs_getFilesystemState();
 afatfsError_e afatfs_getLastError();
@@ -0,0 +1,366 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "platform.h"
+
+#include "asyncfatfs_image.h"
+
+#include "fat_standard.h"
+
+#define AFATFS_IMAGE_BLOCK_SIZE 512
+
+// The layout that a PC would use when formatting a card as FAT32
+#define AFATFS_IMAGE_PARTITION_START_SECTOR 2048
+#define AFATFS_IMAGE_RESERVED_SECTORS       32
+#define AFATFS_IMAGE_NUM_FATS               2
+#define AFATFS_IMAGE_ROOT_CLUSTER           2
+
+#define FAT32_FSINFO_LEAD_SIGNATURE   0x41615252
+#define FAT32_FSINFO_STRUCT_SIGNATURE 0x61417272
+#define FAT32_FSINFO_TRAIL_SIGNATURE  0xAA550000
+
+typedef struct afatfsImagePendingOperation_s {
+    bool active;
+    sdcardBlockOperation_e operation;
+    uint32_t blockIndex;
+    uint8_t *buffer;
+    sdcard_operationCompleteCallback_c callback;
+    uint32_t callbackData;
+    uint64_t completeAtUs;
+} afatfsImagePendingOperation_t;
+
+static struct {
+    int fd;
+    uint32_t numBlocks;
+    afatfsImageConfig_t config;
+    afatfsImagePendingOperation_t pending;
+    afatfsImageStats_t stats;
+
+    // The multi-block write in progress, if multiWriteBlocksRemain is non-zero
+    uint32_t multiWriteNextBlock;
+    uint32_t multiWriteBlocksRemain;
+    bool multiWriteStreaming; // Set once the first block of the multi-block write has been written
+} image = { .fd = -1 };
+
+static uint64_t afatfsImageMicros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void writeLE16(uint8_t *dst, uint16_t value)
+{
+    dst[0] = value & 0xFF;
+    dst[1] = value >> 8;
+}
+
+static void writeLE32(uint8_t *dst, uint32_t value)
+{
+    writeLE16(dst, value & 0xFFFF);
+    writeLE16(dst + 2, value >> 16);
+}
+
+static bool afatfsImageWriteSector(int fd, uint32_t sectorIndex, const uint8_t *sector)
+{
+    return pwrite(fd, sector, AFATFS_IMAGE_BLOCK_SIZE, (off_t)sectorIndex * AFATFS_IMAGE_BLOCK_SIZE) == AFATFS_IMAGE_BLOCK_SIZE;
+}
+
+/**
+ * Create a new image file of the given size which holds an MBR with a single empty FAT32 partition. Any existing file
+ * is overwritten. The image is created sparse so only the filesystem structures occupy space on the host.
+ *
+ * The volume must hold more than FAT16_MAX_CLUSTERS clusters to be recognised as FAT32, e.g. 512MB with 4kB clusters.
+ */
+bool afatfsImageFormat(const char *filename, uint32_t sizeMB, uint8_t sectorsPerCluster)
+{
+    const uint32_t totalSectors = sizeMB * (1024 * 1024 / AFATFS_IMAGE_BLOCK_SIZE);
+
+    if (totalSectors <= AFATFS_IMAGE_PARTITION_START_SECTOR + AFATFS_IMAGE_RESERVED_SECTORS || sectorsPerCluster == 0) {
+        return false;
+    }
+
+    const uint32_t partitionSectors = totalSectors - AFATFS_IMAGE_PARTITION_START_SECTOR;
+
+    // Size the FATs for every sector being a cluster, then trim the cluster count to what is left over after the FATs
+    const uint32_t fatEntriesPerSector = AFATFS_IMAGE_BLOCK_SIZE / sizeof(uint32_t);
+    const uint32_t fatSectors = ((partitionSectors - AFATFS_IMAGE_RESERVED_SECTORS) / sectorsPerCluster + 2 + fatEntriesPerSector - 1) / fatEntriesPerSector;
+    const uint32_t numClusters = (partitionSectors - AFATFS_IMAGE_RESERVED_SECTORS - AFATFS_IMAGE_NUM_FATS * fatSectors) / sectorsPerCluster;
+
+    if (numClusters <= FAT16_MAX_CLUSTERS) {
+        return false;
+    }
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = ftruncate(fd, (off_t)totalSectors * AFATFS_IMAGE_BLOCK_SIZE) == 0;
+
+    uint8_t sector[AFATFS_IMAGE_BLOCK_SIZE];
+
+    // MBR
+    memset(sector, 0, sizeof(sector));
+    mbrPartitionEntry_t partition;
+    memset(&partition, 0, sizeof(partition));
+    partition.type = MBR_PARTITION_TYPE_FAT32_LBA;
+    partition.lbaBegin = AFATFS_IMAGE_PARTITION_START_SECTOR;
+    partition.numSectors = partitionSectors;
+    memcpy(sector + 446, &partition, sizeof(partition));
+    sector[510] = FAT_VOLUME_ID_SIGNATURE_1;
+    sector[511] = FAT_VOLUME_ID_SIGNATURE_2;
+    ok = ok && afatfsImageWriteSector(fd, 0, sector);
+
+    // Volume ID, written to the boot sector and to its backup
+    memset(sector, 0, sizeof(sector));
+    fatVolumeID_t *volume = (fatVolumeID_t *) sector;
+    volume->jmpBoot[0] = 0xEB;
+    volume->jmpBoot[1] = 0x58;
+    volume->jmpBoot[2] = 0x90;
+    memcpy(volume->oemName, "MSWIN4.1", sizeof(volume->oemName));
+    volume->bytesPerSector = AFATFS_IMAGE_BLOCK_SIZE;
+    volume->sectorsPerCluster = sectorsPerCluster;
+    volume->reservedSectorCount = AFATFS_IMAGE_RESERVED_SECTORS;
+    volume->numFATs = AFATFS_IMAGE_NUM_FATS;
+    volume->media = 0xF8;
+    volume->sectorsPerTrack = 63;
+    volume->numHeads = 255;
+    volume->hiddenSectors = AFATFS_IMAGE_PARTITION_START_SECTOR;
+    volume->totalSectors32 = partitionSectors;
+    volume->fatDescriptor.fat32.FATSize32 = fatSectors;
+    volume->fatDescriptor.fat32.rootCluster = AFATFS_IMAGE_ROOT_CLUSTER;
+    volume->fatDescriptor.fat32.fsInfo = 1;
+    volume->fatDescriptor.fat32.backupBootSector = 6;
+    volume->fatDescriptor.fat32.driveNumber = 0x80;
+    volume->fatDescriptor.fat32.bootSignature = 0x29;
+    volume->fatDescriptor.fat32.volumeID = 0x20151201;
+    memcpy(volume->fatDescriptor.fat32.volumeLabel, "NO NAME    ", sizeof(volume->fatDescriptor.fat32.volumeLabel));
+    memcpy(volume->fatDescriptor.fat32.fileSystemType, "FAT32   ", sizeof(volume->fatDescriptor.fat32.fileSystemType));
+    sector[510] = FAT_VOLUME_ID_SIGNATURE_1;
+    sector[511] = FAT_VOLUME_ID_SIGNATURE_2;
+    ok = ok && afatfsImageWriteSector(fd, AFATFS_IMAGE_PARTITION_START_SECTOR, sector);
+    ok = ok && afatfsImageWriteSector(fd, AFATFS_IMAGE_PARTITION_START_SECTOR + 6, sector);
+
+    // FSInfo, with the free cluster count and next free cluster left unknown
+    memset(sector, 0, sizeof(sector));
+    writeLE32(sector, FAT32_FSINFO_LEAD_SIGNATURE);
+    writeLE32(sector + 484, FAT32_FSINFO_STRUCT_SIGNATURE);
+    writeLE32(sector + 488, 0xFFFFFFFF);
+    writeLE32(sector + 492, 0xFFFFFFFF);
+    writeLE32(sector + 508, FAT32_FSINFO_TRAIL_SIGNATURE);
+    ok = ok && afatfsImageWriteSector(fd, AFATFS_IMAGE_PARTITION_START_SECTOR + 1, sector);
+
+    // Reserved FAT entries followed by the end of the (single cluster) root directory chain, the rest of the FAT is free
+    memset(sector, 0, sizeof(sector));
+    writeLE32(sector, 0x0FFFFFF8);
+    writeLE32(sector + 4, 0x0FFFFFFF);
+    writeLE32(sector + AFATFS_IMAGE_ROOT_CLUSTER * sizeof(uint32_t), 0x0FFFFFFF);
+    for (int i = 0; i < AFATFS_IMAGE_NUM_FATS; i++) {
+        ok = ok && afatfsImageWriteSector(fd, AFATFS_IMAGE_PARTITION_START_SECTOR + AFATFS_IMAGE_RESERVED_SECTORS + i * fatSectors, sector);
+    }
+
+    return close(fd) == 0 && ok;
+}
+
+/**
+ * Open an existing image to serve as the afatfsImageBlockDevice.
+ */
+bool afatfsImageOpen(const char *filename, const afatfsImageConfig_t *config)
+{
+    afatfsImageClose();
+
+    image.fd = open(filename, O_RDWR);
+    if (image.fd < 0) {
+        return false;
+    }
+
+    const off_t size = lseek(image.fd, 0, SEEK_END);
+    if (size < AFATFS_IMAGE_BLOCK_SIZE) {
+        afatfsImageClose();
+        return false;
+    }
+
+    image.numBlocks = size / AFATFS_IMAGE_BLOCK_SIZE;
+    image.config = *config;
+
+    return true;
+}
+
+/**
+ * Close the image. Any operation still in progress is abandoned without calling back.
+ */
+void afatfsImageClose(void)
+{
+    if (image.fd >= 0) {
+        close(image.fd);
+    }
+
+    memset(&image, 0, sizeof(image));
+    image.fd = -1;
+}
+
+const afatfsImageStats_t *afatfsImageGetStats(void)
+{
+    return &image.stats;
+}
+
+static void afatfsImageBeginOperation(sdcardBlockOperation_e operation, uint32_t blockIndex, uint8_t *buffer,
+    sdcard_operationCompleteCallback_c callback, uint32_t callbackData)
+{
+    uint32_t latencyUs = image.config.blockLatencyUs;
+
+    if (operation == SDCARD_BLOCK_OPERATION_WRITE) {
+        image.stats.blocksWritten++;
+
+        // The first block of a multi-block write pays for the command, the rest of them are streamed
+        if (image.multiWriteBlocksRemain && blockIndex == image.multiWriteNextBlock) {
+            if (image.multiWriteStreaming) {
+                latencyUs = image.config.multipleBlockLatencyUs;
+                image.stats.multipleBlockWriteBlocks++;
+            }
+            image.multiWriteStreaming = true;
+            image.multiWriteNextBlock++;
+            image.multiWriteBlocksRemain--;
+        } else {
+            // Writing anywhere else ends the multi-block write
+            image.multiWriteBlocksRemain = 0;
+        }
+
+        if (image.config.stallIntervalBlocks && image.stats.blocksWritten % image.config.stallIntervalBlocks == 0) {
+            latencyUs = image.config.stallUs;
+        }
+    } else {
+        image.stats.blocksRead++;
+        image.multiWriteBlocksRemain = 0;
+    }
+
+    image.pending.active = true;
+    image.pending.operation = operation;
+    image.pending.blockIndex = blockIndex;
+    image.pending.buffer = buffer;
+    image.pending.callback = callback;
+    image.pending.callbackData = callbackData;
+    image.pending.completeAtUs = afatfsImageMicros() + latencyUs;
+}
+
+/**
+ * Complete the pending operation once its latency has elapsed. Like the SD card, the contents of a write buffer are
+ * only consumed when the operation completes, so the caller must not modify it in the meantime.
+ *
+ * Returns true if the device is ready to accept a new operation.
+ */
+static bool afatfsImagePoll(void)
+{
+    if (image.fd < 0) {
+        return false;
+    }
+
+    if (!image.pending.active) {
+        return true;
+    }
+
+    if (afatfsImageMicros() < image.pending.completeAtUs) {
+        return false;
+    }
+
+    afatfsImagePendingOperation_t operation = image.pending;
+    const off_t offset = (off_t)operation.blockIndex * AFATFS_IMAGE_BLOCK_SIZE;
+    bool success = operation.blockIndex < image.numBlocks;
+
+    if (success) {
+        if (operation.operation == SDCARD_BLOCK_OPERATION_READ) {
+            success = pread(image.fd, operation.buffer, AFATFS_IMAGE_BLOCK_SIZE, offset) == AFATFS_IMAGE_BLOCK_SIZE;
+        } else {
+            success = pwrite(image.fd, operation.buffer, AFATFS_IMAGE_BLOCK_SIZE, offset) == AFATFS_IMAGE_BLOCK_SIZE;
+        }
+    }
+
+    // Clear the operation before calling back so that the callback may begin a new one
+    image.pending.active = false;
+
+    if (operation.callback) {
+        operation.callback(operation.operation, operation.blockIndex, success ? operation.buffer : NULL, operation.callbackData);
+    }
+
+    return !image.pending.active;
+}
+
+static bool afatfsImageReadBlock(uint32_t blockIndex, uint8_t *buffer, sdcard_operationCompleteCallback_c callback, uint32_t callbackData)
+{
+    if (image.fd < 0 || image.pending.active) {
+        return false;
+    }
+
+    afatfsImageBeginOperation(SDCARD_BLOCK_OPERATION_READ, blockIndex, buffer, callback, callbackData);
+
+    return true;
+}
+
+/**
+ * Begin a multi-block write of blockCount blocks, unless the call continues the multi-block write in progress (like the
+ * SD card driver).
+ */
+static sdcardOperationStatus_e afatfsImageBeginWriteBlocks(uint32_t blockIndex, uint32_t blockCount)
+{
+    if (image.fd < 0) {
+        return SDCARD_OPERATION_FAILURE;
+    }
+    if (image.pending.active) {
+        return SDCARD_OPERATION_BUSY;
+    }
+
+    if (image.multiWriteBlocksRemain == 0 || blockIndex != image.multiWriteNextBlock) {
+        image.multiWriteNextBlock = blockIndex;
+        image.multiWriteBlocksRemain = blockCount;
+        image.multiWriteStreaming = false;
+        image.stats.multipleBlockWrites++;
+    }
+
+    return SDCARD_OPERATION_SUCCESS;
+}
+
+static sdcardOperationStatus_e afatfsImageWriteBlock(uint32_t blockIndex, uint8_t *buffer, sdcard_operationCompleteCallback_c callback, uint32_t callbackData)
+{
+    if (image.fd < 0) {
+        return SDCARD_OPERATION_FAILURE;
+    }
+    if (image.pending.active) {
+        return SDCARD_OPERATION_BUSY;
+    }
+
+    afatfsImageBeginOperation(SDCARD_BLOCK_OPERATION_WRITE, blockIndex, buffer, callback, callbackData);
+
+    return SDCARD_OPERATION_IN_PROGRESS;
+}
+
+const afatfsBlockDevice_t afatfsImageBlockDevice = {
+    .poll = afatfsImagePoll,
+    .readBlock = afatfsImageReadBlock,
+    .beginWriteBlocks = afatfsImageBeginWriteBlocks,
+    .writeBlock = afatfsImageWriteBlock,
+};
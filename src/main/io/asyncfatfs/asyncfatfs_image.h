@@ -0,0 +1,51 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "asyncfatfs.h"
+
+/*
+ * A block device for asyncfatfs that is backed by a disk image file on the host, for benchmarks and simulation.
+ * Every block operation is delayed by the configured latency so that the filesystem sees a device which is as slow as
+ * a real SD card.
+ */
+
+typedef struct afatfsImageConfig_s {
+    uint32_t blockLatencyUs;      // Time taken by every block read, and by block writes outside a multi-block write
+    uint32_t multipleBlockLatencyUs; // Time taken by the second and later blocks of a multi-block write
+    uint32_t stallIntervalBlocks; // Every this many block writes, one write takes stallUs instead (0 disables stalls)
+    uint32_t stallUs;             // Models the card's internal housekeeping, which stalls writes for tens of milliseconds
+} afatfsImageConfig_t;
+
+typedef struct afatfsImageStats_s {
+    uint32_t blocksRead;
+    uint32_t blocksWritten;
+    uint32_t multipleBlockWrites;      // Number of multi-block writes begun by the filesystem
+    uint32_t multipleBlockWriteBlocks; // Number of blocks written as the continuation of a multi-block write
+} afatfsImageStats_t;
+
+bool afatfsImageFormat(const char *filename, uint32_t sizeMB, uint8_t sectorsPerCluster);
+bool afatfsImageOpen(const char *filename, const afatfsImageConfig_t *config);
+void afatfsImageClose(void);
+
+const afatfsImageStats_t *afatfsImageGetStats(void);
+
+extern const afatfsBlockDevice_t afatfsImageBlockDevice;
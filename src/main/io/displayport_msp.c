@@ -24,12 +24,14 @@
 
 #ifdef USE_MSP_DISPLAYPORT
 
+#include "common/maths.h"
 #include "common/utils.h"
 
 #include "config/parameter_group.h"
 #include "config/parameter_group_ids.h"
 
 #include "drivers/display.h"
+#include "drivers/time.h"
 
 #include "fc/fc_msp.h"
 
@@ -41,8 +43,30 @@
 // no template required since defaults are zero
 PG_REGISTER(displayPortProfile_t, displayPortProfileMsp, PG_DISPLAY_PORT_MSP_CONFIG, 0);
 
+#define MSP_OSD_MAX_STRING_LENGTH 30 // FIXME move this
+
+#define MSP_DISPLAYPORT_MAX_ROWS 16
+#define MSP_DISPLAYPORT_MAX_COLS 32
+
+// mspSerialPush() counts a frame as the largest header, the payload and the checksum, so a write of n chars is
+// n + 13 bytes (8 + 4 + 1). Changed chars closer than this on a row are sent together.
+#define MSP_DISPLAYPORT_WRITE_OVERHEAD 13
+// A frame with just a subcommand
+#define MSP_DISPLAYPORT_SUBCMD_FRAME_SIZE 10
+
+// Send the whole screen again this often, in case the other end lost it
+#define MSP_DISPLAYPORT_FULL_RESYNC_INTERVAL_MS 2000
+
 static displayPort_t mspDisplayPort;
 
+// What's been written and what's been sent. Writes only go into the screen buffer, drawScreen() sends the changes.
+static uint8_t screenBuffer[MSP_DISPLAYPORT_MAX_ROWS][MSP_DISPLAYPORT_MAX_COLS];
+static uint8_t sentBuffer[MSP_DISPLAYPORT_MAX_ROWS][MSP_DISPLAYPORT_MAX_COLS];
+static uint16_t dirtyRows;
+static bool sentBufferValid;
+static bool drawPending;
+static timeMs_t lastFullResyncMs;
+
 #ifdef USE_CLI
 extern uint8_t cliMode;
 #endif
@@ -60,10 +84,22 @@ static int output(displayPort_t *displayPort, uint8_t cmd, uint8_t *buf, int len
     return mspSerialPush(cmd, buf, len, MSP_DIRECTION_REPLY);
 }
 
+// The other end's screen isn't known, so send all of it on the next drawScreen()
+static void invalidateSentBuffer(void)
+{
+    sentBufferValid = false;
+    dirtyRows = 0xFFFF;
+    lastFullResyncMs = millis();
+}
+
 static int heartbeat(displayPort_t *displayPort)
 {
     uint8_t subcmd[] = { 0 };
 
+    if (millis() - lastFullResyncMs > MSP_DISPLAYPORT_FULL_RESYNC_INTERVAL_MS) {
+        invalidateSentBuffer();
+    }
+
     // heartbeat is used to:
     // a) ensure display is not released by MW OSD software
     // b) prevent OSD Slave boards from displaying a 'disconnected' status.
@@ -72,6 +108,7 @@ static int heartbeat(displayPort_t *displayPort)
 
 static int grab(displayPort_t *displayPort)
 {
+    invalidateSentBuffer();
     return heartbeat(displayPort);
 }
 
@@ -79,20 +116,125 @@ static int release(displayPort_t *displayPort)
 {
     uint8_t subcmd[] = { 1 };
 
+    invalidateSentBuffer();
     return output(displayPort, MSP_DISPLAYPORT, subcmd, sizeof(subcmd));
 }
 
 static int clearScreen(displayPort_t *displayPort)
 {
-    uint8_t subcmd[] = { 2 };
+    for (int row = 0; row < displayPort->rows; row++) {
+        memset(screenBuffer[row], ' ', displayPort->cols);
+    }
+    dirtyRows = 0xFFFF;
 
-    return output(displayPort, MSP_DISPLAYPORT, subcmd, sizeof(subcmd));
+    return 0;
 }
 
+/*
+ * Send the chars from col to the end of the span of changed chars that starts there, with the unchanged chars in
+ * between changes that are close together. Returns the number of bytes written, 0 if the span didn't fit in the
+ * room left.
+ */
+static int writeSpan(displayPort_t *displayPort, uint8_t row, uint8_t col, uint8_t *endCol, int room)
+{
+    uint8_t end = col + 1;
+    for (uint8_t c = end; c < displayPort->cols && c - col < MSP_OSD_MAX_STRING_LENGTH; c++) {
+        if (c - end >= MSP_DISPLAYPORT_WRITE_OVERHEAD) {
+            break;
+        }
+        if (screenBuffer[row][c] != sentBuffer[row][c]) {
+            end = c + 1;
+        }
+    }
+
+    const int len = end - col;
+    if (len + MSP_DISPLAYPORT_WRITE_OVERHEAD > room) {
+        return 0;
+    }
+
+    uint8_t buf[MSP_OSD_MAX_STRING_LENGTH + 4];
+    buf[0] = 3;
+    buf[1] = row;
+    buf[2] = col;
+    buf[3] = 0;
+    memcpy(&buf[4], &screenBuffer[row][col], len);
+
+    const int written = output(displayPort, MSP_DISPLAYPORT, buf, len + 4);
+    if (written) {
+        memcpy(&sentBuffer[row][col], &screenBuffer[row][col], len);
+    }
+    *endCol = end;
+    return written;
+}
+
+/*
+ * Send the rows that changed, as few writes as there are spans of changes on them, and as many as there's room for in
+ * the serial port. What doesn't fit is sent on the next call, and the other end is only told to draw once all of it
+ * has been sent, so it doesn't show half a screen.
+ */
 static int drawScreen(displayPort_t *displayPort)
 {
-    uint8_t subcmd[] = { 4 };
-    return output(displayPort, MSP_DISPLAYPORT, subcmd, sizeof(subcmd));
+    // Every frame goes to all the MSP ports, so only as much is sent as fits in the one with the least room
+    const uint32_t bytesFree = mspSerialTxBytesFree();
+    if (bytesFree < MSP_DISPLAYPORT_SUBCMD_FRAME_SIZE * 2) {
+        return 0;
+    }
+    int room = MIN(bytesFree, (uint32_t)INT32_MAX); // UINT32_MAX when there are no MSP ports
+    room -= MSP_DISPLAYPORT_SUBCMD_FRAME_SIZE; // for the draw
+
+    int written = 0;
+
+    if (!sentBufferValid) {
+        uint8_t subcmd[] = { 2 };
+        written = output(displayPort, MSP_DISPLAYPORT, subcmd, sizeof(subcmd));
+        if (!written) {
+            return 0;
+        }
+        room -= written;
+        memset(sentBuffer, ' ', sizeof(sentBuffer));
+        sentBufferValid = true;
+        drawPending = true;
+    }
+
+    uint8_t row;
+    for (row = 0; row < displayPort->rows; row++) {
+        if (!(dirtyRows & (1 << row))) {
+            continue;
+        }
+
+        bool rowSent = true;
+        for (uint8_t col = 0; col < displayPort->cols; col++) {
+            if (screenBuffer[row][col] == sentBuffer[row][col]) {
+                continue;
+            }
+            uint8_t endCol;
+            const int spanWritten = writeSpan(displayPort, row, col, &endCol, room);
+            if (!spanWritten) {
+                rowSent = false;
+                break;
+            }
+            written += spanWritten;
+            room -= spanWritten;
+            drawPending = true;
+            col = endCol - 1;
+        }
+
+        if (!rowSent) {
+            break;
+        }
+        dirtyRows &= ~(1 << row);
+    }
+    if (row == displayPort->rows) {
+        dirtyRows = 0;
+    }
+
+    if (drawPending && !dirtyRows) {
+        uint8_t subcmd[] = { 4 };
+        written += output(displayPort, MSP_DISPLAYPORT, subcmd, sizeof(subcmd));
+        drawPending = false;
+    }
+
+    return written;
 }
 
 static int screenSize(const displayPort_t *displayPort)
@@ -102,21 +244,16 @@ static int screenSize(const displayPort_t *displayPort)
 
 static int write(displayPort_t *displayPort, uint8_t col, uint8_t row, const char *string)
 {
-#define MSP_OSD_MAX_STRING_LENGTH 30 // FIXME move this
-    uint8_t buf[MSP_OSD_MAX_STRING_LENGTH + 4];
-
-    int len = strlen(string);
-    if (len >= MSP_OSD_MAX_STRING_LENGTH) {
-        len = MSP_OSD_MAX_STRING_LENGTH;
+    if (row >= displayPort->rows) {
+        return 0;
     }
 
-    buf[0] = 3;
-    buf[1] = row;
-    buf[2] = col;
-    buf[3] = 0;
-    memcpy(&buf[4], string, len);
+    for (; *string && col < displayPort->cols; string++, col++) {
+        screenBuffer[row][col] = *string;
+    }
+    dirtyRows |= 1 << row;
 
-    return output(displayPort, MSP_DISPLAYPORT, buf, len + 4);
+    return 0;
 }
 
 static int writeChar(displayPort_t *displayPort, uint8_t col, uint8_t row, uint8_t c)
@@ -125,7 +262,7 @@ static int writeChar(displayPort_t *displayPort, uint8_t col, uint8_t row, uint8
 
     buf[0] = c;
     buf[1] = 0;
-    return write(displayPort, col, row, buf); //!!TODO - check if there is a direct MSP command to do this
+    return write(displayPort, col, row, buf);
 }
 
 static bool isTransferInProgress(const displayPort_t *displayPort)
@@ -136,8 +273,9 @@ static bool isTransferInProgress(const displayPort_t *displayPort)
 
 static void resync(displayPort_t *displayPort)
 {
-    displayPort->rows = 13 + displayPortProfileMsp()->rowAdjust; // XXX Will reflect NTSC/PAL in the future
-    displayPort->cols = 30 + displayPortProfileMsp()->colAdjust;
+    displayPort->rows = MIN(13 + displayPortProfileMsp()->rowAdjust, MSP_DISPLAYPORT_MAX_ROWS); // XXX Will reflect NTSC/PAL in the future
+    displayPort->cols = MIN(30 + displayPortProfileMsp()->colAdjust, MSP_DISPLAYPORT_MAX_COLS);
+    invalidateSentBuffer();
 }
 
 static uint32_t txBytesFree(const displayPort_t *displayPort)
@@ -164,6 +302,7 @@ displayPort_t *displayPortMspInit(void)
 {
     displayInit(&mspDisplayPort, &mspDisplayPortVTable);
     resync(&mspDisplayPort);
+    clearScreen(&mspDisplayPort);
     return &mspDisplayPort;
 }
 #endif // USE_MSP_DISPLAYPORT
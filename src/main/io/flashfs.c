@@ -31,13 +31,33 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 
+#include "common/maths.h"
+#include "common/utils.h"
+
 #include "drivers/flash.h"
 #include "drivers/flash_m25p16.h"
 
 #include "io/flashfs.h"
 
+#ifdef USE_FLASHFS_PAGE_BUFFERS
+/* Two page-sized write buffers. flashfsWrite() fills one of them while the other one holds a page which is waiting
+ * to be programmed (or is being programmed by the chip), so that the flash is always given whole pages to program
+ * instead of the small pieces of a page that the circular buffer flushes.
+ *
+ * The data in the fill buffer starts at index 0 and belongs at flash address (tailAddress + programLength), it can
+ * only grow up to the next page boundary of the flash.
+ */
+static uint8_t flashPageBuffers[2][M25P16_PAGESIZE];
+
+static uint8_t fillBufferIndex = 0;
+static uint16_t fillLength = 0;
+
+// The number of bytes in the other buffer which are waiting to be programmed at tailAddress, 0 if it is free
+static uint16_t programLength = 0;
+#else
 static uint8_t flashWriteBuffer[FLASHFS_WRITE_BUFFER_SIZE];
 
 /* The position of our head and tail in the circular flash write buffer.
@@ -48,18 +68,52 @@ static uint8_t flashWriteBuffer[FLASHFS_WRITE_BUFFER_SIZE];
  * When the circular buffer is empty, head == tail
  */
 static uint8_t bufferHead = 0, bufferTail = 0;
+#endif
 
 // The position of the buffer's tail in the overall flash address space:
 static uint32_t tailAddress = 0;
 
+#ifdef USE_FLASHFS_LOG_INDEX
+/* The last sector of the flash holds an index of the logs on the volume, so that we can find the end of the last
+ * log on startup and tell the host where each log starts and ends without scanning the flash.
+ *
+ * Closing a log appends an entry with its start and end address. Entries are programmed in order from the start of
+ * the sector, so the first erased entry marks the end of the index.
+ */
+#define FLASHFS_INDEX_MAGIC 0x474F4C42 // "BLOG"
+
+typedef struct flashfsIndexEntry_s {
+    uint32_t magic;
+    uint32_t start;
+    uint32_t end;
+    uint32_t crc;
+} flashfsIndexEntry_t;
+
+// False if the index sector holds something other than an index, in which case we don't add to it
+static bool indexValid = false;
+static uint16_t indexEntryCount = 0;
+static uint32_t indexEnd = 0; // The end of the last log in the index
+
+// The start of the log which is currently being written
+static uint32_t logStartAddress = 0;
+#endif
+
 static void flashfsClearBuffer()
 {
+#ifdef USE_FLASHFS_PAGE_BUFFERS
+    fillLength = programLength = 0;
+#else
     bufferTail = bufferHead = 0;
+#endif
 }
 
 static bool flashfsBufferIsEmpty()
 {
+#ifdef USE_FLASHFS_PAGE_BUFFERS
+    return fillLength == 0 && programLength == 0;
+#else
     return bufferTail == bufferHead;
+#endif
 }
 
 static void flashfsSetTailAddress(uint32_t address)
@@ -74,6 +128,12 @@ void flashfsEraseCompletely()
     flashfsClearBuffer();
 
     flashfsSetTailAddress(0);
+
+#ifdef USE_FLASHFS_LOG_INDEX
+    indexValid = true;
+    indexEntryCount = 0;
+    indexEnd = logStartAddress = 0;
+#endif
 }
 
 /**
@@ -113,9 +173,23 @@ bool flashfsIsReady()
 
 uint32_t flashfsGetSize()
 {
+#ifdef USE_FLASHFS_LOG_INDEX
+    // The last sector is reserved for the log index
+    const flashGeometry_t *geometry = m25p16_getGeometry();
+
+    return geometry->totalSize - geometry->sectorSize;
+#else
     return m25p16_getGeometry()->totalSize;
+#endif
 }
 
+#ifdef USE_FLASHFS_PAGE_BUFFERS
+// The number of bytes the fill buffer can hold before it reaches the next page boundary of the flash
+static uint32_t flashfsFillBufferCapacity()
+{
+    return M25P16_PAGESIZE - (tailAddress + programLength) % M25P16_PAGESIZE;
+}
+#else
 static uint32_t flashfsTransmitBufferUsed()
 {
     if (bufferHead >= bufferTail)
@@ -123,13 +197,18 @@ static uint32_t flashfsTransmitBufferUsed()
 
     return FLASHFS_WRITE_BUFFER_SIZE - bufferTail + bufferHead;
 }
+#endif
 
 /**
  * Get the size of the largest single write that flashfs could ever accept without blocking or data loss.
  */
 uint32_t flashfsGetWriteBufferSize()
 {
+#ifdef USE_FLASHFS_PAGE_BUFFERS
+    return M25P16_PAGESIZE;
+#else
     return FLASHFS_WRITE_BUFFER_USABLE;
+#endif
 }
 
 /**
@@ -137,7 +216,12 @@ uint32_t flashfsGetWriteBufferSize()
  */
 uint32_t flashfsGetWriteBufferFreeSpace()
 {
+#ifdef USE_FLASHFS_PAGE_BUFFERS
+    // Once the fill buffer is full it can be handed over to be programmed, if the other buffer is free
+    return flashfsFillBufferCapacity() - fillLength + (programLength == 0 ? M25P16_PAGESIZE : 0);
+#else
     return flashfsGetWriteBufferSize() - flashfsTransmitBufferUsed();
+#endif
 }
 
 const flashGeometry_t* flashfsGetGeometry()
@@ -247,6 +331,173 @@ static uint32_t flashfsWriteBuffers(uint8_t const **buffers, uint32_t *bufferSiz
     return bytesTotal - bytesTotalRemaining;
 }
 
+#ifdef USE_FLASHFS_PAGE_BUFFERS
+/**
+ * Get the current offset of the file pointer within the volume.
+ */
+uint32_t flashfsGetOffset()
+{
+    // Dirty data in the buffers contributes to the offset
+    return tailAddress + programLength + fillLength;
+}
+
+/**
+ * Program the page waiting in the program buffer (if any) to the flash at the tail address.
+ *
+ * In asynchronous mode, if the flash is busy then nothing is written and the routine returns false.
+ *
+ * Returns true if the program buffer is free.
+ */
+static bool flashfsProgramPage(bool sync)
+{
+    if (programLength == 0) {
+        return true;
+    }
+
+    if (!sync && !m25p16_isReady()) {
+        return false;
+    }
+
+    // The buffer never crosses a page boundary, so this is a single page program
+    uint8_t const * buffers[1] = { flashPageBuffers[fillBufferIndex ^ 1] };
+    uint32_t bufferSizes[1] = { programLength };
+
+    flashfsWriteBuffers(buffers, bufferSizes, 1, sync);
+
+    programLength = 0;
+
+    return true;
+}
+
+/**
+ * Hand the contents of the fill buffer over to be programmed and start filling the other buffer. The program
+ * buffer must be free.
+ */
+static void flashfsSwapBuffers()
+{
+    programLength = fillLength;
+    fillLength = 0;
+    fillBufferIndex ^= 1;
+}
+
+/**
+ * Called when the fill buffer has reached a page boundary, moves the page to the program buffer and starts
+ * programming it if the flash is ready.
+ *
+ * In asynchronous mode the fill buffer stays full if the previous page is still waiting for the flash.
+ */
+static void flashfsFillBufferCompleted(bool sync)
+{
+    if (!flashfsProgramPage(sync)) {
+        return;
+    }
+
+    flashfsSwapBuffers();
+
+    flashfsProgramPage(false);
+}
+
+/**
+ * If the flash is ready to accept writes, program any complete pages that are waiting in the buffers. Partially
+ * filled pages stay buffered until more data arrives or flashfsFlushAsync()/flashfsFlushSync() is called.
+ *
+ * Returns true if there are no complete pages left waiting to be programmed.
+ */
+bool flashfsFlushPagesAsync()
+{
+    if (fillLength == flashfsFillBufferCapacity()) {
+        flashfsFillBufferCompleted(false);
+    } else {
+        flashfsProgramPage(false);
+    }
+
+    return programLength == 0 && fillLength < flashfsFillBufferCapacity();
+}
+
+/**
+ * If the flash is ready to accept writes, flush the buffer to it.
+ *
+ * Returns true if all data in the buffer has been flushed to the device, or false if
+ * there is still data to be written (call flush again later).
+ */
+bool flashfsFlushAsync()
+{
+    if (flashfsBufferIsEmpty()) {
+        return true; // Nothing to flush
+    }
+
+    // Each call programs at most one page, since we'd have to wait for the flash before the next one
+    if (programLength == 0) {
+        flashfsSwapBuffers();
+    }
+
+    flashfsProgramPage(false);
+
+    return flashfsBufferIsEmpty();
+}
+
+/**
+ * Wait for the flash to become ready and begin flushing any buffered data to flash.
+ *
+ * The flash will still be busy some time after this sync completes, but space will
+ * be freed up to accept more writes in the write buffer.
+ */
+void flashfsFlushSync()
+{
+    flashfsProgramPage(true);
+
+    if (fillLength > 0) {
+        flashfsSwapBuffers();
+        flashfsProgramPage(true);
+    }
+}
+
+/**
+ * Write the given byte asynchronously to the flash. If the buffer overflows, data is silently discarded.
+ */
+void flashfsWriteByte(uint8_t byte)
+{
+    flashfsWrite(&byte, 1, false);
+}
+
+/**
+ * Write the given buffer to the flash either synchronously or asynchronously depending on the 'sync' parameter.
+ *
+ * If writing asynchronously, data will be silently discarded if the buffer overflows.
+ * If writing synchronously, the routine will block waiting for the flash to become ready so will never drop data.
+ */
+void flashfsWrite(const uint8_t *data, unsigned int len, bool sync)
+{
+    if (!sync && len > flashfsGetWriteBufferFreeSpace()) {
+        // Make room by programming the waiting page if the flash has finished with the previous one
+        flashfsProgramPage(false);
+
+        if (len > flashfsGetWriteBufferFreeSpace()) {
+            /*
+             * Silently drop the data the user asked to write (i.e. no-op) since we can't buffer it and they
+             * requested async.
+             */
+            return;
+        }
+    }
+
+    while (len > 0) {
+        const uint32_t fillCapacity = flashfsFillBufferCapacity();
+        const uint32_t bytesThisIteration = MIN(len, fillCapacity - fillLength);
+
+        memcpy(flashPageBuffers[fillBufferIndex] + fillLength, data, bytesThisIteration);
+
+        fillLength += bytesThisIteration;
+        data += bytesThisIteration;
+        len -= bytesThisIteration;
+
+        if (fillLength == fillCapacity) {
+            // In async mode, the free space check above guarantees that this hands over the page if there's more data
+            flashfsFillBufferCompleted(sync);
+        }
+    }
+}
+#else
 /*
  * Since the buffered data might wrap around the end of the circular buffer, we can have two segments of data to write,
  * an initial portion and a possible wrapped portion.
@@ -299,6 +550,14 @@ static void flashfsAdvanceTailInBuffer(uint32_t delta)
     }
 }
 
+/**
+ * Same as flashfsFlushAsync(), the circular buffer has no whole pages to wait for.
+ */
+bool flashfsFlushPagesAsync()
+{
+    return flashfsFlushAsync();
+}
+
 /**
  * If the flash is ready to accept writes, flush the buffer to it.
  *
@@ -344,20 +603,6 @@ void flashfsFlushSync()
     flashfsClearBuffer();
 }
 
-void flashfsSeekAbs(uint32_t offset)
-{
-    flashfsFlushSync();
-
-    flashfsSetTailAddress(offset);
-}
-
-void flashfsSeekRel(int32_t offset)
-{
-    flashfsFlushSync();
-
-    flashfsSetTailAddress(tailAddress + offset);
-}
-
 /**
  * Write the given byte asynchronously to the flash. If the buffer overflows, data is silently discarded.
  */
@@ -458,6 +703,22 @@ void flashfsWrite(const uint8_t *data, unsigned int len, bool sync)
     }
 }
 
+#endif
+
+void flashfsSeekAbs(uint32_t offset)
+{
+    flashfsFlushSync();
+
+    flashfsSetTailAddress(offset);
+}
+
+void flashfsSeekRel(int32_t offset)
+{
+    flashfsFlushSync();
+
+    flashfsSetTailAddress(tailAddress + offset);
+}
+
 /**
  * Read `len` bytes from the given address into the supplied buffer.
  *
@@ -481,60 +742,73 @@ int flashfsReadAbs(uint32_t address, uint8_t *buffer, unsigned int len)
     return bytesRead;
 }
 
+enum {
+    /* We can choose whatever power of 2 size we like, which determines how much wastage of free space we'll have
+     * at the end of the last written data. But smaller blocksizes will require more searching.
+     */
+    FREE_BLOCK_SIZE = 2048,
+
+    /* We don't expect valid data to ever contain this many consecutive uint32_t's of all 1 bits: */
+    FREE_BLOCK_TEST_SIZE_INTS = 4, // i.e. 16 bytes
+    FREE_BLOCK_TEST_SIZE_BYTES = FREE_BLOCK_TEST_SIZE_INTS * sizeof(uint32_t)
+};
+
 /**
- * Find the offset of the start of the free space on the device (or the size of the device if it is full).
+ * Check if the bytes at the given address appear to be erased, i.e. nothing was ever written there.
+ *
+ * Returns false if the flash didn't respond.
  */
-int flashfsIdentifyStartOfFreeSpace()
+static bool flashfsTestErased(uint32_t address, bool *erased)
+{
+    union {
+        uint8_t bytes[FREE_BLOCK_TEST_SIZE_BYTES];
+        uint32_t ints[FREE_BLOCK_TEST_SIZE_INTS];
+    } testBuffer;
+
+    if (m25p16_readBytes(address, testBuffer.bytes, FREE_BLOCK_TEST_SIZE_BYTES) < FREE_BLOCK_TEST_SIZE_BYTES) {
+        return false;
+    }
+
+    // Checking the buffer 4 bytes at a time like this is probably faster than byte-by-byte, but I didn't benchmark it :)
+    *erased = true;
+    for (int i = 0; i < FREE_BLOCK_TEST_SIZE_INTS; i++) {
+        if (testBuffer.ints[i] != 0xFFFFFFFF) {
+            *erased = false;
+            break;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Find the offset of the start of the free space on the device at or after the given address (or the size of the
+ * device if it is full).
+ */
+static uint32_t flashfsFindStartOfFreeSpace(uint32_t start)
 {
     /* Find the start of the free space on the device by examining the beginning of blocks with a binary search,
      * looking for ones that appear to be erased. We can achieve this with good accuracy because an erased block
      * is all bits set to 1, which pretty much never appears in reasonable size substrings of blackbox logs.
      *
-     * To do better we might write a volume header instead, which would mark how much free space remains. But keeping
-     * a header up to date while logging would incur more writes to the flash, which would consume precious write
-     * bandwidth and block more often.
+     * The log index gives us the exact end of every closed log, so this search is only needed when the index is
+     * missing or corrupt, or to find the end of a log which was still being written when the power was lost.
      */
 
-    enum {
-        /* We can choose whatever power of 2 size we like, which determines how much wastage of free space we'll have
-         * at the end of the last written data. But smaller blocksizes will require more searching.
-         */
-        FREE_BLOCK_SIZE = 2048,
-
-        /* We don't expect valid data to ever contain this many consecutive uint32_t's of all 1 bits: */
-        FREE_BLOCK_TEST_SIZE_INTS = 4, // i.e. 16 bytes
-        FREE_BLOCK_TEST_SIZE_BYTES = FREE_BLOCK_TEST_SIZE_INTS * sizeof(uint32_t)
-    };
-
-    union {
-        uint8_t bytes[FREE_BLOCK_TEST_SIZE_BYTES];
-        uint32_t ints[FREE_BLOCK_TEST_SIZE_INTS];
-    } testBuffer;
-
-    int left = 0; // Smallest block index in the search region
+    int left = (start + FREE_BLOCK_SIZE - 1) / FREE_BLOCK_SIZE; // Smallest block index in the search region
     int right = flashfsGetSize() / FREE_BLOCK_SIZE; // One past the largest block index in the search region
     int mid;
     int result = right;
-    int i;
     bool blockErased;
 
     while (left < right) {
         mid = (left + right) / 2;
 
-        if (m25p16_readBytes(mid * FREE_BLOCK_SIZE, testBuffer.bytes, FREE_BLOCK_TEST_SIZE_BYTES) < FREE_BLOCK_TEST_SIZE_BYTES) {
+        if (!flashfsTestErased(mid * FREE_BLOCK_SIZE, &blockErased)) {
             // Unexpected timeout from flash, so bail early (reporting the device fuller than it really is)
             break;
         }
 
-        // Checking the buffer 4 bytes at a time like this is probably faster than byte-by-byte, but I didn't benchmark it :)
-        blockErased = true;
-        for (i = 0; i < FREE_BLOCK_TEST_SIZE_INTS; i++) {
-            if (testBuffer.ints[i] != 0xFFFFFFFF) {
-                blockErased = false;
-                break;
-            }
-        }
-
         if (blockErased) {
             /* This erased block might be the leftmost erased block in the volume, but we'll need to continue the
              * search leftwards to find out:
@@ -550,6 +824,199 @@ int flashfsIdentifyStartOfFreeSpace()
     return result * FREE_BLOCK_SIZE;
 }
 
+/**
+ * Find the offset of the start of the free space on the device (or the size of the device if it is full).
+ */
+int flashfsIdentifyStartOfFreeSpace()
+{
+    return flashfsFindStartOfFreeSpace(0);
+}
+
+#ifdef USE_FLASHFS_LOG_INDEX
+static uint32_t flashfsIndexAddress()
+{
+    return flashfsGetSize();
+}
+
+static uint16_t flashfsIndexCapacity()
+{
+    return m25p16_getGeometry()->sectorSize / sizeof(flashfsIndexEntry_t);
+}
+
+static uint32_t flashfsIndexEntryCrc(const flashfsIndexEntry_t *entry)
+{
+    return crc16_ccitt_update(0, entry, offsetof(flashfsIndexEntry_t, crc));
+}
+
+static bool flashfsIndexEntryIsErased(const flashfsIndexEntry_t *entry)
+{
+    return entry->magic == 0xFFFFFFFF && entry->start == 0xFFFFFFFF && entry->end == 0xFFFFFFFF && entry->crc == 0xFFFFFFFF;
+}
+
+static bool flashfsIndexEntryIsValid(const flashfsIndexEntry_t *entry)
+{
+    return entry->magic == FLASHFS_INDEX_MAGIC && entry->crc == flashfsIndexEntryCrc(entry)
+        && entry->start <= entry->end && entry->end <= flashfsGetSize();
+}
+
+static bool flashfsIndexReadEntry(int index, flashfsIndexEntry_t *entry)
+{
+    const uint32_t address = flashfsIndexAddress() + index * sizeof(*entry);
+
+    return m25p16_readBytes(address, (uint8_t *) entry, sizeof(*entry)) == sizeof(*entry);
+}
+
+/**
+ * Find the end of the index with a binary search for the first erased entry.
+ *
+ * Returns false if the index sector doesn't hold a valid index.
+ */
+static bool flashfsIndexLoad()
+{
+    flashfsIndexEntry_t entry;
+    int left = 0;
+    int right = flashfsIndexCapacity();
+    int result = right;
+
+    while (left < right) {
+        const int mid = (left + right) / 2;
+
+        if (!flashfsIndexReadEntry(mid, &entry)) {
+            return false;
+        }
+
+        if (flashfsIndexEntryIsErased(&entry)) {
+            result = mid;
+            right = mid;
+        } else {
+            left = mid + 1;
+        }
+    }
+
+    indexEntryCount = result;
+    indexEnd = 0;
+
+    if (indexEntryCount > 0) {
+        if (!flashfsIndexReadEntry(indexEntryCount - 1, &entry) || !flashfsIndexEntryIsValid(&entry)) {
+            return false;
+        }
+        indexEnd = entry.end;
+    }
+
+    return true;
+}
+
+static void flashfsIndexAppend(uint32_t start, uint32_t end)
+{
+    if (!indexValid || indexEntryCount >= flashfsIndexCapacity()) {
+        return;
+    }
+
+    flashfsIndexEntry_t entry = {
+        .magic = FLASHFS_INDEX_MAGIC,
+        .start = start,
+        .end = end,
+    };
+    entry.crc = flashfsIndexEntryCrc(&entry);
+
+    // Entries divide the page size evenly, so never cross a page boundary
+    m25p16_pageProgram(flashfsIndexAddress() + indexEntryCount * sizeof(entry), (const uint8_t *) &entry, sizeof(entry));
+
+    indexEntryCount++;
+    indexEnd = end;
+}
+
+/**
+ * Find the start of the free space from the log index, falling back to scanning the device if the index is missing
+ * or corrupt. A log that was still being written when the power was lost is added to the index.
+ */
+static uint32_t flashfsIndexMount()
+{
+    indexValid = flashfsIndexLoad();
+
+    if (!indexValid) {
+        return flashfsIdentifyStartOfFreeSpace();
+    }
+
+    bool erased = true;
+
+    if (indexEnd < flashfsGetSize() && flashfsTestErased(indexEnd, &erased) && erased) {
+        // Every log on the device was closed
+        return indexEnd;
+    }
+
+    const uint32_t end = flashfsFindStartOfFreeSpace(indexEnd);
+
+    if (end > indexEnd) {
+        flashfsIndexAppend(indexEnd, end);
+    }
+
+    return end;
+}
+
+/**
+ * Get the number of logs in the log index, which is 0 if the device has no valid index.
+ */
+int flashfsGetLogCount()
+{
+    return indexValid ? indexEntryCount : 0;
+}
+
+/**
+ * Get the start and end address of the log with the given number (from 0, in the order they were written).
+ *
+ * Returns false if there's no such log.
+ */
+bool flashfsGetLog(int index, flashfsLog_t *log)
+{
+    flashfsIndexEntry_t entry;
+
+    if (index < 0 || index >= flashfsGetLogCount() || !flashfsIndexReadEntry(index, &entry) || !flashfsIndexEntryIsValid(&entry)) {
+        return false;
+    }
+
+    log->start = entry.start;
+    log->end = entry.end;
+
+    return true;
+}
+#else
+int flashfsGetLogCount()
+{
+    return 0;
+}
+
+bool flashfsGetLog(int index, flashfsLog_t *log)
+{
+    UNUSED(index);
+    UNUSED(log);
+
+    return false;
+}
+#endif
+
+/**
+ * Call when a log is complete, in order to record it in the log index.
+ *
+ * Returns true once all of the log has been written to flash, or false if it's still being written (call again
+ * later).
+ */
+bool flashfsCloseLog()
+{
+    if (!flashfsFlushAsync() || !flashfsIsReady()) {
+        return false;
+    }
+
+#ifdef USE_FLASHFS_LOG_INDEX
+    if (tailAddress > logStartAddress) {
+        flashfsIndexAppend(logStartAddress, tailAddress);
+    }
+    logStartAddress = tailAddress;
+#endif
+
+    return true;
+}
+
 /**
  * Returns true if the file pointer is at the end of the device.
  */
@@ -565,6 +1032,11 @@ void flashfsInit()
     // If we have a flash chip present at all
     if (flashfsGetSize() > 0) {
         // Start the file pointer off at the beginning of free space so caller can start writing immediately
+#ifdef USE_FLASHFS_LOG_INDEX
+        flashfsSeekAbs(flashfsIndexMount());
+        logStartAddress = tailAddress;
+#else
         flashfsSeekAbs(flashfsIdentifyStartOfFreeSpace());
+#endif
     }
 }
@@ -23,6 +23,11 @@
 // Automatically trigger a flush when this much data is in the buffer
 #define FLASHFS_WRITE_BUFFER_AUTO_FLUSH_LEN 64
 
+typedef struct flashfsLog_s {
+    uint32_t start;
+    uint32_t end;
+} flashfsLog_t;
+
 void flashfsEraseCompletely();
 void flashfsEraseRange(uint32_t start, uint32_t end);
 
@@ -43,8 +48,13 @@ void flashfsWrite(const uint8_t *data, unsigned int len, bool sync);
 int flashfsReadAbs(uint32_t offset, uint8_t *data, unsigned int len);
 
 bool flashfsFlushAsync();
+bool flashfsFlushPagesAsync();
 void flashfsFlushSync();
 
+bool flashfsCloseLog();
+int flashfsGetLogCount();
+bool flashfsGetLog(int index, flashfsLog_t *log);
+
 void flashfsInit();
 
 bool flashfsIsReady();
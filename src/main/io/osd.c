@@ -134,6 +134,36 @@ static displayPort_t *osdDisplayPort;
 #define AH_MAX_ROLL 400  // Specify maximum AHI roll value displayed. Default 400 = 40.0 degrees
 #define AH_SIDEBAR_WIDTH_POS 7
 #define AH_SIDEBAR_HEIGHT_POS 3
+#define AH_CENTER_X 14
+#define AH_BAR_COUNT 9
+#define AH_BAR_HIDDEN 0xFF
+#define AH_SIDEBAR_CELL_COUNT ((2 * AH_SIDEBAR_HEIGHT_POS + 1) * 2 + 2)
+
+#define OSD_ELEMENT_BUFFER_LENGTH 32
+#define OSD_MAX_ROWS 16
+
+// What's on screen for each element, so only the elements that change are redrawn
+typedef struct osdElement_s {
+    uint8_t x;
+    uint8_t y;
+    uint8_t len; // 0 when the element isn't on screen
+    char text[OSD_ELEMENT_BUFFER_LENGTH];
+} osdElement_t;
+
+typedef struct osdCell_s {
+    uint8_t x;
+    uint8_t y;
+    uint8_t c;
+} osdCell_t;
+
+static osdElement_t osdElements[OSD_ITEM_COUNT];
+static osdCell_t ahBars[AH_BAR_COUNT];
+static uint8_t sidebarsCenterY = AH_BAR_HIDDEN;
+
+// A bit for each cell erased or written in this refresh, one word per row
+static uint32_t osdDirtyCells[OSD_MAX_ROWS];
+static bool osdRedrawAll = true;
+static timeUs_t osdRedrawAllAt = 0;
 
 PG_REGISTER_WITH_RESET_FN(osdConfig_t, osdConfig, PG_OSD_CONFIG, 0);
 
@@ -188,18 +218,20 @@ static void osdFormatPID(char * buff, const char * label, const pid8_t * pid)
     tfp_sprintf(buff, "%s %3d %3d %3d", label, pid->P, pid->I, pid->D);
 }
 
-static void osdDrawSingleElement(uint8_t item)
+/*
+ * Format the text of an element and work out where it goes.
+ * Returns false if the element isn't shown.
+ */
+static bool osdFormatElement(uint8_t item, uint8_t *x, uint8_t *y, char *buff)
 {
     if (!VISIBLE(osdConfig()->item_pos[item]) || BLINK(item))
-        return;
+        return false;
 
     uint8_t elemPosX = OSD_X(osdConfig()->item_pos[item]);
     uint8_t elemPosY = OSD_Y(osdConfig()->item_pos[item]);
 
     uint8_t elemOffsetX = 0;
 
-    char buff[32];
-
     switch(item) {
     case OSD_RSSI_VALUE:
         {
@@ -305,8 +337,8 @@ static void osdDrawSingleElement(uint8_t item)
             else if (FLIGHT_MODE(HORIZON_MODE))
                 p = "HOR";
 
-            displayWrite(osdDisplayPort, elemPosX, elemPosY, p);
-            return;
+            strcpy(buff, p);
+            break;
         }
 
     case OSD_CRAFT_NAME:
@@ -358,59 +390,6 @@ static void osdDrawSingleElement(uint8_t item)
         buff[3] = 0;
         break;
 
-    case OSD_ARTIFICIAL_HORIZON:
-        {
-            elemPosX = 14;
-            elemPosY = 6 - 4; // Top center of the AH area
-
-            const int rollAngle = constrain(attitude.values.roll, -AH_MAX_ROLL, AH_MAX_ROLL);
-            int pitchAngle = constrain(attitude.values.pitch, -AH_MAX_PITCH, AH_MAX_PITCH);
-
-            if (displayScreenSize(osdDisplayPort) == VIDEO_BUFFER_CHARS_PAL) {
-                ++elemPosY;
-            }
-
-            // Convert pitchAngle to y compensation value
-            pitchAngle = (pitchAngle / 8) - 41; // 41 = 4 * 9 + 5
-
-            for (int x = -4; x <= 4; x++) {
-                int y = (-rollAngle * x) / 64;
-                y -= pitchAngle;
-                // y += 41; // == 4 * 9 + 5
-                if (y >= 0 && y <= 81) {
-                    displayWriteChar(osdDisplayPort, elemPosX + x, elemPosY + (y / 9), (SYM_AH_BAR9_0 + (y % 9)));
-                }
-            }
-
-            osdDrawSingleElement(OSD_HORIZON_SIDEBARS);
-
-            return;
-        }
-
-    case OSD_HORIZON_SIDEBARS:
-        {
-            elemPosX = 14;
-            elemPosY = 6;
-
-            if (displayScreenSize(osdDisplayPort) == VIDEO_BUFFER_CHARS_PAL) {
-                ++elemPosY;
-            }
-
-            // Draw AH sides
-            int8_t hudwidth = AH_SIDEBAR_WIDTH_POS;
-            int8_t hudheight = AH_SIDEBAR_HEIGHT_POS;
-            for (int8_t y = -hudheight; y <= hudheight; y++) {
-                displayWriteChar(osdDisplayPort, elemPosX - hudwidth, elemPosY + y, SYM_AH_DECORATION);
-                displayWriteChar(osdDisplayPort, elemPosX + hudwidth, elemPosY + y, SYM_AH_DECORATION);
-            }
-
-            // AH level indicators
-            displayWriteChar(osdDisplayPort, elemPosX - hudwidth + 1, elemPosY, SYM_AH_LEFT);
-            displayWriteChar(osdDisplayPort, elemPosX + hudwidth - 1, elemPosY, SYM_AH_RIGHT);
-
-            return;
-        }
-
     case OSD_ROLL_PIDS:
         {
             const pidProfile_t *pidProfile = currentPidProfile;
@@ -455,7 +434,7 @@ static void osdDrawSingleElement(uint8_t item)
             break;
 
         default:
-            return;
+            return false;
         }
         break;
 
@@ -514,79 +493,297 @@ static void osdDrawSingleElement(uint8_t item)
             tfp_sprintf(buff, "DISARMED");
             break;
         } else {
-            return;
+            return false;
         }
 
     default:
+        return false;
+    }
+
+    *x = elemPosX + elemOffsetX;
+    *y = elemPosY;
+    return true;
+}
+
+static uint32_t osdSpanMask(uint8_t x, uint8_t len)
+{
+    return (len >= 32 ? 0xFFFFFFFF : (1u << len) - 1) << x;
+}
+
+static void osdMarkDirty(uint8_t x, uint8_t y, uint8_t len)
+{
+    if (y < OSD_MAX_ROWS && x < 32) {
+        osdDirtyCells[y] |= osdSpanMask(x, len);
+    }
+}
+
+static bool osdIsDirty(uint8_t x, uint8_t y, uint8_t len)
+{
+    return y < OSD_MAX_ROWS && x < 32 && (osdDirtyCells[y] & osdSpanMask(x, len));
+}
+
+static void osdEraseCells(uint8_t x, uint8_t y, uint8_t len)
+{
+    if (len == 0) {
         return;
     }
 
-    displayWrite(osdDisplayPort, elemPosX + elemOffsetX, elemPosY, buff);
+    char spaces[OSD_ELEMENT_BUFFER_LENGTH];
+    memset(spaces, ' ', len);
+    spaces[len] = 0;
+    displayWrite(osdDisplayPort, x, y, spaces);
+    osdMarkDirty(x, y, len);
 }
 
-void osdDrawElements(void)
+static void osdUpdateTextElement(uint8_t item, bool enabled)
 {
-    displayClearScreen(osdDisplayPort);
+    osdElement_t *element = &osdElements[item];
+    char buff[OSD_ELEMENT_BUFFER_LENGTH];
+    uint8_t x = element->x;
+    uint8_t y = element->y;
 
-    /* Hide OSD when OSDSW mode is active */
-    if (IS_RC_MODE_ACTIVE(BOXOSD))
-      return;
+    if (!enabled || !osdFormatElement(item, &x, &y, buff)) {
+        buff[0] = 0;
+    }
 
-#if 0
-    if (currentElement)
-        osdDrawElementPositioningHelp();
-#else
-    if (false)
-        ;
+    const uint8_t len = strlen(buff);
+    if (x == element->x && y == element->y) {
+        if (len == element->len && memcmp(buff, element->text, len) == 0) {
+            return;
+        }
+        // The new text covers the start of the old
+        if (len < element->len) {
+            osdEraseCells(x + len, y, element->len - len);
+        }
+    } else {
+        osdEraseCells(element->x, element->y, element->len);
+    }
+
+    element->x = x;
+    element->y = y;
+    element->len = len;
+    memcpy(element->text, buff, len + 1);
+    osdMarkDirty(x, y, len);
+}
+
+static void osdWriteTextElement(uint8_t item)
+{
+    const osdElement_t *element = &osdElements[item];
+
+    if (element->len && osdIsDirty(element->x, element->y, element->len)) {
+        displayWrite(osdDisplayPort, element->x, element->y, element->text);
+        osdMarkDirty(element->x, element->y, element->len);
+    }
+}
+
+static uint8_t osdHorizonCenterY(void)
+{
+    return displayScreenSize(osdDisplayPort) == VIDEO_BUFFER_CHARS_PAL ? 7 : 6;
+}
+
+static void osdUpdateArtificialHorizon(bool enabled)
+{
+    const bool shown = enabled && VISIBLE(osdConfig()->item_pos[OSD_ARTIFICIAL_HORIZON]) && !BLINK(OSD_ARTIFICIAL_HORIZON);
+
+    const uint8_t elemPosX = AH_CENTER_X;
+    const uint8_t elemPosY = osdHorizonCenterY() - 4; // Top center of the AH area
+
+    const int rollAngle = constrain(attitude.values.roll, -AH_MAX_ROLL, AH_MAX_ROLL);
+    int pitchAngle = constrain(attitude.values.pitch, -AH_MAX_PITCH, AH_MAX_PITCH);
+
+    // Convert pitchAngle to y compensation value
+    pitchAngle = (pitchAngle / 8) - 41; // 41 = 4 * 9 + 5
+
+    for (int x = -4; x <= 4; x++) {
+        osdCell_t *bar = &ahBars[x + 4];
+        osdCell_t newBar = { .x = elemPosX + x, .y = AH_BAR_HIDDEN, .c = 0 };
+
+        int y = (-rollAngle * x) / 64;
+        y -= pitchAngle;
+        // y += 41; // == 4 * 9 + 5
+        if (shown && y >= 0 && y <= 81) {
+            newBar.y = elemPosY + (y / 9);
+            newBar.c = SYM_AH_BAR9_0 + (y % 9);
+        }
+
+        if (newBar.y != bar->y || newBar.c != bar->c) {
+            if (bar->y != AH_BAR_HIDDEN) {
+                osdEraseCells(bar->x, bar->y, 1);
+            }
+            *bar = newBar;
+            if (bar->y != AH_BAR_HIDDEN) {
+                osdMarkDirty(bar->x, bar->y, 1);
+            }
+        }
+    }
+}
+
+static void osdWriteArtificialHorizon(void)
+{
+    for (int i = 0; i < AH_BAR_COUNT; i++) {
+        const osdCell_t *bar = &ahBars[i];
+        if (bar->y != AH_BAR_HIDDEN && osdIsDirty(bar->x, bar->y, 1)) {
+            displayWriteChar(osdDisplayPort, bar->x, bar->y, bar->c);
+            osdMarkDirty(bar->x, bar->y, 1);
+        }
+    }
+}
+
+/*
+ * The sidebars are a column of decorations on each side of the AH, with the level indicators inside them.
+ */
+static osdCell_t osdHorizonSidebarCell(int index, uint8_t centerY)
+{
+    const int8_t hudwidth = AH_SIDEBAR_WIDTH_POS;
+    const int8_t hudheight = AH_SIDEBAR_HEIGHT_POS;
+
+    osdCell_t cell;
+    if (index < AH_SIDEBAR_CELL_COUNT - 2) {
+        cell.x = AH_CENTER_X + (index % 2 ? hudwidth : -hudwidth);
+        cell.y = centerY - hudheight + index / 2;
+        cell.c = SYM_AH_DECORATION;
+    } else if (index == AH_SIDEBAR_CELL_COUNT - 2) {
+        cell.x = AH_CENTER_X - hudwidth + 1;
+        cell.y = centerY;
+        cell.c = SYM_AH_LEFT;
+    } else {
+        cell.x = AH_CENTER_X + hudwidth - 1;
+        cell.y = centerY;
+        cell.c = SYM_AH_RIGHT;
+    }
+    return cell;
+}
+
+static void osdUpdateHorizonSidebars(bool enabled)
+{
+    const bool shown = enabled && VISIBLE(osdConfig()->item_pos[OSD_HORIZON_SIDEBARS]) && !BLINK(OSD_HORIZON_SIDEBARS);
+    const uint8_t centerY = shown ? osdHorizonCenterY() : AH_BAR_HIDDEN;
+
+    if (centerY == sidebarsCenterY) {
+        return;
+    }
+
+    for (int i = 0; i < AH_SIDEBAR_CELL_COUNT; i++) {
+        if (sidebarsCenterY != AH_BAR_HIDDEN) {
+            const osdCell_t cell = osdHorizonSidebarCell(i, sidebarsCenterY);
+            osdEraseCells(cell.x, cell.y, 1);
+        }
+        if (centerY != AH_BAR_HIDDEN) {
+            const osdCell_t cell = osdHorizonSidebarCell(i, centerY);
+            osdMarkDirty(cell.x, cell.y, 1);
+        }
+    }
+    sidebarsCenterY = centerY;
+}
+
+static void osdWriteHorizonSidebars(void)
+{
+    if (sidebarsCenterY == AH_BAR_HIDDEN) {
+        return;
+    }
+
+    for (int i = 0; i < AH_SIDEBAR_CELL_COUNT; i++) {
+        const osdCell_t cell = osdHorizonSidebarCell(i, sidebarsCenterY);
+        if (osdIsDirty(cell.x, cell.y, 1)) {
+            displayWriteChar(osdDisplayPort, cell.x, cell.y, cell.c);
+            osdMarkDirty(cell.x, cell.y, 1);
+        }
+    }
+}
+
+static const uint8_t osdTextElementOrder[] = {
+    OSD_MAIN_BATT_VOLTAGE,
+    OSD_RSSI_VALUE,
+    OSD_CROSSHAIRS,
+    OSD_FLYTIME,
+    OSD_ONTIME,
+    OSD_FLYMODE,
+    OSD_THROTTLE_POS,
+    OSD_VTX_CHANNEL,
+    OSD_CURRENT_DRAW,
+    OSD_MAH_DRAWN,
+    OSD_CRAFT_NAME,
+    OSD_ALTITUDE,
+    OSD_ROLL_PIDS,
+    OSD_PITCH_PIDS,
+    OSD_YAW_PIDS,
+    OSD_POWER,
+    OSD_PIDRATE_PROFILE,
+    OSD_MAIN_BATT_WARNING,
+    OSD_AVG_CELL_VOLTAGE,
+    OSD_DEBUG,
+    OSD_PITCH_ANGLE,
+    OSD_ROLL_ANGLE,
+    OSD_MAIN_BATT_USAGE,
+    OSD_ARMED_TIME,
+    OSD_DISARMED,
+#ifdef GPS
+    OSD_GPS_SATS,
+    OSD_GPS_SPEED,
+    OSD_GPS_LAT,
+    OSD_GPS_LON,
 #endif
+};
+
+static bool osdIsGpsElement(uint8_t item)
+{
+    return item == OSD_GPS_SATS || item == OSD_GPS_SPEED || item == OSD_GPS_LAT || item == OSD_GPS_LON;
+}
+
+/*
+ * The elements are retained between refreshes. Each refresh first updates the elements, erasing what's changed or gone
+ * and marking the cells it touches, then writes the elements that are on marked cells in the order a full redraw would,
+ * so where elements overlap the screen ends up the same.
+ */
+void osdDrawElements(void)
+{
+    /* Hide OSD when OSDSW mode is active */
+    if (IS_RC_MODE_ACTIVE(BOXOSD)) {
+        displayClearScreen(osdDisplayPort);
+        osdRedrawAll = true;
+        return;
+    }
+
+    if (osdRedrawAll) {
+        displayClearScreen(osdDisplayPort);
+        memset(osdElements, 0, sizeof(osdElements));
+        for (int i = 0; i < AH_BAR_COUNT; i++) {
+            ahBars[i].y = AH_BAR_HIDDEN;
+        }
+        sidebarsCenterY = AH_BAR_HIDDEN;
+        osdRedrawAll = false;
+    }
+
+    memset(osdDirtyCells, 0, sizeof(osdDirtyCells));
+
 #ifdef CMS
-    else if (sensors(SENSOR_ACC) || displayIsGrabbed(osdDisplayPort))
+    const bool drawHorizon = sensors(SENSOR_ACC) || displayIsGrabbed(osdDisplayPort);
 #else
-    else if (sensors(SENSOR_ACC))
+    const bool drawHorizon = sensors(SENSOR_ACC);
 #endif
-    {
-        osdDrawSingleElement(OSD_ARTIFICIAL_HORIZON);
-    }
-
-    osdDrawSingleElement(OSD_MAIN_BATT_VOLTAGE);
-    osdDrawSingleElement(OSD_RSSI_VALUE);
-    osdDrawSingleElement(OSD_CROSSHAIRS);
-    osdDrawSingleElement(OSD_FLYTIME);
-    osdDrawSingleElement(OSD_ONTIME);
-    osdDrawSingleElement(OSD_FLYMODE);
-    osdDrawSingleElement(OSD_THROTTLE_POS);
-    osdDrawSingleElement(OSD_VTX_CHANNEL);
-    osdDrawSingleElement(OSD_CURRENT_DRAW);
-    osdDrawSingleElement(OSD_MAH_DRAWN);
-    osdDrawSingleElement(OSD_CRAFT_NAME);
-    osdDrawSingleElement(OSD_ALTITUDE);
-    osdDrawSingleElement(OSD_ROLL_PIDS);
-    osdDrawSingleElement(OSD_PITCH_PIDS);
-    osdDrawSingleElement(OSD_YAW_PIDS);
-    osdDrawSingleElement(OSD_POWER);
-    osdDrawSingleElement(OSD_PIDRATE_PROFILE);
-    osdDrawSingleElement(OSD_MAIN_BATT_WARNING);
-    osdDrawSingleElement(OSD_AVG_CELL_VOLTAGE);
-    osdDrawSingleElement(OSD_DEBUG);
-    osdDrawSingleElement(OSD_PITCH_ANGLE);
-    osdDrawSingleElement(OSD_ROLL_ANGLE);
-    osdDrawSingleElement(OSD_MAIN_BATT_USAGE);
-    osdDrawSingleElement(OSD_ARMED_TIME);
-    osdDrawSingleElement(OSD_DISARMED);
-
 #ifdef GPS
 #ifdef CMS
-    if (sensors(SENSOR_GPS) || displayIsGrabbed(osdDisplayPort))
+    const bool drawGps = sensors(SENSOR_GPS) || displayIsGrabbed(osdDisplayPort);
+#else
+    const bool drawGps = sensors(SENSOR_GPS);
+#endif
 #else
-    if (sensors(SENSOR_GPS))
+    const bool drawGps = false;
 #endif
-    {
-        osdDrawSingleElement(OSD_GPS_SATS);
-        osdDrawSingleElement(OSD_GPS_SPEED);
-        osdDrawSingleElement(OSD_GPS_LAT);
-        osdDrawSingleElement(OSD_GPS_LON);
+
+    osdUpdateArtificialHorizon(drawHorizon);
+    // the sidebars are part of the AH
+    osdUpdateHorizonSidebars(drawHorizon && VISIBLE(osdConfig()->item_pos[OSD_ARTIFICIAL_HORIZON]) && !BLINK(OSD_ARTIFICIAL_HORIZON));
+    for (unsigned i = 0; i < ARRAYLEN(osdTextElementOrder); i++) {
+        const uint8_t item = osdTextElementOrder[i];
+        osdUpdateTextElement(item, drawGps || !osdIsGpsElement(item));
+    }
+
+    osdWriteArtificialHorizon();
+    osdWriteHorizonSidebars();
+    for (unsigned i = 0; i < ARRAYLEN(osdTextElementOrder); i++) {
+        osdWriteTextElement(osdTextElementOrder[i]);
     }
-#endif // GPS
 }
 
 void pgResetFn_osdConfig(osdConfig_t *osdProfile)
@@ -671,6 +868,7 @@ void osdInit(displayPort_t *osdDisplayPortToUse)
     memset(blinkBits, 0, sizeof(blinkBits));
 
     displayClearScreen(osdDisplayPort);
+    osdRedrawAll = true;
 
     osdDrawLogo(3, 1);
 
@@ -837,6 +1035,7 @@ static void osdShowStats(void)
     char buff[10];
 
     displayClearScreen(osdDisplayPort);
+    osdRedrawAll = true;
     displayWrite(osdDisplayPort, 2, top++, "  --- STATS ---");
 
     if (osdConfig()->enabled_stats[OSD_STAT_ARMEDTIME]) {
@@ -904,6 +1103,7 @@ static void osdShowArmed(void)
 {
     displayClearScreen(osdDisplayPort);
     displayWrite(osdDisplayPort, 12, 7, "ARMED");
+    osdRedrawAll = true;
 }
 
 static void osdRefresh(timeUs_t currentTimeUs)
@@ -945,20 +1145,28 @@ static void osdRefresh(timeUs_t currentTimeUs)
             displayHeartbeat(osdDisplayPort);
             return;
         } else {
-            displayClearScreen(osdDisplayPort);
+            osdRedrawAll = true;
             resumeRefreshAt = 0;
         }
     }
 
     blinkState = (currentTimeUs / 200000) % 2;
 
+    // Redraw everything now and then, for displays that may have lost what was drawn
+    if (cmpTimeUs(currentTimeUs, osdRedrawAllAt) >= 0) {
+        osdRedrawAll = true;
+        osdRedrawAllAt = currentTimeUs + REFRESH_1S;
+    }
+
 #ifdef CMS
     if (!displayIsGrabbed(osdDisplayPort)) {
         osdUpdateAlarms();
         osdDrawElements();
         displayHeartbeat(osdDisplayPort);
-#ifdef OSD_CALLS_CMS
     } else {
+        // the menu draws over the elements
+        osdRedrawAll = true;
+#ifdef OSD_CALLS_CMS
         cmsUpdate(currentTimeUs);
 #endif
     }
@@ -24,6 +24,11 @@
 
 #include "scheduler/scheduler.h"
 
+#ifdef SIMULATOR_BUILD
+#include "drivers/serial.h"
+#include "drivers/serial_tcp.h"
+#endif
+
 
 int main(void)
 {
@@ -32,7 +37,12 @@ int main(void)
         scheduler();
         processLoopback();
 #ifdef SIMULATOR_BUILD
+        tcpFlush();
+#ifdef SIMULATOR_LOCKSTEP
+        simulatorLockstepUpdate();
+#else
         delayMicroseconds_real(50); // max rate 20kHz
+#endif
 #endif
     }
     return 0;
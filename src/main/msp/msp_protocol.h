@@ -152,6 +152,8 @@
 #define MSP_ARMING_CONFIG               61 //out message         Returns auto_disarm_delay and disarm_kill_switch parameters
 #define MSP_SET_ARMING_CONFIG           62 //in message          Sets auto_disarm_delay and disarm_kill_switch parameters
 
+#define MSP_SET_STREAM                  63 //in message          Send the replies to a list of out messages at an interval, without requests
+
 //
 // Baseflight MSP commands (if enabled they exist in Cleanflight)
 //
@@ -211,6 +213,10 @@
 #define MSP_SENSOR_CONFIG               96
 #define MSP_SET_SENSOR_CONFIG           97
 
+#define MSP_DATAFLASH_LOG               98 //out message - get the start and end address of a log on the dataflash chip
+
+#define MSP_SDCARD_LATENCY              99 //out message         Get the histogram of SD card block read and write times
+
 //
 // OSD specific
 //
@@ -21,13 +21,17 @@
 
 #include "platform.h"
 
+#include "common/maths.h"
 #include "common/streambuf.h"
 #include "common/utils.h"
 #include "build/debug.h"
 
+#include "drivers/time.h"
+
 #include "io/serial.h"
 
 #include "msp/msp.h"
+#include "msp/msp_protocol.h"
 #include "msp/msp_serial.h"
 
 static mspPort_t mspPorts[MAX_MSP_PORT_COUNT];
@@ -71,6 +75,13 @@ void mspSerialReleasePortIfAllocated(serialPort_t *serialPort)
     }
 }
 
+// "$M<", size, command and checksum, no frame of either version is shorter
+#define MSP_MIN_FRAME_SIZE 6
+
+// MSP v2 frames have flags, a 16 bit command and a 16 bit size after "$X<", and a CRC8 DVB-S2 of all but "$X<" at the end
+#define MSP_V2_HEADER_SIZE 5
+#define MSP_V2_MIN_FRAME_SIZE (3 + MSP_V2_HEADER_SIZE + 1)
+
 static bool mspSerialProcessReceivedData(mspPort_t *mspPort, uint8_t c)
 {
     if (mspPort->c_state == MSP_IDLE) {
@@ -80,23 +91,39 @@ static bool mspSerialProcessReceivedData(mspPort_t *mspPort, uint8_t c)
             return false;
         }
     } else if (mspPort->c_state == MSP_HEADER_START) {
-        mspPort->c_state = (c == 'M') ? MSP_HEADER_M : MSP_IDLE;
-    } else if (mspPort->c_state == MSP_HEADER_M) {
+        switch (c) {
+            case 'M':
+                mspPort->mspVersion = MSP_V1;
+                mspPort->c_state = MSP_HEADER_M;
+                break;
+            case 'X':
+                mspPort->mspVersion = MSP_V2;
+                mspPort->c_state = MSP_HEADER_X;
+                break;
+            default:
+                mspPort->c_state = MSP_IDLE;
+                break;
+        }
+    } else if (mspPort->c_state == MSP_HEADER_M || mspPort->c_state == MSP_HEADER_X) {
+        const mspState_e arrowState = mspPort->c_state == MSP_HEADER_M ? MSP_HEADER_ARROW : MSP_HEADER_V2_ARROW;
         mspPort->c_state = MSP_IDLE;
         switch(c) {
             case '<': // COMMAND
                 mspPort->packetType = MSP_PACKET_COMMAND;
-                mspPort->c_state = MSP_HEADER_ARROW;
+                mspPort->c_state = arrowState;
                 break;
             case '>': // REPLY
                 mspPort->packetType = MSP_PACKET_REPLY;
-                mspPort->c_state = MSP_HEADER_ARROW;
+                mspPort->c_state = arrowState;
                 break;
             default:
                 break;
         }
+        mspPort->offset = 0;
+        mspPort->checksum = 0;
     } else if (mspPort->c_state == MSP_HEADER_ARROW) {
-        if (c > MSP_PORT_INBUF_SIZE) {
+        const uint16_t dataSize = c; // the inBuf only holds every v1 size on targets with a larger one
+        if (dataSize > MSP_PORT_INBUF_SIZE) {
             mspPort->c_state = MSP_IDLE;
         } else {
             mspPort->dataSize = c;
@@ -118,6 +145,30 @@ static bool mspSerialProcessReceivedData(mspPort_t *mspPort, uint8_t c)
         } else {
             mspPort->c_state = MSP_IDLE;
         }
+    } else if (mspPort->c_state == MSP_HEADER_V2_ARROW) {
+        // flags, command and size, collected in inBuf until the payload starts
+        mspPort->inBuf[mspPort->offset++] = c;
+        mspPort->checksum = crc8_dvb_s2(mspPort->checksum, c);
+        if (mspPort->offset == MSP_V2_HEADER_SIZE) {
+            const uint16_t dataSize = mspPort->inBuf[3] | (mspPort->inBuf[4] << 8);
+            if (dataSize > MSP_PORT_INBUF_SIZE) {
+                mspPort->c_state = MSP_IDLE;
+            } else {
+                mspPort->cmdMSP = mspPort->inBuf[1] | (mspPort->inBuf[2] << 8);
+                mspPort->dataSize = dataSize;
+                mspPort->offset = 0;
+                mspPort->c_state = MSP_HEADER_V2;
+            }
+        }
+    } else if (mspPort->c_state == MSP_HEADER_V2 && mspPort->offset < mspPort->dataSize) {
+        mspPort->checksum = crc8_dvb_s2(mspPort->checksum, c);
+        mspPort->inBuf[mspPort->offset++] = c;
+    } else if (mspPort->c_state == MSP_HEADER_V2 && mspPort->offset >= mspPort->dataSize) {
+        if (mspPort->checksum == c) {
+            mspPort->c_state = MSP_COMMAND_RECEIVED;
+        } else {
+            mspPort->c_state = MSP_IDLE;
+        }
     }
     return true;
 }
@@ -130,44 +181,176 @@ static uint8_t mspSerialChecksumBuf(uint8_t checksum, const uint8_t *data, int l
     return checksum;
 }
 
+/*
+ * The number of bytes that are sure to belong to the frame being received (or to the non MSP data in front of it),
+ * until the payload is reached.
+ */
+static int mspSerialHeaderBytesWanted(const mspPort_t *mspPort)
+{
+    switch (mspPort->c_state) {
+    case MSP_IDLE:
+        return MSP_MIN_FRAME_SIZE;
+    case MSP_HEADER_START:
+        return MSP_MIN_FRAME_SIZE - 1;
+    case MSP_HEADER_M:
+        return MSP_MIN_FRAME_SIZE - 2;
+    case MSP_HEADER_ARROW:
+        return MSP_MIN_FRAME_SIZE - 3;
+    case MSP_HEADER_SIZE:
+        return MSP_MIN_FRAME_SIZE - 4;
+    case MSP_HEADER_CMD:
+        return 1; // the checksum
+    case MSP_HEADER_X:
+        return MSP_V2_MIN_FRAME_SIZE - 2;
+    case MSP_HEADER_V2_ARROW:
+        return MSP_V2_HEADER_SIZE - mspPort->offset;
+    case MSP_HEADER_V2:
+        return 1; // the CRC
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Read the bytes waiting on the port a span at a time, up to the end of the first complete frame, so that any frames
+ * after it stay in the port's buffer for the next call.
+ *
+ * The payload is read straight into the port's inBuf, only the header and checksum bytes go through
+ * mspSerialProcessReceivedData() one at a time.
+ */
+static void mspSerialReceive(mspPort_t *mspPort, mspEvaluateNonMspData_e evaluateNonMspData)
+{
+    uint8_t header[MSP_V2_MIN_FRAME_SIZE];
+
+    while (mspPort->c_state != MSP_COMMAND_RECEIVED) {
+        if ((mspPort->c_state == MSP_HEADER_CMD || mspPort->c_state == MSP_HEADER_V2) && mspPort->offset < mspPort->dataSize) {
+            uint8_t *payload = &mspPort->inBuf[mspPort->offset];
+            const int len = serialReadBuf(mspPort->port, payload, mspPort->dataSize - mspPort->offset);
+            if (len == 0) {
+                break;
+            }
+            if (mspPort->mspVersion == MSP_V2) {
+                mspPort->checksum = crc8_dvb_s2_update(mspPort->checksum, payload, len);
+            } else {
+                mspPort->checksum = mspSerialChecksumBuf(mspPort->checksum, payload, len);
+            }
+            mspPort->offset += len;
+            continue;
+        }
+
+        const int len = serialReadBuf(mspPort->port, header, mspSerialHeaderBytesWanted(mspPort));
+        if (len == 0) {
+            break;
+        }
+
+        int i = 0;
+        if (mspPort->c_state == MSP_IDLE && evaluateNonMspData == MSP_SKIP_NON_MSP_DATA) {
+            // Nothing before the start of a frame needs to be looked at
+            const uint8_t *frameStart = memchr(header, '$', len);
+            i = frameStart ? frameStart - header : len;
+        }
+        for (; i < len; i++) {
+            const bool consumed = mspSerialProcessReceivedData(mspPort, header[i]);
+
+            if (!consumed && evaluateNonMspData == MSP_EVALUATE_NON_MSP_DATA) {
+                serialEvaluateNonMspData(mspPort->port, header[i]);
+            }
+        }
+    }
+}
+
 #define JUMBO_FRAME_SIZE_LIMIT 255
+#define MSP_MAX_HEADER_SIZE (3 + MSP_V2_HEADER_SIZE)
 
-static int mspSerialEncode(mspPort_t *msp, mspPacket_t *packet)
+static uint8_t mspSerialOutBuf[MSP_PORT_OUTBUF_SIZE];
+
+/*
+ * Fill in the header of a frame with a payload of len bytes, returns the length of the header.
+ */
+static int mspSerialFrameHeader(uint8_t *hdr, const mspPacket_t *packet, int len, mspVersion_e mspVersion)
 {
-    serialBeginWrite(msp->port);
-    const int len = sbufBytesRemaining(&packet->buf);
-    const int mspLen = len < JUMBO_FRAME_SIZE_LIMIT ? len : JUMBO_FRAME_SIZE_LIMIT;
-    uint8_t hdr[8] = {
-        '$',
-        'M',
-        packet->result == MSP_RESULT_ERROR ? '!' : packet->direction == MSP_DIRECTION_REPLY ? '>' : '<',
-        mspLen,
-        packet->cmd
-    };
-    int hdrLen = 5;
-#define CHECKSUM_STARTPOS 3  // checksum starts from mspLen field
+    hdr[0] = '$';
+    hdr[1] = mspVersion == MSP_V2 ? 'X' : 'M';
+    hdr[2] = packet->result == MSP_RESULT_ERROR ? '!' : packet->direction == MSP_DIRECTION_REPLY ? '>' : '<';
+    if (mspVersion == MSP_V2) {
+        hdr[3] = 0; // flags
+        hdr[4] = packet->cmd & 0xff;
+        hdr[5] = (packet->cmd >> 8) & 0xff;
+        hdr[6] = len & 0xff;
+        hdr[7] = (len >> 8) & 0xff;
+        return 3 + MSP_V2_HEADER_SIZE;
+    }
+
+    hdr[3] = len < JUMBO_FRAME_SIZE_LIMIT ? len : JUMBO_FRAME_SIZE_LIMIT;
+    hdr[4] = packet->cmd;
     if (len >= JUMBO_FRAME_SIZE_LIMIT) {
-        hdrLen += 2;
         hdr[5] = len & 0xff;
         hdr[6] = (len >> 8) & 0xff;
+        return 7;
+    }
+    return 5;
+}
+
+#define CHECKSUM_STARTPOS 3  // checksum starts from the size field in v1 and the flags field in v2
+
+static uint8_t mspSerialFrameChecksum(const uint8_t *hdr, int hdrLen, const uint8_t *data, int len, mspVersion_e mspVersion)
+{
+    if (mspVersion == MSP_V2) {
+        const uint8_t checksum = crc8_dvb_s2_update(0, hdr + CHECKSUM_STARTPOS, hdrLen - CHECKSUM_STARTPOS);
+        return crc8_dvb_s2_update(checksum, data, len);
     }
+    const uint8_t checksum = mspSerialChecksumBuf(0, hdr + CHECKSUM_STARTPOS, hdrLen - CHECKSUM_STARTPOS);
+    return mspSerialChecksumBuf(checksum, data, len);
+}
+
+static int mspSerialEncode(mspPort_t *msp, mspPacket_t *packet, mspVersion_e mspVersion)
+{
+    serialBeginWrite(msp->port);
+    const int len = sbufBytesRemaining(&packet->buf);
+    uint8_t hdr[MSP_MAX_HEADER_SIZE];
+    const int hdrLen = mspSerialFrameHeader(hdr, packet, len, mspVersion);
+    const uint8_t checksum = mspSerialFrameChecksum(hdr, hdrLen, sbufPtr(&packet->buf), len, mspVersion);
     serialWriteBuf(msp->port, hdr, hdrLen);
-    uint8_t checksum = mspSerialChecksumBuf(0, hdr + CHECKSUM_STARTPOS, hdrLen - CHECKSUM_STARTPOS);
     if (len > 0) {
         serialWriteBuf(msp->port, sbufPtr(&packet->buf), len);
-        checksum = mspSerialChecksumBuf(checksum, sbufPtr(&packet->buf), len);
     }
     serialWriteBuf(msp->port, &checksum, 1);
     serialEndWrite(msp->port);
     return sizeof(hdr) + len + 1; // header, data, and checksum
 }
 
-static mspPostProcessFnPtr mspSerialProcessReceivedCommand(mspPort_t *msp, mspProcessCommandFnPtr mspProcessCommandFn)
+/*
+ * MSP_SET_STREAM, an interval in milliseconds followed by the 16 bit ids of the out commands to send the replies of.
+ * An interval of 0 or no ids stops the stream.
+ */
+static mspResult_e mspSerialSetStream(mspPort_t *msp, sbuf_t *src)
 {
-    static uint8_t outBuf[MSP_PORT_OUTBUF_SIZE];
+    mspStream_t *stream = &msp->stream;
+
+    if (sbufBytesRemaining(src) < (int)sizeof(uint16_t)) {
+        return MSP_RESULT_ERROR;
+    }
+    const uint16_t intervalMs = sbufReadU16(src);
+    const int cmdCount = sbufBytesRemaining(src) / sizeof(uint16_t);
+    if (cmdCount > MSP_STREAM_MAX_COMMANDS) {
+        return MSP_RESULT_ERROR;
+    }
 
+    for (int i = 0; i < cmdCount; i++) {
+        stream->cmd[i] = sbufReadU16(src);
+    }
+    stream->cmdCount = intervalMs ? cmdCount : 0;
+    stream->mspVersion = msp->mspVersion;
+    stream->intervalUs = intervalMs * 1000;
+    stream->nextUs = micros();
+
+    return MSP_RESULT_ACK;
+}
+
+static mspPostProcessFnPtr mspSerialProcessReceivedCommand(mspPort_t *msp, mspProcessCommandFnPtr mspProcessCommandFn)
+{
     mspPacket_t reply = {
-        .buf = { .ptr = outBuf, .end = ARRAYEND(outBuf), },
+        .buf = { .ptr = mspSerialOutBuf, .end = ARRAYEND(mspSerialOutBuf), },
         .cmd = -1,
         .result = 0,
         .direction = MSP_DIRECTION_REPLY,
@@ -182,11 +365,18 @@ static mspPostProcessFnPtr mspSerialProcessReceivedCommand(mspPort_t *msp, mspPr
     };
 
     mspPostProcessFnPtr mspPostProcessFn = NULL;
-    const mspResult_e status = mspProcessCommandFn(&command, &reply, &mspPostProcessFn);
+    mspResult_e status;
+    if (msp->cmdMSP == MSP_SET_STREAM) {
+        // a stream belongs to the port it was asked for on, so it's not up to mspProcessCommandFn
+        reply.cmd = msp->cmdMSP;
+        reply.result = status = mspSerialSetStream(msp, &command.buf);
+    } else {
+        status = mspProcessCommandFn(&command, &reply, &mspPostProcessFn);
+    }
 
     if (status != MSP_RESULT_NO_REPLY) {
         sbufSwitchToReader(&reply.buf, outBufHead); // change streambuf direction
-        mspSerialEncode(msp, &reply);
+        mspSerialEncode(msp, &reply, msp->mspVersion); // reply in the version the command came in
     }
 
     return mspPostProcessFn;
@@ -224,25 +414,17 @@ void mspSerialProcess(mspEvaluateNonMspData_e evaluateNonMspData, mspProcessComm
 
         mspPostProcessFnPtr mspPostProcessFn = NULL;
 
-        while (serialRxBytesWaiting(mspPort->port)) {
+        // process one command at a time so as not to block.
+        mspSerialReceive(mspPort, evaluateNonMspData);
 
-            const uint8_t c = serialRead(mspPort->port);
-            const bool consumed = mspSerialProcessReceivedData(mspPort, c);
-
-            if (!consumed && evaluateNonMspData == MSP_EVALUATE_NON_MSP_DATA) {
-                serialEvaluateNonMspData(mspPort->port, c);
+        if (mspPort->c_state == MSP_COMMAND_RECEIVED) {
+            if (mspPort->packetType == MSP_PACKET_COMMAND) {
+                mspPostProcessFn = mspSerialProcessReceivedCommand(mspPort, mspProcessCommandFn);
+            } else if (mspPort->packetType == MSP_PACKET_REPLY) {
+                mspSerialProcessReceivedReply(mspPort, mspProcessReplyFn);
             }
 
-            if (mspPort->c_state == MSP_COMMAND_RECEIVED) {
-                if (mspPort->packetType == MSP_PACKET_COMMAND) {
-                    mspPostProcessFn = mspSerialProcessReceivedCommand(mspPort, mspProcessCommandFn);
-                } else if (mspPort->packetType == MSP_PACKET_REPLY) {
-                    mspSerialProcessReceivedReply(mspPort, mspProcessReplyFn);
-                }
-
-                mspPort->c_state = MSP_IDLE;
-                break; // process one command at a time so as not to block.
-            }
+            mspPort->c_state = MSP_IDLE;
         }
 
         if (mspPostProcessFn) {
@@ -252,6 +434,74 @@ void mspSerialProcess(mspEvaluateNonMspData_e evaluateNonMspData, mspProcessComm
     }
 }
 
+// Streamed replies are dropped rather than waited for when the port can't take them
+static void mspSerialWriteStream(mspPort_t *msp, const uint8_t *data, int len)
+{
+    if (len > 0 && serialTxBytesFree(msp->port) >= (uint32_t)len) {
+        serialWriteBuf(msp->port, data, len);
+    }
+}
+
+/*
+ * Send the replies of the ports' streams that are due, the frames for each port coalesced into one write.
+ *
+ * Called periodically by the scheduler, so a stream is no faster than the serial task.
+ */
+void mspSerialProcessStreams(timeUs_t currentTimeUs, mspProcessOutCommandFnPtr mspProcessOutCommandFn)
+{
+    static uint8_t streamBuf[MSP_PORT_STREAM_BUF_SIZE];
+
+    for (uint8_t portIndex = 0; portIndex < MAX_MSP_PORT_COUNT; portIndex++) {
+        mspPort_t * const mspPort = &mspPorts[portIndex];
+        mspStream_t * const stream = &mspPort->stream;
+        if (!mspPort->port || stream->cmdCount == 0 || cmpTimeUs(currentTimeUs, stream->nextUs) < 0) {
+            continue;
+        }
+
+        stream->nextUs += stream->intervalUs;
+        if (cmpTimeUs(currentTimeUs, stream->nextUs) >= 0) {
+            // fallen behind, don't try to catch up
+            stream->nextUs = currentTimeUs + stream->intervalUs;
+        }
+
+        int streamLen = 0;
+        for (int i = 0; i < stream->cmdCount; i++) {
+            mspPacket_t reply = {
+                .buf = { .ptr = mspSerialOutBuf, .end = ARRAYEND(mspSerialOutBuf), },
+                .cmd = stream->cmd[i],
+                .result = MSP_RESULT_ACK,
+                .direction = MSP_DIRECTION_REPLY,
+            };
+            if (!mspProcessOutCommandFn(stream->cmd[i], &reply.buf)) {
+                continue;
+            }
+            sbufSwitchToReader(&reply.buf, mspSerialOutBuf);
+
+            const mspVersion_e mspVersion = stream->cmd[i] > 0xff ? MSP_V2 : stream->mspVersion;
+            const int len = sbufBytesRemaining(&reply.buf);
+            const int frameLen = MSP_MAX_HEADER_SIZE + len + 1;
+            if (streamLen + frameLen > (int)sizeof(streamBuf)) {
+                mspSerialWriteStream(mspPort, streamBuf, streamLen);
+                streamLen = 0;
+                if (frameLen > (int)sizeof(streamBuf)) {
+                    // too big to coalesce
+                    if (serialTxBytesFree(mspPort->port) >= (uint32_t)frameLen) {
+                        mspSerialEncode(mspPort, &reply, mspVersion);
+                    }
+                    continue;
+                }
+            }
+
+            uint8_t *frame = &streamBuf[streamLen];
+            const int hdrLen = mspSerialFrameHeader(frame, &reply, len, mspVersion);
+            memcpy(frame + hdrLen, sbufPtr(&reply.buf), len);
+            frame[hdrLen + len] = mspSerialFrameChecksum(frame, hdrLen, frame + hdrLen, len, mspVersion);
+            streamLen += hdrLen + len + 1;
+        }
+        mspSerialWriteStream(mspPort, streamBuf, streamLen);
+    }
+}
+
 bool mspSerialWaiting(void)
 {
     for (uint8_t portIndex = 0; portIndex < MAX_MSP_PORT_COUNT; portIndex++) {
@@ -267,13 +517,25 @@ bool mspSerialWaiting(void)
     return false;
 }
 
+// Lets an event driven serial task run for the streams when no MSP data is waiting
+bool mspSerialStreamDue(timeUs_t currentTimeUs)
+{
+    for (uint8_t portIndex = 0; portIndex < MAX_MSP_PORT_COUNT; portIndex++) {
+        const mspPort_t * const mspPort = &mspPorts[portIndex];
+        if (mspPort->port && mspPort->stream.cmdCount > 0 && cmpTimeUs(currentTimeUs, mspPort->stream.nextUs) >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void mspSerialInit(void)
 {
     memset(mspPorts, 0, sizeof(mspPorts));
     mspSerialAllocatePorts();
 }
 
-int mspSerialPush(uint8_t cmd, uint8_t *data, int datalen, mspDirection_e direction)
+int mspSerialPush(uint16_t cmd, uint8_t *data, int datalen, mspDirection_e direction)
 {
     int ret = 0;
 
@@ -295,7 +557,8 @@ int mspSerialPush(uint8_t cmd, uint8_t *data, int datalen, mspDirection_e direct
             .direction = direction,
         };
 
-        ret = mspSerialEncode(mspPort, &push);
+        // commands that don't fit in a v1 frame go out as v2
+        ret = mspSerialEncode(mspPort, &push, cmd > 0xff ? MSP_V2 : MSP_V1);
     }
     return ret; // return the number of bytes written
 }
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include "common/time.h"
+
 #include "msp/msp.h"
 
 // Each MSP port requires state and a receive buffer, revisit this default if someone needs more than 3 MSP ports.
@@ -29,9 +31,17 @@ typedef enum {
     MSP_HEADER_ARROW,
     MSP_HEADER_SIZE,
     MSP_HEADER_CMD,
+    MSP_HEADER_X,
+    MSP_HEADER_V2_ARROW,
+    MSP_HEADER_V2,
     MSP_COMMAND_RECEIVED
 } mspState_e;
 
+typedef enum {
+    MSP_V1,
+    MSP_V2
+} mspVersion_e;
+
 typedef enum {
     MSP_PACKET_COMMAND,
     MSP_PACKET_REPLY
@@ -42,7 +52,12 @@ typedef enum {
     MSP_SKIP_NON_MSP_DATA
 } mspEvaluateNonMspData_e;
 
+// MSP v2 frames have a 16 bit size, so commands that set a whole parameter group fit in one frame where there's RAM for it
+#if defined(STM32F1) || defined(STM32F3)
 #define MSP_PORT_INBUF_SIZE 192
+#else
+#define MSP_PORT_INBUF_SIZE 1024
+#endif
 #ifdef USE_FLASHFS
 #ifdef STM32F1
 #define MSP_PORT_DATAFLASH_BUFFER_SIZE 1024
@@ -55,22 +70,38 @@ typedef enum {
 #define MSP_PORT_OUTBUF_SIZE 256
 #endif
 
+#define MSP_PORT_STREAM_BUF_SIZE 256
+#define MSP_STREAM_MAX_COMMANDS 8
+
+// The replies a client asked for with MSP_SET_STREAM, sent without further requests
+typedef struct mspStream_s {
+    uint16_t cmd[MSP_STREAM_MAX_COMMANDS];
+    uint8_t cmdCount;
+    mspVersion_e mspVersion;
+    timeUs_t intervalUs;
+    timeUs_t nextUs;
+} mspStream_t;
+
 struct serialPort_s;
 typedef struct mspPort_s {
     struct serialPort_s *port; // null when port unused.
-    uint8_t offset;
-    uint8_t dataSize;
+    uint16_t offset;
+    uint16_t dataSize;
     uint8_t checksum;
-    uint8_t cmdMSP;
+    uint16_t cmdMSP;
     mspState_e c_state;
     mspPacketType_e packetType;
+    mspVersion_e mspVersion;
+    mspStream_t stream;
     uint8_t inBuf[MSP_PORT_INBUF_SIZE];
 } mspPort_t;
 
 void mspSerialInit(void);
 bool mspSerialWaiting(void);
+bool mspSerialStreamDue(timeUs_t currentTimeUs);
 void mspSerialProcess(mspEvaluateNonMspData_e evaluateNonMspData, mspProcessCommandFnPtr mspProcessCommandFn, mspProcessReplyFnPtr mspProcessReplyFn);
+void mspSerialProcessStreams(timeUs_t currentTimeUs, mspProcessOutCommandFnPtr mspProcessOutCommandFn);
 void mspSerialAllocatePorts(void);
 void mspSerialReleasePortIfAllocated(struct serialPort_s *serialPort);
-int mspSerialPush(uint8_t cmd, uint8_t *data, int datalen, mspDirection_e direction);
+int mspSerialPush(uint16_t cmd, uint8_t *data, int datalen, mspDirection_e direction);
 uint32_t mspSerialTxBytesFree(void);
@@ -23,6 +23,7 @@
 
 #include "platform.h"
 
+#include "build/build_config.h"
 #include "build/debug.h"
 
 #include "scheduler/scheduler.h"
@@ -54,11 +55,184 @@ static int taskQueueSize = 0;
 
 static cfTask_t* taskQueueArray[TASK_COUNT + 1]; // extra item for NULL pointer at end of queue
 
+#ifdef USE_SCHEDULER_READY_QUEUE
+// Ready queue scheduling:
+// Time-driven tasks are kept in a binary min-heap ordered by the time they are next due
+// (lastExecutedAt + desiredPeriod), event-driven tasks (those with a checkFunc) are kept on
+// a separate list. Each scheduler pass only pops the tasks that are due, so its cost is
+// proportional to the number of due tasks rather than to the number of enabled tasks.
+// taskQueueArray is still maintained, it is the record of which tasks are enabled.
+
+#define TIMER_HEAP_POS_NONE     -1  // task is not in the ready queue
+#define TIMER_HEAP_POS_DETACHED -2  // task has been popped from the heap during the current scheduler pass
+
+STATIC_UNIT_TESTED cfTask_t *timerHeap[TASK_COUNT];
+STATIC_UNIT_TESTED int timerHeapSize = 0;
+STATIC_UNIT_TESTED int8_t timerHeapPos[TASK_COUNT];
+
+STATIC_UNIT_TESTED cfTask_t *eventTaskList[TASK_COUNT];
+STATIC_UNIT_TESTED int eventTaskCount = 0;
+
+// The position of each enabled task in taskQueueArray, ties in dynamic priority go to the task that comes first
+static uint8_t taskQueueIndex[TASK_COUNT];
+
+static inline int taskIndex(const cfTask_t *task)
+{
+    return task - cfTasks;
+}
+
+static inline timeUs_t taskDueAt(const cfTask_t *task)
+{
+    return task->lastExecutedAt + task->desiredPeriod;
+}
+
+static inline bool taskDueBefore(const cfTask_t *a, const cfTask_t *b)
+{
+    return (timeDelta_t)(taskDueAt(a) - taskDueAt(b)) < 0;
+}
+
+// returns the heap position of the task, or a negative value if it is not in the heap
+// (timerHeapPos is only valid after queueClear(), rescheduleTask() may be called before that)
+static int timerHeapFind(const cfTask_t *task)
+{
+    const int pos = timerHeapPos[taskIndex(task)];
+    return (pos >= 0 && pos < timerHeapSize && timerHeap[pos] == task) ? pos : TIMER_HEAP_POS_NONE;
+}
+
+static void timerHeapSet(int pos, cfTask_t *task)
+{
+    timerHeap[pos] = task;
+    timerHeapPos[taskIndex(task)] = pos;
+}
+
+static void timerHeapSiftUp(int pos)
+{
+    cfTask_t *task = timerHeap[pos];
+    while (pos > 0) {
+        const int parent = (pos - 1) / 2;
+        if (!taskDueBefore(task, timerHeap[parent])) {
+            break;
+        }
+        timerHeapSet(pos, timerHeap[parent]);
+        pos = parent;
+    }
+    timerHeapSet(pos, task);
+}
+
+static void timerHeapSiftDown(int pos)
+{
+    cfTask_t *task = timerHeap[pos];
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (child >= timerHeapSize) {
+            break;
+        }
+        if (child + 1 < timerHeapSize && taskDueBefore(timerHeap[child + 1], timerHeap[child])) {
+            ++child;
+        }
+        if (!taskDueBefore(timerHeap[child], task)) {
+            break;
+        }
+        timerHeapSet(pos, timerHeap[child]);
+        pos = child;
+    }
+    timerHeapSet(pos, task);
+}
+
+static void timerHeapPush(cfTask_t *task)
+{
+    timerHeap[timerHeapSize] = task;
+    timerHeapSiftUp(timerHeapSize++);
+}
+
+static void timerHeapRemoveAt(int pos)
+{
+    timerHeapPos[taskIndex(timerHeap[pos])] = TIMER_HEAP_POS_DETACHED;
+    if (--timerHeapSize > pos) {
+        cfTask_t *moved = timerHeap[timerHeapSize];
+        timerHeap[pos] = moved;
+        timerHeapSiftUp(pos);
+        timerHeapSiftDown(timerHeapPos[taskIndex(moved)]);
+    }
+}
+
+static void readyQueueClear(void)
+{
+    timerHeapSize = 0;
+    eventTaskCount = 0;
+    memset(timerHeapPos, TIMER_HEAP_POS_NONE, sizeof(timerHeapPos));
+}
+
+static void readyQueueAdd(cfTask_t *task)
+{
+    if (task->checkFunc) {
+        eventTaskList[eventTaskCount++] = task;
+    } else {
+        timerHeapPush(task);
+    }
+}
+
+static void readyQueueRemove(cfTask_t *task)
+{
+    if (task->checkFunc) {
+        for (int ii = 0; ii < eventTaskCount; ++ii) {
+            if (eventTaskList[ii] == task) {
+                memmove(&eventTaskList[ii], &eventTaskList[ii+1], sizeof(task) * (eventTaskCount - ii - 1));
+                --eventTaskCount;
+                break;
+            }
+        }
+    } else {
+        const int pos = timerHeapFind(task);
+        if (pos >= 0) {
+            timerHeapRemoveAt(pos);
+        }
+        timerHeapPos[taskIndex(task)] = TIMER_HEAP_POS_NONE;
+    }
+}
+
+static void readyQueueUpdateDeadline(cfTask_t *task)
+{
+    const int pos = timerHeapFind(task);
+    if (pos >= 0) {
+        timerHeapSiftUp(pos);
+        timerHeapSiftDown(timerHeapPos[taskIndex(task)]);
+    }
+}
+
+static void readyQueueUpdateQueueIndex(int fromPos)
+{
+    for (int ii = fromPos; ii < taskQueueSize; ++ii) {
+        taskQueueIndex[taskIndex(taskQueueArray[ii])] = ii;
+    }
+}
+
+// The same choice as the scan of taskQueueArray makes, the highest dynamic priority and the first task in the queue of those
+static inline bool taskSelectedBefore(const cfTask_t *task, const cfTask_t *selectedTask)
+{
+    return !selectedTask || task->dynamicPriority > selectedTask->dynamicPriority
+        || (task->dynamicPriority == selectedTask->dynamicPriority && taskQueueIndex[taskIndex(task)] < taskQueueIndex[taskIndex(selectedTask)]);
+}
+
+/*
+ * Returns a task popped from the scheduler pass to the heap, unless it was disabled while detached
+ */
+static void readyQueueReattach(cfTask_t *task)
+{
+    if (timerHeapPos[taskIndex(task)] == TIMER_HEAP_POS_DETACHED) {
+        timerHeapPush(task);
+    }
+}
+#endif
+
 void queueClear(void)
 {
     memset(taskQueueArray, 0, sizeof(taskQueueArray));
     taskQueuePos = 0;
     taskQueueSize = 0;
+#ifdef USE_SCHEDULER_READY_QUEUE
+    readyQueueClear();
+#endif
 }
 
 bool queueContains(cfTask_t *task)
@@ -81,6 +255,10 @@ bool queueAdd(cfTask_t *task)
             memmove(&taskQueueArray[ii+1], &taskQueueArray[ii], sizeof(task) * (taskQueueSize - ii));
             taskQueueArray[ii] = task;
             ++taskQueueSize;
+#ifdef USE_SCHEDULER_READY_QUEUE
+            readyQueueUpdateQueueIndex(ii);
+            readyQueueAdd(task);
+#endif
             return true;
         }
     }
@@ -93,6 +271,10 @@ bool queueRemove(cfTask_t *task)
         if (taskQueueArray[ii] == task) {
             memmove(&taskQueueArray[ii], &taskQueueArray[ii+1], sizeof(task) * (taskQueueSize - ii));
             --taskQueueSize;
+#ifdef USE_SCHEDULER_READY_QUEUE
+            readyQueueUpdateQueueIndex(ii);
+            readyQueueRemove(task);
+#endif
             return true;
         }
     }
@@ -166,6 +348,9 @@ void rescheduleTask(cfTaskId_e taskId, uint32_t newPeriodMicros)
     } else if (taskId < TASK_COUNT) {
         cfTask_t *task = &cfTasks[taskId];
         task->desiredPeriod = MAX(SCHEDULER_DELAY_LIMIT, newPeriodMicros);  // Limit delay to 100us (10 kHz) to prevent scheduler clogging
+#ifdef USE_SCHEDULER_READY_QUEUE
+        readyQueueUpdateDeadline(task);
+#endif
     }
 }
 
@@ -221,11 +406,108 @@ void schedulerInit(void)
     queueAdd(&cfTasks[TASK_SYSTEM]);
 }
 
-void scheduler(void)
+// Updates the dynamic priority of an event driven task, returns true if the task is waiting to be executed
+static bool schedulerUpdateEventTask(cfTask_t *task, timeUs_t currentTimeUs)
 {
-    // Cache currentTime
-    const timeUs_t currentTimeUs = micros();
+#if defined(SCHEDULER_DEBUG)
+    const timeUs_t currentTimeBeforeCheckFuncCall = micros();
+#else
+    const timeUs_t currentTimeBeforeCheckFuncCall = currentTimeUs;
+#endif
+    // Increase priority for event driven tasks
+    if (task->dynamicPriority > 0) {
+        task->taskAgeCycles = 1 + ((currentTimeUs - task->lastSignaledAt) / task->desiredPeriod);
+        task->dynamicPriority = 1 + task->staticPriority * task->taskAgeCycles;
+        return true;
+    } else if (task->checkFunc(currentTimeBeforeCheckFuncCall, currentTimeBeforeCheckFuncCall - task->lastExecutedAt)) {
+#if defined(SCHEDULER_DEBUG)
+        DEBUG_SET(DEBUG_SCHEDULER, 3, micros() - currentTimeBeforeCheckFuncCall);
+#endif
+#ifndef SKIP_TASK_STATISTICS
+        if (calculateTaskStatistics) {
+            const uint32_t checkFuncExecutionTime = micros() - currentTimeBeforeCheckFuncCall;
+            checkFuncMovingSumExecutionTime += checkFuncExecutionTime - checkFuncMovingSumExecutionTime / MOVING_SUM_COUNT;
+            checkFuncTotalExecutionTime += checkFuncExecutionTime;   // time consumed by scheduler + task
+            checkFuncMaxExecutionTime = MAX(checkFuncMaxExecutionTime, checkFuncExecutionTime);
+        }
+#endif
+        task->lastSignaledAt = currentTimeBeforeCheckFuncCall;
+        task->taskAgeCycles = 1;
+        task->dynamicPriority = 1 + task->staticPriority;
+        return true;
+    } else {
+        task->taskAgeCycles = 0;
+        return false;
+    }
+}
+
+static inline bool taskCanBeChosenForScheduling(const cfTask_t *task, bool outsideRealtimeGuardInterval)
+{
+    return (outsideRealtimeGuardInterval) ||
+        (task->taskAgeCycles > 1) ||
+        (task->staticPriority == TASK_PRIORITY_REALTIME);
+}
+
+#ifdef USE_SCHEDULER_READY_QUEUE
+static cfTask_t *schedulerSelectTask(timeUs_t currentTimeUs, uint16_t *waitingTasks)
+{
+    // Check for realtime tasks, event driven tasks are few and are not in the heap so check them directly
+    bool outsideRealtimeGuardInterval = true;
+    for (int ii = 0; ii < eventTaskCount; ++ii) {
+        const cfTask_t *task = eventTaskList[ii];
+        if (task->staticPriority >= TASK_PRIORITY_REALTIME && (timeDelta_t)(currentTimeUs - taskDueAt(task)) >= 0) {
+            outsideRealtimeGuardInterval = false;
+        }
+    }
+
+    // Detach all the time-driven tasks that are due from the heap
+    cfTask_t *dueTasks[TASK_COUNT];
+    int dueTaskCount = 0;
+    while (timerHeapSize > 0 && (timeDelta_t)(currentTimeUs - taskDueAt(timerHeap[0])) >= 0) {
+        cfTask_t *task = timerHeap[0];
+        timerHeapRemoveAt(0);
+        dueTasks[dueTaskCount++] = task;
+        if (task->staticPriority >= TASK_PRIORITY_REALTIME) {
+            outsideRealtimeGuardInterval = false;
+        }
+    }
+
+    cfTask_t *selectedTask = NULL;
 
+    for (int ii = 0; ii < eventTaskCount; ++ii) {
+        cfTask_t *task = eventTaskList[ii];
+        if (schedulerUpdateEventTask(task, currentTimeUs)) {
+            (*waitingTasks)++;
+        }
+        if (task->dynamicPriority > 0 && taskSelectedBefore(task, selectedTask) && taskCanBeChosenForScheduling(task, outsideRealtimeGuardInterval)) {
+            selectedTask = task;
+        }
+    }
+
+    for (int ii = 0; ii < dueTaskCount; ++ii) {
+        cfTask_t *task = dueTasks[ii];
+        // Task is time-driven, dynamicPriority is last execution age (measured in desiredPeriods)
+        task->taskAgeCycles = ((currentTimeUs - task->lastExecutedAt) / task->desiredPeriod);
+        task->dynamicPriority = 1 + task->staticPriority * task->taskAgeCycles;
+        (*waitingTasks)++;
+
+        if (taskSelectedBefore(task, selectedTask) && taskCanBeChosenForScheduling(task, outsideRealtimeGuardInterval)) {
+            selectedTask = task;
+        }
+    }
+
+    // Return the tasks that were not selected to the heap, the selected task is returned once it has been executed
+    for (int ii = 0; ii < dueTaskCount; ++ii) {
+        if (dueTasks[ii] != selectedTask) {
+            timerHeapPush(dueTasks[ii]);
+        }
+    }
+
+    return selectedTask;
+}
+#else
+static cfTask_t *schedulerSelectTask(timeUs_t currentTimeUs, uint16_t *waitingTasks)
+{
     // Check for realtime tasks
     bool outsideRealtimeGuardInterval = true;
     for (const cfTask_t *task = queueFirst(); task != NULL && task->staticPriority >= TASK_PRIORITY_REALTIME; task = queueNext()) {
@@ -241,38 +523,11 @@ void scheduler(void)
     uint16_t selectedTaskDynamicPriority = 0;
 
     // Update task dynamic priorities
-    uint16_t waitingTasks = 0;
     for (cfTask_t *task = queueFirst(); task != NULL; task = queueNext()) {
         // Task has checkFunc - event driven
         if (task->checkFunc) {
-#if defined(SCHEDULER_DEBUG)
-            const timeUs_t currentTimeBeforeCheckFuncCall = micros();
-#else
-            const timeUs_t currentTimeBeforeCheckFuncCall = currentTimeUs;
-#endif
-            // Increase priority for event driven tasks
-            if (task->dynamicPriority > 0) {
-                task->taskAgeCycles = 1 + ((currentTimeUs - task->lastSignaledAt) / task->desiredPeriod);
-                task->dynamicPriority = 1 + task->staticPriority * task->taskAgeCycles;
-                waitingTasks++;
-            } else if (task->checkFunc(currentTimeBeforeCheckFuncCall, currentTimeBeforeCheckFuncCall - task->lastExecutedAt)) {
-#if defined(SCHEDULER_DEBUG)
-                DEBUG_SET(DEBUG_SCHEDULER, 3, micros() - currentTimeBeforeCheckFuncCall);
-#endif
-#ifndef SKIP_TASK_STATISTICS
-                if (calculateTaskStatistics) {
-                    const uint32_t checkFuncExecutionTime = micros() - currentTimeBeforeCheckFuncCall;
-                    checkFuncMovingSumExecutionTime += checkFuncExecutionTime - checkFuncMovingSumExecutionTime / MOVING_SUM_COUNT;
-                    checkFuncTotalExecutionTime += checkFuncExecutionTime;   // time consumed by scheduler + task
-                    checkFuncMaxExecutionTime = MAX(checkFuncMaxExecutionTime, checkFuncExecutionTime);
-                }
-#endif
-                task->lastSignaledAt = currentTimeBeforeCheckFuncCall;
-                task->taskAgeCycles = 1;
-                task->dynamicPriority = 1 + task->staticPriority;
-                waitingTasks++;
-            } else {
-                task->taskAgeCycles = 0;
+            if (schedulerUpdateEventTask(task, currentTimeUs)) {
+                (*waitingTasks)++;
             }
         } else {
             // Task is time-driven, dynamicPriority is last execution age (measured in desiredPeriods)
@@ -280,22 +535,28 @@ void scheduler(void)
             task->taskAgeCycles = ((currentTimeUs - task->lastExecutedAt) / task->desiredPeriod);
             if (task->taskAgeCycles > 0) {
                 task->dynamicPriority = 1 + task->staticPriority * task->taskAgeCycles;
-                waitingTasks++;
+                (*waitingTasks)++;
             }
         }
 
-        if (task->dynamicPriority > selectedTaskDynamicPriority) {
-            const bool taskCanBeChosenForScheduling =
-                (outsideRealtimeGuardInterval) ||
-                (task->taskAgeCycles > 1) ||
-                (task->staticPriority == TASK_PRIORITY_REALTIME);
-            if (taskCanBeChosenForScheduling) {
-                selectedTaskDynamicPriority = task->dynamicPriority;
-                selectedTask = task;
-            }
+        if (task->dynamicPriority > selectedTaskDynamicPriority && taskCanBeChosenForScheduling(task, outsideRealtimeGuardInterval)) {
+            selectedTaskDynamicPriority = task->dynamicPriority;
+            selectedTask = task;
         }
     }
 
+    return selectedTask;
+}
+#endif
+
+void scheduler(void)
+{
+    // Cache currentTime
+    const timeUs_t currentTimeUs = micros();
+
+    uint16_t waitingTasks = 0;
+    cfTask_t *selectedTask = schedulerSelectTask(currentTimeUs, &waitingTasks);
+
     totalWaitingTasksSamples++;
     totalWaitingTasks += waitingTasks;
 
@@ -323,6 +584,11 @@ void scheduler(void)
         }
 
 #endif
+#ifdef USE_SCHEDULER_READY_QUEUE
+        if (!selectedTask->checkFunc) {
+            readyQueueReattach(selectedTask);
+        }
+#endif
 #if defined(SCHEDULER_DEBUG)
         DEBUG_SET(DEBUG_SCHEDULER, 2, micros() - currentTimeUs - taskExecutionTime); // time spent in scheduler
     } else {
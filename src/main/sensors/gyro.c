@@ -27,6 +27,7 @@
 #include "common/axis.h"
 #include "common/maths.h"
 #include "common/filter.h"
+#include "common/utils.h"
 
 #include "config/parameter_group.h"
 #include "config/parameter_group_ids.h"
@@ -77,29 +78,35 @@ typedef struct gyroCalibration_s {
     uint16_t calibratingG;
 } gyroCalibration_t;
 
-typedef union gyroSoftFilter_u {
-    biquadFilter_t gyroFilterLpfState[XYZ_AXIS_COUNT];
-    pt1Filter_t gyroFilterPt1State[XYZ_AXIS_COUNT];
-    firFilterDenoise_t gyroDenoiseState[XYZ_AXIS_COUNT];
-} gyroSoftLpfFilter_t;
-
 typedef struct gyroSensor_s {
     gyroDev_t gyroDev;
     gyroCalibration_t calibration;
-    // gyro soft filter
-    filterApplyFnPtr softLpfFilterApplyFn;
-    gyroSoftLpfFilter_t softLpfFilter;
-    void *softLpfFilterPtr[XYZ_AXIS_COUNT];
-    // notch filters
-    filterApplyFnPtr notchFilter1ApplyFn;
-    biquadFilter_t notchFilter1[XYZ_AXIS_COUNT];
-    filterApplyFnPtr notchFilter2ApplyFn;
-    biquadFilter_t notchFilter2[XYZ_AXIS_COUNT];
+    // static notch filters followed by the gyro soft filter, applied to all axes at once
+    filterBank_t filterBank;
+    uint8_t notchFilterStageCount;
+    // gyro soft filter when it is a denoise filter, which cannot be part of the filter bank
+    bool softLpfDenoise;
+    firFilterDenoise_t softLpfDenoiseState[XYZ_AXIS_COUNT];
+    // dynamic notch filter
     filterApplyFnPtr notchFilterDynApplyFn;
-    biquadFilter_t notchFilterDyn[XYZ_AXIS_COUNT];
+    uint8_t notchFilterDynCount;
+    biquadFilter_t notchFilterDyn[XYZ_AXIS_COUNT][GYRO_DYN_NOTCH_COUNT_MAX];
+    // filtered output of this sensor, combined with the other sensors in gyroUpdate
+    float gyroADCf[XYZ_AXIS_COUNT];
+    // sensor health
+    uint8_t readErrorCount;                    // consecutive failed reads
+    float previousRate[XYZ_AXIS_COUNT];        // unfiltered rate of the previous sample
+    pt1Filter_t noiseFilter;                   // smooths the squared change between samples
+    float noiseVariance;
 } gyroSensor_t;
 
-static gyroSensor_t gyroSensor0;
+// the sensors in use, the first one is the primary sensor which also provides the bus for the accelerometer
+static gyroSensor_t gyroSensors[MAX_GYRO_COUNT];
+static uint8_t gyroSensorsInUse;
+
+#define GYRO_HEALTH_READ_ERROR_LIMIT    10      // consecutive failed reads before a sensor is considered unhealthy
+#define GYRO_HEALTH_NOISE_CUTOFF_HZ     5       // cutoff of the noise variance estimate
+#define GYRO_HEALTH_NOISE_MIN_VARIANCE  0.01f   // lower bound of the noise variance, limits the weight of a quiet sensor
 
 static void gyroInitSensorFilters(gyroSensor_t *gyroSensor);
 
@@ -113,7 +120,7 @@ static void gyroInitSensorFilters(gyroSensor_t *gyroSensor);
 #define GYRO_SYNC_DENOM_DEFAULT 4
 #endif
 
-PG_REGISTER_WITH_RESET_TEMPLATE(gyroConfig_t, gyroConfig, PG_GYRO_CONFIG, 0);
+PG_REGISTER_WITH_RESET_TEMPLATE(gyroConfig_t, gyroConfig, PG_GYRO_CONFIG, 2);
 
 PG_RESET_TEMPLATE(gyroConfig_t, gyroConfig,
     .gyro_align = ALIGN_DEFAULT,
@@ -125,26 +132,28 @@ PG_RESET_TEMPLATE(gyroConfig_t, gyroConfig,
     .gyro_isr_update = false,
     .gyro_use_32khz = false,
     .gyro_to_use = 0,
+    .gyro_fusion = GYRO_FUSION_AVERAGE,
     .gyro_soft_notch_hz_1 = 400,
     .gyro_soft_notch_cutoff_1 = 300,
     .gyro_soft_notch_hz_2 = 200,
-    .gyro_soft_notch_cutoff_2 = 100
+    .gyro_soft_notch_cutoff_2 = 100,
+    .dyn_notch_count = 1
 );
 
 
 const busDevice_t *gyroSensorBus(void)
 {
-    return &gyroSensor0.gyroDev.bus;
+    return &gyroSensors[0].gyroDev.bus;
 }
 
 const mpuConfiguration_t *gyroMpuConfiguration(void)
 {
-    return &gyroSensor0.gyroDev.mpuConfiguration;
+    return &gyroSensors[0].gyroDev.mpuConfiguration;
 }
 
 const mpuDetectionResult_t *gyroMpuDetectionResult(void)
 {
-    return &gyroSensor0.gyroDev.mpuDetectionResult;
+    return &gyroSensors[0].gyroDev.mpuDetectionResult;
 }
 
 STATIC_UNIT_TESTED gyroSensor_e gyroDetect(gyroDev_t *dev)
@@ -298,8 +307,20 @@ STATIC_UNIT_TESTED gyroSensor_e gyroDetect(gyroDev_t *dev)
     return gyroHardware;
 }
 
-static bool gyroInitSensor(gyroSensor_t *gyroSensor)
+#ifdef USE_DUAL_GYRO
+// chip select pins of the gyros, set using GYRO_n_CS_PIN defined in target.h
+static const ioTag_t gyroCsPinTags[MAX_GYRO_COUNT] = {
+    IO_TAG(GYRO_0_CS_PIN),
+    IO_TAG(GYRO_1_CS_PIN),
+#if MAX_GYRO_COUNT > 2
+    IO_TAG(GYRO_2_CS_PIN),
+#endif
+};
+#endif
+
+static gyroSensor_e gyroDetectSensor(gyroSensor_t *gyroSensor, uint8_t gyroIndex)
 {
+    UNUSED(gyroIndex);
 #if defined(USE_GYRO_MPU6050) || defined(USE_GYRO_MPU3050) || defined(USE_GYRO_MPU6500) || defined(USE_GYRO_SPI_MPU6500) || defined(USE_GYRO_SPI_MPU6000) || defined(USE_ACC_MPU6050) || defined(USE_GYRO_SPI_MPU9250) || defined(USE_GYRO_SPI_ICM20601) || defined(USE_GYRO_SPI_ICM20689)
 
 #if defined(MPU_INT_EXTI)
@@ -309,10 +330,13 @@ static bool gyroInitSensor(gyroSensor_t *gyroSensor)
 #else
     gyroSensor->gyroDev.mpuIntExtiTag =  IO_TAG_NONE;
 #endif // MPU_INT_EXTI
+    if (gyroSensor != &gyroSensors[0]) {
+        // only the data ready interrupt of the primary sensor is used, the other sensors are read along with it
+        gyroSensor->gyroDev.mpuIntExtiTag = IO_TAG_NONE;
+    }
 
 #ifdef USE_DUAL_GYRO
-    // set cnsPin using GYRO_n_CS_PIN defined in target.h
-    gyroSensor->gyroDev.bus.spi.csnPin = gyroConfig()->gyro_to_use == 0 ? IOGetByTag(IO_TAG(GYRO_0_CS_PIN)) : IOGetByTag(IO_TAG(GYRO_1_CS_PIN));
+    gyroSensor->gyroDev.bus.spi.csnPin = IOGetByTag(gyroCsPinTags[gyroIndex]);
 #else
     gyroSensor->gyroDev.bus.spi.csnPin = IO_NONE; // set cnsPin to IO_NONE so mpuDetect will set it according to value defined in target.h
 #endif // USE_DUAL_GYRO
@@ -321,11 +345,8 @@ static bool gyroInitSensor(gyroSensor_t *gyroSensor)
 #endif
 
     const gyroSensor_e gyroHardware = gyroDetect(&gyroSensor->gyroDev);
-    if (gyroHardware == GYRO_NONE) {
-        return false;
-    }
-
     switch (gyroHardware) {
+    case GYRO_NONE:
     case GYRO_MPU6500:
     case GYRO_MPU9250:
     case GYRO_ICM20601:
@@ -340,53 +361,85 @@ static bool gyroInitSensor(gyroSensor_t *gyroSensor)
         break;
     }
 
+    return gyroHardware;
+}
+
+static void gyroInitSensor(gyroSensor_t *gyroSensor)
+{
     // Must set gyro targetLooptime before gyroDev.init and initialisation of filters
-    gyro.targetLooptime = gyroSetSampleRate(&gyroSensor->gyroDev, gyroConfig()->gyro_lpf, gyroConfig()->gyro_sync_denom, gyroConfig()->gyro_use_32khz);
+    // all sensors run at the sample rate of the primary sensor
+    const uint32_t targetLooptime = gyroSetSampleRate(&gyroSensor->gyroDev, gyroConfig()->gyro_lpf, gyroConfig()->gyro_sync_denom, gyroConfig()->gyro_use_32khz);
+    if (gyroSensor == &gyroSensors[0]) {
+        gyro.targetLooptime = targetLooptime;
+    }
     gyroSensor->gyroDev.lpf = gyroConfig()->gyro_lpf;
     gyroSensor->gyroDev.initFn(&gyroSensor->gyroDev);
-    if (gyroConfig()->gyro_align != ALIGN_DEFAULT) {
+    if (gyroConfig()->gyro_align != ALIGN_DEFAULT && gyroSensorsInUse == 1) {
+        // with multiple sensors each one keeps the alignment defined for it in target.h
         gyroSensor->gyroDev.gyroAlign = gyroConfig()->gyro_align;
     }
     gyroInitSensorFilters(gyroSensor);
-#ifdef USE_GYRO_DATA_ANALYSE
-    gyroDataAnalyseInit(gyro.targetLooptime);
-#endif
-    return true;
 }
 
 bool gyroInit(void)
 {
     memset(&gyro, 0, sizeof(gyro));
-    return gyroInitSensor(&gyroSensor0);
+    memset(gyroSensors, 0, sizeof(gyroSensors));
+    gyroSensorsInUse = 0;
+
+    gyroSensor_e primaryGyroHardware = GYRO_NONE;
+    for (int gyroIndex = 0; gyroIndex < MAX_GYRO_COUNT; gyroIndex++) {
+        if (gyroConfig()->gyro_to_use != GYRO_TO_USE_ALL && gyroConfig()->gyro_to_use != gyroIndex) {
+            continue;
+        }
+        const gyroSensor_e gyroHardware = gyroDetectSensor(&gyroSensors[gyroSensorsInUse], gyroIndex);
+        if (gyroHardware != GYRO_NONE) {
+            if (gyroSensorsInUse == 0) {
+                primaryGyroHardware = gyroHardware;
+            }
+            gyroSensorsInUse++;
+        }
+    }
+    if (gyroSensorsInUse == 0) {
+        return false;
+    }
+    detectedSensors[SENSOR_INDEX_GYRO] = primaryGyroHardware;
+
+    // initialise once all sensors are detected, since detection may disable 32kHz sampling for all of them
+    for (int ii = 0; ii < gyroSensorsInUse; ii++) {
+        gyroInitSensor(&gyroSensors[ii]);
+    }
+#ifdef USE_GYRO_DATA_ANALYSE
+    gyroDataAnalyseInit(gyro.targetLooptime);
+#endif
+    return true;
 }
 
 void gyroInitFilterLpf(gyroSensor_t *gyroSensor, uint8_t lpfHz)
 {
-    gyroSensor->softLpfFilterApplyFn = nullFilterApply;
+    gyroSensor->softLpfDenoise = false;
     const uint32_t gyroFrequencyNyquist = 1000000 / 2 / gyro.targetLooptime;
 
     if (lpfHz && lpfHz <= gyroFrequencyNyquist) {  // Initialisation needs to happen once samplingrate is known
         switch (gyroConfig()->gyro_soft_lpf_type) {
-        case FILTER_BIQUAD:
-            gyroSensor->softLpfFilterApplyFn = (filterApplyFnPtr)biquadFilterApply;
-            for (int axis = 0; axis < 3; axis++) {
-                gyroSensor->softLpfFilterPtr[axis] = &gyroSensor->softLpfFilter.gyroFilterLpfState[axis];
-                biquadFilterInitLPF(&gyroSensor->softLpfFilter.gyroFilterLpfState[axis], lpfHz, gyro.targetLooptime);
-            }
+        case FILTER_BIQUAD: {
+            biquadFilter_t lpfFilter;
+            biquadFilterInitLPF(&lpfFilter, lpfHz, gyro.targetLooptime);
+            filterBankAddBiquad(&gyroSensor->filterBank, &lpfFilter);
             break;
-        case FILTER_PT1:
-            gyroSensor->softLpfFilterApplyFn = (filterApplyFnPtr)pt1FilterApply;
+        }
+        case FILTER_PT1: {
+            pt1Filter_t lpfFilter;
             const float gyroDt = (float) gyro.targetLooptime * 0.000001f;
-            for (int axis = 0; axis < 3; axis++) {
-                gyroSensor->softLpfFilterPtr[axis] = &gyroSensor->softLpfFilter.gyroFilterPt1State[axis];
-                pt1FilterInit(&gyroSensor->softLpfFilter.gyroFilterPt1State[axis], lpfHz, gyroDt);
-            }
+            pt1FilterInit(&lpfFilter, lpfHz, gyroDt);
+            filterBankAddPt1(&gyroSensor->filterBank, &lpfFilter);
             break;
+        }
         default:
-            gyroSensor->softLpfFilterApplyFn = (filterApplyFnPtr)firFilterDenoiseUpdate;
+            gyroSensor->softLpfDenoise = true;
+            memset(gyroSensor->softLpfDenoiseState, 0, sizeof(gyroSensor->softLpfDenoiseState));
             for (int axis = 0; axis < 3; axis++) {
-                gyroSensor->softLpfFilterPtr[axis] = &gyroSensor->softLpfFilter.gyroDenoiseState[axis];
-                firFilterDenoiseInit(&gyroSensor->softLpfFilter.gyroDenoiseState[axis], lpfHz, gyro.targetLooptime);
+                firFilterDenoiseInit(&gyroSensor->softLpfDenoiseState[axis], lpfHz, gyro.targetLooptime);
             }
             break;
         }
@@ -407,56 +460,49 @@ static uint16_t calculateNyquistAdjustedNotchHz(uint16_t notchHz, uint16_t notch
     return notchHz;
 }
 
-void gyroInitFilterNotch1(gyroSensor_t *gyroSensor, uint16_t notchHz, uint16_t notchCutoffHz)
+void gyroInitFilterNotch(gyroSensor_t *gyroSensor, uint16_t notchHz, uint16_t notchCutoffHz)
 {
-    gyroSensor->notchFilter1ApplyFn = nullFilterApply;
-
     notchHz = calculateNyquistAdjustedNotchHz(notchHz, notchCutoffHz);
 
     if (notchHz) {
-        gyroSensor->notchFilter1ApplyFn = (filterApplyFnPtr)biquadFilterApply;
+        biquadFilter_t notchFilter;
         const float notchQ = filterGetNotchQ(notchHz, notchCutoffHz);
-        for (int axis = 0; axis < 3; axis++) {
-            biquadFilterInit(&gyroSensor->notchFilter1[axis], notchHz, gyro.targetLooptime, notchQ, FILTER_NOTCH);
-        }
-    }
-}
-
-void gyroInitFilterNotch2(gyroSensor_t *gyroSensor, uint16_t notchHz, uint16_t notchCutoffHz)
-{
-    gyroSensor->notchFilter2ApplyFn = nullFilterApply;
-
-    notchHz = calculateNyquistAdjustedNotchHz(notchHz, notchCutoffHz);
-
-    if (notchHz) {
-        gyroSensor->notchFilter2ApplyFn = (filterApplyFnPtr)biquadFilterApply;
-        const float notchQ = filterGetNotchQ(notchHz, notchCutoffHz);
-        for (int axis = 0; axis < 3; axis++) {
-            biquadFilterInit(&gyroSensor->notchFilter2[axis], notchHz, gyro.targetLooptime, notchQ, FILTER_NOTCH);
-        }
+        biquadFilterInit(&notchFilter, notchHz, gyro.targetLooptime, notchQ, FILTER_NOTCH);
+        filterBankAddBiquad(&gyroSensor->filterBank, &notchFilter);
     }
 }
 
 void gyroInitFilterDynamicNotch(gyroSensor_t *gyroSensor)
 {
     gyroSensor->notchFilterDynApplyFn = (filterApplyFnPtr)biquadFilterApplyDF1; // must be this function, not DF2
+    gyroSensor->notchFilterDynCount = constrain(gyroConfig()->dyn_notch_count, 1, GYRO_DYN_NOTCH_COUNT_MAX);
     const float notchQ = filterGetNotchQ(400, 390); //just any init value
     for (int axis = 0; axis < 3; axis++) {
-        biquadFilterInit(&gyroSensor->notchFilterDyn[axis], 400, gyro.targetLooptime, notchQ, FILTER_NOTCH);
+        for (int notch = 0; notch < GYRO_DYN_NOTCH_COUNT_MAX; notch++) {
+            biquadFilterInit(&gyroSensor->notchFilterDyn[axis][notch], 400, gyro.targetLooptime, notchQ, FILTER_NOTCH);
+        }
     }
 }
 
 static void gyroInitSensorFilters(gyroSensor_t *gyroSensor)
 {
+    // filter bank stages are applied in the order they are added
+    filterBankInit(&gyroSensor->filterBank);
+    gyroInitFilterNotch(gyroSensor, gyroConfig()->gyro_soft_notch_hz_1, gyroConfig()->gyro_soft_notch_cutoff_1);
+    gyroInitFilterNotch(gyroSensor, gyroConfig()->gyro_soft_notch_hz_2, gyroConfig()->gyro_soft_notch_cutoff_2);
+    gyroSensor->notchFilterStageCount = gyroSensor->filterBank.stageCount;
     gyroInitFilterLpf(gyroSensor, gyroConfig()->gyro_soft_lpf_hz);
-    gyroInitFilterNotch1(gyroSensor, gyroConfig()->gyro_soft_notch_hz_1, gyroConfig()->gyro_soft_notch_cutoff_1);
-    gyroInitFilterNotch2(gyroSensor, gyroConfig()->gyro_soft_notch_hz_2, gyroConfig()->gyro_soft_notch_cutoff_2);
     gyroInitFilterDynamicNotch(gyroSensor);
+
+    memset(&gyroSensor->noiseFilter, 0, sizeof(gyroSensor->noiseFilter));
+    pt1FilterInit(&gyroSensor->noiseFilter, GYRO_HEALTH_NOISE_CUTOFF_HZ, gyro.targetLooptime * 0.000001f);
 }
 
 void gyroInitFilters(void)
 {
-    gyroInitSensorFilters(&gyroSensor0);
+    for (int ii = 0; ii < gyroSensorsInUse; ii++) {
+        gyroInitSensorFilters(&gyroSensors[ii]);
+    }
 }
 
 bool isGyroSensorCalibrationComplete(const gyroSensor_t *gyroSensor)
@@ -464,9 +510,24 @@ bool isGyroSensorCalibrationComplete(const gyroSensor_t *gyroSensor)
     return gyroSensor->calibration.calibratingG == 0;
 }
 
+static bool isGyroSensorHealthy(const gyroSensor_t *gyroSensor)
+{
+    return gyroSensor->readErrorCount < GYRO_HEALTH_READ_ERROR_LIMIT;
+}
+
+// a sensor that fails during calibration must not prevent arming, so only healthy sensors are considered
 bool isGyroCalibrationComplete(void)
 {
-    return isGyroSensorCalibrationComplete(&gyroSensor0);
+    bool healthySensorFound = false;
+    for (int ii = 0; ii < gyroSensorsInUse; ii++) {
+        if (isGyroSensorHealthy(&gyroSensors[ii])) {
+            if (!isGyroSensorCalibrationComplete(&gyroSensors[ii])) {
+                return false;
+            }
+            healthySensorFound = true;
+        }
+    }
+    return healthySensorFound || isGyroSensorCalibrationComplete(&gyroSensors[0]);
 }
 
 static bool isOnFinalGyroCalibrationCycle(const gyroCalibration_t *gyroCalibration)
@@ -491,7 +552,9 @@ static void gyroSetCalibrationCycles(gyroSensor_t *gyroSensor)
 
 void gyroStartCalibration(void)
 {
-    gyroSetCalibrationCycles(&gyroSensor0);
+    for (int ii = 0; ii < gyroSensorsInUse; ii++) {
+        gyroSetCalibrationCycles(&gyroSensors[ii]);
+    }
 }
 
 STATIC_UNIT_TESTED void performGyroCalibration(gyroSensor_t *gyroSensor, uint8_t gyroMovementCalibrationThreshold)
@@ -534,10 +597,13 @@ STATIC_UNIT_TESTED void performGyroCalibration(gyroSensor_t *gyroSensor, uint8_t
 void gyroUpdateSensor(gyroSensor_t *gyroSensor)
 {
     if (!gyroSensor->gyroDev.readFn(&gyroSensor->gyroDev)) {
-
+        if (gyroSensor->readErrorCount < GYRO_HEALTH_READ_ERROR_LIMIT) {
+            gyroSensor->readErrorCount++;
+        }
         return;
     }
     gyroSensor->gyroDev.dataReady = false;
+    gyroSensor->readErrorCount = 0;
 
     if (isGyroSensorCalibrationComplete(gyroSensor)) {
         // move gyro data into 32-bit variables to avoid overflows in calculations
@@ -549,64 +615,180 @@ void gyroUpdateSensor(gyroSensor_t *gyroSensor)
     } else {
         performGyroCalibration(gyroSensor, gyroConfig()->gyroMovementCalibrationThreshold);
         // Reset gyro values to zero to prevent other code from using uncalibrated data
-        gyro.gyroADCf[X] = 0.0f;
-        gyro.gyroADCf[Y] = 0.0f;
-        gyro.gyroADCf[Z] = 0.0f;
+        gyroSensor->gyroADCf[X] = 0.0f;
+        gyroSensor->gyroADCf[Y] = 0.0f;
+        gyroSensor->gyroADCf[Z] = 0.0f;
         // still calibrating, so no need to further process gyro data
         return;
     }
 
 #ifdef USE_GYRO_DATA_ANALYSE
-    gyroDataAnalyse(&gyroSensor->gyroDev, gyroSensor->notchFilterDyn);
+    // the noise spectrum is analysed on the primary sensor, the other sensors copy its notches in gyroUpdate
+    if (gyroSensor == &gyroSensors[0]) {
+        gyroDataAnalyse(&gyroSensor->gyroDev, gyroSensor->notchFilterDyn);
+    }
 #endif
 
+    float gyroADCf[XYZ_AXIS_COUNT];
+    float sampleChangeSquared = 0;
     for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
         // scale gyro output to degrees per second
-        float gyroADCf = (float)gyroSensor->gyroDev.gyroADC[axis] * gyroSensor->gyroDev.scale;
+        gyroADCf[axis] = (float)gyroSensor->gyroDev.gyroADC[axis] * gyroSensor->gyroDev.scale;
+
+        // the change between samples is dominated by noise, its variance is used to weight the sensor
+        const float sampleChange = gyroADCf[axis] - gyroSensor->previousRate[axis];
+        sampleChangeSquared += sampleChange * sampleChange;
+        gyroSensor->previousRate[axis] = gyroADCf[axis];
 
 #ifdef USE_GYRO_DATA_ANALYSE
         // Apply Dynamic Notch filtering
         if (axis == 0)
-            DEBUG_SET(DEBUG_FFT, 0, lrintf(gyroADCf)); // store raw data
+            DEBUG_SET(DEBUG_FFT, 0, lrintf(gyroADCf[axis])); // store raw data
 
-        if (isDynamicFilterActive())
-            gyroADCf = gyroSensor->notchFilterDynApplyFn(&gyroSensor->notchFilterDyn[axis], gyroADCf);
+        if (isDynamicFilterActive()) {
+            for (int notch = 0; notch < gyroSensor->notchFilterDynCount; notch++) {
+                gyroADCf[axis] = gyroSensor->notchFilterDynApplyFn(&gyroSensor->notchFilterDyn[axis][notch], gyroADCf[axis]);
+            }
+        }
 
         if (axis == 0)
-            DEBUG_SET(DEBUG_FFT, 1, lrintf(gyroADCf)); // store data after dynamic notch
+            DEBUG_SET(DEBUG_FFT, 1, lrintf(gyroADCf[axis])); // store data after dynamic notch
 #endif
+        DEBUG_SET(DEBUG_NOTCH, axis, lrintf(gyroADCf[axis]));
+    }
 
-        // Apply Static Notch filtering
-        DEBUG_SET(DEBUG_NOTCH, axis, lrintf(gyroADCf));
-        gyroADCf = gyroSensor->notchFilter1ApplyFn(&gyroSensor->notchFilter1[axis], gyroADCf);
-        gyroADCf = gyroSensor->notchFilter2ApplyFn(&gyroSensor->notchFilter2[axis], gyroADCf);
+    // Apply Static Notch filtering and LPF
+    if (debugMode == DEBUG_GYRO) {
+        filterBankApplyStages(&gyroSensor->filterBank, gyroADCf, 0, gyroSensor->notchFilterStageCount);
+        for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+            debug[axis] = lrintf(gyroADCf[axis]);
+        }
+        filterBankApplyStages(&gyroSensor->filterBank, gyroADCf, gyroSensor->notchFilterStageCount, gyroSensor->filterBank.stageCount);
+    } else {
+        filterBankApply(&gyroSensor->filterBank, gyroADCf);
+    }
 
-        // Apply LPF
-        DEBUG_SET(DEBUG_GYRO, axis, lrintf(gyroADCf));
-        gyroADCf = gyroSensor->softLpfFilterApplyFn(gyroSensor->softLpfFilterPtr[axis], gyroADCf);
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        if (gyroSensor->softLpfDenoise) {
+            gyroADCf[axis] = firFilterDenoiseUpdate(&gyroSensor->softLpfDenoiseState[axis], gyroADCf[axis]);
+        }
+        gyroSensor->gyroADCf[axis] = gyroADCf[axis];
+    }
+    gyroSensor->noiseVariance = pt1FilterApply(&gyroSensor->noiseFilter, sampleChangeSquared);
+}
 
-        gyro.gyroADCf[axis] = gyroADCf;
+// combines the rates of the healthy sensors, the first one being the one with the lowest index
+STATIC_UNIT_TESTED void gyroFuseRates(gyroFusion_e fusion, float rates[][XYZ_AXIS_COUNT], const float *noiseVariance, int sensorCount, float *gyroADCf)
+{
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        if (sensorCount == 1 || fusion == GYRO_FUSION_FAILOVER) {
+            gyroADCf[axis] = rates[0][axis];
+        } else if (fusion == GYRO_FUSION_MEDIAN && sensorCount == 3) {
+            float axisRates[3] = { rates[0][axis], rates[1][axis], rates[2][axis] };
+            gyroADCf[axis] = quickMedianFilter3f(axisRates);
+        } else if (fusion == GYRO_FUSION_WEIGHTED) {
+            // inverse variance weighting, the less noisy a sensor the more it contributes
+            float weightedSum = 0;
+            float weightSum = 0;
+            for (int ii = 0; ii < sensorCount; ii++) {
+                const float weight = 1.0f / MAX(noiseVariance[ii], GYRO_HEALTH_NOISE_MIN_VARIANCE);
+                weightedSum += weight * rates[ii][axis];
+                weightSum += weight;
+            }
+            gyroADCf[axis] = weightedSum / weightSum;
+        } else {
+            // average, also used by the median with only two sensors
+            float sum = 0;
+            for (int ii = 0; ii < sensorCount; ii++) {
+                sum += rates[ii][axis];
+            }
+            gyroADCf[axis] = sum / sensorCount;
+        }
     }
 }
 
+static void gyroFuseSensors(void)
+{
+    float rates[MAX_GYRO_COUNT][XYZ_AXIS_COUNT];
+    float noiseVariance[MAX_GYRO_COUNT];
+    int healthyCount = 0;
+    for (int ii = 0; ii < gyroSensorsInUse; ii++) {
+        if (isGyroSensorHealthy(&gyroSensors[ii]) && isGyroSensorCalibrationComplete(&gyroSensors[ii])) {
+            memcpy(rates[healthyCount], gyroSensors[ii].gyroADCf, sizeof(rates[healthyCount]));
+            noiseVariance[healthyCount] = gyroSensors[ii].noiseVariance;
+            healthyCount++;
+        }
+    }
+    if (healthyCount == 0) {
+        // no healthy sensor left, keep using the primary sensor
+        memcpy(rates[0], gyroSensors[0].gyroADCf, sizeof(rates[0]));
+        noiseVariance[0] = gyroSensors[0].noiseVariance;
+        healthyCount = 1;
+    }
+    gyroFuseRates(gyroConfig()->gyro_fusion, rates, noiseVariance, healthyCount, gyro.gyroADCf);
+}
+
+#ifdef USE_GYRO_DATA_ANALYSE
+static void gyroCopyDynamicNotches(gyroSensor_t *gyroSensor, const gyroSensor_t *primarySensor)
+{
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        for (int notch = 0; notch < gyroSensor->notchFilterDynCount; notch++) {
+            biquadFilter_t *filter = &gyroSensor->notchFilterDyn[axis][notch];
+            const biquadFilter_t *primaryFilter = &primarySensor->notchFilterDyn[axis][notch];
+            filter->b0 = primaryFilter->b0;
+            filter->b1 = primaryFilter->b1;
+            filter->b2 = primaryFilter->b2;
+            filter->a1 = primaryFilter->a1;
+            filter->a2 = primaryFilter->a2;
+        }
+    }
+}
+#endif
+
 void gyroUpdate(void)
 {
-    gyroUpdateSensor(&gyroSensor0);
+    gyroUpdateSensor(&gyroSensors[0]);
+    if (gyroSensorsInUse == 1) {
+        gyro.gyroADCf[X] = gyroSensors[0].gyroADCf[X];
+        gyro.gyroADCf[Y] = gyroSensors[0].gyroADCf[Y];
+        gyro.gyroADCf[Z] = gyroSensors[0].gyroADCf[Z];
+        return;
+    }
+
+    for (int ii = 1; ii < gyroSensorsInUse; ii++) {
+#ifdef USE_GYRO_DATA_ANALYSE
+        if (isDynamicFilterActive()) {
+            gyroCopyDynamicNotches(&gyroSensors[ii], &gyroSensors[0]);
+        }
+#endif
+        gyroUpdateSensor(&gyroSensors[ii]);
+    }
+    gyroFuseSensors();
+}
+
+uint8_t gyroSensorCount(void)
+{
+    return gyroSensorsInUse;
+}
+
+bool gyroSensorIsHealthy(uint8_t index)
+{
+    return index < gyroSensorsInUse && isGyroSensorHealthy(&gyroSensors[index]);
 }
 
 void gyroReadTemperature(void)
 {
-    if (gyroSensor0.gyroDev.temperatureFn) {
-        gyroSensor0.gyroDev.temperatureFn(&gyroSensor0.gyroDev, &gyroSensor0.gyroDev.temperature);
+    if (gyroSensors[0].gyroDev.temperatureFn) {
+        gyroSensors[0].gyroDev.temperatureFn(&gyroSensors[0].gyroDev, &gyroSensors[0].gyroDev.temperature);
     }
 }
 
 int16_t gyroGetTemperature(void)
 {
-    return gyroSensor0.gyroDev.temperature;
+    return gyroSensors[0].gyroDev.temperature;
 }
 
 int16_t gyroRateDps(int axis)
 {
-    return lrintf(gyro.gyroADCf[axis] / gyroSensor0.gyroDev.scale);
+    return lrintf(gyro.gyroADCf[axis] / gyroSensors[0].gyroDev.scale);
 }
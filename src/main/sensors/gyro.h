@@ -46,6 +46,25 @@ typedef struct gyro_s {
 
 extern gyro_t gyro;
 
+#define GYRO_DYN_NOTCH_COUNT_MAX 3
+
+#if defined(USE_DUAL_GYRO) && defined(GYRO_2_CS_PIN)
+#define MAX_GYRO_COUNT 3
+#elif defined(USE_DUAL_GYRO)
+#define MAX_GYRO_COUNT 2
+#elif !defined(MAX_GYRO_COUNT)
+#define MAX_GYRO_COUNT 1
+#endif
+
+#define GYRO_TO_USE_ALL MAX_GYRO_COUNT // gyro_to_use value that selects all gyros
+
+typedef enum {
+    GYRO_FUSION_AVERAGE = 0,
+    GYRO_FUSION_MEDIAN,
+    GYRO_FUSION_WEIGHTED,
+    GYRO_FUSION_FAILOVER
+} gyroFusion_e;
+
 typedef struct gyroConfig_s {
     sensor_align_e gyro_align;              // gyro alignment
     uint8_t  gyroMovementCalibrationThreshold; // people keep forgetting that moving model while init results in wrong gyro offsets. and then they never reset gyro. so this is now on by default.
@@ -55,11 +74,13 @@ typedef struct gyroConfig_s {
     uint8_t  gyro_soft_lpf_hz;
     bool     gyro_isr_update;
     bool     gyro_use_32khz;
-    uint8_t  gyro_to_use;
+    uint8_t  gyro_to_use;                      // index of the gyro to use, or GYRO_TO_USE_ALL
+    uint8_t  gyro_fusion;                      // how the outputs of multiple gyros are combined, see gyroFusion_e
     uint16_t gyro_soft_notch_hz_1;
     uint16_t gyro_soft_notch_cutoff_1;
     uint16_t gyro_soft_notch_hz_2;
     uint16_t gyro_soft_notch_cutoff_2;
+    uint8_t  dyn_notch_count;                  // number of dynamic notches per axis
 } gyroConfig_t;
 
 PG_DECLARE(gyroConfig_t, gyroConfig);
@@ -78,3 +99,5 @@ bool isGyroCalibrationComplete(void);
 void gyroReadTemperature(void);
 int16_t gyroGetTemperature(void);
 int16_t gyroRateDps(int axis);
+uint8_t gyroSensorCount(void);
+bool gyroSensorIsHealthy(uint8_t index);
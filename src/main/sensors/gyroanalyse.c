@@ -15,13 +15,14 @@
  * along with Cleanflight.	If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <math.h>
 
 #include "platform.h"
 
 #ifdef USE_GYRO_DATA_ANALYSE
-#include "arm_math.h"
-
 #include "build/debug.h"
 
 #include "common/filter.h"
@@ -42,13 +43,15 @@
 #include "sensors/gyro.h"
 #include "sensors/gyroanalyse.h"
 
-#include "common/filter.h"
-
-// The FFT splits the frequency domain into an number of bins
-// A sampling frequency of 1000 and max frequency of 500 at a window size of 32 gives 16 frequency bins each with a width 31.25Hz
-// Eg [0,31), [31,62), [62, 93) etc
+// The sliding DFT splits the frequency domain into a number of bins
+// A sampling frequency of 1000 at a window size of 64 gives 32 frequency bins each with a width of 15.625Hz
+// Eg [0,15.6), [15.6,31.25), [31.25, 46.9) etc
+// The spectrum is updated incrementally with every sample, so there is no need to wait for a full window
+// of new samples or to spread a complete FFT over several calls.
 
-#define FFT_WINDOW_SIZE                32  // max for f3 targets
+#define SDFT_SAMPLE_SIZE               64
+#define SDFT_BIN_COUNT                 (SDFT_SAMPLE_SIZE / 2 + 1)
+#define SDFT_DAMPING_FACTOR            0.9999f // keeps the recursion stable despite rounding errors
 #define FFT_MIN_FREQ                  100  // not interested in filtering frequencies below 100Hz
 #define FFT_SAMPLING_RATE            1000  // allows analysis up to 500Hz which is more than motors create
 #define FFT_BPF_HZ                    200  // use a bandpass on gyro data to ignore extreme low and extreme high frequencies
@@ -56,76 +59,117 @@
 #define DYN_NOTCH_CHANGERATE           60  // lower cut does not improve the performance much, higher cut makes it worse...
 #define DYN_NOTCH_MIN_CUTOFF          120  // don't cut too deep into low frequencies
 #define DYN_NOTCH_MAX_CUTOFF          200  // don't go above this cutoff (better filtering with "constant" delay at higher center frequencies)
+#define DYN_NOTCH_PEAK_RATIO          100  // ignore peaks more than 20dB below the strongest one
 
 #define BIQUAD_Q 1.0f / sqrtf(2.0f)         // quality factor - butterworth
 
+typedef struct sdftComplex_s {
+    float re;
+    float im;
+} sdftComplex_t;
+
 static uint16_t samplingFrequency;          // gyro rate
-static uint8_t fftBinCount;
 static float fftResolution;                 // hz per bin
-static float gyroData[3][FFT_WINDOW_SIZE];  // gyro data used for frequency analysis
-
-static arm_rfft_fast_instance_f32 fftInstance;
-static float fftData[FFT_WINDOW_SIZE];
-static float rfftData[FFT_WINDOW_SIZE];
-static gyroFftData_t fftResult[3];
 static uint16_t fftMaxFreq = 0;             // nyquist rate
-static uint16_t fftIdx = 0;                 // use a circular buffer for the last FFT_WINDOW_SIZE samples
+static uint8_t sdftStartBin;                // lowest bin that may contain a peak
+static uint8_t sdftEndBin;                  // highest bin that may contain a peak
+static uint8_t dynNotchCount;               // number of dynamic notches per axis
+
+static float gyroData[3][SDFT_SAMPLE_SIZE]; // last SDFT_SAMPLE_SIZE samples, needed to remove the oldest sample from the spectrum
+static uint8_t sdftIdx = 0;                 // use a circular buffer for the last SDFT_SAMPLE_SIZE samples
+static sdftComplex_t sdftData[3][SDFT_BIN_COUNT];
+static sdftComplex_t sdftTwiddle[SDFT_BIN_COUNT];
+static float sdftDampingFactorN;            // damping factor to the power of SDFT_SAMPLE_SIZE
 
+static gyroFftData_t fftResult[3];
 
 // accumulator for oversampled data => no aliasing and less noise
 static float fftAcc[3] = {0, 0, 0};
 static int fftAccCount = 0;
 static int fftSamplingScale;
 
+// samples waiting to be added to the spectrum, at most sdftAxesPerCall axes are updated per call
+static float sdftPendingSample[3];
+static uint8_t sdftPendingAxes;             // bit mask of axes with a pending sample
+static uint8_t sdftAxesPerCall;
+
+typedef enum {
+    STEP_DETECT_PEAKS,
+    STEP_UPDATE_FILTERS,
+} UpdateStep_e;
+
+// analysis state, one step for one axis per call
+static uint8_t updateStep;
+static uint8_t updateAxis;
+static uint8_t updateNotch;
+
 // bandpass filter gyro data
 static biquadFilter_t fftGyroFilter[3];
 
 // filter for smoothing frequency estimation
-static biquadFilter_t fftFreqFilter[3];
-
-// Hanning window, see https://en.wikipedia.org/wiki/Window_function#Hann_.28Hanning.29_window
-static float hanningWindow[FFT_WINDOW_SIZE];
+static pt1Filter_t fftFreqFilter[3][GYRO_DYN_NOTCH_COUNT_MAX];
 
-void initHanning()
-{
-    for (int i = 0; i < FFT_WINDOW_SIZE; i++) {
-        hanningWindow[i] = (0.5 - 0.5 * cosf(2 * M_PIf * i / (FFT_WINDOW_SIZE - 1)));
-    }
-}
-
-void initGyroData()
+static void initGyroData(void)
 {
     for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
-        for (int i = 0; i < FFT_WINDOW_SIZE; i++) {
+        for (int i = 0; i < SDFT_SAMPLE_SIZE; i++) {
             gyroData[axis][i] = 0;
         }
+        for (int bin = 0; bin < SDFT_BIN_COUNT; bin++) {
+            sdftData[axis][bin].re = 0;
+            sdftData[axis][bin].im = 0;
+        }
     }
+    sdftIdx = 0;
+    sdftPendingAxes = 0;
+    fftAccCount = 0;
+    updateStep = STEP_DETECT_PEAKS;
+    updateAxis = 0;
+    updateNotch = 0;
 }
 
-static inline int fftFreqToBin(int freq)
+static void initSdftTwiddle(void)
 {
-    return ((FFT_WINDOW_SIZE / 2 - 1) * freq) / (fftMaxFreq);
+    for (int bin = 0; bin < SDFT_BIN_COUNT; bin++) {
+        const float phi = 2 * M_PIf * bin / SDFT_SAMPLE_SIZE;
+        sdftTwiddle[bin].re = cosf(phi);
+        sdftTwiddle[bin].im = sinf(phi);
+    }
+    sdftDampingFactorN = powf(SDFT_DAMPING_FACTOR, SDFT_SAMPLE_SIZE);
 }
 
 void gyroDataAnalyseInit(uint32_t targetLooptimeUs)
 {
     // initialise even if FEATURE_DYNAMIC_FILTER not set, since it may be set later
     samplingFrequency = 1000000 / targetLooptimeUs;
-    fftSamplingScale = samplingFrequency / FFT_SAMPLING_RATE;
+    fftSamplingScale = MAX(samplingFrequency / FFT_SAMPLING_RATE, 1);
     fftMaxFreq = FFT_SAMPLING_RATE / 2;
-    fftBinCount = fftFreqToBin(fftMaxFreq) + 1;
-    fftResolution = FFT_SAMPLING_RATE / FFT_WINDOW_SIZE;
-    arm_rfft_fast_init_f32(&fftInstance, FFT_WINDOW_SIZE);
+    fftResolution = (float)FFT_SAMPLING_RATE / SDFT_SAMPLE_SIZE;
+    // the Hann window and the peak interpolation each need the neighbouring bins
+    sdftStartBin = MAX(lrintf(FFT_MIN_FREQ / fftResolution), 2);
+    sdftEndBin = SDFT_BIN_COUNT - 3;
+    // all axes must be updated before the next sample is complete
+    sdftAxesPerCall = (XYZ_AXIS_COUNT + fftSamplingScale - 1) / fftSamplingScale;
+    dynNotchCount = constrain(gyroConfig()->dyn_notch_count, 1, GYRO_DYN_NOTCH_COUNT_MAX);
 
     initGyroData();
-    initHanning();
+    initSdftTwiddle();
 
-    // recalculation of filters takes 4 calls per axis => each filter gets updated every 3 * 4 = 12 calls
-    // at 4khz gyro loop rate this means 4khz / 4 / 3 = 333Hz => update every 3ms
-    float looptime = targetLooptimeUs * 4 * 3;
+    // peak detection and the update of each notch take one call per axis
+    // => each filter gets updated every (1 + dynNotchCount) * 3 calls
+    // at 4khz gyro loop rate with two notches this means 4khz / 3 / 3 = 444Hz => update every 2.25ms
+    const float freqFilterDt = targetLooptimeUs * (1 + dynNotchCount) * XYZ_AXIS_COUNT * 1e-6f;
     for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
-        fftResult[axis].centerFreq = 200; // any init value
-        biquadFilterInitLPF(&fftFreqFilter[axis], DYN_NOTCH_CHANGERATE, looptime);
+        fftAcc[axis] = 0;
+        fftResult[axis].maxVal = 0;
+        fftResult[axis].notchCount = dynNotchCount;
+        for (int i = 0; i < GYRO_DYN_NOTCH_COUNT_MAX; i++) {
+            // spread the initial notches over the range, they move to the peaks once these are detected
+            fftResult[axis].centerFreq[i] = DYN_NOTCH_MIN_CUTOFF + 10 + (i + 1) * (fftMaxFreq - DYN_NOTCH_MIN_CUTOFF - 10) / (dynNotchCount + 1);
+            memset(&fftFreqFilter[axis][i], 0, sizeof(pt1Filter_t));
+            pt1FilterInit(&fftFreqFilter[axis][i], DYN_NOTCH_CHANGERATE, freqFilterDt);
+            fftFreqFilter[axis][i].state = fftResult[axis].centerFreq[i];
+        }
         biquadFilterInit(&fftGyroFilter[axis], FFT_BPF_HZ, 1000000 / FFT_SAMPLING_RATE, BIQUAD_Q, FILTER_BPF);
     }
 }
@@ -142,14 +186,35 @@ bool isDynamicFilterActive(void)
 }
 
 /*
- * Collect gyro data, to be analysed in gyroDataAnalyseUpdate function
+ * Slide the window of one axis by one sample: remove the oldest sample and add the new one to every bin of interest
+ */
+static void sdftUpdate(int axis, float sample)
+{
+    const float delta = sample - sdftDampingFactorN * gyroData[axis][sdftIdx];
+    gyroData[axis][sdftIdx] = sample;
+
+    sdftComplex_t *data = sdftData[axis];
+    for (int bin = sdftStartBin - 2; bin <= sdftEndBin + 2; bin++) {
+        const float re = SDFT_DAMPING_FACTOR * data[bin].re + delta;
+        const float im = SDFT_DAMPING_FACTOR * data[bin].im;
+        data[bin].re = sdftTwiddle[bin].re * re - sdftTwiddle[bin].im * im;
+        data[bin].im = sdftTwiddle[bin].re * im + sdftTwiddle[bin].im * re;
+    }
+}
+
+/*
+ * Collect gyro data and add it to the spectrum, then do one step of the analysis in gyroDataAnalyseUpdate
  */
-void gyroDataAnalyse(const gyroDev_t *gyroDev, biquadFilter_t *notchFilterDyn)
+void gyroDataAnalyse(const gyroDev_t *gyroDev, biquadFilter_t notchFilterDyn[][GYRO_DYN_NOTCH_COUNT_MAX])
 {
     if (!isDynamicFilterActive()) {
         return;
     }
 
+    uint32_t startTime = 0;
+    if (debugMode == (DEBUG_FFT_TIME))
+        startTime = micros();
+
     // if gyro sampling is > 1kHz, accumulate multiple samples
     for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
         fftAcc[axis] += gyroDev->gyroADC[axis];
@@ -164,160 +229,147 @@ void gyroDataAnalyse(const gyroDev_t *gyroDev, biquadFilter_t *notchFilterDyn)
         for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
             float sample = fftAcc[axis] / fftSamplingScale;
             sample = biquadFilterApply(&fftGyroFilter[axis], sample);
-            gyroData[axis][fftIdx] = sample;
+            sdftPendingSample[axis] = sample;
             if (axis == 0)
                 DEBUG_SET(DEBUG_FFT, 2, lrintf(sample * gyroDev->scale));
             fftAcc[axis] = 0;
         }
+        sdftPendingAxes = (1 << XYZ_AXIS_COUNT) - 1;
+    }
 
-        fftIdx = (fftIdx + 1) % FFT_WINDOW_SIZE;
+    // spread the spectrum update over the calls until the next sample is complete
+    if (sdftPendingAxes) {
+        for (int axis = 0, updated = 0; axis < XYZ_AXIS_COUNT && updated < sdftAxesPerCall; axis++) {
+            if (sdftPendingAxes & (1 << axis)) {
+                sdftUpdate(axis, sdftPendingSample[axis]);
+                sdftPendingAxes &= ~(1 << axis);
+                updated++;
+            }
+        }
+        if (!sdftPendingAxes) {
+            // all axes have the sample, the next one replaces the following oldest sample
+            sdftIdx = (sdftIdx + 1) % SDFT_SAMPLE_SIZE;
+        }
     }
+    DEBUG_SET(DEBUG_FFT_TIME, 1, micros() - startTime);
 
-    // calculate FFT and update filters
+    // detect peaks and update filters
     gyroDataAnalyseUpdate(notchFilterDyn);
+
+    DEBUG_SET(DEBUG_FFT_TIME, 3, micros() - startTime);
 }
 
-void stage_rfft_f32(arm_rfft_fast_instance_f32 * S, float32_t * p, float32_t * pOut);
-void arm_cfft_radix8by2_f32( arm_cfft_instance_f32 * S, float32_t * p1);
-void arm_cfft_radix8by4_f32( arm_cfft_instance_f32 * S, float32_t * p1);
-void arm_radix8_butterfly_f32(float32_t * pSrc, uint16_t fftLen, const float32_t * pCoef, uint16_t twidCoefModifier);
-void arm_bitreversal_32(uint32_t * pSrc, const uint16_t bitRevLen, const uint16_t * pBitRevTable);
+/*
+ * Find the strongest peaks in the Hann windowed spectrum of an axis and move the notch center frequencies towards them
+ */
+static void sdftDetectPeaks(int axis)
+{
+    const sdftComplex_t *data = sdftData[axis];
+    float power[SDFT_BIN_COUNT];
+
+    // Hann window applied in the frequency domain: Y[k] = 0.5 * X[k] - 0.25 * (X[k - 1] + X[k + 1])
+    fftResult[axis].maxVal = 0;
+    for (int bin = sdftStartBin - 1; bin <= sdftEndBin + 1; bin++) {
+        const float re = 0.5f * data[bin].re - 0.25f * (data[bin - 1].re + data[bin + 1].re);
+        const float im = 0.5f * data[bin].im - 0.25f * (data[bin - 1].im + data[bin + 1].im);
+        power[bin] = re * re + im * im;
+        if (bin >= sdftStartBin && bin <= sdftEndBin) {
+            fftResult[axis].maxVal = MAX(fftResult[axis].maxVal, power[bin]);
+        }
+    }
+    const float peakThreshold = fftResult[axis].maxVal / DYN_NOTCH_PEAK_RATIO;
+
+    // keep the dynNotchCount strongest local maxima, strongest first
+    int peakBin[GYRO_DYN_NOTCH_COUNT_MAX];
+    int peakCount = 0;
+    for (int bin = sdftStartBin; bin <= sdftEndBin; bin++) {
+        if (power[bin] > peakThreshold && power[bin] > power[bin - 1] && power[bin] >= power[bin + 1]) {
+            int i = MIN(peakCount, dynNotchCount - 1);
+            if (i == peakCount || power[bin] > power[peakBin[i]]) {
+                while (i > 0 && power[bin] > power[peakBin[i - 1]]) {
+                    peakBin[i] = peakBin[i - 1];
+                    i--;
+                }
+                peakBin[i] = bin;
+                peakCount = MIN(peakCount + 1, dynNotchCount);
+            }
+        }
+    }
+
+    // assign each peak, strongest first, to the closest notch not yet assigned, notches without a peak stay where they are
+    uint8_t assignedNotches = 0;
+    for (int i = 0; i < peakCount; i++) {
+        const int bin = peakBin[i];
+        // parabolic interpolation of the magnitudes around the peak gives the offset from the bin center
+        const float m0 = sqrtf(power[bin - 1]);
+        const float m1 = sqrtf(power[bin]);
+        const float m2 = sqrtf(power[bin + 1]);
+        const float denominator = m0 - 2 * m1 + m2;
+        const float binOffset = denominator < 0 ? 0.5f * (m0 - m2) / denominator : 0;
+        const float peakFreq = (bin + binOffset) * fftResolution;
+
+        int closestNotch = -1;
+        for (int notch = 0; notch < dynNotchCount; notch++) {
+            if (!(assignedNotches & (1 << notch))
+                && (closestNotch < 0 || ABS(peakFreq - fftResult[axis].centerFreq[notch]) < ABS(peakFreq - fftResult[axis].centerFreq[closestNotch]))) {
+                closestNotch = notch;
+            }
+        }
+        assignedNotches |= 1 << closestNotch;
+
+        // don't go below the minimal cutoff frequency + 10 and don't jump around too much
+        float centerFreq;
+        centerFreq = constrain(peakFreq, DYN_NOTCH_MIN_CUTOFF + 10, fftMaxFreq);
+        centerFreq = pt1FilterApply(&fftFreqFilter[axis][closestNotch], centerFreq);
+        centerFreq = constrain(centerFreq, DYN_NOTCH_MIN_CUTOFF + 10, fftMaxFreq);
+        fftResult[axis].centerFreq[closestNotch] = centerFreq;
+        if (axis == 0 && i == 0) {
+            DEBUG_SET(DEBUG_FFT, 3, lrintf((bin + binOffset) * 100));
+        }
+    }
+
+    DEBUG_SET(DEBUG_FFT_FREQ, axis, fftResult[axis].centerFreq[0]);
+}
 
-typedef enum {
-    STEP_ARM_CFFT_F32,
-    STEP_BITREVERSAL,
-    STEP_STAGE_RFFT_F32,
-    STEP_ARM_CMPLX_MAG_F32,
-    STEP_CALC_FREQUENCIES,
-    STEP_UPDATE_FILTERS,
-    STEP_HANNING,
-    STEP_COUNT
-} UpdateStep_e;
 
 /*
- * Analyse last gyro data from the last FFT_WINDOW_SIZE milliseconds
+ * Analyse the spectrum of the last SDFT_SAMPLE_SIZE milliseconds, one axis or one notch per call
  */
-void gyroDataAnalyseUpdate(biquadFilter_t *notchFilterDyn)
+void gyroDataAnalyseUpdate(biquadFilter_t notchFilterDyn[][GYRO_DYN_NOTCH_COUNT_MAX])
 {
-    static int axis = 0;
-    static int step = 0;
-    arm_cfft_instance_f32 * Sint = &(fftInstance.Sint);
-
     uint32_t startTime = 0;
     if (debugMode == (DEBUG_FFT_TIME))
         startTime = micros();
 
-    DEBUG_SET(DEBUG_FFT_TIME, 0, step);
-    switch (step) {
-        case STEP_ARM_CFFT_F32:
-        {
-            switch (FFT_WINDOW_SIZE / 2) {
-            case 16:
-                // 16us
-                arm_cfft_radix8by2_f32(Sint, fftData);
-                break;
-            case 32:
-                // 35us
-                arm_cfft_radix8by4_f32(Sint, fftData);
-                break;
-            case 64:
-                // 70us
-                arm_radix8_butterfly_f32(fftData, FFT_WINDOW_SIZE / 2, Sint->pTwiddle, 1);
-                break;
-            }
-            DEBUG_SET(DEBUG_FFT_TIME, 1, micros() - startTime);
-            break;
-        }
-        case STEP_BITREVERSAL:
-        {
-            // 6us
-            arm_bitreversal_32((uint32_t*) fftData, Sint->bitRevLength, Sint->pBitRevTable);
-            DEBUG_SET(DEBUG_FFT_TIME, 1, micros() - startTime);
-            step++;
-            // fall through
-        }
-        case STEP_STAGE_RFFT_F32:
+    DEBUG_SET(DEBUG_FFT_TIME, 0, updateStep);
+    switch (updateStep) {
+        case STEP_DETECT_PEAKS:
         {
-            // 14us
-            // this does not work in place => fftData AND rfftData needed
-            stage_rfft_f32(&fftInstance, fftData, rfftData);
-            DEBUG_SET(DEBUG_FFT_TIME, 1, micros() - startTime);
-            break;
-        }
-        case STEP_ARM_CMPLX_MAG_F32:
-        {
-            // 8us
-            arm_cmplx_mag_f32(rfftData, fftData, fftBinCount);
-            DEBUG_SET(DEBUG_FFT_TIME, 2, micros() - startTime);
-            step++;
-            // fall through
-        }
-        case STEP_CALC_FREQUENCIES:
-        {
-            // 13us
-            float fftSum = 0;
-            float fftWeightedSum = 0;
-
-            fftResult[axis].maxVal = 0;
-            // iterate over fft data and calculate weighted indexes
-            float squaredData;
-            for (int i = 0; i < fftBinCount; i++) {
-                squaredData = fftData[i] * fftData[i];  //more weight on higher peaks
-                fftResult[axis].maxVal = MAX(fftResult[axis].maxVal, squaredData);
-                fftSum += squaredData;
-                fftWeightedSum += squaredData * (i + 1); // calculate weighted index starting at 1, not 0
-            }
-
-            // get weighted center of relevant frequency range (this way we have a better resolution than 31.25Hz)
-            if (fftSum > 0) {
-                // idx was shifted by 1 to start at 1, not 0
-                float fftMeanIndex = (fftWeightedSum / fftSum) - 1;
-                // the index points at the center frequency of each bin so index 0 is actually 16.125Hz
-                // fftMeanIndex += 0.5;
-
-                // don't go below the minimal cutoff frequency + 10 and don't jump around too much
-                float centerFreq;
-                centerFreq = constrain(fftMeanIndex * fftResolution, DYN_NOTCH_MIN_CUTOFF + 10, fftMaxFreq);
-                centerFreq = biquadFilterApply(&fftFreqFilter[axis], centerFreq);
-                centerFreq = constrain(centerFreq, DYN_NOTCH_MIN_CUTOFF + 10, fftMaxFreq);
-                fftResult[axis].centerFreq = centerFreq;
-                if (axis == 0) {
-                    DEBUG_SET(DEBUG_FFT, 3, lrintf(fftMeanIndex * 100));
-                }
-            }
-
-            DEBUG_SET(DEBUG_FFT_FREQ, axis, fftResult[axis].centerFreq);
-            DEBUG_SET(DEBUG_FFT_TIME, 1, micros() - startTime);
+            // 12us
+            sdftDetectPeaks(updateAxis);
+            updateNotch = 0;
+            updateStep = STEP_UPDATE_FILTERS;
             break;
         }
         case STEP_UPDATE_FILTERS:
         {
             // 7us
             // calculate new filter coefficients
-            float cutoffFreq = constrain(fftResult[axis].centerFreq - DYN_NOTCH_WIDTH, DYN_NOTCH_MIN_CUTOFF, DYN_NOTCH_MAX_CUTOFF);
-            float notchQ = filterGetNotchQApprox(fftResult[axis].centerFreq, cutoffFreq);
-            biquadFilterUpdate(&notchFilterDyn[axis], fftResult[axis].centerFreq, gyro.targetLooptime, notchQ, FILTER_NOTCH);
-            DEBUG_SET(DEBUG_FFT_TIME, 1, micros() - startTime);
-
-            axis = (axis + 1) % 3;
-            step++;
-            // fall through
-        }
-        case STEP_HANNING:
-        {
-            // 5us
-            // apply hanning window to gyro samples and store result in fftData
-            // hanning starts and ends with 0, could be skipped for minor speed improvement
-            uint8_t ringBufIdx = FFT_WINDOW_SIZE - fftIdx;
-            arm_mult_f32(&gyroData[axis][fftIdx], &hanningWindow[0], &fftData[0], ringBufIdx);
-            if (fftIdx > 0)
-                arm_mult_f32(&gyroData[axis][0], &hanningWindow[ringBufIdx], &fftData[ringBufIdx], fftIdx);
-
-            DEBUG_SET(DEBUG_FFT_TIME, 1, micros() - startTime);
+            const uint16_t centerFreq = fftResult[updateAxis].centerFreq[updateNotch];
+            float cutoffFreq = constrain(centerFreq - DYN_NOTCH_WIDTH, DYN_NOTCH_MIN_CUTOFF, DYN_NOTCH_MAX_CUTOFF);
+            float notchQ = filterGetNotchQApprox(centerFreq, cutoffFreq);
+            biquadFilterUpdate(&notchFilterDyn[updateAxis][updateNotch], centerFreq, gyro.targetLooptime, notchQ, FILTER_NOTCH);
+
+            updateNotch++;
+            if (updateNotch == dynNotchCount) {
+                updateAxis = (updateAxis + 1) % XYZ_AXIS_COUNT;
+                updateStep = STEP_DETECT_PEAKS;
+            }
+            break;
         }
     }
 
-    step = (step + 1) % STEP_COUNT;
+    DEBUG_SET(DEBUG_FFT_TIME, 2, micros() - startTime);
 }
 
 #endif // USE_GYRO_DATA_ANALYSE
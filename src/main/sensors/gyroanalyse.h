@@ -20,15 +20,18 @@
 #include "common/time.h"
 #include "common/filter.h"
 
-#define GYRO_FFT_BIN_COUNT      16 // FFT_WINDOW_SIZE / 2
+#include "sensors/gyro.h"
+
+#define GYRO_FFT_BIN_COUNT      32 // SDFT_SAMPLE_SIZE / 2
 typedef struct gyroFftData_s {
     float maxVal;
-    uint16_t centerFreq;
+    uint8_t notchCount;
+    uint16_t centerFreq[GYRO_DYN_NOTCH_COUNT_MAX];
 } gyroFftData_t;
 
 void gyroDataAnalyseInit(uint32_t targetLooptime);
 const gyroFftData_t *gyroFftData(int axis);
 struct gyroDev_s;
-void gyroDataAnalyse(const struct gyroDev_s *gyroDev, biquadFilter_t *notchFilterDyn);
-void gyroDataAnalyseUpdate(biquadFilter_t *notchFilterDyn);
+void gyroDataAnalyse(const struct gyroDev_s *gyroDev, biquadFilter_t notchFilterDyn[][GYRO_DYN_NOTCH_COUNT_MAX]);
+void gyroDataAnalyseUpdate(biquadFilter_t notchFilterDyn[][GYRO_DYN_NOTCH_COUNT_MAX]);
 bool isDynamicFilterActive();
@@ -51,12 +51,28 @@ static servo_packet pwmPkt;
 
 static struct timespec start_time;
 static double simRate = 1.0;
-static pthread_t tcpWorker, udpWorker;
+static pthread_t tcpWorker;
+#ifndef SIMULATOR_LOCKSTEP
+static pthread_t udpWorker;
+#endif
 static bool workerRunning = true;
 static udpLink_t stateLink, pwmLink;
 static pthread_mutex_t updateLock;
 static pthread_mutex_t mainLoopLock;
 
+#ifdef SIMULATOR_LOCKSTEP
+// simulated time per main loop pass, the scheduler runs at most one task per pass
+#define SIMULATOR_LOCKSTEP_STEP_US      10
+#define SIMULATOR_LOCKSTEP_RECV_TIMEOUT 100 // ms, only to check for reset while waiting
+
+static uint64_t simTimeUs = 0;          // the clock, only advanced by FDM packets and delays
+static uint64_t simFrameEndUs = 0;      // simulated time at which the current FDM packet is consumed
+static uint64_t simFirstFrameUs = 0;
+static double simFirstTimestamp = 0;    // in seconds
+static double simLastTimestamp = 0;
+static bool simStarted = false;
+#endif
+
 int timeval_sub(struct timespec *result, struct timespec *x, struct timespec *y);
 
 int lockMainPID(void) {
@@ -69,27 +85,7 @@ int lockMainPID(void) {
 void sendMotorUpdate() {
 	udpSend(&pwmLink, &pwmPkt, sizeof(servo_packet));
 }
-void updateState(const fdm_packet* pkt) {
-	static double last_timestamp = 0; // in seconds
-	static uint64_t last_realtime = 0; // in uS
-	static struct timespec last_ts; // last packet
-
-	struct timespec now_ts;
-	clock_gettime(CLOCK_MONOTONIC, &now_ts);
-
-	const uint64_t realtime_now = micros64_real();
-	if(realtime_now > last_realtime + 500*1e3) { // 500ms timeout
-		last_timestamp = pkt->timestamp;
-		last_realtime = realtime_now;
-		sendMotorUpdate();
-		return;
-	}
-
-	const double deltaSim = pkt->timestamp - last_timestamp;  // in seconds
-	if(deltaSim < 0) { // don't use old packet
-		return;
-	}
-
+static void updateSensors(const fdm_packet* pkt, double deltaSim) {
 	int16_t x,y,z;
 	x = -pkt->imu_linear_acceleration_xyz[0] * ACC_SCALE;
 	y = -pkt->imu_linear_acceleration_xyz[1] * ACC_SCALE;
@@ -137,8 +133,33 @@ void updateState(const fdm_packet* pkt) {
 #if defined(SIMULATOR_IMU_SYNC)
 	imuSetHasNewData(deltaSim*1e6);
 	imuUpdateAttitude(micros());
+#else
+	UNUSED(deltaSim);
 #endif
+}
 
+void updateState(const fdm_packet* pkt) {
+	static double last_timestamp = 0; // in seconds
+	static uint64_t last_realtime = 0; // in uS
+	static struct timespec last_ts; // last packet
+
+	struct timespec now_ts;
+	clock_gettime(CLOCK_MONOTONIC, &now_ts);
+
+	const uint64_t realtime_now = micros64_real();
+	if(realtime_now > last_realtime + 500*1e3) { // 500ms timeout
+		last_timestamp = pkt->timestamp;
+		last_realtime = realtime_now;
+		sendMotorUpdate();
+		return;
+	}
+
+	const double deltaSim = pkt->timestamp - last_timestamp;  // in seconds
+	if(deltaSim < 0) { // don't use old packet
+		return;
+	}
+
+	updateSensors(pkt, deltaSim);
 
 	if(deltaSim < 0.02 && deltaSim > 0) { // simulator should run faster than 50Hz
 //		simRate = simRate * 0.5 + (1e6 * deltaSim / (realtime_now - last_realtime)) * 0.5;
@@ -161,6 +182,7 @@ void updateState(const fdm_packet* pkt) {
 #endif
 }
 
+#ifndef SIMULATOR_LOCKSTEP
 static void* udpThread(void* data) {
 	UNUSED(data);
 	int n = 0;
@@ -176,16 +198,59 @@ static void* udpThread(void* data) {
 	printf("udpThread end!!\n");
 	return NULL;
 }
+#endif
+
+#ifdef SIMULATOR_LOCKSTEP
+// Called by the main loop after each scheduler pass, runs on the main thread so the order of
+// sensor updates, task execution and motor output only depends on the FDM packets.
+void simulatorLockstepUpdate(void) {
+	if (simStarted) {
+		simTimeUs += SIMULATOR_LOCKSTEP_STEP_US;
+		if (simTimeUs < simFrameEndUs) {
+			return;
+		}
+		simTimeUs = simFrameEndUs;
+		// current frame is consumed, answer it
+		sendMotorUpdate();
+	}
+
+	while (workerRunning) {
+		if (udpRecv(&stateLink, &fdmPkt, sizeof(fdm_packet), SIMULATOR_LOCKSTEP_RECV_TIMEOUT) != sizeof(fdm_packet)) {
+			continue;
+		}
+		if (!simStarted) {
+			simStarted = true;
+			simFirstTimestamp = simLastTimestamp = fdmPkt.timestamp;
+			simFirstFrameUs = simTimeUs;
+		}
+		const double deltaSim = fdmPkt.timestamp - simLastTimestamp;  // in seconds
+		if (deltaSim < 0) { // don't use old packet
+			continue;
+		}
+		updateSensors(&fdmPkt, deltaSim);
+		simLastTimestamp = fdmPkt.timestamp;
+		// from the first timestamp, so rounding does not accumulate
+		simFrameEndUs = simFirstFrameUs + llrint((fdmPkt.timestamp - simFirstTimestamp) * 1e6);
+		if (simFrameEndUs == simTimeUs) {
+			// nothing to simulate, still answer every packet
+			sendMotorUpdate();
+			continue;
+		}
+		return;
+	}
+}
+#endif
 
 static void* tcpThread(void* data) {
 	UNUSED(data);
 
 	dyad_init();
 	dyad_setTickInterval(0.2f);
-	dyad_setUpdateTimeout(0.5f);
+	// short timeout, TX data published by the main loop is sent after each update
+	dyad_setUpdateTimeout(0.001f);
 
 	while (workerRunning) {
-		dyad_update();
+		tcpUpdate();
 	}
 
 	dyad_shutdown();
@@ -225,11 +290,16 @@ void systemInit(void) {
 	ret = udpInit(&stateLink, NULL, 9003, true);
 	printf("start UDP server...%d\n", ret);
 
+#ifdef SIMULATOR_LOCKSTEP
+	// FDM packets are received by the main loop, see simulatorLockstepUpdate()
+	printf("lockstep mode, waiting for simulator\n");
+#else
 	ret = pthread_create(&udpWorker, NULL, udpThread, NULL);
 	if(ret != 0) {
 		printf("Create udpWorker error!\n");
 		exit(1);
 	}
+#endif
 
 	// serial can't been slow down
 	rescheduleTask(TASK_SERIAL, 1);
@@ -239,14 +309,18 @@ void systemReset(void){
 	printf("[system]Reset!\n");
 	workerRunning = false;
 	pthread_join(tcpWorker, NULL);
+#ifndef SIMULATOR_LOCKSTEP
 	pthread_join(udpWorker, NULL);
+#endif
 	exit(0);
 }
 void systemResetToBootloader(void) {
 	printf("[system]ResetToBootloader!\n");
 	workerRunning = false;
 	pthread_join(tcpWorker, NULL);
+#ifndef SIMULATOR_LOCKSTEP
 	pthread_join(udpWorker, NULL);
+#endif
 	exit(0);
 }
 
@@ -285,6 +359,9 @@ uint64_t millis64_real() {
 }
 
 uint64_t micros64() {
+#ifdef SIMULATOR_LOCKSTEP
+	return simTimeUs;
+#else
 	static uint64_t last = 0;
 	static uint64_t out = 0;
 	uint64_t now = nanos64_real();
@@ -294,8 +371,12 @@ uint64_t micros64() {
 
 	return out*1e-3;
 //	return micros64_real();
+#endif
 }
 uint64_t millis64() {
+#ifdef SIMULATOR_LOCKSTEP
+	return simTimeUs / 1000;
+#else
 	static uint64_t last = 0;
 	static uint64_t out = 0;
 	uint64_t now = nanos64_real();
@@ -305,6 +386,7 @@ uint64_t millis64() {
 
 	return out*1e-6;
 //	return millis64_real();
+#endif
 }
 
 uint32_t micros(void) {
@@ -322,17 +404,25 @@ void microsleep(uint32_t usec) {
     while (nanosleep(&ts, &ts) == -1 && errno == EINTR) ;
 }
 void delayMicroseconds(uint32_t us) {
+#ifdef SIMULATOR_LOCKSTEP
+	simTimeUs += us;
+#else
 	microsleep(us / simRate);
+#endif
 }
 void delayMicroseconds_real(uint32_t us) {
 	microsleep(us);
 }
 void delay(uint32_t ms) {
+#ifdef SIMULATOR_LOCKSTEP
+	simTimeUs += ms * 1000ULL;
+#else
 	uint64_t start = millis64();
 
 	while ((millis64() - start) < ms) {
 		microsleep(1000);
 	}
+#endif
 }
 
 // Subtract the ‘struct timespec’ values X and Y,  storing the result in RESULT.
@@ -414,9 +504,12 @@ void pwmCompleteMotorUpdate(uint8_t motorCount) {
 	pwmPkt.motor_speed[1] = motorsPwm[2] / outScale;
 	pwmPkt.motor_speed[2] = motorsPwm[3] / outScale;
 
+#ifndef SIMULATOR_LOCKSTEP
 	// get one "fdm_packet" can only send one "servo_packet"!!
+	// in lockstep mode it is sent once the FDM packet is consumed, see simulatorLockstepUpdate()
 	if(pthread_mutex_trylock(&updateLock) != 0) return;
 	udpSend(&pwmLink, &pwmPkt, sizeof(servo_packet));
+#endif
 //	printf("[pwm]%u:%u,%u,%u,%u\n", idlePulse, motorsPwm[0], motorsPwm[1], motorsPwm[2], motorsPwm[3]);
 }
 void pwmWriteServo(uint8_t index, uint16_t value) {
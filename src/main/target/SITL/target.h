@@ -32,6 +32,11 @@
 //#define SIMULATOR_IMU_SYNC
 //#define SIMULATOR_GYROPID_SYNC
 
+// lockstep: the FDM packet timestamps drive micros()/millis(), each packet advances the FC by the
+// simulated time since the previous one and is answered by one servo_packet. Runs as fast as the
+// simulator allows and is reproducible for the same packet stream.
+//#define SIMULATOR_LOCKSTEP
+
 // file name to save config
 #define EEPROM_FILENAME "eeprom.bin"
 
@@ -45,6 +50,9 @@
 #undef SCHEDULER_DELAY_LIMIT
 #define SCHEDULER_DELAY_LIMIT           1
 
+#define USE_SCHEDULER_READY_QUEUE
+#define USE_GYRO_DATA_ANALYSE
+
 #define ACC
 #define USE_FAKE_ACC
 
@@ -244,4 +252,5 @@ uint64_t micros64();
 uint64_t millis64();
 
 int lockMainPID(void);
+void simulatorLockstepUpdate(void);
 
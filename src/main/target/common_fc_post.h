@@ -28,3 +28,8 @@
 #if defined(USE_QUAD_MIXER_ONLY) && defined(USE_SERVOS)
 #undef USE_SERVOS
 #endif
+
+// The latency stats are kept by the SD card driver, which flash only targets don't build
+#if defined(USE_SDCARD_LATENCY_STATS) && !defined(USE_SDCARD)
+#undef USE_SDCARD_LATENCY_STATS
+#endif
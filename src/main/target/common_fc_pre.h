@@ -26,6 +26,7 @@
 //#pragma GCC diagnostic warning "-Wpadded"
 
 //#define SCHEDULER_DEBUG // define this to use scheduler debug[] values. Undefined by default for performance reasons
+//#define USE_SCHEDULER_READY_QUEUE // define this to schedule time-driven tasks from a deadline ordered heap instead of scanning every task
 #define DEBUG_MODE DEBUG_NONE // change this to change initial debug mode
 
 #define I2C1_OVERCLOCK true
@@ -50,6 +51,10 @@
 #define I2C3_OVERCLOCK true
 #define TELEMETRY_IBUS
 #define USE_GYRO_DATA_ANALYSE
+#define USE_FLASHFS_PAGE_BUFFERS // program the dataflash a whole page at a time
+#define USE_FLASHFS_LOG_INDEX // keep an index of the logs in the last sector of the dataflash
+#define USE_HUFFMAN // compress dataflash reads over MSP
+#define USE_SDCARD_LATENCY_STATS // histogram of SD card block read and write times
 #endif
 
 #ifdef STM32F7
@@ -59,6 +64,11 @@
 #define I2C4_OVERCLOCK true
 #define TELEMETRY_IBUS
 #define USE_GYRO_DATA_ANALYSE
+#define USE_FLASHFS_PAGE_BUFFERS
+#define USE_FLASHFS_LOG_INDEX
+#define USE_HUFFMAN
+#define USE_SDCARD_LATENCY_STATS
+#define AFATFS_NUM_CACHE_SECTORS 32 // 16kB of SD card cache lets blackbox ride out the card's write stalls
 #endif
 
 #if defined(STM32F4) || defined(STM32F7)
@@ -0,0 +1,238 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmark of blackbox logging to an SD card through asyncfatfs.
+//
+// Formats a FAT32 image file, mounts it with the image block device and streams
+// blackbox frame buffer sized afatfs_fwrite() calls into a log file, polling the
+// filesystem between writes like the main loop does. Each block operation on the
+// image is delayed to model SD cards of different speeds, including one which stalls
+// periodically for its internal housekeeping. Like a real card, blocks streamed as part
+// of a multi-block write are faster than individually written ones.
+//
+// Reports the sustained write rate, the share of the sectors that asyncfatfs needed
+// to read which it had already read ahead (rather than waiting for the device), and
+// the longest time the writer had to wait for buffer space (the time for which
+// blackbox would have been dropping frames). Writes are issued as fast
+// as the filesystem accepts them, unless a logging rate is given in kB/s. Add
+// AFATFS_NUM_CACHE_SECTORS=<n> to asyncfatfs_benchmark_DEFINES to compare cache sizes.
+//
+// usage: asyncfatfs_benchmark [megabytes] [write size] [kB/s]
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "blackbox/blackbox_io.h"
+
+    #include "common/utils.h"
+
+    #include "io/asyncfatfs/asyncfatfs.h"
+    #include "io/asyncfatfs/asyncfatfs_image.h"
+}
+
+#include "benchmark.h"
+
+#define DEFAULT_MEGABYTES 4
+#define BENCH_IMAGE_SIZE_MB 512
+#define BENCH_SECTORS_PER_CLUSTER 8 // 4kB clusters, so the 512MB image is large enough to be FAT32
+
+typedef struct benchConfig_s {
+    const char *name;
+    afatfsImageConfig_t device;
+} benchConfig_t;
+
+static const benchConfig_t benchConfigs[] = {
+    { "ram",   { 0,   0,   0,   0 } },
+    { "fast",  { 100, 25,  0,   0 } },
+    { "slow",  { 500, 100, 0,   0 } },
+    { "stall", { 100, 25,  256, 20000 } },
+};
+
+static afatfsFilePtr_t benchLogFile;
+static bool benchCallbackDone;
+
+static void benchLogFileCreated(afatfsFilePtr_t file)
+{
+    benchLogFile = file;
+    benchCallbackDone = true;
+}
+
+static void benchLogFileClosed(void)
+{
+    benchCallbackDone = true;
+}
+
+static bool benchWaitForCallback(void)
+{
+    while (!benchCallbackDone) {
+        afatfs_poll();
+        if (afatfs_getFilesystemState() == AFATFS_FILESYSTEM_STATE_FATAL) {
+            return false;
+        }
+    }
+    benchCallbackDone = false;
+    return true;
+}
+
+static bool benchMount(const char *imageName, const benchConfig_t *config)
+{
+    if (!afatfsImageFormat(imageName, BENCH_IMAGE_SIZE_MB, BENCH_SECTORS_PER_CLUSTER)
+        || !afatfsImageOpen(imageName, &config->device)) {
+        return false;
+    }
+    afatfs_init(&afatfsImageBlockDevice);
+    while (afatfs_getFilesystemState() == AFATFS_FILESYSTEM_STATE_INITIALIZATION) {
+        afatfs_poll();
+    }
+    return afatfs_getFilesystemState() == AFATFS_FILESYSTEM_STATE_READY;
+}
+
+static void benchRun(const char *imageName, const benchConfig_t *config, uint32_t totalBytes, uint32_t writeSize, uint32_t rateKBps, uint64_t timerOverheadNs)
+{
+    BenchStage writeStage("afatfs_fwrite");
+    BenchStage pollStage("afatfs_poll");
+    writeStage.reserve(2 * totalBytes / writeSize);
+    pollStage.reserve(2 * totalBytes / writeSize);
+
+    const uint64_t mountStartNs = benchNowNs();
+    if (!benchMount(imageName, config)) {
+        fprintf(stderr, "%s: unable to mount %s\n", config->name, imageName);
+        afatfsImageClose();
+        return;
+    }
+    const uint64_t mountNs = benchNowNs() - mountStartNs;
+
+    // blackbox creates its logs with the same mode
+    afatfs_fopen("LOG00001.BFL", "as", benchLogFileCreated);
+    if (!benchWaitForCallback() || !benchLogFile) {
+        fprintf(stderr, "%s: unable to create the log file\n", config->name);
+        afatfs_destroy(true);
+        afatfsImageClose();
+        return;
+    }
+
+    uint8_t *data = (uint8_t *)malloc(writeSize);
+    for (uint32_t ii = 0; ii < writeSize; ii++) {
+        data[ii] = rand();
+    }
+
+    uint64_t worstStallNs = 0;
+    uint32_t stalledWrites = 0;
+    const uint64_t streamStartNs = benchNowNs();
+    for (uint32_t written = 0; written < totalBytes; ) {
+        if (rateKBps) {
+            const uint64_t dueNs = streamStartNs + (uint64_t)written * 1000000 / rateKBps;
+            while (benchNowNs() < dueNs) {
+                afatfs_poll();
+            }
+        }
+        // a frame which doesn't fit completely would be partly dropped by blackbox, so keep count of the time until it does
+        uint64_t stallStartNs = 0;
+        for (uint32_t offset = 0; offset < writeSize; ) {
+            const uint64_t pollStartNs = benchNowNs();
+            afatfs_poll();
+            const uint64_t writeStartNs = benchNowNs();
+            offset += afatfs_fwrite(benchLogFile, data + offset, writeSize - offset);
+            const uint64_t endNs = benchNowNs();
+
+            pollStage.add(writeStartNs - pollStartNs);
+            writeStage.add(endNs - writeStartNs);
+            if (offset < writeSize && !stallStartNs) {
+                stallStartNs = writeStartNs;
+            }
+            if (afatfs_isFull()) {
+                fprintf(stderr, "%s: filesystem full\n", config->name);
+                totalBytes = written;
+                break;
+            }
+        }
+        if (stallStartNs) {
+            stalledWrites++;
+            worstStallNs = std::max(worstStallNs, benchNowNs() - stallStartNs);
+        }
+        written += writeSize;
+    }
+    const uint64_t streamNs = benchNowNs() - streamStartNs;
+
+    afatfs_fclose(benchLogFile, benchLogFileClosed);
+    benchWaitForCallback();
+
+    const afatfsCacheStats_t cacheStats = *afatfs_getCacheStats();
+    const afatfsImageStats_t deviceStats = *afatfsImageGetStats();
+    while (!afatfs_destroy(false)) {
+    }
+    afatfsImageClose();
+    free(data);
+
+    const uint32_t cacheReads = cacheStats.hits + cacheStats.misses;
+    printf("%-10s %10.1f %10.2f %9.1f%% %10.2f %10u %10u %10u %10u %10u\n", config->name,
+        mountNs / 1e6, streamNs ? totalBytes / (streamNs / 1e9) / (1024 * 1024) : 0.0,
+        cacheReads ? 100.0 * cacheStats.hits / cacheReads : 0.0, worstStallNs / 1e6,
+        stalledWrites, deviceStats.blocksRead, deviceStats.blocksWritten, deviceStats.multipleBlockWrites,
+        deviceStats.multipleBlockWriteBlocks);
+
+    BenchStage::printHeader();
+    writeStage.report(config->name, timerOverheadNs);
+    pollStage.report(config->name, timerOverheadNs);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MEGABYTES;
+    const uint32_t writeSize = argc > 2 ? strtoul(argv[2], NULL, 10) : BLACKBOX_FRAME_BUFFER_SIZE;
+    const uint32_t rateKBps = argc > 3 ? strtoul(argv[3], NULL, 10) : 0;
+    if (writeSize == 0) {
+        fprintf(stderr, "write size must be at least one byte\n");
+        return 1;
+    }
+
+    char imageName[] = "/tmp/afatfs_benchmark_XXXXXX";
+    const int fd = mkstemp(imageName);
+    if (fd < 0) {
+        fprintf(stderr, "unable to create an image file\n");
+        return 1;
+    }
+    close(fd);
+    srand(1);
+
+    printf("%uMB in %u byte writes per config", megabytes, writeSize);
+    if (rateKBps) {
+        printf(" at %ukB/s", rateKBps);
+    }
+    printf(", %uMB FAT32 image with %u byte clusters\n", BENCH_IMAGE_SIZE_MB, BENCH_SECTORS_PER_CLUSTER * 512);
+    const uint64_t timerOverheadNs = benchTimerOverheadNs();
+    for (size_t ii = 0; ii < ARRAYLEN(benchConfigs); ii++) {
+        const afatfsImageConfig_t *device = &benchConfigs[ii].device;
+        printf("\n%s: %uus per block, %uus per streamed block", benchConfigs[ii].name, device->blockLatencyUs,
+            device->multipleBlockLatencyUs);
+        if (device->stallIntervalBlocks) {
+            printf(", %uus stall every %u block writes", device->stallUs, device->stallIntervalBlocks);
+        }
+        printf("\n%-10s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "config", "mount ms", "MB/s", "read ahead",
+            "stall ms", "stalls", "reads", "writes", "multi", "streamed");
+        benchRun(imageName, &benchConfigs[ii], megabytes * 1024 * 1024, writeSize, rateKBps, timerOverheadNs);
+    }
+    unlink(imageName);
+    return 0;
+}
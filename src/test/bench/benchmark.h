@@ -0,0 +1,91 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Helpers shared by the host benchmarks.
+// Each benchmark times individual calls with a monotonic clock and reports
+// mean, p50, p99 and max in nanoseconds together with the throughput.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+static inline uint64_t benchNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// prevents the compiler from optimising away a computed value
+template <typename T>
+static inline void benchKeep(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+class BenchStage {
+public:
+    explicit BenchStage(const char *name) : name(name), totalNs(0) {}
+
+    void reserve(size_t count) { samples.reserve(count); }
+    void add(uint64_t ns) { samples.push_back(ns); totalNs += ns; }
+    void clear(void) { samples.clear(); totalNs = 0; }
+
+    // timer overhead (cost of an empty start/stop pair) is subtracted from every sample
+    void report(const char *config, uint64_t timerOverheadNs)
+    {
+        if (samples.empty()) {
+            return;
+        }
+        std::vector<uint64_t> sorted(samples);
+        std::sort(sorted.begin(), sorted.end());
+        const size_t count = sorted.size();
+        const double overhead = (double)timerOverheadNs;
+        const double mean = std::max(0.0, (double)totalNs / count - overhead);
+        const double p50 = std::max(0.0, (double)sorted[count / 2] - overhead);
+        const double p99 = std::max(0.0, (double)sorted[(count * 99) / 100] - overhead);
+        const double max = std::max(0.0, (double)sorted[count - 1] - overhead);
+        const double throughput = mean > 0 ? 1e9 / mean : 0;
+        printf("%-10s %-16s %10.1f %10.1f %10.1f %10.1f %14.0f\n", config, name, mean, p50, p99, max, throughput);
+    }
+
+    static void printHeader(void)
+    {
+        printf("%-10s %-16s %10s %10s %10s %10s %14s\n", "config", "stage", "ns/iter", "p50", "p99", "max", "iter/s");
+    }
+
+private:
+    const char *name;
+    uint64_t totalNs;
+    std::vector<uint64_t> samples;
+};
+
+static inline uint64_t benchTimerOverheadNs(void)
+{
+    uint64_t best = UINT64_MAX;
+    for (int ii = 0; ii < 1000; ++ii) {
+        const uint64_t start = benchNowNs();
+        const uint64_t stop = benchNowNs();
+        best = std::min(best, stop - start);
+    }
+    return best;
+}
@@ -0,0 +1,483 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmark of the blackbox frame encoding and device write path.
+//
+// Encodes I and P frames with the field layout of a quad logging gyro, debug and motors,
+// and writes them to the serial and flash devices through blackbox_io.c, including the
+// per-iteration device flush. The serial port is modelled on the UART driver (a Tx ring
+// whose transmission is started on every write), the flash chip is held in memory. The
+// "flash" device is always ready, the "m25p16" device is busy after each page program for
+// the time the M25P16 takes to program that many bytes, against a clock that advances by
+// one looptime per frame, so it shows the data lost when flashfs can't keep up.
+//
+// Then the log left on the flash is compressed the way MSP_DATAFLASH_READ compresses it,
+// in reads the size of the MSP reply buffer. A recorded log can be given on the command
+// line to compress that instead.
+//
+// usage: blackbox_benchmark [iterations] [log file]
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <math.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "blackbox/blackbox.h"
+    #include "blackbox/blackbox_encoding.h"
+    #include "blackbox/blackbox_io.h"
+
+    #include "common/axis.h"
+    #include "common/huffman.h"
+    #include "common/maths.h"
+    #include "common/utils.h"
+
+    #include "config/parameter_group.h"
+    #include "config/parameter_group_ids.h"
+
+    #include "drivers/flash.h"
+    #include "drivers/flash_m25p16.h"
+    #include "drivers/serial.h"
+
+    #include "fc/rc_controls.h"
+
+    #include "io/flashfs.h"
+    #include "io/serial.h"
+
+    extern uint32_t targetPidLooptime;
+}
+
+#include "benchmark.h"
+
+#define DEFAULT_ITERATIONS 200000
+#define BENCH_I_INTERVAL 32
+#define BENCH_MOTOR_COUNT 4
+#define BENCH_DEBUG_COUNT 4
+
+typedef struct benchFrame_s {
+    int32_t axisPID_P[XYZ_AXIS_COUNT];
+    int32_t axisPID_I[XYZ_AXIS_COUNT];
+    int32_t axisPID_D[XYZ_AXIS_COUNT];
+    int16_t rcCommand[4];
+    int16_t gyroADC[XYZ_AXIS_COUNT];
+    int16_t accSmooth[XYZ_AXIS_COUNT];
+    int16_t debug[BENCH_DEBUG_COUNT];
+    int16_t motor[BENCH_MOTOR_COUNT];
+} benchFrame_t;
+
+// stick movement with motor noise, as in the pidloop benchmark
+static void benchFrameLoad(benchFrame_t *frame, uint32_t index)
+{
+    const float t = index * 125e-6f;
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        const float stick = 200.0f * sinf(2 * M_PIf * (axis + 1) * 0.5f * t);
+        const float noise = 40.0f * sinf(2 * M_PIf * 180.0f * t + axis) + (rand() % 21 - 10);
+        frame->gyroADC[axis] = lrintf(stick + noise);
+        frame->accSmooth[axis] = lrintf(noise / 4) + (axis == Z ? 512 : 0);
+        frame->axisPID_P[axis] = lrintf(noise / 2);
+        frame->axisPID_I[axis] = lrintf(stick / 10);
+        frame->axisPID_D[axis] = lrintf(noise);
+        frame->rcCommand[axis] = lrintf(stick / 2);
+    }
+    frame->rcCommand[THROTTLE] = 1400 + lrintf(100 * sinf(t));
+    for (int i = 0; i < BENCH_DEBUG_COUNT; i++) {
+        frame->debug[i] = frame->gyroADC[i % XYZ_AXIS_COUNT] + rand() % 5;
+    }
+    for (int i = 0; i < BENCH_MOTOR_COUNT; i++) {
+        frame->motor[i] = frame->rcCommand[THROTTLE] + frame->axisPID_D[i % XYZ_AXIS_COUNT] / 2;
+    }
+}
+
+static void writeBenchIntraframe(const benchFrame_t *frame, uint32_t iteration)
+{
+    blackboxWrite('I');
+    blackboxWriteUnsignedVB(iteration);
+    blackboxWriteUnsignedVB(iteration * 125);
+    blackboxWriteSignedVBArray((int32_t *)frame->axisPID_P, XYZ_AXIS_COUNT);
+    blackboxWriteSignedVBArray((int32_t *)frame->axisPID_I, XYZ_AXIS_COUNT);
+    blackboxWriteSignedVBArray((int32_t *)frame->axisPID_D, XYZ_AXIS_COUNT);
+    blackboxWriteSigned16VBArray((int16_t *)frame->rcCommand, 3);
+    blackboxWriteUnsignedVB(frame->rcCommand[THROTTLE] - 1070);
+    blackboxWriteSigned16VBArray((int16_t *)frame->gyroADC, XYZ_AXIS_COUNT);
+    blackboxWriteSigned16VBArray((int16_t *)frame->accSmooth, XYZ_AXIS_COUNT);
+    blackboxWriteSigned16VBArray((int16_t *)frame->debug, BENCH_DEBUG_COUNT);
+    blackboxWriteUnsignedVB(frame->motor[0] - 1070);
+    for (int i = 1; i < BENCH_MOTOR_COUNT; i++) {
+        blackboxWriteSignedVB(frame->motor[i] - frame->motor[0]);
+    }
+}
+
+static void writeBenchInterframe(const benchFrame_t *frame, const benchFrame_t *last)
+{
+    int32_t deltas[8];
+
+    blackboxWrite('P');
+    blackboxWriteSignedVB(0);
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        deltas[axis] = frame->axisPID_P[axis] - last->axisPID_P[axis];
+    }
+    blackboxWriteSignedVBArray(deltas, XYZ_AXIS_COUNT);
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        deltas[axis] = frame->axisPID_I[axis] - last->axisPID_I[axis];
+    }
+    blackboxWriteTag2_3S32(deltas);
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        blackboxWriteSignedVB(frame->axisPID_D[axis] - last->axisPID_D[axis]);
+    }
+    for (int i = 0; i < 4; i++) {
+        deltas[i] = frame->rcCommand[i] - last->rcCommand[i];
+    }
+    blackboxWriteTag8_4S16(deltas);
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        deltas[axis] = frame->accSmooth[axis] - last->accSmooth[axis];
+    }
+    blackboxWriteTag8_8SVB(deltas, XYZ_AXIS_COUNT);
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        blackboxWriteSignedVB(frame->gyroADC[axis] - last->gyroADC[axis]);
+    }
+    for (int i = 0; i < BENCH_DEBUG_COUNT; i++) {
+        blackboxWriteSignedVB(frame->debug[i] - last->debug[i]);
+    }
+    for (int i = 0; i < BENCH_MOTOR_COUNT; i++) {
+        blackboxWriteSignedVB(frame->motor[i] - last->motor[i]);
+    }
+}
+
+// Serial port modelled on the UART driver
+
+#define BENCH_SERIAL_TX_BUFFER_SIZE 256
+
+static volatile uint8_t benchSerialTxBuffer[BENCH_SERIAL_TX_BUFFER_SIZE];
+static volatile uint32_t benchSerialTxStarts;
+static serialPort_t benchSerialPort;
+
+static void benchSerialStartTx(void)
+{
+    // stands in for enabling the TXE interrupt or kicking the Tx DMA
+    benchSerialTxStarts++;
+}
+
+static void benchSerialWrite(serialPort_t *instance, uint8_t ch)
+{
+    instance->txBuffer[instance->txBufferHead] = ch;
+    if (instance->txBufferHead + 1 >= instance->txBufferSize) {
+        instance->txBufferHead = 0;
+    } else {
+        instance->txBufferHead++;
+    }
+    benchSerialStartTx();
+}
+
+static void benchSerialWriteBuf(serialPort_t *instance, const void *data, int count)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (count > 0) {
+        const uint32_t chunk = MIN((uint32_t)count, instance->txBufferSize - instance->txBufferHead);
+        memcpy((uint8_t *)&instance->txBuffer[instance->txBufferHead], p, chunk);
+        instance->txBufferHead = (instance->txBufferHead + chunk) % instance->txBufferSize;
+        p += chunk;
+        count -= chunk;
+        benchSerialStartTx();
+    }
+}
+
+static uint32_t benchSerialTxBytesFree(const serialPort_t *instance)
+{
+    const uint32_t used = (instance->txBufferHead + instance->txBufferSize - instance->txBufferTail) % instance->txBufferSize;
+    return instance->txBufferSize - used - 1;
+}
+
+static bool benchSerialTxBufferEmpty(const serialPort_t *instance)
+{
+    return instance->txBufferHead == instance->txBufferTail;
+}
+
+static const struct serialPortVTable benchSerialVTable = {
+    .serialWrite = benchSerialWrite,
+    .serialTotalRxWaiting = NULL,
+    .serialTotalTxFree = benchSerialTxBytesFree,
+    .serialRead = NULL,
+    .serialSetBaudRate = NULL,
+    .isSerialTransmitBufferEmpty = benchSerialTxBufferEmpty,
+    .setMode = NULL,
+    .writeBuf = benchSerialWriteBuf,
+    .readBuf = NULL,
+    .beginWrite = NULL,
+    .endWrite = NULL,
+};
+
+typedef struct benchDevice_s {
+    const char *name;
+    uint8_t device;
+    bool flashProgramTime;
+} benchDevice_t;
+
+static const benchDevice_t benchDevices[] = {
+    { "serial", BLACKBOX_DEVICE_SERIAL, false },
+    { "flash", BLACKBOX_DEVICE_FLASH, false },
+    { "m25p16", BLACKBOX_DEVICE_FLASH, true },
+};
+
+typedef struct benchFlashStats_s {
+    uint32_t pagePrograms;
+    uint64_t programmedBytes;
+} benchFlashStats_t;
+
+static bool benchFlashProgramTime;
+static uint64_t benchFlashNowUs;
+static uint64_t benchFlashBusyUntilUs;
+static benchFlashStats_t benchFlashStats;
+
+static void benchRun(const benchDevice_t *device, uint32_t iterations, uint64_t timerOverheadNs)
+{
+    BenchStage iFrameStage("I frame");
+    BenchStage pFrameStage("P frame");
+    iFrameStage.reserve(iterations / BENCH_I_INTERVAL + 1);
+    pFrameStage.reserve(iterations);
+
+    blackboxConfigMutable()->device = device->device;
+    benchFlashProgramTime = device->flashProgramTime;
+    benchFlashNowUs = benchFlashBusyUntilUs = 0;
+    flashfsEraseCompletely();
+    flashfsInit();
+    blackboxDeviceOpen();
+    memset(&benchFlashStats, 0, sizeof(benchFlashStats));
+
+    benchFrame_t frames[2];
+    uint64_t bytes = flashfsGetOffset();
+    uint64_t serialBytes = 0;
+    uint32_t droppedFrames = 0;
+    for (uint32_t ii = 0; ii < iterations; ii++) {
+        benchFrame_t *frame = &frames[ii & 1];
+        const benchFrame_t *last = &frames[(ii + 1) & 1];
+        benchFrameLoad(frame, ii);
+
+        const uint64_t startNs = benchNowNs();
+        if (ii % BENCH_I_INTERVAL == 0) {
+            writeBenchIntraframe(frame, ii);
+        } else {
+            writeBenchInterframe(frame, last);
+        }
+        if (blackboxEndFrame()) {
+            droppedFrames++;
+        }
+        blackboxDeviceFlush();
+        const uint64_t endNs = benchNowNs();
+
+        (ii % BENCH_I_INTERVAL == 0 ? iFrameStage : pFrameStage).add(endNs - startNs);
+
+        // the Tx interrupt drains the serial port between loop iterations
+        serialBytes += (benchSerialPort.txBufferHead + BENCH_SERIAL_TX_BUFFER_SIZE - benchSerialPort.txBufferTail) % BENCH_SERIAL_TX_BUFFER_SIZE;
+        benchSerialPort.txBufferTail = benchSerialPort.txBufferHead;
+        benchFlashNowUs += targetPidLooptime;
+        if (flashfsIsEOF()) {
+            bytes += flashfsGetOffset();
+            flashfsEraseCompletely();
+            flashfsInit();
+        }
+    }
+    blackboxDeviceFlushForce();
+    bytes = device->device == BLACKBOX_DEVICE_SERIAL ? serialBytes : bytes + flashfsGetOffset();
+
+    iFrameStage.report(device->name, timerOverheadNs);
+    pFrameStage.report(device->name, timerOverheadNs);
+    printf("%-10s %.1f bytes per frame, %u frames dropped\n", device->name, (double)bytes / iterations, droppedFrames);
+    if (device->device == BLACKBOX_DEVICE_FLASH) {
+        printf("%-10s %u page programs, %.1f bytes per program\n", device->name,
+            benchFlashStats.pagePrograms, (double)benchFlashStats.programmedBytes / benchFlashStats.pagePrograms);
+    }
+}
+
+#define BENCH_DATAFLASH_READ_SIZE 4096
+#define BENCH_DOWNLOAD_BAUD 115200
+
+static void benchCompress(const char *name, const std::vector<uint8_t> &log, uint64_t timerOverheadNs)
+{
+    static huffmanTable_t table;
+    static uint32_t histogram[HUFFMAN_SYMBOL_COUNT];
+    static uint8_t coded[BENCH_DATAFLASH_READ_SIZE];
+    static uint8_t decoded[BENCH_DATAFLASH_READ_SIZE];
+
+    BenchStage compressStage("huffman");
+    compressStage.reserve(log.size() / BENCH_DATAFLASH_READ_SIZE + 1);
+
+    uint64_t replyBytes = 0;
+    uint64_t totalNs = 0;
+    for (size_t offset = 0; offset < log.size(); offset += BENCH_DATAFLASH_READ_SIZE) {
+        const int readLen = MIN(BENCH_DATAFLASH_READ_SIZE, log.size() - offset);
+
+        const uint64_t startNs = benchNowNs();
+        memset(histogram, 0, sizeof(histogram));
+        huffmanCountSymbols(histogram, &log[offset], readLen);
+        huffmanBuildTable(&table, histogram);
+        huffmanState_t state;
+        huffmanInitState(&state, coded, readLen - sizeof(uint16_t) - HUFFMAN_CODE_LENGTHS_SIZE);
+        const bool compressed = huffmanEncode(&state, &table, &log[offset], readLen) && huffmanEncodeFinish(&state);
+        const uint64_t endNs = benchNowNs();
+
+        compressStage.add(endNs - startNs);
+        totalNs += endNs - startNs;
+
+        if (!compressed) {
+            replyBytes += readLen;
+            continue;
+        }
+        replyBytes += sizeof(uint16_t) + HUFFMAN_CODE_LENGTHS_SIZE + state.bytesWritten;
+        if (huffmanDecode(decoded, readLen, coded, state.bytesWritten, &table) != readLen || memcmp(decoded, &log[offset], readLen)) {
+            fprintf(stderr, "compressed read at %u does not decode\n", (unsigned)offset);
+            exit(1);
+        }
+    }
+
+    compressStage.report(name, timerOverheadNs);
+    printf("%-10s %u bytes compressed to %.1f%% at %.1fMB/s, download at %d baud takes %.0fs instead of %.0fs\n", name,
+        (unsigned)log.size(), 100.0 * replyBytes / log.size(), log.size() * 1e3 / totalNs, BENCH_DOWNLOAD_BAUD,
+        replyBytes * 10.0 / BENCH_DOWNLOAD_BAUD, log.size() * 10.0 / BENCH_DOWNLOAD_BAUD);
+}
+
+static bool loadLog(const char *fileName, std::vector<uint8_t> &log)
+{
+    FILE *fp = fopen(fileName, "rb");
+    if (!fp) {
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t bytesRead;
+    while ((bytesRead = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        log.insert(log.end(), buffer, buffer + bytesRead);
+    }
+    fclose(fp);
+    return !log.empty();
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+
+    std::vector<uint8_t> recordedLog;
+    if (argc > 2 && !loadLog(argv[2], recordedLog)) {
+        fprintf(stderr, "unable to read blackbox log from %s\n", argv[2]);
+        return 1;
+    }
+
+    pgResetAll(0);
+    benchSerialPort.vTable = &benchSerialVTable;
+    benchSerialPort.txBuffer = benchSerialTxBuffer;
+    benchSerialPort.txBufferSize = BENCH_SERIAL_TX_BUFFER_SIZE;
+    srand(1);
+
+    printf("%u frames per device, I frame every %d frames\n", iterations, BENCH_I_INTERVAL);
+    const uint64_t timerOverheadNs = benchTimerOverheadNs();
+    BenchStage::printHeader();
+    for (size_t ii = 0; ii < ARRAYLEN(benchDevices); ii++) {
+        benchRun(&benchDevices[ii], iterations, timerOverheadNs);
+    }
+
+    if (recordedLog.empty()) {
+        // the log written to the flash by the last run
+        std::vector<uint8_t> flashLog(flashfsGetOffset());
+        flashfsReadAbs(0, flashLog.data(), flashLog.size());
+        benchCompress("flash log", flashLog, timerOverheadNs);
+    } else {
+        benchCompress(argv[2], recordedLog, timerOverheadNs);
+    }
+    return 0;
+}
+
+// STUBS
+
+extern "C" {
+
+PG_REGISTER(blackboxConfig_t, blackboxConfig, PG_BLACKBOX_CONFIG, 0);
+
+uint32_t targetPidLooptime = 125;
+const uint32_t baudRates[] = { 0, 9600, 19200, 38400, 57600, 115200, 230400, 250000,
+        400000, 460800, 500000, 921600, 1000000, 1500000, 2000000, 2470000 };
+
+static serialPortConfig_t benchSerialPortConfig;
+
+serialPort_t *findSharedSerialPort(uint16_t, serialPortFunction_e) { return NULL; }
+serialPortConfig_t *findSerialPortConfig(serialPortFunction_e) { return &benchSerialPortConfig; }
+portSharing_e determinePortSharing(const serialPortConfig_t *, serialPortFunction_e) { return PORTSHARING_NOT_SHARED; }
+serialPort_t *openSerialPort(serialPortIdentifier_e, serialPortFunction_e, serialReceiveCallbackPtr, uint32_t, portMode_t, portOptions_t)
+{
+    return &benchSerialPort;
+}
+void closeSerialPort(serialPort_t *) {}
+void mspSerialReleasePortIfAllocated(serialPort_t *) {}
+void mspSerialAllocatePorts(void) {}
+
+// flash chip held in memory, optionally with the M25P16's typical page program time
+
+#define BENCH_FLASH_SECTORS 256
+#define BENCH_FLASH_PAGES_PER_SECTOR 256
+
+// the M25P16 takes 0.64ms to program a whole page (typical), most of which it also takes for a few bytes
+#define BENCH_FLASH_PAGE_PROGRAM_BASE_US 400
+#define BENCH_FLASH_PAGE_PROGRAM_PAGE_US 240
+
+static flashGeometry_t benchFlashGeometry = {
+    .sectors = BENCH_FLASH_SECTORS,
+    .pagesPerSector = BENCH_FLASH_PAGES_PER_SECTOR,
+    .pageSize = M25P16_PAGESIZE,
+    .sectorSize = BENCH_FLASH_PAGES_PER_SECTOR * M25P16_PAGESIZE,
+    .totalSize = BENCH_FLASH_SECTORS * BENCH_FLASH_PAGES_PER_SECTOR * M25P16_PAGESIZE,
+};
+
+static std::vector<uint8_t> benchFlash(BENCH_FLASH_SECTORS * BENCH_FLASH_PAGES_PER_SECTOR * M25P16_PAGESIZE, 0xFF);
+static uint32_t benchFlashProgramAddress;
+static uint32_t benchFlashProgramLength;
+
+const flashGeometry_t *m25p16_getGeometry(void) { return &benchFlashGeometry; }
+bool m25p16_isReady(void) { return !benchFlashProgramTime || benchFlashNowUs >= benchFlashBusyUntilUs; }
+void m25p16_eraseCompletely(void) { std::fill(benchFlash.begin(), benchFlash.end(), 0xFF); }
+void m25p16_eraseSector(uint32_t address)
+{
+    std::fill(benchFlash.begin() + address, benchFlash.begin() + address + benchFlashGeometry.sectorSize, 0xFF);
+}
+void m25p16_pageProgramBegin(uint32_t address)
+{
+    // the driver waits for the previous program to finish
+    if (!m25p16_isReady()) {
+        benchFlashNowUs = benchFlashBusyUntilUs;
+    }
+    benchFlashProgramAddress = address;
+    benchFlashProgramLength = 0;
+}
+void m25p16_pageProgramContinue(const uint8_t *data, int length)
+{
+    memcpy(&benchFlash[benchFlashProgramAddress], data, length);
+    benchFlashProgramAddress += length;
+    benchFlashProgramLength += length;
+}
+void m25p16_pageProgramFinish(void)
+{
+    benchFlashStats.pagePrograms++;
+    benchFlashStats.programmedBytes += benchFlashProgramLength;
+    benchFlashBusyUntilUs = benchFlashNowUs + BENCH_FLASH_PAGE_PROGRAM_BASE_US
+        + benchFlashProgramLength * BENCH_FLASH_PAGE_PROGRAM_PAGE_US / M25P16_PAGESIZE;
+}
+int m25p16_readBytes(uint32_t address, uint8_t *buffer, int length)
+{
+    memcpy(buffer, &benchFlash[address], length);
+    return length;
+}
+}
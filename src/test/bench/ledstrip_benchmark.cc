@@ -0,0 +1,219 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmark of updating a 32 LED strip.
+//
+// Each update sets the colour of every LED, like the fixed layers of the LED strip
+// do, has a layer change some of them, then calls ws2811UpdateStrip() to fill the DMA
+// buffer. The configs go from a strip that doesn't change between updates, through a
+// larson scanner moving over it and a blinking warning, to every LED changing colour
+// on every update.
+//
+// Then it times expanding LED colours into DMA buffer compare values with
+// ws2811EncodeLed() and with the bit at a time loop it replaced, and reports the time
+// per LED, and on x86 the timestamp counter ticks per LED.
+//
+// usage: ledstrip_benchmark [iterations]
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "common/color.h"
+    #include "common/utils.h"
+
+    #include "drivers/light_ws2811strip.h"
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_TSC
+#endif
+
+#include "benchmark.h"
+
+extern "C" {
+    void ws2811EncodeLed(ledStripDMAElement_t *dst, const rgbColor24bpp_t *color);
+}
+
+#define DEFAULT_ITERATIONS 200000
+
+typedef void benchLayerFn(uint32_t update);
+
+static const hsvColor_t benchBackground = { 0, 0, 0 };
+static const hsvColor_t benchColor = { 120, 0, 255 };
+static const hsvColor_t benchHighlight = { 0, 0, 255 };
+
+static void benchLayerNone(uint32_t update)
+{
+    UNUSED(update);
+}
+
+static void benchLayerLarson(uint32_t update)
+{
+    const int position = update % WS2811_LED_STRIP_LENGTH;
+    for (int i = -2; i <= 2; i++) {
+        const int index = (position + i + WS2811_LED_STRIP_LENGTH) % WS2811_LED_STRIP_LENGTH;
+        hsvColor_t color;
+        getLedHsv(index, &color);
+        color.v = i ? 255 / (2 * abs(i)) : 255;
+        setLedHsv(index, &color);
+    }
+}
+
+static void benchLayerBlink(uint32_t update)
+{
+    if (update & 1) {
+        for (int index = 0; index < WS2811_LED_STRIP_LENGTH; index += 4) {
+            setLedHsv(index, &benchHighlight);
+        }
+    }
+}
+
+static void benchLayerRainbow(uint32_t update)
+{
+    for (int index = 0; index < WS2811_LED_STRIP_LENGTH; index++) {
+        const hsvColor_t color = { (uint16_t)((update + index * 11) % (HSV_HUE_MAX + 1)), 0, 255 };
+        setLedHsv(index, &color);
+    }
+}
+
+typedef struct benchConfig_s {
+    const char *name;
+    benchLayerFn *layer;
+} benchConfig_t;
+
+static const benchConfig_t benchConfigs[] = {
+    { "static", benchLayerNone },
+    { "larson", benchLayerLarson },
+    { "blink", benchLayerBlink },
+    { "rainbow", benchLayerRainbow },
+};
+
+static void benchRun(const benchConfig_t *config, uint32_t iterations, uint64_t timerOverheadNs)
+{
+    BenchStage layerStage("layers");
+    BenchStage updateStage("ws2811Update");
+    BenchStage totalStage("total");
+    layerStage.reserve(iterations);
+    updateStage.reserve(iterations);
+    totalStage.reserve(iterations);
+
+    ws2811LedStripInit(IO_TAG_NONE);
+
+    for (uint32_t ii = 0; ii < iterations; ii++) {
+        const uint64_t layerStartNs = benchNowNs();
+        for (int index = 0; index < WS2811_LED_STRIP_LENGTH; index++) {
+            setLedHsv(index, index % 8 ? &benchColor : &benchBackground);
+        }
+        config->layer(ii);
+        const uint64_t updateStartNs = benchNowNs();
+        ws2811UpdateStrip();
+        const uint64_t endNs = benchNowNs();
+
+        layerStage.add(updateStartNs - layerStartNs);
+        updateStage.add(endNs - updateStartNs);
+        totalStage.add(endNs - layerStartNs);
+        benchKeep(ledStripDMABuffer);
+    }
+
+    layerStage.report(config->name, timerOverheadNs);
+    updateStage.report(config->name, timerOverheadNs);
+    totalStage.report(config->name, timerOverheadNs * 2);
+}
+
+typedef void benchEncodeFn(ledStripDMAElement_t *dst, const rgbColor24bpp_t *color);
+
+// The encoder before ws2811EncodeLed()
+static void bitAtATimeEncodeLed(ledStripDMAElement_t *dst, const rgbColor24bpp_t *color)
+{
+    const uint32_t grb = (color->rgb.g << 16) | (color->rgb.r << 8) | (color->rgb.b);
+
+    for (int8_t index = 23; index >= 0; index--) {
+        *dst++ = (grb & (1 << index)) ? BIT_COMPARE_1 : BIT_COMPARE_0;
+    }
+}
+
+static void benchEncode(const char *name, benchEncodeFn *encode, uint32_t iterations)
+{
+    rgbColor24bpp_t colors[WS2811_LED_STRIP_LENGTH];
+    srand(1);
+    for (int index = 0; index < WS2811_LED_STRIP_LENGTH; index++) {
+        for (int i = 0; i < RGB_COLOR_COMPONENT_COUNT; i++) {
+            colors[index].raw[i] = rand();
+        }
+    }
+
+    const uint64_t startNs = benchNowNs();
+#ifdef BENCH_TSC
+    const uint64_t startTsc = __rdtsc();
+#endif
+    for (uint32_t ii = 0; ii < iterations; ii++) {
+        for (int index = 0; index < WS2811_LED_STRIP_LENGTH; index++) {
+            encode(&ledStripDMABuffer[index * WS2811_BITS_PER_LED], &colors[index]);
+        }
+        benchKeep(ledStripDMABuffer);
+        // a different colour for each LED next time round
+        colors[ii % WS2811_LED_STRIP_LENGTH].rgb.g++;
+    }
+    const double leds = (double)iterations * WS2811_LED_STRIP_LENGTH;
+    printf("%-16s %10.2f ns/LED", name, (benchNowNs() - startNs) / leds);
+#ifdef BENCH_TSC
+    printf(" %10.1f tsc/LED", (__rdtsc() - startTsc) / leds);
+#endif
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+
+    printf("%d LEDs, %u iterations per config\n", WS2811_LED_STRIP_LENGTH, iterations);
+    const uint64_t timerOverheadNs = benchTimerOverheadNs();
+    BenchStage::printHeader();
+    for (size_t ii = 0; ii < ARRAYLEN(benchConfigs); ii++) {
+        benchRun(&benchConfigs[ii], iterations, timerOverheadNs);
+    }
+
+    printf("\n");
+    benchEncode("bit at a time", bitAtATimeEncodeLed, iterations);
+    benchEncode("ws2811EncodeLed", ws2811EncodeLed, iterations);
+    return 0;
+}
+
+// STUBS
+
+extern "C" {
+
+void ws2811LedStripHardwareInit(ioTag_t ioTag)
+{
+    UNUSED(ioTag);
+
+    ws2811SetBitCompare(WS2811_TIMER_MHZ * 1000000 / WS2811_CARRIER_HZ);
+}
+
+// the transfer finishes straight away
+void ws2811LedStripDMAEnable(void)
+{
+    ws2811LedDataTransferInProgress = 0;
+}
+
+}
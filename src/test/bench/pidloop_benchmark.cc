@@ -0,0 +1,252 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmark of the gyro -> PID -> mixer hot path.
+//
+// Runs gyroUpdate(), pidController() and mixTable() against the fake gyro driver
+// at 1, 2, 4, 8 and 32kHz looptimes. The gyro stream is synthetic (stick input plus
+// motor noise) unless a recorded stream is given on the command line as a text file
+// with one "x,y,z" line of raw gyro values per sample.
+//
+// usage: pidloop_benchmark [gyro.csv] [iterations]
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <math.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "build/debug.h"
+
+    #include "common/axis.h"
+    #include "common/filter.h"
+    #include "common/maths.h"
+    #include "common/utils.h"
+
+    #include "config/feature.h"
+    #include "config/parameter_group.h"
+    #include "config/parameter_group_ids.h"
+
+    #include "drivers/accgyro/accgyro.h"
+    #include "drivers/accgyro/accgyro_fake.h"
+    #include "drivers/sensor.h"
+
+    #include "fc/config.h"
+    #include "fc/rc_controls.h"
+    #include "fc/runtime_config.h"
+
+    #include "flight/imu.h"
+    #include "flight/mixer.h"
+    #include "flight/pid.h"
+
+    #include "io/beeper.h"
+
+    #include "rx/rx.h"
+
+    #include "scheduler/scheduler.h"
+
+    #include "sensors/acceleration.h"
+    #include "sensors/gyro.h"
+    #include "sensors/sensors.h"
+
+    extern gyroDev_t *fakeGyroDev;
+}
+
+#include "benchmark.h"
+
+typedef struct benchConfig_s {
+    const char *name;
+    uint32_t looptimeUs;
+} benchConfig_t;
+
+static const benchConfig_t benchConfigs[] = {
+    { "1kHz", 1000 },
+    { "2kHz", 500 },
+    { "4kHz", 250 },
+    { "8kHz", 125 },
+    { "32kHz", 31 },
+};
+
+#define DEFAULT_ITERATIONS 200000
+
+typedef struct gyroSample_s {
+    int16_t adc[XYZ_AXIS_COUNT];
+} gyroSample_t;
+
+static std::vector<gyroSample_t> recordedStream;
+
+static bool loadRecordedStream(const char *fileName)
+{
+    FILE *fp = fopen(fileName, "r");
+    if (!fp) {
+        return false;
+    }
+    int x, y, z;
+    char line[128];
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%d,%d,%d", &x, &y, &z) == 3) {
+            const gyroSample_t sample = {{ (int16_t)x, (int16_t)y, (int16_t)z }};
+            recordedStream.push_back(sample);
+        }
+    }
+    fclose(fp);
+    return !recordedStream.empty();
+}
+
+// stick movement on each axis with motor noise at two frequencies and some broadband noise
+static gyroSample_t syntheticSample(uint32_t index, uint32_t looptimeUs)
+{
+    static const float stickHz[XYZ_AXIS_COUNT] = { 1.5f, 2.0f, 0.5f };
+    static const float motorNoiseHz[2] = { 180.0f, 330.0f };
+    const float t = index * looptimeUs * 1e-6f;
+    gyroSample_t sample;
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        float value = 200.0f * sinf(2 * M_PIf * stickHz[axis] * t);
+        value += 40.0f * sinf(2 * M_PIf * motorNoiseHz[0] * t + axis);
+        value += 25.0f * sinf(2 * M_PIf * motorNoiseHz[1] * t + 2 * axis);
+        value += (float)(rand() % 21 - 10);
+        sample.adc[axis] = (int16_t)lrintf(value);
+    }
+    return sample;
+}
+
+static void benchInit(const benchConfig_t *config)
+{
+    gyroConfigMutable()->gyro_soft_lpf_type = FILTER_PT1;
+    gyroInit();
+    // set the looptime directly, since the fake gyro does not support 32kHz
+    gyro.targetLooptime = config->looptimeUs;
+    gyroInitFilters();
+
+    pidConfigMutable()->pid_process_denom = 1;
+    pidInit(currentPidProfile);
+    pidStabilisationState(PID_STABILISATION_ON);
+
+    mixerInit(MIXER_QUADX);
+    mixerConfigureOutput();
+
+    ENABLE_ARMING_FLAG(ARMED);
+    rcCommand[THROTTLE] = 1500;
+}
+
+static void benchRun(const benchConfig_t *config, uint32_t iterations, uint64_t timerOverheadNs)
+{
+    BenchStage gyroStage("gyroUpdate");
+    BenchStage pidStage("pidController");
+    BenchStage mixerStage("mixTable");
+    BenchStage loopStage("total");
+    gyroStage.reserve(iterations);
+    pidStage.reserve(iterations);
+    mixerStage.reserve(iterations);
+    loopStage.reserve(iterations);
+
+    benchInit(config);
+
+    const rollAndPitchTrims_t angleTrim = {{ 0, 0 }};
+    timeUs_t currentTimeUs = 0;
+    for (uint32_t ii = 0; ii < iterations; ii++) {
+        const gyroSample_t sample = recordedStream.empty()
+            ? syntheticSample(ii, config->looptimeUs)
+            : recordedStream[ii % recordedStream.size()];
+        fakeGyroSet(fakeGyroDev, sample.adc[X], sample.adc[Y], sample.adc[Z]);
+        currentTimeUs += config->looptimeUs;
+
+        const uint64_t gyroStartNs = benchNowNs();
+        gyroUpdate();
+        const uint64_t pidStartNs = benchNowNs();
+        pidController(currentPidProfile, &angleTrim, currentTimeUs);
+        const uint64_t mixerStartNs = benchNowNs();
+        mixTable(currentPidProfile);
+        const uint64_t endNs = benchNowNs();
+
+        gyroStage.add(pidStartNs - gyroStartNs);
+        pidStage.add(mixerStartNs - pidStartNs);
+        mixerStage.add(endNs - mixerStartNs);
+        loopStage.add(endNs - gyroStartNs);
+        benchKeep(motor);
+    }
+
+    gyroStage.report(config->name, timerOverheadNs);
+    pidStage.report(config->name, timerOverheadNs);
+    mixerStage.report(config->name, timerOverheadNs);
+    loopStage.report(config->name, timerOverheadNs * 3);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && !loadRecordedStream(argv[1])) {
+        fprintf(stderr, "unable to read gyro stream from %s\n", argv[1]);
+        return 1;
+    }
+    const uint32_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_ITERATIONS;
+
+    pgResetAll(MAX_PROFILE_COUNT);
+    currentPidProfile = pidProfilesMutable(0);
+    rxConfigMutable()->mincheck = 1100;
+    rxConfigMutable()->midrc = 1500;
+    srand(1);
+
+    printf("gyro stream: %s, %u iterations per config\n", recordedStream.empty() ? "synthetic" : argv[1], iterations);
+    const uint64_t timerOverheadNs = benchTimerOverheadNs();
+    BenchStage::printHeader();
+    for (size_t ii = 0; ii < ARRAYLEN(benchConfigs); ii++) {
+        benchRun(&benchConfigs[ii], iterations, timerOverheadNs);
+    }
+    return 0;
+}
+
+// STUBS
+
+extern "C" {
+
+uint8_t armingFlags;
+uint16_t flightModeFlags;
+uint8_t detectedSensors[SENSOR_INDEX_COUNT];
+attitudeEulerAngles_t attitude;
+int16_t GPS_angle[ANGLE_INDEX_COUNT];
+float rcCommand[4];
+int16_t rcData[MAX_SUPPORTED_RC_CHANNEL_COUNT];
+pidProfile_t *currentPidProfile;
+
+rxConfig_t rxConfig_System;
+
+const timerHardware_t timerHardware[USABLE_TIMER_CHANNEL_COUNT] = {};
+
+void sensorsSet(uint32_t) {}
+void beeper(beeperMode_e) {}
+void schedulerResetTaskStatistics(cfTaskId_e) {}
+void delay(timeMs_t) {}
+void delayMicroseconds(timeUs_t) {}
+
+bool feature(uint32_t) { return false; }
+bool isAirmodeActive(void) { return true; }
+bool failsafeIsActive(void) { return false; }
+float calculateVbatPidCompensation(void) { return 1.0f; }
+float getThrottlePIDAttenuation(void) { return 1.0f; }
+float getSetpointRate(int) { return 0.0f; }
+float getRcDeflection(int) { return 0.0f; }
+float getRcDeflectionAbs(int) { return 0.0f; }
+
+bool pwmAreMotorsEnabled(void) { return true; }
+void pwmWriteMotor(uint8_t, uint16_t) {}
+void pwmCompleteMotorUpdate(uint8_t) {}
+void pwmShutdownPulsesForAllMotors(uint8_t) {}
+}
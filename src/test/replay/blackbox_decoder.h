@@ -0,0 +1,924 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Streaming decoder for the logs written by blackbox/blackbox.c.
+//
+// The log is read through a small fixed size buffer, so arbitrarily large files
+// (including files holding several logs back to back, as written to flash) can be
+// decoded without loading them into memory. The field layout is taken from the
+// "H Field" header lines of each log, so the decoder does not depend on the
+// conditions (motor count, debug, vbat...) the log was recorded with.
+//
+// Frames that fail to decode, or that are not followed by a valid frame marker,
+// are dropped and the decoder resynchronises on the next intra (I) frame.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "blackbox/blackbox_fielddefs.h"
+}
+
+#define BLACKBOX_DECODER_BUFFER_SIZE 65536
+#define BLACKBOX_DECODER_MAX_FIELDS 128
+#define BLACKBOX_DECODER_MAX_HEADER_LINE 1024
+
+static const char blackboxLogStartMarker[] = "H Product:";
+
+typedef struct blackboxFrameDef_s {
+    std::vector<std::string> name;
+    std::vector<int> isSigned;
+    std::vector<int> predictor;
+    std::vector<int> encoding;
+} blackboxFrameDef_t;
+
+typedef struct blackboxDecoderStats_s {
+    uint32_t iFrames;
+    uint32_t pFrames;
+    uint32_t slowFrames;
+    uint32_t gpsFrames;
+    uint32_t gpsHomeFrames;
+    uint32_t eventFrames;
+    uint32_t corruptFrames;
+    uint32_t skippedPFrames; // P frames that arrived without a valid I frame to predict from
+} blackboxDecoderStats_t;
+
+class BlackboxDecoder {
+public:
+    typedef enum {
+        FRAME_NONE = 0,
+        FRAME_MAIN,         // I or P frame, values in mainValues()
+        FRAME_SLOW,         // S frame, values in slowValues()
+        FRAME_EVENT,        // E frame, type in eventType()
+        FRAME_OTHER,        // G or H (GPS) frame
+        FRAME_LOG_END       // end of the current log, either an explicit end event or the start of the next log
+    } frameType_e;
+
+    explicit BlackboxDecoder(FILE *fp)
+        : fp(fp), bufferStart(0), bufferEnd(0), fileOffset(0), eof(false), inLog(false),
+          mainHistoryValid(false), lastEventType(-1), lastMainTime(0)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    // Skips to the start of the next log in the file and parses its header.
+    // Returns false when there are no more logs.
+    bool nextLog(void)
+    {
+        inLog = false;
+        for (;;) {
+            while (!startsWith(blackboxLogStartMarker)) {
+                if (!skipByte()) {
+                    return false;
+                }
+            }
+            resetLog();
+            while (peekByte() == 'H' && peekByte(1) == ' ') {
+                parseHeaderLine();
+            }
+            // a log whose header was cut short cannot be decoded, try the next one
+            if (!mainDef.name.empty() && mainDef.encoding.size() == mainDef.name.size()
+                && mainDef.predictor.size() == mainDef.name.size()
+                && deltaDef.encoding.size() == mainDef.name.size()
+                && deltaDef.predictor.size() == mainDef.name.size()) {
+                break;
+            }
+        }
+        for (size_t ii = 0; ii < mainDef.name.size(); ii++) {
+            mainFieldIndex[mainDef.name[ii]] = ii;
+        }
+        inLog = true;
+        return true;
+    }
+
+    // Decodes frames until the next main, slow or event frame, or the end of the log.
+    frameType_e nextFrame(void)
+    {
+        if (!inLog) {
+            return FRAME_LOG_END;
+        }
+        for (;;) {
+            if (startsWith(blackboxLogStartMarker)) {
+                inLog = false;
+                return FRAME_LOG_END;
+            }
+            const int marker = readByte();
+            if (marker < 0) {
+                inLog = false;
+                return FRAME_LOG_END;
+            }
+            frameType_e frameType = FRAME_NONE;
+            bool ok = true;
+            switch (marker) {
+            case 'I':
+                ok = parseMainFrame(true);
+                frameType = FRAME_MAIN;
+                break;
+            case 'P':
+                if (!mainHistoryValid) {
+                    // cannot predict this frame, drop it and everything up to the next I frame
+                    stats.skippedPFrames++;
+                    resyncOnIntraframe();
+                    continue;
+                }
+                ok = parseMainFrame(false);
+                frameType = FRAME_MAIN;
+                break;
+            case 'S':
+                ok = parseSimpleFrame(slowDef, slowFrame);
+                frameType = FRAME_SLOW;
+                break;
+            case 'G':
+                ok = parseGpsFrame();
+                frameType = FRAME_OTHER;
+                break;
+            case 'H':
+                ok = parseSimpleFrame(gpsHomeDef, gpsHome);
+                frameType = FRAME_OTHER;
+                break;
+            case 'E':
+                ok = parseEventFrame();
+                frameType = FRAME_EVENT;
+                break;
+            default:
+                ok = false;
+                break;
+            }
+            if (ok && frameType == FRAME_EVENT && lastEventType == FLIGHT_LOG_EVENT_LOG_END) {
+                inLog = false;
+                return FRAME_LOG_END;
+            }
+            // a frame is only trusted if the next byte starts another frame
+            if (ok && !isFrameBoundary()) {
+                ok = false;
+            }
+            if (!ok) {
+                stats.corruptFrames++;
+                mainHistoryValid = false;
+                resyncOnIntraframe();
+                continue;
+            }
+            if (frameType == FRAME_MAIN) {
+                commitMainFrame(marker == 'I');
+            }
+            if (frameType == FRAME_OTHER) {
+                continue;
+            }
+            return frameType;
+        }
+    }
+
+    // header access, "H name:value" lines of the current log
+    bool hasHeader(const char *name) const { return headers.count(name) != 0; }
+
+    int headerInt(const char *name, int index, int defaultValue) const
+    {
+        std::map<std::string, std::string>::const_iterator it = headers.find(name);
+        if (it == headers.end()) {
+            return defaultValue;
+        }
+        const char *p = it->second.c_str();
+        for (int ii = 0; ii < index; ii++) {
+            p = strchr(p, ',');
+            if (!p) {
+                return defaultValue;
+            }
+            p++;
+        }
+        char *end;
+        const long value = strtol(p, &end, 0);
+        return end == p ? defaultValue : (int)value;
+    }
+
+    std::string headerString(const char *name) const
+    {
+        std::map<std::string, std::string>::const_iterator it = headers.find(name);
+        return it == headers.end() ? std::string() : it->second;
+    }
+
+    const std::map<std::string, std::string> &allHeaders(void) const { return headers; }
+
+    // index of the named main frame field, eg "gyroADC[0]", or -1
+    int mainField(const std::string &name) const
+    {
+        std::map<std::string, int>::const_iterator it = mainFieldIndex.find(name);
+        return it == mainFieldIndex.end() ? -1 : it->second;
+    }
+    int mainFieldCount(void) const { return mainDef.name.size(); }
+    const std::string &mainFieldName(int index) const { return mainDef.name[index]; }
+
+    int slowField(const std::string &name) const
+    {
+        for (size_t ii = 0; ii < slowDef.name.size(); ii++) {
+            if (slowDef.name[ii] == name) {
+                return ii;
+            }
+        }
+        return -1;
+    }
+
+    const int32_t *mainValues(void) const { return mainHistory[0]; }
+    const int32_t *slowValues(void) const { return slowFrame; }
+    int eventType(void) const { return lastEventType; }
+    bool lastMainFrameWasIntra(void) const { return lastMainIntra; }
+
+    const blackboxDecoderStats_t &statistics(void) const { return stats; }
+    uint64_t bytesRead(void) const { return fileOffset; }
+
+private:
+    // buffered input with lookahead
+
+    bool fill(size_t needed)
+    {
+        if (bufferEnd - bufferStart >= needed) {
+            return true;
+        }
+        if (eof) {
+            return false;
+        }
+        memmove(buffer, buffer + bufferStart, bufferEnd - bufferStart);
+        bufferEnd -= bufferStart;
+        bufferStart = 0;
+        while (bufferEnd < needed) {
+            const size_t read = fread(buffer + bufferEnd, 1, sizeof(buffer) - bufferEnd, fp);
+            if (read == 0) {
+                eof = true;
+                return false;
+            }
+            bufferEnd += read;
+        }
+        return true;
+    }
+
+    int peekByte(size_t offset = 0)
+    {
+        if (!fill(offset + 1)) {
+            return -1;
+        }
+        return buffer[bufferStart + offset];
+    }
+
+    int readByte(void)
+    {
+        if (bufferStart == bufferEnd && !fill(1)) {
+            return -1;
+        }
+        fileOffset++;
+        return buffer[bufferStart++];
+    }
+
+    bool skipByte(void) { return readByte() >= 0; }
+
+    bool startsWith(const char *s)
+    {
+        const size_t len = strlen(s);
+        if (!fill(len)) {
+            return false;
+        }
+        return memcmp(buffer + bufferStart, s, len) == 0;
+    }
+
+    // primitive decoders, the inverse of blackbox_encoding.c
+
+    bool readUnsignedVB(uint32_t *value)
+    {
+        uint32_t result = 0;
+        for (int shift = 0; shift < 32; shift += 7) {
+            const int c = readByte();
+            if (c < 0) {
+                return false;
+            }
+            result |= (uint32_t)(c & 0x7F) << shift;
+            if (c < 128) {
+                *value = result;
+                return true;
+            }
+        }
+        return false; // more than 5 bytes, corrupt
+    }
+
+    bool readSignedVB(int32_t *value)
+    {
+        uint32_t u;
+        if (!readUnsignedVB(&u)) {
+            return false;
+        }
+        *value = (int32_t)((u >> 1) ^ -(int32_t)(u & 1)); // zigzag decode
+        return true;
+    }
+
+    static int32_t signExtend(uint32_t value, int bits)
+    {
+        const uint32_t signBit = 1U << (bits - 1);
+        value &= (bits == 32) ? 0xFFFFFFFF : ((1U << bits) - 1);
+        return (int32_t)((value ^ signBit) - signBit);
+    }
+
+    bool readBytesLE(int count, int32_t *value)
+    {
+        uint32_t result = 0;
+        for (int ii = 0; ii < count; ii++) {
+            const int c = readByte();
+            if (c < 0) {
+                return false;
+            }
+            result |= (uint32_t)c << (8 * ii);
+        }
+        *value = signExtend(result, 8 * count);
+        return true;
+    }
+
+    bool readTag2_3S32(int32_t *values)
+    {
+        const int lead = readByte();
+        if (lead < 0) {
+            return false;
+        }
+        int c;
+        switch (lead >> 6) {
+        case 0: // 2 bits per field
+            values[0] = signExtend(lead >> 4, 2);
+            values[1] = signExtend(lead >> 2, 2);
+            values[2] = signExtend(lead, 2);
+            return true;
+        case 1: // 4 bits per field
+            if ((c = readByte()) < 0) {
+                return false;
+            }
+            values[0] = signExtend(lead, 4);
+            values[1] = signExtend(c >> 4, 4);
+            values[2] = signExtend(c, 4);
+            return true;
+        case 2: // 6 bits per field
+            values[0] = signExtend(lead, 6);
+            for (int ii = 1; ii < 3; ii++) {
+                if ((c = readByte()) < 0) {
+                    return false;
+                }
+                values[ii] = signExtend(c, 6);
+            }
+            return true;
+        default: // 8, 16, 24 or 32 bits per field
+            for (int ii = 0; ii < 3; ii++) {
+                if (!readBytesLE(((lead >> (2 * ii)) & 0x03) + 1, &values[ii])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    bool readTag2_3SVariable(int32_t *values)
+    {
+        const int lead = readByte();
+        if (lead < 0) {
+            return false;
+        }
+        int b1, b2;
+        switch (lead >> 6) {
+        case 0:
+            values[0] = signExtend(lead >> 4, 2);
+            values[1] = signExtend(lead >> 2, 2);
+            values[2] = signExtend(lead, 2);
+            return true;
+        case 1: // 5, 5 and 4 bits
+            if ((b1 = readByte()) < 0) {
+                return false;
+            }
+            values[0] = signExtend(lead >> 1, 5);
+            values[1] = signExtend(((lead & 0x01) << 4) | (b1 >> 4), 5);
+            values[2] = signExtend(b1, 4);
+            return true;
+        case 2: // 8, 7 and 7 bits
+            if ((b1 = readByte()) < 0 || (b2 = readByte()) < 0) {
+                return false;
+            }
+            values[0] = signExtend(((lead & 0x3F) << 2) | (b1 >> 6), 8);
+            values[1] = signExtend(((b1 & 0x3F) << 1) | (b2 >> 7), 7);
+            values[2] = signExtend(b2, 7);
+            return true;
+        default:
+            for (int ii = 0; ii < 3; ii++) {
+                if (!readBytesLE(((lead >> (2 * ii)) & 0x03) + 1, &values[ii])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    bool readTag8_4S16(int32_t *values)
+    {
+        int selector = readByte();
+        if (selector < 0) {
+            return false;
+        }
+        bool haveNibble = false;
+        uint8_t nibbleBuffer = 0;
+        int c1, c2;
+        for (int ii = 0; ii < 4; ii++, selector >>= 2) {
+            switch (selector & 0x03) {
+            case 0:
+                values[ii] = 0;
+                break;
+            case 1: // 4 bits
+                if (haveNibble) {
+                    values[ii] = signExtend(nibbleBuffer & 0x0F, 4);
+                    haveNibble = false;
+                } else {
+                    if ((c1 = readByte()) < 0) {
+                        return false;
+                    }
+                    nibbleBuffer = c1;
+                    values[ii] = signExtend(nibbleBuffer >> 4, 4);
+                    haveNibble = true;
+                }
+                break;
+            case 2: // 8 bits
+                if ((c1 = readByte()) < 0) {
+                    return false;
+                }
+                if (haveNibble) {
+                    values[ii] = signExtend(((nibbleBuffer & 0x0F) << 4) | (c1 >> 4), 8);
+                    nibbleBuffer = c1;
+                } else {
+                    values[ii] = signExtend(c1, 8);
+                }
+                break;
+            case 3: // 16 bits
+                if ((c1 = readByte()) < 0 || (c2 = readByte()) < 0) {
+                    return false;
+                }
+                if (haveNibble) {
+                    values[ii] = signExtend(((nibbleBuffer & 0x0F) << 12) | (c1 << 4) | (c2 >> 4), 16);
+                    nibbleBuffer = c2;
+                } else {
+                    values[ii] = signExtend((c1 << 8) | c2, 16);
+                }
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool readTag8_8SVB(int32_t *values, int count)
+    {
+        if (count == 1) {
+            return readSignedVB(&values[0]);
+        }
+        const int header = readByte();
+        if (header < 0) {
+            return false;
+        }
+        for (int ii = 0; ii < count; ii++) {
+            values[ii] = 0;
+            if (header & (1 << ii)) {
+                if (!readSignedVB(&values[ii])) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // reads the raw (unpredicted) values of a frame according to its field encodings
+    bool readFields(const std::vector<int> &encoding, int32_t *values)
+    {
+        const int count = encoding.size();
+        for (int ii = 0; ii < count; ) {
+            uint32_t u;
+            int groupCount;
+            switch (encoding[ii]) {
+            case FLIGHT_LOG_FIELD_ENCODING_SIGNED_VB:
+                if (!readSignedVB(&values[ii])) {
+                    return false;
+                }
+                ii++;
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_UNSIGNED_VB:
+                if (!readUnsignedVB(&u)) {
+                    return false;
+                }
+                values[ii++] = (int32_t)u;
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_NEG_14BIT:
+                if (!readUnsignedVB(&u)) {
+                    return false;
+                }
+                values[ii++] = -signExtend(u, 14);
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_NULL:
+                values[ii++] = 0;
+                break;
+            case FLIGHT_LOG_FIELD_ENCODING_TAG2_3S32:
+            case FLIGHT_LOG_FIELD_ENCODING_TAG2_3SVARIABLE:
+            case FLIGHT_LOG_FIELD_ENCODING_TAG8_4S16:
+            case FLIGHT_LOG_FIELD_ENCODING_TAG8_8SVB: {
+                // grouped encodings cover a run of consecutive fields with the same encoding
+                const int maxGroup = encoding[ii] == FLIGHT_LOG_FIELD_ENCODING_TAG8_8SVB ? 8
+                    : encoding[ii] == FLIGHT_LOG_FIELD_ENCODING_TAG8_4S16 ? 4 : 3;
+                groupCount = 1;
+                while (groupCount < maxGroup && ii + groupCount < count && encoding[ii + groupCount] == encoding[ii]) {
+                    groupCount++;
+                }
+                int32_t group[8];
+                bool ok;
+                switch (encoding[ii]) {
+                case FLIGHT_LOG_FIELD_ENCODING_TAG2_3S32:
+                    ok = readTag2_3S32(group);
+                    break;
+                case FLIGHT_LOG_FIELD_ENCODING_TAG2_3SVARIABLE:
+                    ok = readTag2_3SVariable(group);
+                    break;
+                case FLIGHT_LOG_FIELD_ENCODING_TAG8_4S16:
+                    ok = readTag8_4S16(group);
+                    break;
+                default:
+                    ok = readTag8_8SVB(group, groupCount);
+                    break;
+                }
+                if (!ok) {
+                    return false;
+                }
+                memcpy(&values[ii], group, groupCount * sizeof(int32_t));
+                ii += groupCount;
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // frame parsers
+
+    int32_t predict(int predictor, int fieldIndex, const int32_t *current, bool intra)
+    {
+        const int32_t *previous = mainHistory[1];
+        const int32_t *previous2 = mainHistory[2];
+        switch (predictor) {
+        case FLIGHT_LOG_FIELD_PREDICTOR_0:
+            return 0;
+        case FLIGHT_LOG_FIELD_PREDICTOR_PREVIOUS:
+            return intra ? 0 : previous[fieldIndex];
+        case FLIGHT_LOG_FIELD_PREDICTOR_STRAIGHT_LINE:
+            return intra ? 0 : 2 * previous[fieldIndex] - previous2[fieldIndex];
+        case FLIGHT_LOG_FIELD_PREDICTOR_AVERAGE_2:
+            // matches the truncating integer average used by the encoder
+            return intra ? 0 : (previous[fieldIndex] + previous2[fieldIndex]) / 2;
+        case FLIGHT_LOG_FIELD_PREDICTOR_MINTHROTTLE:
+            return minthrottle;
+        case FLIGHT_LOG_FIELD_PREDICTOR_MOTOR_0:
+            return motor0Index >= 0 ? current[motor0Index] : 0;
+        case FLIGHT_LOG_FIELD_PREDICTOR_INC:
+            return intra ? 0 : previous[fieldIndex] + skippedFrames() + 1;
+        case FLIGHT_LOG_FIELD_PREDICTOR_1500:
+            return 1500;
+        case FLIGHT_LOG_FIELD_PREDICTOR_VBATREF:
+            return vbatref;
+        case FLIGHT_LOG_FIELD_PREDICTOR_MINMOTOR:
+            return minmotor;
+        default:
+            return 0;
+        }
+    }
+
+    // number of loop iterations the logger skipped since the last main frame, see blackboxShouldLogPFrame()
+    int skippedFrames(void) const
+    {
+        if (pIntervalNum >= pIntervalDenom || loopIterationIndex < 0) {
+            return 0;
+        }
+        int skipped = 0;
+        uint32_t frameIndex = mainHistory[1][loopIterationIndex] + 1;
+        while ((frameIndex % iInterval + pIntervalNum - 1) % pIntervalDenom >= (uint32_t)pIntervalNum && skipped < iInterval) {
+            frameIndex++;
+            skipped++;
+        }
+        return skipped;
+    }
+
+    bool parseMainFrame(bool intra)
+    {
+        const std::vector<int> &encoding = intra ? mainDef.encoding : deltaDef.encoding;
+        const std::vector<int> &predictor = intra ? mainDef.predictor : deltaDef.predictor;
+        int32_t *current = mainHistory[0];
+        if (!readFields(encoding, current)) {
+            return false;
+        }
+        // motor[0] must be predicted before the motors that use it as their predictor
+        const int count = encoding.size();
+        if (motor0Index >= 0) {
+            current[motor0Index] += predict(predictor[motor0Index], motor0Index, current, intra);
+        }
+        for (int ii = 0; ii < count; ii++) {
+            if (ii != motor0Index) {
+                current[ii] += predict(predictor[ii], ii, current, intra);
+            }
+        }
+        return true;
+    }
+
+    void commitMainFrame(bool intra)
+    {
+        const size_t bytes = mainDef.name.size() * sizeof(int32_t);
+        if (intra) {
+            memcpy(mainHistory[1], mainHistory[0], bytes);
+            memcpy(mainHistory[2], mainHistory[0], bytes);
+            stats.iFrames++;
+        } else {
+            memcpy(mainHistory[2], mainHistory[1], bytes);
+            memcpy(mainHistory[1], mainHistory[0], bytes);
+            stats.pFrames++;
+        }
+        // present the committed frame through mainValues()
+        memcpy(mainHistory[0], mainHistory[1], bytes);
+        mainHistoryValid = true;
+        lastMainIntra = intra;
+        if (timeIndex >= 0) {
+            lastMainTime = mainHistory[1][timeIndex];
+        }
+    }
+
+    bool parseSimpleFrame(const blackboxFrameDef_t &def, int32_t *values)
+    {
+        if (!readFields(def.encoding, values)) {
+            return false;
+        }
+        if (&def == &slowDef) {
+            stats.slowFrames++;
+        } else {
+            stats.gpsHomeFrames++;
+        }
+        return true;
+    }
+
+    bool parseGpsFrame(void)
+    {
+        int32_t values[BLACKBOX_DECODER_MAX_FIELDS];
+        if (!readFields(gpsDef.encoding, values)) {
+            return false;
+        }
+        stats.gpsFrames++;
+        return true;
+    }
+
+    bool parseEventFrame(void)
+    {
+        const int type = readByte();
+        uint32_t u;
+        int32_t s;
+        lastEventType = type;
+        switch (type) {
+        case FLIGHT_LOG_EVENT_SYNC_BEEP:
+            if (!readUnsignedVB(&u)) {
+                return false;
+            }
+            break;
+        case FLIGHT_LOG_EVENT_FLIGHTMODE:
+        case FLIGHT_LOG_EVENT_LOGGING_RESUME:
+            if (!readUnsignedVB(&u) || !readUnsignedVB(&u)) {
+                return false;
+            }
+            if (type == FLIGHT_LOG_EVENT_LOGGING_RESUME) {
+                // the history is stale after a pause, the next main frame is an I frame
+                mainHistoryValid = false;
+            }
+            break;
+        case FLIGHT_LOG_EVENT_INFLIGHT_ADJUSTMENT: {
+            const int function = readByte();
+            if (function < 0) {
+                return false;
+            }
+            if (function & FLIGHT_LOG_EVENT_INFLIGHT_ADJUSTMENT_FUNCTION_FLOAT_VALUE_FLAG) {
+                if (!readBytesLE(4, &s)) {
+                    return false;
+                }
+            } else if (!readSignedVB(&s)) {
+                return false;
+            }
+            break;
+        }
+        case FLIGHT_LOG_EVENT_DATA_DROPPED: {
+            // only logs which announce this event in their header have it, in older ones this is an unknown event
+            if (headerInt("Data dropped event", 0, -1) != FLIGHT_LOG_EVENT_DATA_DROPPED) {
+                return false;
+            }
+            // dropped intraframes, interframes, slow frames and bytes, then the P interval logged from here on
+            uint32_t num, denom;
+            if (!readUnsignedVB(&u) || !readUnsignedVB(&u) || !readUnsignedVB(&u) || !readUnsignedVB(&u)
+                || !readUnsignedVB(&num) || !readUnsignedVB(&denom)) {
+                return false;
+            }
+            if (num >= 1 && denom >= 1) {
+                pIntervalNum = num;
+                pIntervalDenom = denom;
+            }
+            break;
+        }
+        case FLIGHT_LOG_EVENT_LOG_END: {
+            // "End of log" followed by a zero byte
+            static const char endMessage[] = "End of log";
+            for (size_t ii = 0; ii < sizeof(endMessage); ii++) {
+                if (readByte() != (uint8_t)endMessage[ii]) {
+                    return false;
+                }
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+        stats.eventFrames++;
+        return true;
+    }
+
+    bool isFrameBoundary(void)
+    {
+        const int c = peekByte();
+        return c < 0 || c == 'I' || c == 'P' || c == 'S' || c == 'G' || c == 'H' || c == 'E';
+    }
+
+    void resyncOnIntraframe(void)
+    {
+        for (;;) {
+            const int c = peekByte();
+            if (c < 0 || c == 'I' || startsWith(blackboxLogStartMarker)) {
+                return;
+            }
+            skipByte();
+        }
+    }
+
+    // header parsing
+
+    void parseHeaderLine(void)
+    {
+        char line[BLACKBOX_DECODER_MAX_HEADER_LINE];
+        size_t len = 0;
+        int c;
+        // skip the "H "
+        readByte();
+        readByte();
+        while ((c = readByte()) >= 0 && c != '\n') {
+            if (len < sizeof(line) - 1) {
+                line[len++] = c;
+            }
+        }
+        line[len] = '\0';
+        char *colon = strchr(line, ':');
+        if (!colon) {
+            return;
+        }
+        *colon = '\0';
+        const std::string name(line);
+        const std::string value(colon + 1);
+        headers[name] = value;
+
+        if (name.compare(0, 6, "Field ") == 0 && name.size() > 8) {
+            const char frameType = name[6];
+            const std::string property = name.substr(8);
+            blackboxFrameDef_t *def = frameType == 'I' ? &mainDef
+                : frameType == 'P' ? &deltaDef
+                : frameType == 'S' ? &slowDef
+                : frameType == 'G' ? &gpsDef
+                : frameType == 'H' ? &gpsHomeDef
+                : NULL;
+            if (def) {
+                if (property == "name") {
+                    splitNames(value, &def->name);
+                } else if (property == "signed") {
+                    splitInts(value, &def->isSigned);
+                } else if (property == "predictor") {
+                    splitInts(value, &def->predictor);
+                } else if (property == "encoding") {
+                    splitInts(value, &def->encoding);
+                }
+            }
+        } else if (name == "I interval") {
+            iInterval = atoi(value.c_str());
+            if (iInterval < 1) {
+                iInterval = 1;
+            }
+        } else if (name == "P interval") {
+            sscanf(value.c_str(), "%d/%d", &pIntervalNum, &pIntervalDenom);
+            if (pIntervalNum < 1 || pIntervalDenom < 1) {
+                pIntervalNum = pIntervalDenom = 1;
+            }
+        } else if (name == "minthrottle") {
+            minthrottle = atoi(value.c_str());
+        } else if (name == "vbatref") {
+            vbatref = atoi(value.c_str());
+        } else if (name == "motorOutput") {
+            minmotor = atoi(value.c_str());
+        }
+
+        if (!mainDef.name.empty()) {
+            motor0Index = loopIterationIndex = timeIndex = -1;
+            for (size_t ii = 0; ii < mainDef.name.size(); ii++) {
+                if (mainDef.name[ii] == "motor[0]") {
+                    motor0Index = ii;
+                } else if (mainDef.name[ii] == "loopIteration") {
+                    loopIterationIndex = ii;
+                } else if (mainDef.name[ii] == "time") {
+                    timeIndex = ii;
+                }
+            }
+        }
+    }
+
+    static void splitNames(const std::string &value, std::vector<std::string> *out)
+    {
+        out->clear();
+        size_t start = 0;
+        while (start <= value.size() && out->size() < BLACKBOX_DECODER_MAX_FIELDS) {
+            const size_t comma = value.find(',', start);
+            out->push_back(value.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+            if (comma == std::string::npos) {
+                break;
+            }
+            start = comma + 1;
+        }
+    }
+
+    static void splitInts(const std::string &value, std::vector<int> *out)
+    {
+        std::vector<std::string> parts;
+        splitNames(value, &parts);
+        out->clear();
+        for (size_t ii = 0; ii < parts.size(); ii++) {
+            out->push_back(atoi(parts[ii].c_str()));
+        }
+    }
+
+    void resetLog(void)
+    {
+        headers.clear();
+        mainFieldIndex.clear();
+        mainDef = deltaDef = slowDef = gpsDef = gpsHomeDef = blackboxFrameDef_t();
+        memset(mainHistory, 0, sizeof(mainHistory));
+        memset(slowFrame, 0, sizeof(slowFrame));
+        memset(gpsHome, 0, sizeof(gpsHome));
+        memset(&stats, 0, sizeof(stats));
+        mainHistoryValid = false;
+        lastMainIntra = false;
+        lastEventType = -1;
+        lastMainTime = 0;
+        iInterval = 32;
+        pIntervalNum = pIntervalDenom = 1;
+        minthrottle = 1150;
+        vbatref = 0;
+        minmotor = 0;
+        motor0Index = loopIterationIndex = timeIndex = -1;
+    }
+
+    FILE *fp;
+    uint8_t buffer[BLACKBOX_DECODER_BUFFER_SIZE];
+    size_t bufferStart, bufferEnd;
+    uint64_t fileOffset;
+    bool eof;
+    bool inLog;
+
+    std::map<std::string, std::string> headers;
+    std::map<std::string, int> mainFieldIndex;
+    blackboxFrameDef_t mainDef, deltaDef, slowDef, gpsDef, gpsHomeDef;
+
+    // [0] is the frame being decoded (and after decoding a copy of [1]), [1] and [2] are the history
+    int32_t mainHistory[3][BLACKBOX_DECODER_MAX_FIELDS];
+    int32_t slowFrame[BLACKBOX_DECODER_MAX_FIELDS];
+    int32_t gpsHome[BLACKBOX_DECODER_MAX_FIELDS];
+    bool mainHistoryValid;
+    bool lastMainIntra;
+    int lastEventType;
+    int32_t lastMainTime;
+
+    int iInterval;
+    int pIntervalNum, pIntervalDenom;
+    int32_t minthrottle, vbatref, minmotor;
+    int motor0Index, loopIterationIndex, timeIndex;
+
+    blackboxDecoderStats_t stats;
+};
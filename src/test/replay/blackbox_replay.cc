@@ -0,0 +1,679 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Offline replay of blackbox logs through the flight code.
+//
+// Each log is decoded as a stream and its recorded gyro and rcCommand values are fed
+// through the real gyro filters (gyroUpdate), setpoint calculation (processRcCommand),
+// PID controller (pidController) and mixer (mixTable), configured from the log header.
+// Settings can be overridden with --set to evaluate a filter or PID change against
+// the recorded flights. For every log the replayed motor outputs are written to a CSV
+// file next to the recorded ones, and the time spent in each stage is reported.
+//
+// The flight code keeps its state in globals, so logs are replayed in parallel by
+// forked worker processes, one log file per worker.
+//
+// The gyro input is the unfiltered gyro recorded with debug_mode GYRO or NOTCH. Other
+// logs only hold the filtered gyro, which is then filtered a second time by the replay.
+//
+// usage: blackbox_replay [-j jobs] [-o output_dir] [--set name=value[,value...]]... log...
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <math.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "build/debug.h"
+
+    #include "common/axis.h"
+    #include "common/filter.h"
+    #include "common/maths.h"
+    #include "common/utils.h"
+
+    #include "config/feature.h"
+    #include "config/parameter_group.h"
+    #include "config/parameter_group_ids.h"
+
+    #include "drivers/accgyro/accgyro.h"
+    #include "drivers/accgyro/accgyro_fake.h"
+    #include "drivers/sensor.h"
+
+    #include "fc/config.h"
+    #include "fc/controlrate_profile.h"
+    #include "fc/fc_core.h"
+    #include "fc/fc_rc.h"
+    #include "fc/rc_controls.h"
+    #include "fc/runtime_config.h"
+
+    #include "flight/imu.h"
+    #include "flight/mixer.h"
+    #include "flight/pid.h"
+
+    #include "io/beeper.h"
+
+    #include "rx/rx.h"
+
+    #include "scheduler/scheduler.h"
+
+    #include "sensors/acceleration.h"
+    #include "sensors/gyro.h"
+    #include "sensors/sensors.h"
+
+    extern gyroDev_t *fakeGyroDev;
+}
+
+#include "../bench/benchmark.h"
+
+#include "blackbox_decoder.h"
+
+// settings are named as in the log header, so a header line can be used as an override
+typedef struct replaySetting_s {
+    const char *name;
+    void (*apply)(const int *values, int count);
+} replaySetting_t;
+
+static controlRateConfig_t replayRateProfile;
+static uint32_t replayFeatures;
+static uint8_t replayDebugMode;
+static int replayMixerMode = -1;
+
+#define PID_SETTING(settingName, pidIndex) \
+    { settingName, [](const int *v, int n) { \
+        pid8_t *pid = &pidProfilesMutable(0)->pid[pidIndex]; \
+        if (n > 0) pid->P = v[0]; \
+        if (n > 1) pid->I = v[1]; \
+        if (n > 2) pid->D = v[2]; } }
+
+static const replaySetting_t replaySettings[] = {
+    { "minthrottle",                [](const int *v, int) { motorConfigMutable()->minthrottle = v[0]; } },
+    { "maxthrottle",                [](const int *v, int) { motorConfigMutable()->maxthrottle = v[0]; } },
+    { "motor_pwm_protocol",         [](const int *v, int) { motorConfigMutable()->dev.motorPwmProtocol = v[0]; } },
+    { "dshot_idle_value",           [](const int *v, int) { motorConfigMutable()->digitalIdleOffsetValue = v[0]; } },
+    { "features",                   [](const int *v, int) { replayFeatures = v[0]; } },
+    { "debug_mode",                 [](const int *v, int) { replayDebugMode = v[0]; } },
+    { "mincheck",                   [](const int *v, int) { rxConfig_System.mincheck = v[0]; } },
+    { "mixer",                      [](const int *v, int) { replayMixerMode = v[0]; } },
+
+    { "rc_rate",                    [](const int *v, int) { replayRateProfile.rcRate8 = v[0]; } },
+    { "rc_expo",                    [](const int *v, int) { replayRateProfile.rcExpo8 = v[0]; } },
+    { "rc_rate_yaw",                [](const int *v, int) { replayRateProfile.rcYawRate8 = v[0]; } },
+    { "rc_expo_yaw",                [](const int *v, int) { replayRateProfile.rcYawExpo8 = v[0]; } },
+    { "thr_mid",                    [](const int *v, int) { replayRateProfile.thrMid8 = v[0]; } },
+    { "thr_expo",                   [](const int *v, int) { replayRateProfile.thrExpo8 = v[0]; } },
+    { "tpa_rate",                   [](const int *v, int) { replayRateProfile.dynThrPID = v[0]; } },
+    { "tpa_breakpoint",             [](const int *v, int) { replayRateProfile.tpa_breakpoint = v[0]; } },
+    { "rates",                      [](const int *v, int n) { for (int ii = 0; ii < n && ii < 3; ii++) replayRateProfile.rates[ii] = v[ii]; } },
+
+    PID_SETTING("rollPID",  PID_ROLL),
+    PID_SETTING("pitchPID", PID_PITCH),
+    PID_SETTING("yawPID",   PID_YAW),
+    PID_SETTING("levelPID", PID_LEVEL),
+    { "dterm_filter_type",          [](const int *v, int) { pidProfilesMutable(0)->dterm_filter_type = v[0]; } },
+    { "dterm_lpf_hz",               [](const int *v, int) { pidProfilesMutable(0)->dterm_lpf_hz = v[0]; } },
+    { "yaw_lpf_hz",                 [](const int *v, int) { pidProfilesMutable(0)->yaw_lpf_hz = v[0]; } },
+    { "dterm_notch_hz",             [](const int *v, int) { pidProfilesMutable(0)->dterm_notch_hz = v[0]; } },
+    { "dterm_notch_cutoff",         [](const int *v, int) { pidProfilesMutable(0)->dterm_notch_cutoff = v[0]; } },
+    { "iterm_windup",               [](const int *v, int) { pidProfilesMutable(0)->itermWindupPointPercent = v[0]; } },
+    { "pidAtMinThrottle",           [](const int *v, int) { pidProfilesMutable(0)->pidAtMinThrottle = v[0]; } },
+    { "anti_gravity_threshold",     [](const int *v, int) { pidProfilesMutable(0)->itermThrottleThreshold = v[0]; } },
+    { "anti_gravity_gain",          [](const int *v, int) { pidProfilesMutable(0)->itermAcceleratorGain = v[0]; } },
+    { "setpoint_relaxation_ratio",  [](const int *v, int) { pidProfilesMutable(0)->setpointRelaxRatio = v[0]; } },
+    { "dterm_setpoint_weight",      [](const int *v, int) { pidProfilesMutable(0)->dtermSetpointWeight = v[0]; } },
+    { "acc_limit_yaw",              [](const int *v, int) { pidProfilesMutable(0)->yawRateAccelLimit = v[0]; } },
+    { "acc_limit",                  [](const int *v, int) { pidProfilesMutable(0)->rateAccelLimit = v[0]; } },
+    { "pidsum_limit",               [](const int *v, int) { pidProfilesMutable(0)->pidSumLimit = v[0]; } },
+    { "pidsum_limit_yaw",           [](const int *v, int) { pidProfilesMutable(0)->pidSumLimitYaw = v[0]; } },
+
+    { "gyro_lowpass_type",          [](const int *v, int) { gyroConfigMutable()->gyro_soft_lpf_type = v[0]; } },
+    { "gyro_lowpass_hz",            [](const int *v, int) { gyroConfigMutable()->gyro_soft_lpf_hz = v[0]; } },
+    { "gyro_notch_hz",              [](const int *v, int n) {
+                                        gyroConfigMutable()->gyro_soft_notch_hz_1 = v[0];
+                                        if (n > 1) gyroConfigMutable()->gyro_soft_notch_hz_2 = v[1]; } },
+    { "gyro_notch_cutoff",          [](const int *v, int n) {
+                                        gyroConfigMutable()->gyro_soft_notch_cutoff_1 = v[0];
+                                        if (n > 1) gyroConfigMutable()->gyro_soft_notch_cutoff_2 = v[1]; } },
+};
+
+#define REPLAY_MAX_SETTING_VALUES 4
+
+typedef struct replayOverride_s {
+    const replaySetting_t *setting;
+    int values[REPLAY_MAX_SETTING_VALUES];
+    int count;
+} replayOverride_t;
+
+static std::vector<replayOverride_t> replayOverrides;
+static const char *outputDir = ".";
+
+static const replaySetting_t *findSetting(const char *name)
+{
+    for (size_t ii = 0; ii < ARRAYLEN(replaySettings); ii++) {
+        if (strcmp(replaySettings[ii].name, name) == 0) {
+            return &replaySettings[ii];
+        }
+    }
+    return NULL;
+}
+
+static int parseValues(const char *text, int *values)
+{
+    int count = 0;
+    while (count < REPLAY_MAX_SETTING_VALUES) {
+        char *end;
+        values[count] = strtol(text, &end, 0);
+        if (end == text) {
+            break;
+        }
+        count++;
+        if (*end != ',') {
+            break;
+        }
+        text = end + 1;
+    }
+    return count;
+}
+
+static bool addOverride(const char *assignment)
+{
+    const char *equals = strchr(assignment, '=');
+    if (!equals) {
+        return false;
+    }
+    const std::string name(assignment, equals - assignment);
+    replayOverride_t override;
+    override.setting = findSetting(name.c_str());
+    override.count = parseValues(equals + 1, override.values);
+    if (!override.setting || override.count == 0) {
+        return false;
+    }
+    replayOverrides.push_back(override);
+    return true;
+}
+
+// settings from the log header first, then the command line overrides
+static void replayConfigure(const BlackboxDecoder &decoder)
+{
+    pgResetAll(MAX_PROFILE_COUNT);
+    currentPidProfile = pidProfilesMutable(0);
+
+    memset(&replayRateProfile, 0, sizeof(replayRateProfile));
+    replayRateProfile.rcRate8 = 100;
+    replayRateProfile.rcYawRate8 = 100;
+    replayRateProfile.thrMid8 = 50;
+    replayRateProfile.dynThrPID = 10;
+    replayRateProfile.tpa_breakpoint = 1650;
+    currentControlRateProfile = &replayRateProfile;
+
+    memset(&rxConfig_System, 0, sizeof(rxConfig_System));
+    rxConfig_System.mincheck = 1100;
+    rxConfig_System.midrc = 1500;
+    rxConfig_System.rcInterpolation = RC_SMOOTHING_OFF; // the logged rcCommand is already interpolated
+
+    replayFeatures = 0;
+    replayDebugMode = DEBUG_NONE;
+    replayMixerMode = -1;
+
+    for (size_t ii = 0; ii < ARRAYLEN(replaySettings); ii++) {
+        const std::string value = decoder.headerString(replaySettings[ii].name);
+        int values[REPLAY_MAX_SETTING_VALUES];
+        const int count = value.empty() ? 0 : parseValues(value.c_str(), values);
+        if (count > 0) {
+            replaySettings[ii].apply(values, count);
+        }
+    }
+    for (size_t ii = 0; ii < replayOverrides.size(); ii++) {
+        replayOverrides[ii].setting->apply(replayOverrides[ii].values, replayOverrides[ii].count);
+    }
+}
+
+static mixerMode_e mixerForMotorCount(int motorCount)
+{
+    if (replayMixerMode >= 0) {
+        return (mixerMode_e)replayMixerMode;
+    }
+    switch (motorCount) {
+    case 3:
+        return MIXER_TRI;
+    case 6:
+        return MIXER_HEX6X;
+    case 8:
+        return MIXER_OCTOX8;
+    default:
+        return MIXER_QUADX;
+    }
+}
+
+// updateRcCommands() computes the throttle PID attenuation from rcData, which is not logged,
+// so build the inverse of the throttle curve to recover rcData from the logged throttle
+static int16_t throttleToRcData[PWM_RANGE_MAX + 1];
+
+static void buildThrottleInverse(void)
+{
+    generateThrottleCurve();
+    int rcValue = PWM_RANGE_MIN;
+    for (int throttle = 0; throttle <= PWM_RANGE_MAX; throttle++) {
+        while (rcValue < PWM_RANGE_MAX) {
+            rcData[THROTTLE] = rcValue;
+            updateRcCommands();
+            if (rcCommand[THROTTLE] >= throttle) {
+                break;
+            }
+            rcValue++;
+        }
+        throttleToRcData[throttle] = rcValue;
+    }
+}
+
+typedef struct replayResult_s {
+    uint32_t logs;
+    uint32_t frames;
+    uint32_t corruptFrames;
+    bool failed;
+    bool crashed;
+} replayResult_t;
+
+typedef struct replayInput_s {
+    int time;
+    int loopIteration;
+    int rcCommand[4];
+    int gyro[XYZ_AXIS_COUNT];
+    int gyroADC[XYZ_AXIS_COUNT];
+    int motor[MAX_SUPPORTED_MOTORS];
+} replayInput_t;
+
+static int requireField(const BlackboxDecoder &decoder, const std::string &name)
+{
+    const int index = decoder.mainField(name);
+    if (index < 0) {
+        printf("  missing field %s\n", name.c_str());
+    }
+    return index;
+}
+
+static std::string baseName(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    std::string name(slash ? slash + 1 : path);
+    const size_t dot = name.rfind('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+static bool replayLog(BlackboxDecoder &decoder, const char *fileName, int logNumber, uint64_t timerOverheadNs, replayResult_t *result)
+{
+    replayInput_t field;
+    replayConfigure(decoder);
+
+    printf("== %s log %d\n", fileName, logNumber);
+
+    bool ok = (field.time = requireField(decoder, "time")) >= 0;
+    field.loopIteration = decoder.mainField("loopIteration");
+    for (int ii = 0; ii < 4; ii++) {
+        ok &= (field.rcCommand[ii] = requireField(decoder, "rcCommand[" + std::to_string(ii) + "]")) >= 0;
+    }
+    int motorCount = 0;
+    while (motorCount < MAX_SUPPORTED_MOTORS && (field.motor[motorCount] = decoder.mainField("motor[" + std::to_string(motorCount) + "]")) >= 0) {
+        motorCount++;
+    }
+
+    // prefer the gyro recorded ahead of the static notch and lowpass filters
+    const bool unfilteredGyro = replayDebugMode == DEBUG_GYRO || replayDebugMode == DEBUG_NOTCH;
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        const std::string name = (unfilteredGyro ? "debug[" : "gyroADC[") + std::to_string(axis) + "]";
+        ok &= (field.gyro[axis] = requireField(decoder, name)) >= 0;
+        ok &= (field.gyroADC[axis] = requireField(decoder, "gyroADC[" + std::to_string(axis) + "]")) >= 0;
+    }
+    if (!ok || motorCount == 0) {
+        printf("  not replayable, skipped\n");
+        return false;
+    }
+    if (!unfilteredGyro) {
+        printf("  warning: log has no unfiltered gyro (debug_mode GYRO or NOTCH), replaying the filtered gyroADC\n");
+    }
+
+    // the logged frames are the PID loop iterations, so the replay runs at the logged frame rate
+    const int pidLooptimeUs = decoder.headerInt("looptime", 0, 1000) * decoder.headerInt("pid_process_denom", 0, 1);
+    const int pIntervalNum = decoder.headerInt("P interval", 0, 1);
+    const int pIntervalDenom = MAX(decoder.headerInt("P interval", 1, 1), 1);
+    const uint32_t frameIntervalUs = pidLooptimeUs * pIntervalDenom / MAX(pIntervalNum, 1);
+    if (pIntervalNum != pIntervalDenom || decoder.headerInt("pid_process_denom", 0, 1) != 1) {
+        printf("  warning: log does not hold every gyro sample, filters run at the logged rate of %uus\n", frameIntervalUs);
+    }
+
+    gyroInit();
+    gyro.targetLooptime = frameIntervalUs;
+    gyroInitFilters();
+    pidConfigMutable()->pid_process_denom = 1;
+    pidInit(currentPidProfile);
+    pidStabilisationState(PID_STABILISATION_ON);
+    mixerInit(mixerForMotorCount(motorCount));
+    mixerConfigureOutput();
+    buildThrottleInverse();
+    // the blackbox only records while armed
+    ENABLE_ARMING_FLAG(ARMED);
+
+    const std::string traceName = std::string(outputDir) + "/" + baseName(fileName) + "." + std::to_string(logNumber) + ".csv";
+    FILE *trace = fopen(traceName.c_str(), "w");
+    if (!trace) {
+        printf("  unable to write %s\n", traceName.c_str());
+        return false;
+    }
+    fprintf(trace, "loopIteration,time,rcCommand[0],rcCommand[1],rcCommand[2],rcCommand[3],setpoint[0],setpoint[1],setpoint[2],gyroInput[0],gyroInput[1],gyroInput[2]");
+    for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+        fprintf(trace, ",gyroADC[%d],replayGyroADC[%d]", axis, axis);
+    }
+    for (int ii = 0; ii < motorCount; ii++) {
+        fprintf(trace, ",motor[%d],replayMotor[%d]", ii, ii);
+    }
+    fprintf(trace, "\n");
+
+    BenchStage decodeStage("decode");
+    BenchStage rcStage("processRcCommand");
+    BenchStage gyroStage("gyroUpdate");
+    BenchStage pidStage("pidController");
+    BenchStage mixerStage("mixTable");
+    BenchStage loopStage("total");
+
+    const int airmodeSlowField = decoder.slowField("flightModeFlags");
+    const rollAndPitchTrims_t angleTrim = {{ 0, 0 }};
+    int32_t lastRcCommand[4];
+    double motorErrorSquared = 0;
+    uint32_t frames = 0;
+    for (;;) {
+        const uint64_t decodeStartNs = benchNowNs();
+        const BlackboxDecoder::frameType_e frameType = decoder.nextFrame();
+        const uint64_t decodeEndNs = benchNowNs();
+        if (frameType == BlackboxDecoder::FRAME_LOG_END) {
+            break;
+        }
+        if (frameType == BlackboxDecoder::FRAME_SLOW && airmodeSlowField >= 0) {
+            rcModeActivationMask = decoder.slowValues()[airmodeSlowField];
+            continue;
+        }
+        if (frameType != BlackboxDecoder::FRAME_MAIN) {
+            continue;
+        }
+        decodeStage.add(decodeEndNs - decodeStartNs);
+
+        const int32_t *values = decoder.mainValues();
+        const int throttle = constrain(values[field.rcCommand[THROTTLE]], 0, PWM_RANGE_MAX);
+        fakeGyroSet(fakeGyroDev, values[field.gyro[X]], values[field.gyro[Y]], values[field.gyro[Z]]);
+
+        const uint64_t rcStartNs = benchNowNs();
+        rcData[THROTTLE] = throttleToRcData[throttle];
+        updateRcCommands();
+        // a change of the logged rcCommand stands in for the arrival of new rx data
+        for (int ii = 0; ii < 4; ii++) {
+            isRXDataNew |= frames == 0 || lastRcCommand[ii] != values[field.rcCommand[ii]];
+            lastRcCommand[ii] = values[field.rcCommand[ii]];
+            rcCommand[ii] = values[field.rcCommand[ii]];
+        }
+        processRcCommand();
+        const uint64_t gyroStartNs = benchNowNs();
+        gyroUpdate();
+        const uint64_t pidStartNs = benchNowNs();
+        pidController(currentPidProfile, &angleTrim, values[field.time]);
+        const uint64_t mixerStartNs = benchNowNs();
+        mixTable(currentPidProfile);
+        const uint64_t endNs = benchNowNs();
+
+        rcStage.add(gyroStartNs - rcStartNs);
+        gyroStage.add(pidStartNs - gyroStartNs);
+        pidStage.add(mixerStartNs - pidStartNs);
+        mixerStage.add(endNs - mixerStartNs);
+        loopStage.add(endNs - rcStartNs);
+
+        fprintf(trace, "%d,%u,%d,%d,%d,%d,%.2f,%.2f,%.2f,%d,%d,%d",
+            field.loopIteration >= 0 ? values[field.loopIteration] : (int)frames, (uint32_t)values[field.time],
+            values[field.rcCommand[0]], values[field.rcCommand[1]], values[field.rcCommand[2]], values[field.rcCommand[3]],
+            (double)getSetpointRate(FD_ROLL), (double)getSetpointRate(FD_PITCH), (double)getSetpointRate(FD_YAW),
+            values[field.gyro[X]], values[field.gyro[Y]], values[field.gyro[Z]]);
+        for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+            fprintf(trace, ",%d,%.2f", values[field.gyroADC[axis]], (double)gyro.gyroADCf[axis]);
+        }
+        for (int ii = 0; ii < motorCount; ii++) {
+            const int logged = values[field.motor[ii]];
+            fprintf(trace, ",%d,%d", logged, motor[ii]);
+            motorErrorSquared += (double)(motor[ii] - logged) * (motor[ii] - logged);
+        }
+        fprintf(trace, "\n");
+        frames++;
+    }
+    fclose(trace);
+
+    const blackboxDecoderStats_t &stats = decoder.statistics();
+    printf("  %u frames (%u I, %u P, %u corrupt), %uus per frame, motor traces in %s\n",
+        frames, stats.iFrames, stats.pFrames, stats.corruptFrames + stats.skippedPFrames, frameIntervalUs, traceName.c_str());
+    if (frames > 0) {
+        printf("  rms difference between replayed and logged motor output: %.2f\n", sqrt(motorErrorSquared / ((double)frames * motorCount)));
+    }
+
+    char config[16];
+    snprintf(config, sizeof(config), "log %d", logNumber);
+    BenchStage::printHeader();
+    decodeStage.report(config, timerOverheadNs);
+    rcStage.report(config, timerOverheadNs);
+    gyroStage.report(config, timerOverheadNs);
+    pidStage.report(config, timerOverheadNs);
+    mixerStage.report(config, timerOverheadNs);
+    loopStage.report(config, timerOverheadNs * 4);
+
+    result->frames += frames;
+    result->corruptFrames += stats.corruptFrames + stats.skippedPFrames;
+    return true;
+}
+
+static void replayFile(const char *fileName, replayResult_t *result)
+{
+    FILE *fp = fopen(fileName, "rb");
+    if (!fp) {
+        printf("== %s: unable to open\n", fileName);
+        result->failed = true;
+        return;
+    }
+    const uint64_t timerOverheadNs = benchTimerOverheadNs();
+    BlackboxDecoder *decoder = new BlackboxDecoder(fp);
+    int logNumber = 0;
+    while (decoder->nextLog()) {
+        logNumber++;
+        if (replayLog(*decoder, fileName, logNumber, timerOverheadNs, result)) {
+            result->logs++;
+        }
+    }
+    if (logNumber == 0) {
+        printf("== %s: no blackbox logs found\n", fileName);
+        result->failed = true;
+    }
+    delete decoder;
+    fclose(fp);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: blackbox_replay [-j jobs] [-o output_dir] [--set name=value[,value...]]... log...\n");
+    fprintf(stderr, "settings:");
+    for (size_t ii = 0; ii < ARRAYLEN(replaySettings); ii++) {
+        fprintf(stderr, "%s %s", ii % 6 ? "" : "\n ", replaySettings[ii].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    std::vector<const char *> files;
+    for (int ii = 1; ii < argc; ii++) {
+        if (strcmp(argv[ii], "-j") == 0 && ii + 1 < argc) {
+            jobs = atoi(argv[++ii]);
+        } else if (strcmp(argv[ii], "-o") == 0 && ii + 1 < argc) {
+            outputDir = argv[++ii];
+        } else if (strcmp(argv[ii], "--set") == 0 && ii + 1 < argc) {
+            if (!addOverride(argv[++ii])) {
+                fprintf(stderr, "invalid setting %s\n", argv[ii]);
+                usage();
+                return 1;
+            }
+        } else if (argv[ii][0] == '-') {
+            usage();
+            return 1;
+        } else {
+            files.push_back(argv[ii]);
+        }
+    }
+    if (files.empty()) {
+        usage();
+        return 1;
+    }
+    jobs = constrain(jobs, 1, (int)files.size());
+
+    // results are written by the workers into shared memory, their reports into a temporary file each
+    replayResult_t *results = (replayResult_t *)mmap(NULL, files.size() * sizeof(replayResult_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(results, 0, files.size() * sizeof(replayResult_t));
+    std::vector<FILE *> reports(files.size());
+    std::vector<pid_t> workers(files.size(), 0);
+    std::vector<bool> finished(files.size(), false);
+
+    const uint64_t startNs = benchNowNs();
+    size_t nextFile = 0;
+    int running = 0;
+    size_t reported = 0;
+    while (reported < files.size()) {
+        while (running < jobs && nextFile < files.size()) {
+            reports[nextFile] = tmpfile();
+            // the worker must not inherit, and later repeat, output still buffered here
+            fflush(stdout);
+            const pid_t pid = fork();
+            if (pid == 0) {
+                if (reports[nextFile]) {
+                    dup2(fileno(reports[nextFile]), STDOUT_FILENO);
+                }
+                replayFile(files[nextFile], &results[nextFile]);
+                fflush(stdout);
+                _exit(0);
+            }
+            if (pid < 0) {
+                perror("fork");
+                results[nextFile].failed = true;
+                finished[nextFile] = true;
+            } else {
+                workers[nextFile] = pid;
+                running++;
+            }
+            nextFile++;
+        }
+        int status;
+        const pid_t pid = running > 0 ? wait(&status) : -1;
+        if (pid > 0) {
+            running--;
+            for (size_t ii = 0; ii < files.size(); ii++) {
+                if (workers[ii] == pid) {
+                    results[ii].crashed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+                    results[ii].failed |= results[ii].crashed;
+                    finished[ii] = true;
+                }
+            }
+        } else if (running == 0 && nextFile == files.size()) {
+            // no worker left to wait for, the remaining files failed to start
+            std::fill(finished.begin(), finished.end(), true);
+        }
+        // reports are printed in the order the files were given, whichever worker finishes first
+        while (reported < files.size() && finished[reported]) {
+            if (results[reported].crashed) {
+                printf("== %s: replay crashed\n", files[reported]);
+            }
+            if (reports[reported]) {
+                char buffer[4096];
+                size_t length;
+                rewind(reports[reported]);
+                while ((length = fread(buffer, 1, sizeof(buffer), reports[reported])) > 0) {
+                    fwrite(buffer, 1, length, stdout);
+                }
+                fclose(reports[reported]);
+            }
+            reported++;
+        }
+    }
+    const double elapsedS = (benchNowNs() - startNs) * 1e-9;
+
+    replayResult_t total = { 0, 0, 0, false, false };
+    for (size_t ii = 0; ii < files.size(); ii++) {
+        total.logs += results[ii].logs;
+        total.frames += results[ii].frames;
+        total.corruptFrames += results[ii].corruptFrames;
+        total.failed |= results[ii].failed;
+    }
+    printf("replayed %u logs from %u files, %u frames (%u corrupt) in %.2fs with %d jobs, %.0f frames/s\n",
+        total.logs, (unsigned)files.size(), total.frames, total.corruptFrames, elapsedS, jobs, total.frames / elapsedS);
+    return total.failed ? 1 : 0;
+}
+
+// STUBS
+
+extern "C" {
+
+uint8_t armingFlags;
+uint16_t flightModeFlags;
+uint8_t detectedSensors[SENSOR_INDEX_COUNT];
+attitudeEulerAngles_t attitude;
+int16_t GPS_angle[ANGLE_INDEX_COUNT];
+float rcCommand[4];
+int16_t rcData[MAX_SUPPORTED_RC_CHANNEL_COUNT];
+pidProfile_t *currentPidProfile;
+controlRateConfig_t *currentControlRateProfile;
+uint32_t rcModeActivationMask;
+bool isRXDataNew;
+int16_t headFreeModeHold;
+
+rxConfig_t rxConfig_System;
+rcControlsConfig_t rcControlsConfig_System;
+
+const timerHardware_t timerHardware[USABLE_TIMER_CHANNEL_COUNT] = {};
+
+void sensorsSet(uint32_t) {}
+void beeper(beeperMode_e) {}
+void schedulerResetTaskStatistics(cfTaskId_e) {}
+timeDelta_t getTaskDeltaTime(cfTaskId_e) { return 0; }
+void delay(timeMs_t) {}
+void delayMicroseconds(timeUs_t) {}
+
+bool feature(uint32_t mask) { return replayFeatures & mask; }
+bool isAirmodeActive(void) { return feature(FEATURE_AIRMODE) || IS_RC_MODE_ACTIVE(BOXAIRMODE); }
+bool isAntiGravityModeActive(void) { return feature(FEATURE_ANTI_GRAVITY) || IS_RC_MODE_ACTIVE(BOXANTIGRAVITY); }
+bool failsafeIsActive(void) { return false; }
+float calculateVbatPidCompensation(void) { return 1.0f; }
+uint16_t rxGetRefreshRate(void) { return 0; }
+
+bool pwmAreMotorsEnabled(void) { return true; }
+void pwmWriteMotor(uint8_t, uint16_t) {}
+void pwmCompleteMotorUpdate(uint8_t) {}
+void pwmShutdownPulsesForAllMotors(uint8_t) {}
+}
@@ -0,0 +1,356 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "io/asyncfatfs/asyncfatfs.h"
+    #include "io/asyncfatfs/asyncfatfs_image.h"
+
+    int afatfs_cacheCheck();
+    void afatfs_cacheReadAhead(uint32_t sectorIndex, uint32_t inUseSectorIndex);
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+/*
+ * The filesystem runs on a FAT32 image file through a block device which records what the filesystem asks of it, and
+ * which checks the cache against its hash table on every operation.
+ */
+
+#define TEST_IMAGE_SIZE_MB 64
+#define TEST_MAX_POLLS 1000000
+
+// Every sector of the test data starts with this tag followed by the sector's index in the file
+#define TEST_DATA_TAG "TEST"
+#define TEST_DATA_TAG_LENGTH 4
+
+static const afatfsImageConfig_t testImageConfig = { 0, 0, 0, 0 };
+
+static std::vector<uint32_t> blocksWritten;
+static std::vector<std::pair<uint32_t, uint32_t> > dataSectorsWritten; // Block index, index of the test data sector
+static std::vector<std::pair<uint32_t, uint32_t> > multipleBlockWrites;
+static bool holdWrites; // The device is busy for writes, so dirty sectors stay in the cache
+static uint32_t stallPolls; // If non-zero, the device alternates between this many polls busy for writes and this many ready
+static uint32_t pollCount;
+static int cacheCheckFailures;
+
+static int checkCache(void)
+{
+    const int dirtyEntries = afatfs_cacheCheck();
+    if (dirtyEntries < 0) {
+        cacheCheckFailures++;
+    }
+    return dirtyEntries;
+}
+
+static bool writesBusy(void)
+{
+    return holdWrites || (stallPolls > 0 && (pollCount / stallPolls) % 2 == 1);
+}
+
+static bool testPoll(void)
+{
+    pollCount++;
+    checkCache();
+    return afatfsImageBlockDevice.poll();
+}
+
+static bool testReadBlock(uint32_t blockIndex, uint8_t *buffer, sdcard_operationCompleteCallback_c callback, uint32_t callbackData)
+{
+    checkCache();
+    return afatfsImageBlockDevice.readBlock(blockIndex, buffer, callback, callbackData);
+}
+
+static sdcardOperationStatus_e testBeginWriteBlocks(uint32_t blockIndex, uint32_t blockCount)
+{
+    if (writesBusy()) {
+        return SDCARD_OPERATION_BUSY;
+    }
+    const sdcardOperationStatus_e status = afatfsImageBlockDevice.beginWriteBlocks(blockIndex, blockCount);
+    if (status == SDCARD_OPERATION_SUCCESS) {
+        multipleBlockWrites.push_back(std::make_pair(blockIndex, blockCount));
+    }
+    return status;
+}
+
+static sdcardOperationStatus_e testWriteBlock(uint32_t blockIndex, uint8_t *buffer, sdcard_operationCompleteCallback_c callback, uint32_t callbackData)
+{
+    checkCache();
+    if (writesBusy()) {
+        return SDCARD_OPERATION_BUSY;
+    }
+    const sdcardOperationStatus_e status = afatfsImageBlockDevice.writeBlock(blockIndex, buffer, callback, callbackData);
+    if (status == SDCARD_OPERATION_SUCCESS || status == SDCARD_OPERATION_IN_PROGRESS) {
+        blocksWritten.push_back(blockIndex);
+        if (memcmp(buffer, TEST_DATA_TAG, TEST_DATA_TAG_LENGTH) == 0) {
+            uint32_t dataSector;
+            memcpy(&dataSector, buffer + TEST_DATA_TAG_LENGTH, sizeof(dataSector));
+            dataSectorsWritten.push_back(std::make_pair(blockIndex, dataSector));
+        }
+    }
+    return status;
+}
+
+static const afatfsBlockDevice_t testBlockDevice = {
+    testPoll,
+    testReadBlock,
+    testBeginWriteBlocks,
+    testWriteBlock,
+};
+
+static afatfsFilePtr_t testFile;
+static bool testCallbackDone;
+
+static void testFileOpened(afatfsFilePtr_t file)
+{
+    testFile = file;
+    testCallbackDone = true;
+}
+
+static void testFileClosed(void)
+{
+    testCallbackDone = true;
+}
+
+static bool waitForCallback(void)
+{
+    for (int poll = 0; poll < TEST_MAX_POLLS && !testCallbackDone; poll++) {
+        afatfs_poll();
+    }
+    const bool done = testCallbackDone;
+    testCallbackDone = false;
+    return done;
+}
+
+static void fillTestData(std::vector<uint8_t> *data, size_t size)
+{
+    data->resize(size);
+    for (size_t ii = 0; ii < size; ii++) {
+        (*data)[ii] = ii * 7 + ii / 509;
+    }
+    for (uint32_t sector = 0; (sector + 1) * 512 <= size; sector++) {
+        memcpy(&(*data)[sector * 512], TEST_DATA_TAG, TEST_DATA_TAG_LENGTH);
+        memcpy(&(*data)[sector * 512 + TEST_DATA_TAG_LENGTH], &sector, sizeof(sector));
+    }
+}
+
+// Writes all of the data, polling the filesystem whenever it has no room for more
+static void writeTestFile(const char *filename, const char *mode, const std::vector<uint8_t> &data, uint32_t writeSize)
+{
+    ASSERT_TRUE(afatfs_fopen(filename, mode, testFileOpened));
+    ASSERT_TRUE(waitForCallback());
+    ASSERT_TRUE(testFile != NULL);
+
+    size_t offset = 0;
+    for (int poll = 0; poll < TEST_MAX_POLLS && offset < data.size(); poll++) {
+        const uint32_t len = std::min<size_t>(writeSize, data.size() - offset);
+        offset += afatfs_fwrite(testFile, &data[offset], len);
+        afatfs_poll();
+    }
+    ASSERT_EQ(data.size(), offset);
+
+    ASSERT_TRUE(afatfs_fclose(testFile, testFileClosed));
+    ASSERT_TRUE(waitForCallback());
+}
+
+static void expectTestFile(const char *filename, const std::vector<uint8_t> &data)
+{
+    ASSERT_TRUE(afatfs_fopen(filename, "r", testFileOpened));
+    ASSERT_TRUE(waitForCallback());
+    ASSERT_TRUE(testFile != NULL);
+
+    std::vector<uint8_t> readBack(data.size() + 1);
+    size_t offset = 0;
+    for (int poll = 0; poll < TEST_MAX_POLLS && !afatfs_feof(testFile); poll++) {
+        offset += afatfs_fread(testFile, &readBack[offset], readBack.size() - offset);
+        afatfs_poll();
+    }
+    EXPECT_EQ(data.size(), offset);
+    readBack.resize(offset);
+    EXPECT_TRUE(readBack == data);
+
+    ASSERT_TRUE(afatfs_fclose(testFile, testFileClosed));
+    ASSERT_TRUE(waitForCallback());
+}
+
+class AsyncFatfsTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        strcpy(imageName, "/tmp/afatfs_unittest_XXXXXX");
+        const int fd = mkstemp(imageName);
+        ASSERT_GE(fd, 0);
+        close(fd);
+        ASSERT_TRUE(afatfsImageFormat(imageName, TEST_IMAGE_SIZE_MB, 1));
+
+        blocksWritten.clear();
+        dataSectorsWritten.clear();
+        multipleBlockWrites.clear();
+        holdWrites = false;
+        stallPolls = 0;
+        pollCount = 0;
+        cacheCheckFailures = 0;
+        testFile = NULL;
+        testCallbackDone = false;
+    }
+
+    virtual void TearDown() {
+        holdWrites = false;
+        stallPolls = 0;
+        for (int poll = 0; poll < TEST_MAX_POLLS && !afatfs_destroy(false); poll++) {
+        }
+        afatfsImageClose();
+        unlink(imageName);
+    }
+
+    void mount(void) {
+        ASSERT_TRUE(afatfsImageOpen(imageName, &testImageConfig));
+        afatfs_init(&testBlockDevice);
+        for (int poll = 0; poll < TEST_MAX_POLLS && afatfs_getFilesystemState() == AFATFS_FILESYSTEM_STATE_INITIALIZATION; poll++) {
+            afatfs_poll();
+        }
+        ASSERT_EQ(AFATFS_FILESYSTEM_STATE_READY, afatfs_getFilesystemState());
+    }
+
+    char imageName[32];
+};
+
+TEST_F(AsyncFatfsTest, CacheHashStaysConsistent)
+{
+    // given a log many times the size of the cache, and a file that fits in the clusters the freefile leaves free
+    std::vector<uint8_t> logData, fileData;
+    fillTestData(&logData, 300 * 1024 + 123);
+    fillTestData(&fileData, 40 * 1024 + 45);
+    mount();
+
+    // when both are written and read back
+    writeTestFile("LOG00001.BFL", "as", logData, 100);
+    writeTestFile("LOG00002.TXT", "a", fileData, 1000);
+    expectTestFile("LOG00001.BFL", logData);
+    expectTestFile("LOG00002.TXT", fileData);
+
+    // then every sector that was inserted into and evicted from the cache was also updated in the hash table
+    EXPECT_EQ(0, cacheCheckFailures);
+    std::set<uint32_t> sectors(blocksWritten.begin(), blocksWritten.end());
+    EXPECT_GT(sectors.size(), (logData.size() + fileData.size()) / 512);
+}
+
+TEST_F(AsyncFatfsTest, FileDataIsFlushedInOrder)
+{
+    // given
+    std::vector<uint8_t> data;
+    fillTestData(&data, 256 * 1024);
+    mount();
+
+    // when a log is streamed, in writes that don't line up with the sectors, to a device which stalls now and then
+    stallPolls = 50;
+    writeTestFile("LOG00001.BFL", "as", data, 100);
+    stallPolls = 0;
+
+    // then its sectors are written behind the writer once each, in order, to consecutive blocks
+    ASSERT_EQ(data.size() / 512, dataSectorsWritten.size());
+    for (size_t ii = 0; ii < dataSectorsWritten.size(); ii++) {
+        EXPECT_EQ(ii, dataSectorsWritten[ii].second);
+        if (ii > 0) {
+            EXPECT_EQ(dataSectorsWritten[ii - 1].first + 1, dataSectorsWritten[ii].first);
+        }
+    }
+
+    // and almost all of them as the continuation of a multi-block write
+    uint32_t continuedBlocks = 0;
+    for (size_t ii = 0; ii < dataSectorsWritten.size(); ii++) {
+        for (size_t run = 0; run < multipleBlockWrites.size(); run++) {
+            if (dataSectorsWritten[ii].first > multipleBlockWrites[run].first
+                && dataSectorsWritten[ii].first < multipleBlockWrites[run].first + multipleBlockWrites[run].second) {
+                continuedBlocks++;
+                break;
+            }
+        }
+    }
+    EXPECT_GT(continuedBlocks, 9 * dataSectorsWritten.size() / 10);
+    EXPECT_EQ(0, cacheCheckFailures);
+
+    // and the file reads back
+    expectTestFile("LOG00001.BFL", data);
+}
+
+TEST_F(AsyncFatfsTest, ReadAheadLeavesDirtySectorsInTheCache)
+{
+    // given a filesystem which read the FAT ahead while it searched it for free space during mounting
+    mount();
+    EXPECT_GT(afatfs_getCacheStats()->hits, 100u);
+
+    // and a file whose first sector has been written, which ends the multi-block write that mounting left open
+    std::vector<uint8_t> data;
+    fillTestData(&data, 20000);
+    ASSERT_TRUE(afatfs_fopen("LOG00001.TXT", "a", testFileOpened));
+    ASSERT_TRUE(waitForCallback());
+
+    size_t offset = 0;
+    for (int poll = 0; poll < 1000 && offset < 512; poll++) {
+        offset += afatfs_fwrite(testFile, &data[offset], 512 - offset);
+        afatfs_poll();
+    }
+    for (int poll = 0; poll < 1000 && checkCache() > 0; poll++) {
+        afatfs_poll();
+    }
+    ASSERT_EQ(0, checkCache());
+
+    // and a device that won't write, so the file's next sectors are left dirty in the cache
+    blocksWritten.clear();
+    holdWrites = true;
+    for (int poll = 0; poll < 1000 && offset < 4 * 512; poll++) {
+        offset += afatfs_fwrite(testFile, &data[offset], 100);
+        afatfs_poll();
+    }
+    const int dirtyEntries = checkCache();
+    EXPECT_GT(dirtyEntries, 2);
+    EXPECT_TRUE(blocksWritten.empty());
+
+    // when sectors are read ahead
+    for (uint32_t sector = 0; sector < 8; sector++) {
+        afatfs_cacheReadAhead(100000 + sector, 0);
+        afatfs_poll();
+    }
+
+    // then no dirty sector is given up for them
+    EXPECT_EQ(dirtyEntries, checkCache());
+
+    // and the file is intact once the device writes again
+    holdWrites = false;
+    for (int poll = 0; poll < TEST_MAX_POLLS && offset < data.size(); poll++) {
+        offset += afatfs_fwrite(testFile, &data[offset], std::min<size_t>(700, data.size() - offset));
+        afatfs_poll();
+    }
+    ASSERT_EQ(data.size(), offset);
+    ASSERT_TRUE(afatfs_fclose(testFile, testFileClosed));
+    ASSERT_TRUE(waitForCallback());
+    expectTestFile("LOG00001.TXT", data);
+    EXPECT_EQ(0, cacheCheckFailures);
+}
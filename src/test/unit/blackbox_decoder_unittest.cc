@@ -0,0 +1,394 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "blackbox/blackbox_encoding.h"
+    #include "blackbox/blackbox_fielddefs.h"
+    #include "blackbox/blackbox_io.h"
+
+    #include "drivers/serial.h"
+}
+
+#include "../replay/blackbox_decoder.h"
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+/*
+ * Logs are written here with the encoders from blackbox_encoding.c, the same way blackbox.c writes them, and read back
+ * with the replay tools' decoder.
+ */
+
+static std::vector<uint8_t> logData;
+
+#define TEST_I_INTERVAL 32
+#define TEST_MINTHROTTLE 1150
+#define TEST_FIELD_COUNT 12
+
+typedef struct testMainState_s {
+    int32_t loopIteration;
+    int32_t time;
+    int32_t rcCommand[4];
+    int32_t gyroADC[3];
+    int32_t motor[3];
+} testMainState_t;
+
+// the order of the fields in the header
+static void testStateFields(testMainState_t *state, int32_t *fields[TEST_FIELD_COUNT])
+{
+    int count = 0;
+    fields[count++] = &state->loopIteration;
+    fields[count++] = &state->time;
+    for (int ii = 0; ii < 4; ii++) {
+        fields[count++] = &state->rcCommand[ii];
+    }
+    for (int ii = 0; ii < 3; ii++) {
+        fields[count++] = &state->gyroADC[ii];
+    }
+    for (int ii = 0; ii < 3; ii++) {
+        fields[count++] = &state->motor[ii];
+    }
+}
+
+static void loadTestState(testMainState_t *state, int32_t iteration)
+{
+    state->loopIteration = iteration;
+    state->time = 1000 + iteration * 125 + iteration % 3; // with some jitter in the loop time
+    for (int ii = 0; ii < 4; ii++) {
+        state->rcCommand[ii] = (iteration * 7 + ii * 13) % 200 - 100;
+    }
+    for (int ii = 0; ii < 3; ii++) {
+        // large changes from frame to frame, to use the wider tag encodings
+        state->gyroADC[ii] = (iteration * iteration * 37 + ii * 1001) % 4000 - 2000;
+    }
+    state->motor[0] = TEST_MINTHROTTLE + (iteration * 11) % 850;
+    for (int ii = 1; ii < 3; ii++) {
+        state->motor[ii] = state->motor[0] + (iteration + ii * 5) % 40 - 20;
+    }
+}
+
+// Older firmware doesn't announce the data dropped event in the header
+static bool testHeaderHasDataDropped;
+
+static void writeTestHeader(int pIntervalNum, int pIntervalDenom)
+{
+    blackboxPrintfHeaderLine("Product", "Blackbox flight data recorder by Nicholas Sherlock");
+    blackboxPrintfHeaderLine("Data version", "%d", 2);
+    blackboxPrintfHeaderLine("I interval", "%d", TEST_I_INTERVAL);
+    blackboxPrintfHeaderLine("P interval", "%d/%d", pIntervalNum, pIntervalDenom);
+    if (testHeaderHasDataDropped) {
+        blackboxPrintfHeaderLine("P interval adaptive", "%d", 1);
+        blackboxPrintfHeaderLine("Data dropped event", "%d", FLIGHT_LOG_EVENT_DATA_DROPPED);
+    }
+    blackboxPrintfHeaderLine("minthrottle", "%d", TEST_MINTHROTTLE);
+    blackboxPrintfHeaderLine("Field I name", "%s", "loopIteration,time,rcCommand[0],rcCommand[1],rcCommand[2],rcCommand[3],"
+        "gyroADC[0],gyroADC[1],gyroADC[2],motor[0],motor[1],motor[2]");
+    blackboxPrintfHeaderLine("Field I predictor", "%s", "0,0,0,0,0,0,0,0,0,4,5,5");
+    blackboxPrintfHeaderLine("Field I encoding", "%s", "1,1,0,0,0,0,0,0,0,1,0,0");
+    blackboxPrintfHeaderLine("Field P predictor", "%s", "6,2,1,1,1,1,3,3,3,1,1,1");
+    blackboxPrintfHeaderLine("Field P encoding", "%s", "9,0,8,8,8,8,6,6,6,7,7,7");
+}
+
+static void writeTestIntraframe(const testMainState_t *current)
+{
+    blackboxWrite('I');
+    blackboxWriteUnsignedVB(current->loopIteration);
+    blackboxWriteUnsignedVB(current->time);
+    blackboxWriteSignedVBArray((int32_t *)current->rcCommand, 4);
+    blackboxWriteSignedVBArray((int32_t *)current->gyroADC, 3);
+    blackboxWriteUnsignedVB(current->motor[0] - TEST_MINTHROTTLE);
+    for (int ii = 1; ii < 3; ii++) {
+        blackboxWriteSignedVB(current->motor[ii] - current->motor[0]);
+    }
+}
+
+static void writeTestInterframe(const testMainState_t *current, const testMainState_t *previous, const testMainState_t *previous2)
+{
+    int32_t deltas[4];
+
+    blackboxWrite('P');
+    blackboxWriteSignedVB(current->time - 2 * previous->time + previous2->time);
+    for (int ii = 0; ii < 4; ii++) {
+        deltas[ii] = current->rcCommand[ii] - previous->rcCommand[ii];
+    }
+    blackboxWriteTag8_4S16(deltas);
+    for (int ii = 0; ii < 3; ii++) {
+        deltas[ii] = current->gyroADC[ii] - (previous->gyroADC[ii] + previous2->gyroADC[ii]) / 2;
+    }
+    blackboxWriteTag8_8SVB(deltas, 3);
+    for (int ii = 0; ii < 3; ii++) {
+        deltas[ii] = current->motor[ii] - previous->motor[ii];
+    }
+    blackboxWriteTag2_3S32(deltas);
+}
+
+static void writeTestDataDropped(uint32_t interframes, int pIntervalNum, int pIntervalDenom)
+{
+    blackboxWrite('E');
+    blackboxWrite(FLIGHT_LOG_EVENT_DATA_DROPPED);
+    blackboxWriteUnsignedVB(0);
+    blackboxWriteUnsignedVB(interframes);
+    blackboxWriteUnsignedVB(0);
+    blackboxWriteUnsignedVB(interframes * 20);
+    blackboxWriteUnsignedVB(pIntervalNum);
+    blackboxWriteUnsignedVB(pIntervalDenom);
+}
+
+static void writeTestLogEnd(void)
+{
+    blackboxWrite('E');
+    blackboxWrite(FLIGHT_LOG_EVENT_LOG_END);
+    blackboxPrint("End of log");
+    blackboxWrite(0);
+}
+
+/*
+ * Writes a log of the given loop iterations the way blackbox.c does: an I frame every TEST_I_INTERVAL iterations and
+ * P frames at the P interval in between. The P frame at dropIteration is dropped, and so are the rest of the P frames
+ * up to the next I frame. That I frame is preceded by a data dropped event which changes the P interval to
+ * 1/(pIntervalDenom * 2). Returns the frames that were written.
+ */
+static std::vector<testMainState_t> writeTestLog(int iterations, int pIntervalNum, int pIntervalDenom, int dropIteration)
+{
+    std::vector<testMainState_t> logged;
+    testMainState_t history[3];
+    bool mainFrameDropped = false;
+    bool droppedSinceEvent = false;
+    uint32_t droppedInterframes = 0;
+
+    writeTestHeader(pIntervalNum, pIntervalDenom);
+
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        const int pFrameIndex = iteration % TEST_I_INTERVAL;
+        if (pFrameIndex == 0) {
+            if (droppedSinceEvent) {
+                droppedSinceEvent = false;
+                pIntervalNum = 1;
+                pIntervalDenom *= 2;
+                writeTestDataDropped(droppedInterframes, pIntervalNum, pIntervalDenom);
+            }
+            mainFrameDropped = false;
+            loadTestState(&history[0], iteration);
+            writeTestIntraframe(&history[0]);
+            history[2] = history[1] = history[0];
+            logged.push_back(history[0]);
+        } else if ((pFrameIndex + pIntervalNum - 1) % pIntervalDenom < pIntervalNum) {
+            if (iteration == dropIteration || mainFrameDropped) {
+                mainFrameDropped = true;
+                droppedSinceEvent = true;
+                droppedInterframes++;
+                continue;
+            }
+            loadTestState(&history[0], iteration);
+            writeTestInterframe(&history[0], &history[1], &history[2]);
+            history[2] = history[1];
+            history[1] = history[0];
+            logged.push_back(history[0]);
+        }
+    }
+    writeTestLogEnd();
+
+    return logged;
+}
+
+static FILE *openTestLog(void)
+{
+    return fmemopen(logData.data(), logData.size(), "rb");
+}
+
+static void expectDecodedFrame(const BlackboxDecoder &decoder, const testMainState_t &expected)
+{
+    testMainState_t state = expected;
+    int32_t *fields[TEST_FIELD_COUNT];
+    testStateFields(&state, fields);
+    for (int ii = 0; ii < TEST_FIELD_COUNT; ii++) {
+        EXPECT_EQ(*fields[ii], decoder.mainValues()[ii]) << decoder.mainFieldName(ii) << " at iteration " << expected.loopIteration;
+    }
+}
+
+class BlackboxDecoderTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        logData.clear();
+        testHeaderHasDataDropped = true;
+    }
+};
+
+TEST_F(BlackboxDecoderTest, TestRoundTrip)
+{
+    // given
+    const std::vector<testMainState_t> logged = writeTestLog(200, 1, 2, -1);
+    FILE *fp = openTestLog();
+    BlackboxDecoder decoder(fp);
+
+    // when
+    ASSERT_TRUE(decoder.nextLog());
+
+    // then the header is read
+    EXPECT_EQ(TEST_FIELD_COUNT, decoder.mainFieldCount());
+    EXPECT_EQ(9, decoder.mainField("motor[0]"));
+    EXPECT_EQ(TEST_I_INTERVAL, decoder.headerInt("I interval", 0, 0));
+
+    // and every frame decodes to the values that were written
+    size_t frame = 0;
+    BlackboxDecoder::frameType_e frameType;
+    while ((frameType = decoder.nextFrame()) != BlackboxDecoder::FRAME_LOG_END) {
+        ASSERT_EQ(BlackboxDecoder::FRAME_MAIN, frameType);
+        ASSERT_LT(frame, logged.size());
+        EXPECT_EQ(logged[frame].loopIteration % TEST_I_INTERVAL == 0, decoder.lastMainFrameWasIntra());
+        expectDecodedFrame(decoder, logged[frame]);
+        frame++;
+    }
+    EXPECT_EQ(logged.size(), frame);
+    EXPECT_EQ(FLIGHT_LOG_EVENT_LOG_END, decoder.eventType());
+    EXPECT_EQ(7u, decoder.statistics().iFrames);
+    EXPECT_EQ(0u, decoder.statistics().corruptFrames);
+    EXPECT_EQ(0u, decoder.statistics().skippedPFrames);
+    EXPECT_FALSE(decoder.nextLog());
+
+    fclose(fp);
+}
+
+TEST_F(BlackboxDecoderTest, TestDataDroppedEventChangesPInterval)
+{
+    // given a log that drops frames in the second I interval, and halves its P frame rate from the third
+    const std::vector<testMainState_t> logged = writeTestLog(200, 1, 2, TEST_I_INTERVAL + 10);
+    FILE *fp = openTestLog();
+    BlackboxDecoder decoder(fp);
+    ASSERT_TRUE(decoder.nextLog());
+
+    // when
+    size_t frame = 0;
+    int dataDroppedEvents = 0;
+    BlackboxDecoder::frameType_e frameType;
+    while ((frameType = decoder.nextFrame()) != BlackboxDecoder::FRAME_LOG_END) {
+        if (frameType == BlackboxDecoder::FRAME_EVENT) {
+            EXPECT_EQ(FLIGHT_LOG_EVENT_DATA_DROPPED, decoder.eventType());
+            // the event comes before the I frame that the new rate starts from
+            EXPECT_EQ(2 * TEST_I_INTERVAL, logged[frame].loopIteration);
+            dataDroppedEvents++;
+            continue;
+        }
+        ASSERT_EQ(BlackboxDecoder::FRAME_MAIN, frameType);
+        ASSERT_LT(frame, logged.size());
+        expectDecodedFrame(decoder, logged[frame]);
+        frame++;
+    }
+
+    // then every frame, including those with loopIteration predicted at the new P interval, was decoded
+    EXPECT_EQ(1, dataDroppedEvents);
+    EXPECT_EQ(logged.size(), frame);
+    for (size_t ii = 1; ii < logged.size(); ii++) {
+        if (logged[ii - 1].loopIteration == 2 * TEST_I_INTERVAL) {
+            EXPECT_EQ(2 * TEST_I_INTERVAL + 4, logged[ii].loopIteration);
+        }
+    }
+    EXPECT_EQ(0u, decoder.statistics().corruptFrames);
+
+    fclose(fp);
+}
+
+TEST_F(BlackboxDecoderTest, TestDataDroppedEventNeedsHeader)
+{
+    // given a log with a data dropped event, but without the header that announces it
+    testHeaderHasDataDropped = false;
+    const std::vector<testMainState_t> logged = writeTestLog(200, 1, 2, TEST_I_INTERVAL + 10);
+    FILE *fp = openTestLog();
+    BlackboxDecoder decoder(fp);
+    ASSERT_TRUE(decoder.nextLog());
+
+    // when
+    int events = 0;
+    BlackboxDecoder::frameType_e frameType;
+    while ((frameType = decoder.nextFrame()) != BlackboxDecoder::FRAME_LOG_END) {
+        if (frameType == BlackboxDecoder::FRAME_EVENT) {
+            events++;
+        }
+    }
+
+    // then the event is not trusted, and the decoder resyncs on the I frame after it
+    EXPECT_EQ(0, events);
+    EXPECT_EQ(1u, decoder.statistics().corruptFrames);
+    EXPECT_EQ(FLIGHT_LOG_EVENT_LOG_END, decoder.eventType());
+
+    fclose(fp);
+}
+
+TEST_F(BlackboxDecoderTest, TestLogsBackToBack)
+{
+    // given two logs in the same file, as written to flash
+    const std::vector<testMainState_t> first = writeTestLog(70, 1, 1, -1);
+    const std::vector<testMainState_t> second = writeTestLog(40, 2, 3, -1);
+    FILE *fp = openTestLog();
+    BlackboxDecoder decoder(fp);
+
+    // expect
+    const std::vector<testMainState_t> *logs[] = { &first, &second };
+    for (int log = 0; log < 2; log++) {
+        ASSERT_TRUE(decoder.nextLog());
+        size_t frame = 0;
+        while (decoder.nextFrame() == BlackboxDecoder::FRAME_MAIN) {
+            ASSERT_LT(frame, logs[log]->size());
+            expectDecodedFrame(decoder, (*logs[log])[frame]);
+            frame++;
+        }
+        EXPECT_EQ(logs[log]->size(), frame);
+    }
+    EXPECT_FALSE(decoder.nextLog());
+
+    fclose(fp);
+}
+
+// STUBS
+
+extern "C" {
+
+int32_t blackboxHeaderBudget;
+
+void serialWrite(serialPort_t *instance, uint8_t ch)
+{
+    UNUSED(instance);
+    UNUSED(ch);
+}
+
+bool isSerialTransmitBufferEmpty(const serialPort_t *instance)
+{
+    UNUSED(instance);
+    return true;
+}
+
+void blackboxWrite(uint8_t value)
+{
+    logData.push_back(value);
+}
+
+int blackboxPrint(const char *s)
+{
+    const int length = strlen(s);
+    logData.insert(logData.end(), s, s + length);
+    return length;
+}
+
+}
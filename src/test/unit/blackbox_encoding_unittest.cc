@@ -15,13 +15,19 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <chrono>
+#include <vector>
+
 extern "C" {
     #include "platform.h"
 
     #include "blackbox/blackbox.h"
     #include "blackbox/blackbox_encoding.h"
+    #include "blackbox/blackbox_io.h"
+    #include "common/encoding.h"
     #include "common/utils.h"
 
     #include "config/parameter_group.h"
@@ -43,6 +49,14 @@ static int serialReadEnd = 0;
 static uint8_t serialReadBuffer[SERIAL_BUFFER_SIZE];
 static uint8_t serialWriteBuffer[SERIAL_BUFFER_SIZE];
 
+/*
+ * When set, encoded bytes go straight into a scratch buffer instead of through the serial port checks, so that the
+ * encoders can be compared over many values and timed.
+ */
+static bool encodeDirect = false;
+static uint8_t directBuffer[256];
+static uint8_t directPos;
+
 serialPort_t serialTestInstance;
 
 void serialWrite(serialPort_t *instance, uint8_t ch)
@@ -240,12 +254,470 @@ TEST(BlackboxTest, TestWriteTag2_3SVariable_BITS887)
     EXPECT_EQ(0, buf[3]); // ensure next byte has not been written
     buf += 3;
 }
+/*
+ * The encoders as they were before the selectors were computed with count-leading-zeros and lookup tables, to check
+ * that the output is unchanged byte for byte.
+ */
+static void referenceWriteTag2_3S32(int32_t *values)
+{
+    static const int NUM_FIELDS = 3;
+
+    enum {
+        BITS_2  = 0,
+        BITS_4  = 1,
+        BITS_6  = 2,
+        BITS_32 = 3
+    };
+
+    enum {
+        BYTES_1  = 0,
+        BYTES_2  = 1,
+        BYTES_3  = 2,
+        BYTES_4  = 3
+    };
+
+    int selector = BITS_2, selector2;
+
+    for (int x = 0; x < NUM_FIELDS; x++) {
+        if (values[x] >= 32 || values[x] < -32) {
+            selector = BITS_32;
+            break;
+        }
+
+        if (values[x] >= 8 || values[x] < -8) {
+             if (selector < BITS_6) {
+                 selector = BITS_6;
+             }
+        } else if (values[x] >= 2 || values[x] < -2) {
+            if (selector < BITS_4) {
+                selector = BITS_4;
+            }
+        }
+    }
+
+    switch (selector) {
+    case BITS_2:
+        blackboxWrite((selector << 6) | ((values[0] & 0x03) << 4) | ((values[1] & 0x03) << 2) | (values[2] & 0x03));
+        break;
+    case BITS_4:
+        blackboxWrite((selector << 6) | (values[0] & 0x0F));
+        blackboxWrite((values[1] << 4) | (values[2] & 0x0F));
+        break;
+    case BITS_6:
+        blackboxWrite((selector << 6) | (values[0] & 0x3F));
+        blackboxWrite((uint8_t)values[1]);
+        blackboxWrite((uint8_t)values[2]);
+        break;
+    case BITS_32:
+        selector2 = 0;
+
+        for (int x = NUM_FIELDS - 1; x >= 0; x--) {
+            selector2 <<= 2;
+
+            if (values[x] < 128 && values[x] >= -128) {
+                selector2 |= BYTES_1;
+            } else if (values[x] < 32768 && values[x] >= -32768) {
+                selector2 |= BYTES_2;
+            } else if (values[x] < 8388608 && values[x] >= -8388608) {
+                selector2 |= BYTES_3;
+            } else {
+                selector2 |= BYTES_4;
+            }
+        }
+
+        blackboxWrite((selector << 6) | selector2);
+
+        for (int x = 0; x < NUM_FIELDS; x++, selector2 >>= 2) {
+            switch (selector2 & 0x03) {
+            case BYTES_1:
+                blackboxWrite(values[x]);
+                break;
+            case BYTES_2:
+                blackboxWrite(values[x]);
+                blackboxWrite(values[x] >> 8);
+                break;
+            case BYTES_3:
+                blackboxWrite(values[x]);
+                blackboxWrite(values[x] >> 8);
+                blackboxWrite(values[x] >> 16);
+                break;
+            case BYTES_4:
+                blackboxWrite(values[x]);
+                blackboxWrite(values[x] >> 8);
+                blackboxWrite(values[x] >> 16);
+                blackboxWrite(values[x] >> 24);
+                break;
+            }
+        }
+        break;
+    }
+}
+
+static int referenceWriteTag2_3SVariable(int32_t *values)
+{
+    static const int FIELD_COUNT = 3;
+    enum {
+        BITS_2  = 0,
+        BITS_554  = 1,
+        BITS_877  = 2,
+        BITS_32 = 3
+    };
+
+    enum {
+        BYTES_1  = 0,
+        BYTES_2  = 1,
+        BYTES_3  = 2,
+        BYTES_4  = 3
+    };
+
+    int selector = BITS_2;
+    int selector2 = 0;
+    if (values[0] >= 256 || values[0] < -256
+            || values[1] >= 128 || values[1] < -128
+            || values[2] >= 128 || values[2] < -128) {
+        selector = BITS_32;
+    } else if (values[0] >= 16 || values[0] < -16
+            || values[1] >= 16 || values[1] < -16
+            || values[2] >= 8 || values[2] < -8) {
+        selector = BITS_877;
+    } else if (values[0] >= 2 || values[0] < -2
+            || values[1] >= 2 || values[1] < -2
+            || values[2] >= 2 || values[2] < -2) {
+        selector = BITS_554;
+    }
+
+    switch (selector) {
+    case BITS_2:
+        blackboxWrite((selector << 6) | ((values[0] & 0x03) << 4) | ((values[1] & 0x03) << 2) | (values[2] & 0x03));
+        break;
+    case BITS_554:
+        blackboxWrite((selector << 6) | ((values[0] & 0x1F) << 1) | ((values[1] & 0x1F) >> 4));
+        blackboxWrite(((values[1] & 0x0F) << 4) | (values[2] & 0x0F));
+        break;
+    case BITS_877:
+        blackboxWrite((selector << 6) | ((values[0] & 0xFF) >> 2));
+        blackboxWrite(((values[0] & 0x03) << 6) | ((values[1] & 0x7F) >> 1));
+        blackboxWrite(((values[1] & 0x01) << 7) | (values[2] & 0x7F));
+        break;
+    case BITS_32:
+        selector2 = 0;
+        for (int x = FIELD_COUNT - 1; x >= 0; x--) {
+            selector2 <<= 2;
+
+            if (values[x] < 128 && values[x] >= -128) {
+                selector2 |= BYTES_1;
+            } else if (values[x] < 32768 && values[x] >= -32768) {
+                selector2 |= BYTES_2;
+            } else if (values[x] < 8388608 && values[x] >= -8388608) {
+                selector2 |= BYTES_3;
+            } else {
+                selector2 |= BYTES_4;
+            }
+        }
+
+        blackboxWrite((selector << 6) | selector2);
+
+        for (int x = 0; x < FIELD_COUNT; x++, selector2 >>= 2) {
+            switch (selector2 & 0x03) {
+            case BYTES_1:
+                blackboxWrite(values[x]);
+                break;
+            case BYTES_2:
+                blackboxWrite(values[x]);
+                blackboxWrite(values[x] >> 8);
+                break;
+            case BYTES_3:
+                blackboxWrite(values[x]);
+                blackboxWrite(values[x] >> 8);
+                blackboxWrite(values[x] >> 16);
+                break;
+            case BYTES_4:
+                blackboxWrite(values[x]);
+                blackboxWrite(values[x] >> 8);
+                blackboxWrite(values[x] >> 16);
+                blackboxWrite(values[x] >> 24);
+                break;
+            }
+        }
+    break;
+    }
+    return selector;
+}
+
+static void referenceWriteTag8_4S16(int32_t *values)
+{
+    enum {
+        FIELD_ZERO  = 0,
+        FIELD_4BIT  = 1,
+        FIELD_8BIT  = 2,
+        FIELD_16BIT = 3
+    };
+
+    uint8_t selector = 0;
+    for (int x = 3; x >= 0; x--) {
+        selector <<= 2;
+
+        if (values[x] == 0) {
+            selector |= FIELD_ZERO;
+        } else if (values[x] < 8 && values[x] >= -8) {
+            selector |= FIELD_4BIT;
+        } else if (values[x] < 128 && values[x] >= -128) {
+            selector |= FIELD_8BIT;
+        } else {
+            selector |= FIELD_16BIT;
+        }
+    }
+
+    blackboxWrite(selector);
+
+    int nibbleIndex = 0;
+    uint8_t buffer = 0;
+    for (int x = 0; x < 4; x++, selector >>= 2) {
+        switch (selector & 0x03) {
+        case FIELD_ZERO:
+            break;
+        case FIELD_4BIT:
+            if (nibbleIndex == 0) {
+                buffer = values[x] << 4;
+                nibbleIndex = 1;
+            } else {
+                blackboxWrite(buffer | (values[x] & 0x0F));
+                nibbleIndex = 0;
+            }
+            break;
+        case FIELD_8BIT:
+            if (nibbleIndex == 0) {
+                blackboxWrite(values[x]);
+            } else {
+                blackboxWrite(buffer | ((values[x] >> 4) & 0x0F));
+                buffer = values[x] << 4;
+            }
+            break;
+        case FIELD_16BIT:
+            if (nibbleIndex == 0) {
+                blackboxWrite(values[x] >> 8);
+                blackboxWrite(values[x]);
+            } else {
+                blackboxWrite(buffer | ((values[x] >> 12) & 0x0F));
+                blackboxWrite(values[x] >> 4);
+                buffer = values[x] << 4;
+            }
+            break;
+        }
+    }
+    if (nibbleIndex == 1) {
+        blackboxWrite(buffer);
+    }
+}
+
+static void referenceWriteTag8_8SVB(int32_t *values, int valueCount)
+{
+    uint8_t header;
+
+    if (valueCount > 0) {
+        if (valueCount == 1) {
+            blackboxWriteSignedVB(values[0]);
+        } else {
+            header = 0;
+
+            for (int i = valueCount - 1; i >= 0; i--) {
+                header <<= 1;
+
+                if (values[i] != 0) {
+                    header |= 0x01;
+                }
+            }
+
+            blackboxWrite(header);
+
+            for (int i = 0; i < valueCount; i++) {
+                if (values[i] != 0) {
+                    blackboxWriteSignedVB(values[i]);
+                }
+            }
+        }
+    }
+}
+
+// the boundaries of all of the field sizes used by the encoders
+static const int32_t encodingEdgeValues[] = {
+    0, 1, -1, 2, -2, -3, 3, 7, 8, -8, -9, 15, 16, -16, -17, 31, 32, -32, -33, 63, 64, -64, -65,
+    127, 128, -128, -129, 255, 256, -256, -257, 32767, 32768, -32768, -32769,
+    8388607, 8388608, -8388608, -8388609, INT32_MAX, INT32_MIN
+};
+
+// a random value whose magnitude is spread evenly over the bit widths
+static int32_t randomEncodingValue(void)
+{
+    const int bits = rand() % 32;
+    const int32_t value = (int32_t)(((uint32_t)rand() << 16) ^ (uint32_t)rand()) >> (31 - bits);
+    return value;
+}
+
+static std::vector<uint8_t> encodedBytes(void)
+{
+    std::vector<uint8_t> bytes(directBuffer, directBuffer + directPos);
+    directPos = 0;
+    return bytes;
+}
+
+static void expectTagEncodersMatchReference(int32_t *values)
+{
+    referenceWriteTag2_3S32(values);
+    std::vector<uint8_t> expected = encodedBytes();
+    blackboxWriteTag2_3S32(values);
+    EXPECT_EQ(expected, encodedBytes()) << "Tag2_3S32 " << values[0] << " " << values[1] << " " << values[2];
+
+    const int expectedSelector = referenceWriteTag2_3SVariable(values);
+    expected = encodedBytes();
+    EXPECT_EQ(expectedSelector, blackboxWriteTag2_3SVariable(values));
+    EXPECT_EQ(expected, encodedBytes()) << "Tag2_3SVariable " << values[0] << " " << values[1] << " " << values[2];
+
+    referenceWriteTag8_4S16(values);
+    expected = encodedBytes();
+    blackboxWriteTag8_4S16(values);
+    EXPECT_EQ(expected, encodedBytes()) << "Tag8_4S16 " << values[0] << " " << values[1] << " " << values[2] << " " << values[3];
+
+    for (int count = 0; count <= 8; count++) {
+        referenceWriteTag8_8SVB(values, count);
+        expected = encodedBytes();
+        blackboxWriteTag8_8SVB(values, count);
+        EXPECT_EQ(expected, encodedBytes()) << "Tag8_8SVB count " << count;
+    }
+}
+
+TEST(BlackboxEncodingTest, TestTagEncodersMatchReference)
+{
+    int32_t values[8];
+
+    encodeDirect = true;
+    directPos = 0;
+
+    // every pair of edge values, each in every position among the first three fields
+    const int edgeCount = ARRAYLEN(encodingEdgeValues);
+    for (int i = 0; i < edgeCount; i++) {
+        for (int j = 0; j < edgeCount; j++) {
+            for (int rotation = 0; rotation < 3; rotation++) {
+                values[rotation] = encodingEdgeValues[i];
+                values[(rotation + 1) % 3] = encodingEdgeValues[j];
+                values[(rotation + 2) % 3] = encodingEdgeValues[(i + j) % edgeCount];
+                for (int x = 3; x < 8; x++) {
+                    values[x] = encodingEdgeValues[(i + j + x) % edgeCount];
+                }
+                expectTagEncodersMatchReference(values);
+            }
+        }
+    }
+
+    srand(1);
+    for (int n = 0; n < 20000; n++) {
+        for (int x = 0; x < 8; x++) {
+            values[x] = rand() % 4 == 0 ? 0 : randomEncodingValue();
+        }
+        expectTagEncodersMatchReference(values);
+    }
+    encodeDirect = false;
+}
+
+/*
+ * Field sets of the P frames of a quad logging at 8kHz: small deltas for the PID terms, gyro and motors, slowly
+ * changing rcCommand and mostly zero optional fields.
+ */
+typedef struct encodeTestFrame_s {
+    int32_t pidP[3];
+    int32_t pidI[3];
+    int32_t pidD[3];
+    int32_t rcCommand[4];
+    int32_t optional[8];
+    int32_t gyro[3];
+    int32_t motor[4];
+} encodeTestFrame_t;
+
+static int32_t randomDelta(int range)
+{
+    return rand() % (2 * range + 1) - range;
+}
+
+static void encodeTestFrameLoad(encodeTestFrame_t *frame, bool intraframe)
+{
+    // I frames hold absolute values, so they are larger than the deltas of P frames
+    const int scale = intraframe ? 40 : 1;
+    for (int axis = 0; axis < 3; axis++) {
+        frame->pidP[axis] = randomDelta(20 * scale);
+        frame->pidI[axis] = randomDelta(3 * scale);
+        frame->pidD[axis] = randomDelta(40 * scale);
+        frame->rcCommand[axis] = rand() % 8 ? 0 : randomDelta(6 * scale);
+        frame->gyro[axis] = randomDelta(30 * scale);
+    }
+    frame->rcCommand[3] = rand() % 8 ? 0 : randomDelta(10 * scale);
+    for (int i = 0; i < 8; i++) {
+        frame->optional[i] = rand() % 4 ? 0 : randomDelta(5 * scale);
+    }
+    for (int i = 0; i < 4; i++) {
+        frame->motor[i] = randomDelta(25 * scale);
+    }
+}
+
+typedef void (*tag2_3S32Encoder)(int32_t *values);
+typedef void (*tag8_4S16Encoder)(int32_t *values);
+typedef void (*tag8_8SVBEncoder)(int32_t *values, int valueCount);
+
+static double encodeFramesPerSecond(const std::vector<encodeTestFrame_t> &frames, int rounds,
+    tag2_3S32Encoder writeTag2_3S32, tag8_4S16Encoder writeTag8_4S16, tag8_8SVBEncoder writeTag8_8SVB)
+{
+    encodeDirect = true;
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (const encodeTestFrame_t &frame : frames) {
+            encodeTestFrame_t f = frame;
+            blackboxWriteSignedVBArray(f.pidP, 3);
+            writeTag2_3S32(f.pidI);
+            blackboxWriteSignedVBArray(f.pidD, 3);
+            writeTag8_4S16(f.rcCommand);
+            writeTag8_8SVB(f.optional, 8);
+            blackboxWriteSignedVBArray(f.gyro, 3);
+            blackboxWriteSignedVBArray(f.motor, 4);
+        }
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    encodeDirect = false;
+    return frames.size() * rounds / elapsed;
+}
+
+TEST(BlackboxEncodingTest, TestEncodeThroughput)
+{
+    static const int FRAME_COUNT = 4096;
+    static const int ROUNDS = 20;
+
+    srand(1);
+    for (int intraframe = 0; intraframe <= 1; intraframe++) {
+        std::vector<encodeTestFrame_t> frames(FRAME_COUNT);
+        for (encodeTestFrame_t &frame : frames) {
+            encodeTestFrameLoad(&frame, intraframe);
+        }
+        const double reference = encodeFramesPerSecond(frames, ROUNDS,
+            referenceWriteTag2_3S32, referenceWriteTag8_4S16, referenceWriteTag8_8SVB);
+        const double tableDriven = encodeFramesPerSecond(frames, ROUNDS,
+            blackboxWriteTag2_3S32, blackboxWriteTag8_4S16, blackboxWriteTag8_8SVB);
+        printf("%s frame encode throughput: reference %.0f frames/s, table driven %.0f frames/s\n",
+            intraframe ? "I" : "P", reference, tableDriven);
+        EXPECT_GT(tableDriven, 0);
+    }
+}
+
 // STUBS
 extern "C" {
 PG_REGISTER(blackboxConfig_t, blackboxConfig, PG_BLACKBOX_CONFIG, 0);
 int32_t blackboxHeaderBudget;
 void mspSerialAllocatePorts(void) {}
-void blackboxWrite(uint8_t value) {serialWrite(blackboxPort, value);}
+void blackboxWrite(uint8_t value)
+{
+    if (encodeDirect) {
+        directBuffer[directPos++] = value;
+    } else {
+        serialWrite(blackboxPort, value);
+    }
+}
 int blackboxPrint(const char *s)
 {
     const uint8_t *pos = (uint8_t*)s;
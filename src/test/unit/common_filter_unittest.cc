@@ -19,11 +19,15 @@
 #include <stdbool.h>
 
 #include <limits.h>
+#include <string.h>
 
 #include <math.h>
 
 extern "C" {
     #include "common/filter.h"
+
+    void filterBankApplyStagesScalar(filterBank_t *bank, float *values, int firstStage, int lastStage);
+    void filterBankApplyStagesVector(filterBank_t *bank, float *values, int firstStage, int lastStage);
 }
 
 #include "unittest_macros.h"
@@ -145,3 +149,69 @@ TEST(FilterUnittest, TestFirFilterApply)
     expected = 7.0f * 26.0f + 6.0 * 27.0 + 5.0 * 28.0 + 4.0f * 29.0f;
     EXPECT_FLOAT_EQ(expected, firFilterApply(&filter));
 }
+
+typedef void (*filterBankApplyStagesFnPtr)(filterBank_t *bank, float *values, int firstStage, int lastStage);
+
+// the filter bank must produce bit identical results to the per axis filters it replaces
+static void testFilterBankMatchesPerAxisFilters(filterBankApplyStagesFnPtr applyStages)
+{
+    biquadFilter_t notch[3];
+    pt1Filter_t pt1[3];
+    biquadFilter_t lpf[3];
+    filterBank_t bank;
+
+    // pt1FilterInit does not reset the filter state
+    memset(pt1, 0, sizeof(pt1));
+    filterBankInit(&bank);
+    for (int axis = 0; axis < 3; axis++) {
+        biquadFilterInit(&notch[axis], 260, 125, filterGetNotchQ(260, 160), FILTER_NOTCH);
+        pt1FilterInit(&pt1[axis], 90, 0.000125f);
+        biquadFilterInitLPF(&lpf[axis], 100, 125);
+    }
+    EXPECT_TRUE(filterBankAddBiquad(&bank, &notch[0]));
+    EXPECT_TRUE(filterBankAddPt1(&bank, &pt1[0]));
+    EXPECT_TRUE(filterBankAddBiquad(&bank, &lpf[0]));
+    EXPECT_FALSE(filterBankAddBiquad(&bank, &lpf[0]));
+    EXPECT_EQ(3, bank.stageCount);
+
+    for (int ii = 0; ii < 2000; ii++) {
+        float values[3];
+        float expected[3];
+        for (int axis = 0; axis < 3; axis++) {
+            values[axis] = 300.0f * sinf(ii * 0.01f * (axis + 1)) + 50.0f * sinf(ii * 1.3f + axis);
+            expected[axis] = biquadFilterApply(&notch[axis], values[axis]);
+            expected[axis] = pt1FilterApply(&pt1[axis], expected[axis]);
+            expected[axis] = biquadFilterApply(&lpf[axis], expected[axis]);
+        }
+        // apply in two parts, as is done when debugging the gyro
+        applyStages(&bank, values, 0, 1);
+        applyStages(&bank, values, 1, bank.stageCount);
+        for (int axis = 0; axis < 3; axis++) {
+            EXPECT_EQ(expected[axis], values[axis]);
+        }
+    }
+}
+
+TEST(FilterUnittest, TestFilterBankScalar)
+{
+    testFilterBankMatchesPerAxisFilters(filterBankApplyStagesScalar);
+}
+
+#if defined(__SSE__) || defined(__ARM_NEON)
+TEST(FilterUnittest, TestFilterBankVector)
+{
+    testFilterBankMatchesPerAxisFilters(filterBankApplyStagesVector);
+}
+#endif
+
+TEST(FilterUnittest, TestFilterBankEmpty)
+{
+    filterBank_t bank;
+    filterBankInit(&bank);
+
+    float values[3] = { 1.0f, -2.0f, 3.0f };
+    filterBankApply(&bank, values);
+    EXPECT_EQ(1.0f, values[0]);
+    EXPECT_EQ(-2.0f, values[1]);
+    EXPECT_EQ(3.0f, values[2]);
+}
@@ -0,0 +1,321 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "drivers/flash.h"
+    #include "drivers/flash_m25p16.h"
+
+    #include "io/flashfs.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+// A small flash chip held in memory. Programming can only clear bits, like the real thing.
+
+#define TEST_FLASH_SECTORS 16
+#define TEST_FLASH_PAGES_PER_SECTOR 16
+#define TEST_FLASH_SECTOR_SIZE (TEST_FLASH_PAGES_PER_SECTOR * M25P16_PAGESIZE)
+#define TEST_FLASH_SIZE (TEST_FLASH_SECTORS * TEST_FLASH_SECTOR_SIZE)
+
+#define TEST_INDEX_ADDRESS (TEST_FLASH_SIZE - TEST_FLASH_SECTOR_SIZE)
+#define TEST_INDEX_ENTRY_SIZE 16
+#define TEST_INDEX_CAPACITY (TEST_FLASH_SECTOR_SIZE / TEST_INDEX_ENTRY_SIZE)
+
+// flashfs only searches for the end of unindexed data to this granularity
+#define TEST_FREE_BLOCK_SIZE 2048
+
+static flashGeometry_t testFlashGeometry = {
+    .sectors = TEST_FLASH_SECTORS,
+    .pagesPerSector = TEST_FLASH_PAGES_PER_SECTOR,
+    .pageSize = M25P16_PAGESIZE,
+    .sectorSize = TEST_FLASH_SECTOR_SIZE,
+    .totalSize = TEST_FLASH_SIZE,
+};
+
+static std::vector<uint8_t> testFlash(TEST_FLASH_SIZE, 0xFF);
+static uint32_t testFlashProgramAddress;
+static bool testFlashBusy;
+
+static std::vector<uint8_t> indexSector(void)
+{
+    return std::vector<uint8_t>(testFlash.begin() + TEST_INDEX_ADDRESS, testFlash.end());
+}
+
+// Writes a log of the given length and closes it
+static void writeLog(uint32_t length)
+{
+    for (uint32_t ii = 0; ii < length; ii++) {
+        flashfsWriteByte(ii & 0x7F);
+    }
+    for (int attempt = 0; attempt < 10 && !flashfsCloseLog(); attempt++) {
+    }
+}
+
+// Mounts the filesystem again, as a reboot would
+static void remount(void)
+{
+    flashfsInit();
+}
+
+class FlashfsTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        testFlashBusy = false;
+        flashfsEraseCompletely();
+        flashfsInit();
+    }
+};
+
+TEST_F(FlashfsTest, SizeExcludesIndexSector)
+{
+    // given
+    EXPECT_EQ((uint32_t)(TEST_FLASH_SIZE - TEST_FLASH_SECTOR_SIZE), flashfsGetSize());
+
+    // when the data area is full, and the index sector doesn't hold an index
+    std::fill(testFlash.begin(), testFlash.end(), 0x55);
+    remount();
+
+    // then the filesystem ends where the index sector starts
+    EXPECT_EQ(flashfsGetSize(), flashfsGetOffset());
+    EXPECT_TRUE(flashfsIsEOF());
+
+    // and reads stop short of it
+    uint8_t buffer[16];
+    EXPECT_EQ(0, flashfsReadAbs(flashfsGetSize(), buffer, sizeof(buffer)));
+    EXPECT_EQ(8, flashfsReadAbs(flashfsGetSize() - 8, buffer, sizeof(buffer)));
+}
+
+TEST_F(FlashfsTest, CloseLogAddsIndexEntry)
+{
+    // given
+    EXPECT_EQ(0, flashfsGetLogCount());
+
+    // when
+    writeLog(1000);
+    writeLog(500);
+
+    // then
+    ASSERT_EQ(2, flashfsGetLogCount());
+    flashfsLog_t log;
+    ASSERT_TRUE(flashfsGetLog(0, &log));
+    EXPECT_EQ(0u, log.start);
+    EXPECT_EQ(1000u, log.end);
+    ASSERT_TRUE(flashfsGetLog(1, &log));
+    EXPECT_EQ(1000u, log.start);
+    EXPECT_EQ(1500u, log.end);
+    EXPECT_FALSE(flashfsGetLog(2, &log));
+    EXPECT_FALSE(flashfsGetLog(-1, &log));
+
+    // and the entries are stored with their magic number in the index sector
+    EXPECT_EQ(0, memcmp(&testFlash[TEST_INDEX_ADDRESS], "BLOG", 4));
+    EXPECT_EQ(0, memcmp(&testFlash[TEST_INDEX_ADDRESS + TEST_INDEX_ENTRY_SIZE], "BLOG", 4));
+
+    // and a remount picks up exactly where the last log ended
+    remount();
+    EXPECT_EQ(2, flashfsGetLogCount());
+    EXPECT_EQ(1500u, flashfsGetOffset());
+}
+
+TEST_F(FlashfsTest, CloseLogWaitsForFlash)
+{
+    // given a log whose last page has been handed to the flash, which is still programming it
+    for (int ii = 0; ii < 300; ii++) {
+        flashfsWriteByte(ii & 0x7F);
+    }
+    flashfsFlushSync();
+    testFlashBusy = true;
+
+    // when
+    const bool closed = flashfsCloseLog();
+
+    // then
+    EXPECT_FALSE(closed);
+    EXPECT_EQ(0, flashfsGetLogCount());
+
+    // when the flash is ready again
+    testFlashBusy = false;
+
+    // then
+    EXPECT_TRUE(flashfsCloseLog());
+    ASSERT_EQ(1, flashfsGetLogCount());
+    flashfsLog_t log;
+    ASSERT_TRUE(flashfsGetLog(0, &log));
+    EXPECT_EQ(300u, log.end);
+}
+
+TEST_F(FlashfsTest, EmptyLogIsNotIndexed)
+{
+    // given
+    writeLog(100);
+
+    // when
+    writeLog(0);
+
+    // then
+    EXPECT_EQ(1, flashfsGetLogCount());
+}
+
+TEST_F(FlashfsTest, UnclosedLogIsIndexedOnMount)
+{
+    // given a closed log, and one that was being written when the power was lost
+    writeLog(3000);
+    for (int ii = 0; ii < 1000; ii++) {
+        flashfsWriteByte(ii & 0x7F);
+    }
+    flashfsFlushSync();
+
+    // when
+    remount();
+
+    // then the second log is indexed up to the next free block after it
+    ASSERT_EQ(2, flashfsGetLogCount());
+    flashfsLog_t log;
+    ASSERT_TRUE(flashfsGetLog(1, &log));
+    EXPECT_EQ(3000u, log.start);
+    EXPECT_EQ(2u * TEST_FREE_BLOCK_SIZE, log.end);
+    EXPECT_EQ(2u * TEST_FREE_BLOCK_SIZE, flashfsGetOffset());
+}
+
+TEST_F(FlashfsTest, FullIndexIsNotOverrun)
+{
+    // given an index with one free entry left
+    for (int ii = 0; ii < TEST_INDEX_CAPACITY - 1; ii++) {
+        writeLog(16);
+    }
+    EXPECT_EQ(TEST_INDEX_CAPACITY - 1, flashfsGetLogCount());
+
+    // when two more logs are closed
+    writeLog(16);
+    const std::vector<uint8_t> fullIndex = indexSector();
+    writeLog(16);
+
+    // then only the first of them fits
+    EXPECT_EQ(TEST_INDEX_CAPACITY, flashfsGetLogCount());
+    EXPECT_TRUE(indexSector() == fullIndex);
+    flashfsLog_t log;
+    ASSERT_TRUE(flashfsGetLog(TEST_INDEX_CAPACITY - 1, &log));
+    EXPECT_EQ(TEST_INDEX_CAPACITY * 16u, log.end);
+
+    // and a remount finds the end of the log that wasn't indexed by scanning for it
+    remount();
+    EXPECT_EQ(TEST_INDEX_CAPACITY, flashfsGetLogCount());
+    EXPECT_TRUE(indexSector() == fullIndex);
+    EXPECT_EQ(0u, flashfsGetOffset() % TEST_FREE_BLOCK_SIZE);
+    EXPECT_GE(flashfsGetOffset(), (TEST_INDEX_CAPACITY + 1) * 16u);
+    EXPECT_LT(flashfsGetOffset(), (TEST_INDEX_CAPACITY + 1) * 16u + TEST_FREE_BLOCK_SIZE);
+}
+
+TEST_F(FlashfsTest, CorruptLastEntryInvalidatesIndex)
+{
+    // given
+    writeLog(1000);
+    writeLog(5000);
+
+    // when bits of the last entry's end address are lost
+    testFlash[TEST_INDEX_ADDRESS + TEST_INDEX_ENTRY_SIZE + 8] &= 0x0F;
+    remount();
+
+    // then no logs are reported, and the end of the data is found by scanning
+    EXPECT_EQ(0, flashfsGetLogCount());
+    flashfsLog_t log;
+    EXPECT_FALSE(flashfsGetLog(0, &log));
+    EXPECT_EQ(3u * TEST_FREE_BLOCK_SIZE, flashfsGetOffset());
+
+    // and nothing more is added to the index sector
+    const std::vector<uint8_t> corruptIndex = indexSector();
+    writeLog(100);
+    EXPECT_EQ(0, flashfsGetLogCount());
+    EXPECT_TRUE(indexSector() == corruptIndex);
+}
+
+TEST_F(FlashfsTest, CorruptEntryIsNotReturned)
+{
+    // given
+    writeLog(1000);
+    writeLog(500);
+    writeLog(700);
+
+    // when an entry's checksum no longer matches
+    testFlash[TEST_INDEX_ADDRESS + TEST_INDEX_ENTRY_SIZE + 4] &= 0x0F;
+    remount();
+
+    // then that log is left out, but the others are still found
+    EXPECT_EQ(3, flashfsGetLogCount());
+    flashfsLog_t log;
+    EXPECT_TRUE(flashfsGetLog(0, &log));
+    EXPECT_FALSE(flashfsGetLog(1, &log));
+    ASSERT_TRUE(flashfsGetLog(2, &log));
+    EXPECT_EQ(2200u, log.end);
+    EXPECT_EQ(2200u, flashfsGetOffset());
+}
+
+TEST_F(FlashfsTest, SectorWhichIsNotAnIndexIsLeftAlone)
+{
+    // given an index sector full of something else
+    std::fill(testFlash.begin() + TEST_INDEX_ADDRESS, testFlash.end(), 0x00);
+    remount();
+
+    // when
+    writeLog(1000);
+
+    // then
+    EXPECT_EQ(0, flashfsGetLogCount());
+    EXPECT_TRUE(std::count(testFlash.begin() + TEST_INDEX_ADDRESS, testFlash.end(), 0x00) == TEST_FLASH_SECTOR_SIZE);
+}
+
+// STUBS
+
+extern "C" {
+
+const flashGeometry_t *m25p16_getGeometry(void) { return &testFlashGeometry; }
+bool m25p16_isReady(void) { return !testFlashBusy; }
+void m25p16_eraseCompletely(void) { std::fill(testFlash.begin(), testFlash.end(), 0xFF); }
+void m25p16_eraseSector(uint32_t address)
+{
+    std::fill(testFlash.begin() + address, testFlash.begin() + address + TEST_FLASH_SECTOR_SIZE, 0xFF);
+}
+void m25p16_pageProgramBegin(uint32_t address) { testFlashProgramAddress = address; }
+void m25p16_pageProgramContinue(const uint8_t *data, int length)
+{
+    for (int ii = 0; ii < length; ii++) {
+        testFlash[testFlashProgramAddress++] &= data[ii];
+    }
+}
+void m25p16_pageProgramFinish(void) {}
+void m25p16_pageProgram(uint32_t address, const uint8_t *data, int length)
+{
+    m25p16_pageProgramBegin(address);
+    m25p16_pageProgramContinue(data, length);
+    m25p16_pageProgramFinish();
+}
+int m25p16_readBytes(uint32_t address, uint8_t *buffer, int length)
+{
+    memcpy(buffer, &testFlash[address], length);
+    return length;
+}
+
+}
@@ -0,0 +1,134 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <math.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "build/debug.h"
+
+    #include "common/axis.h"
+    #include "common/filter.h"
+    #include "common/maths.h"
+
+    #include "config/feature.h"
+
+    #include "fc/config.h"
+
+    #include "drivers/accgyro/accgyro.h"
+
+    #include "sensors/gyro.h"
+    #include "sensors/gyroanalyse.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+#define LOOPTIME_US 250
+#define ANALYSE_SAMPLES 8000 // two seconds at 4kHz
+
+static gyroDev_t gyroDev;
+static biquadFilter_t notchFilterDyn[XYZ_AXIS_COUNT][GYRO_DYN_NOTCH_COUNT_MAX];
+
+// feeds the roll axis with a sum of sine waves and the other axes with a single sine wave
+static void analyseSineWaves(const float *freqs, const float *amplitudes, int count)
+{
+    memset(&gyroDev, 0, sizeof(gyroDev));
+    gyroDev.scale = 1.0f;
+    gyro.targetLooptime = LOOPTIME_US;
+    gyroDataAnalyseInit(LOOPTIME_US);
+
+    for (int ii = 0; ii < ANALYSE_SAMPLES; ii++) {
+        const float t = ii * LOOPTIME_US * 1e-6f;
+        float value = 0;
+        for (int jj = 0; jj < count; jj++) {
+            value += amplitudes[jj] * sinf(2 * M_PIf * freqs[jj] * t);
+        }
+        gyroDev.gyroADC[X] = lrintf(value);
+        gyroDev.gyroADC[Y] = lrintf(amplitudes[0] * sinf(2 * M_PIf * freqs[0] * t));
+        gyroDev.gyroADC[Z] = 0;
+        gyroDataAnalyse(&gyroDev, notchFilterDyn);
+    }
+}
+
+TEST(GyroAnalyseUnittest, TestSinglePeak)
+{
+    gyroConfigMutable()->dyn_notch_count = 1;
+    const float freqs[] = { 230.0f };
+    const float amplitudes[] = { 500.0f };
+    analyseSineWaves(freqs, amplitudes, 1);
+
+    EXPECT_EQ(1, gyroFftData(X)->notchCount);
+    // sub-bin interpolation gets well within the 15.6Hz bin width
+    EXPECT_NEAR(230, gyroFftData(X)->centerFreq[0], 5);
+    EXPECT_NEAR(230, gyroFftData(Y)->centerFreq[0], 5);
+}
+
+TEST(GyroAnalyseUnittest, TestMultiplePeaks)
+{
+    gyroConfigMutable()->dyn_notch_count = 2;
+    const float freqs[] = { 170.0f, 380.0f, 270.0f };
+    const float amplitudes[] = { 400.0f, 300.0f, 50.0f };
+    analyseSineWaves(freqs, amplitudes, 3);
+
+    // the two strongest peaks are tracked, the weak one in between is ignored
+    EXPECT_EQ(2, gyroFftData(X)->notchCount);
+    const uint16_t lowFreq = MIN(gyroFftData(X)->centerFreq[0], gyroFftData(X)->centerFreq[1]);
+    const uint16_t highFreq = MAX(gyroFftData(X)->centerFreq[0], gyroFftData(X)->centerFreq[1]);
+    EXPECT_NEAR(170, lowFreq, 5);
+    EXPECT_NEAR(380, highFreq, 5);
+
+    // the notches are moved to the detected frequencies
+    float notchQ = filterGetNotchQApprox(highFreq, constrain(highFreq - 100, 120, 200));
+    biquadFilter_t expected;
+    biquadFilterInit(&expected, highFreq, LOOPTIME_US, notchQ, FILTER_NOTCH);
+    const int highNotch = gyroFftData(X)->centerFreq[0] == highFreq ? 0 : 1;
+    EXPECT_FLOAT_EQ(expected.b0, notchFilterDyn[X][highNotch].b0);
+    EXPECT_FLOAT_EQ(expected.a1, notchFilterDyn[X][highNotch].a1);
+}
+
+TEST(GyroAnalyseUnittest, TestNoPeakKeepsNotches)
+{
+    gyroConfigMutable()->dyn_notch_count = 3;
+    const float freqs[] = { 0.0f };
+    const float amplitudes[] = { 0.0f };
+    analyseSineWaves(freqs, amplitudes, 1);
+
+    // without any signal the notches stay at their initial frequencies, spread over the range
+    EXPECT_EQ(3, gyroFftData(Z)->notchCount);
+    EXPECT_LT(gyroFftData(Z)->centerFreq[0], gyroFftData(Z)->centerFreq[1]);
+    EXPECT_LT(gyroFftData(Z)->centerFreq[1], gyroFftData(Z)->centerFreq[2]);
+    EXPECT_EQ(0, gyroFftData(Z)->maxVal);
+}
+
+// STUBS
+
+extern "C" {
+
+int16_t debug[DEBUG16_VALUE_COUNT];
+uint8_t debugMode;
+gyro_t gyro;
+gyroConfig_t gyroConfig_System;
+
+uint32_t micros(void) { return 0; }
+bool feature(uint32_t mask) { return mask == FEATURE_DYNAMIC_FILTER; }
+}
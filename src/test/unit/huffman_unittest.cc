@@ -0,0 +1,200 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <string.h>
+
+extern "C" {
+    #include "common/huffman.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+static huffmanTable_t table;
+static uint32_t histogram[HUFFMAN_SYMBOL_COUNT];
+
+static void buildTable(const uint8_t *data, int len)
+{
+    memset(histogram, 0, sizeof(histogram));
+    huffmanCountSymbols(histogram, data, len);
+    huffmanBuildTable(&table, histogram);
+}
+
+// Returns the number of bytes written, or -1 if the output buffer was too small
+static int encode(uint8_t *out, int outLen, const uint8_t *data, int len)
+{
+    huffmanState_t state;
+    huffmanInitState(&state, out, outLen);
+    if (!huffmanEncode(&state, &table, data, len) || !huffmanEncodeFinish(&state)) {
+        return -1;
+    }
+    return state.bytesWritten;
+}
+
+// The Kraft sum of a complete code is 1, scaled here by 2^HUFFMAN_MAX_CODE_LENGTH
+static uint32_t kraftSum(void)
+{
+    uint32_t sum = 0;
+    for (int symbol = 0; symbol < HUFFMAN_SYMBOL_COUNT; symbol++) {
+        if (table.codeLength[symbol]) {
+            sum += 1 << (HUFFMAN_MAX_CODE_LENGTH - table.codeLength[symbol]);
+        }
+    }
+    return sum;
+}
+
+TEST(HuffmanTest, CodeLengthsFollowSymbolCounts)
+{
+    // given
+    const uint8_t data[] = { 'd', 'd', 'd', 'd', 'c', 'c', 'a', 'b' };
+
+    // when
+    buildTable(data, sizeof(data));
+
+    // then
+    EXPECT_EQ(1, table.codeLength['d']);
+    EXPECT_EQ(2, table.codeLength['c']);
+    EXPECT_EQ(3, table.codeLength['a']);
+    EXPECT_EQ(3, table.codeLength['b']);
+    EXPECT_EQ(0, table.codeLength['e']);
+
+    // and the codes are canonical
+    EXPECT_EQ(0x0, table.code['d']);
+    EXPECT_EQ(0x2, table.code['c']);
+    EXPECT_EQ(0x6, table.code['a']);
+    EXPECT_EQ(0x7, table.code['b']);
+
+    // and
+    uint8_t coded[4];
+    EXPECT_EQ(2, encode(coded, sizeof(coded), data, sizeof(data)));
+    EXPECT_EQ(0x0A, coded[0]); // 0 0 0 0 10 10
+    EXPECT_EQ(0xDC, coded[1]); // 110 111 and padding
+}
+
+TEST(HuffmanTest, SingleSymbol)
+{
+    // given
+    uint8_t data[20];
+    memset(data, 0x42, sizeof(data));
+
+    // when
+    buildTable(data, sizeof(data));
+
+    // then
+    EXPECT_EQ(1, table.codeLength[0x42]);
+
+    uint8_t coded[4];
+    uint8_t decoded[sizeof(data)];
+    EXPECT_EQ(3, encode(coded, sizeof(coded), data, sizeof(data)));
+    EXPECT_EQ((int)sizeof(data), huffmanDecode(decoded, sizeof(decoded), coded, 3, &table));
+    EXPECT_EQ(0, memcmp(data, decoded, sizeof(data)));
+}
+
+TEST(HuffmanTest, RoundTripWithPackedCodeLengths)
+{
+    // given data like blackbox frames, mostly small deltas with a frame marker now and then
+    uint8_t data[4096];
+    uint32_t seed = 1;
+    for (unsigned i = 0; i < sizeof(data); i++) {
+        seed = seed * 1103515245 + 12345;
+        const uint8_t noise = (seed >> 16) & 0xFF;
+        data[i] = i % 24 == 0 ? 'P' : (noise < 220 ? noise & 0x03 : noise);
+    }
+
+    // when
+    buildTable(data, sizeof(data));
+    uint8_t coded[sizeof(data)];
+    const int codedLen = encode(coded, sizeof(coded), data, sizeof(data));
+
+    // then
+    EXPECT_GT(codedLen, 0);
+    EXPECT_LT(codedLen, (int)sizeof(data) / 2);
+    EXPECT_EQ(1u << HUFFMAN_MAX_CODE_LENGTH, kraftSum());
+
+    // and the decoder only needs the packed code lengths
+    uint8_t codeLengths[HUFFMAN_CODE_LENGTHS_SIZE];
+    huffmanPackCodeLengths(codeLengths, &table);
+    memset(&table, 0, sizeof(table));
+    huffmanUnpackCodeLengths(&table, codeLengths);
+
+    uint8_t decoded[sizeof(data)];
+    EXPECT_EQ((int)sizeof(data), huffmanDecode(decoded, sizeof(decoded), coded, codedLen, &table));
+    EXPECT_EQ(0, memcmp(data, decoded, sizeof(data)));
+}
+
+TEST(HuffmanTest, CodeLengthsAreLimited)
+{
+    // given symbol counts that follow the Fibonacci sequence, which give a code 19 bits long without a limit
+    static uint8_t data[50000];
+    uint32_t previous = 1, count = 1;
+    int len = 0;
+    for (int symbol = 0; symbol < 20; symbol++) {
+        for (uint32_t i = 0; i < count; i++) {
+            data[len++] = symbol;
+        }
+        const uint32_t next = previous + count;
+        previous = count;
+        count = next;
+    }
+    ASSERT_LT(len, (int)sizeof(data));
+
+    // when
+    buildTable(data, len);
+
+    // then
+    for (int symbol = 0; symbol < 20; symbol++) {
+        EXPECT_GE(table.codeLength[symbol], 1);
+        EXPECT_LE(table.codeLength[symbol], HUFFMAN_MAX_CODE_LENGTH);
+    }
+    EXPECT_EQ(1u << HUFFMAN_MAX_CODE_LENGTH, kraftSum());
+
+    // and
+    static uint8_t coded[sizeof(data)];
+    static uint8_t decoded[sizeof(data)];
+    const int codedLen = encode(coded, sizeof(coded), data, len);
+    EXPECT_GT(codedLen, 0);
+    EXPECT_EQ(len, huffmanDecode(decoded, len, coded, codedLen, &table));
+    EXPECT_EQ(0, memcmp(data, decoded, len));
+}
+
+TEST(HuffmanTest, EncodeStopsWhenOutputIsFull)
+{
+    // given data that doesn't compress
+    uint8_t data[256];
+    for (int i = 0; i < 256; i++) {
+        data[i] = i;
+    }
+    buildTable(data, sizeof(data));
+
+    // expect
+    uint8_t coded[256];
+    EXPECT_EQ(256, encode(coded, sizeof(coded), data, sizeof(data)));
+    EXPECT_EQ(-1, encode(coded, sizeof(coded) - 1, data, sizeof(data)));
+}
+
+TEST(HuffmanTest, DecodeRejectsTruncatedInput)
+{
+    // given
+    const uint8_t data[] = { 'd', 'd', 'd', 'd', 'c', 'c', 'a', 'b' };
+    buildTable(data, sizeof(data));
+    uint8_t coded[4];
+    const int codedLen = encode(coded, sizeof(coded), data, sizeof(data));
+
+    // expect
+    uint8_t decoded[sizeof(data)];
+    EXPECT_EQ(-1, huffmanDecode(decoded, sizeof(decoded), coded, codedLen - 1, &table));
+}
@@ -195,6 +195,23 @@ TEST(MathsUnittest, TestApplyDeadband)
     EXPECT_EQ(applyDeadband(-11, 10), -1);
 }
 
+TEST(MathsUnittest, TestCrc8DvbS2)
+{
+    // The CRC-8/DVB-S2 check value
+    const char check[] = "123456789";
+    EXPECT_EQ(0xBC, crc8_dvb_s2_update(0, check, 9));
+
+    uint8_t crc = 0;
+    for (int i = 0; i < 9; i++) {
+        crc = crc8_dvb_s2(crc, check[i]);
+    }
+    EXPECT_EQ(0xBC, crc);
+
+    // and it can be run in parts
+    EXPECT_EQ(0xBC, crc8_dvb_s2_update(crc8_dvb_s2_update(0, check, 4), check + 4, 5));
+    EXPECT_EQ(0, crc8_dvb_s2_update(0, check, 0));
+}
+
 void expectVectorsAreEqual(struct fp_vector *a, struct fp_vector *b)
 {
     EXPECT_FLOAT_EQ(a->X, b->X);
@@ -0,0 +1,343 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "drivers/bus_spi.h"
+    #include "drivers/io.h"
+    #include "drivers/max7456.h"
+    #include "drivers/vcd.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+#define CHARS_PER_LINE 30
+
+// A model of the MAX7456 display memory, driven by the SPI bytes the driver sends
+
+#define MAX7456ADD_READ 0x80
+#define MAX7456ADD_VM0  0x00
+#define MAX7456ADD_DMM  0x04
+#define MAX7456ADD_DMAH 0x05
+#define MAX7456ADD_DMAL 0x06
+#define MAX7456ADD_DMDI 0x07
+#define MAX7456ADD_STAT 0xA0
+
+static uint8_t registers[0x80];
+static uint8_t displayMemory[VIDEO_BUFFER_CHARS_PAL];
+static uint16_t displayAddress;
+static bool autoIncrement;
+static bool csLow;
+static int addressByte = -1;
+static int spiBytes;
+
+static uint8_t max7456Model(uint8_t in)
+{
+    if (addressByte < 0) {
+        addressByte = in;
+        return 0;
+    }
+
+    const uint8_t reg = addressByte;
+    addressByte = -1;
+
+    if (reg == MAX7456ADD_STAT) {
+        return 0;
+    }
+    if (reg & MAX7456ADD_READ) {
+        return registers[reg & ~MAX7456ADD_READ];
+    }
+
+    registers[reg] = in;
+    switch (reg) {
+    case MAX7456ADD_DMAH:
+        displayAddress = (displayAddress & 0xff) | ((in & 0x01) << 8);
+        break;
+    case MAX7456ADD_DMAL:
+        displayAddress = (displayAddress & 0x100) | in;
+        break;
+    case MAX7456ADD_DMM:
+        autoIncrement = in & 0x01;
+        if (in & 0x04) {
+            memset(displayMemory, 0, sizeof(displayMemory));
+        }
+        break;
+    case MAX7456ADD_DMDI:
+        if (autoIncrement && in == 0xff) {
+            autoIncrement = false;
+        } else {
+            EXPECT_LT(displayAddress, VIDEO_BUFFER_CHARS_PAL);
+            displayMemory[displayAddress % VIDEO_BUFFER_CHARS_PAL] = in;
+            if (autoIncrement) {
+                displayAddress++;
+            }
+        }
+        break;
+    }
+    return 0;
+}
+
+// Returns the number of SPI bytes sent to update the display, not counting the 2 bytes of the stall check
+static int drawScreen(void)
+{
+    spiBytes = 0;
+    max7456DrawScreen();
+    return spiBytes - 2;
+}
+
+static bool displayMatchesScreen(void)
+{
+    return memcmp(displayMemory, max7456GetScreenBuffer(), maxScreenSize) == 0;
+}
+
+class Max7456Test : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        const vcdProfile_t vcdProfile = { VIDEO_SYSTEM_PAL, 0, 0 };
+        max7456Init(&vcdProfile);
+        drawScreen();
+        max7456ClearScreen();
+        while (drawScreen() > 0) {
+        }
+    }
+};
+
+TEST_F(Max7456Test, ClearedScreenIsOnDisplay)
+{
+    // expect
+    EXPECT_EQ(VIDEO_BUFFER_CHARS_PAL, maxScreenSize);
+    EXPECT_TRUE(displayMatchesScreen());
+    EXPECT_EQ(0, drawScreen());
+}
+
+TEST_F(Max7456Test, ShortRunsAreWrittenACharAtATime)
+{
+    // given
+    max7456Write(3, 2, "A");
+    max7456Write(10, 2, "BC");
+
+    // when
+    const int bytes = drawScreen();
+
+    // then
+    EXPECT_EQ(3 * 6, bytes);
+    EXPECT_TRUE(displayMatchesScreen());
+}
+
+TEST_F(Max7456Test, LongRunsAreWrittenInAutoIncrementMode)
+{
+    // given
+    max7456Write(3, 2, "CRAFTNAME");
+
+    // when
+    const int bytes = drawScreen();
+
+    // then
+    EXPECT_EQ(10 + 9 * 2, bytes);
+    EXPECT_TRUE(displayMatchesScreen());
+
+    // and only the changed chars are written
+    max7456Write(3, 2, "CRAFTBANE");
+    EXPECT_EQ(2 * 6, drawScreen());
+    EXPECT_TRUE(displayMatchesScreen());
+}
+
+TEST_F(Max7456Test, EndStringCharBreaksRun)
+{
+    // given a char that ends auto-increment mode
+    const char text[] = { 'A', 'B', 'C', (char)0xff, 'D', 'E', 'F', 0 };
+    max7456Write(0, 5, text);
+
+    // when
+    const int bytes = drawScreen();
+
+    // then
+    EXPECT_EQ((10 + 3 * 2) * 2 + 6, bytes);
+    EXPECT_TRUE(displayMatchesScreen());
+}
+
+TEST_F(Max7456Test, RunsContinueOnTheNextLine)
+{
+    // given
+    max7456Write(CHARS_PER_LINE - 2, 3, "AB");
+    max7456Write(0, 4, "CD");
+
+    // when
+    const int bytes = drawScreen();
+
+    // then
+    EXPECT_EQ(10 + 4 * 2, bytes);
+    EXPECT_TRUE(displayMatchesScreen());
+}
+
+static int osdLayout(int voltage, int seconds)
+{
+    char buff[CHARS_PER_LINE + 1];
+
+    max7456Write(12, 1, "CRAFTNAME");
+    snprintf(buff, sizeof(buff), "\x97%d.%dV", voltage / 10, voltage % 10);
+    max7456Write(1, 1, buff);
+    max7456Write(24, 1, "\x01" "99");
+    max7456Write(13, 7, "\x72\x73\x74");
+    max7456Write(1, 13, "ACRO");
+    snprintf(buff, sizeof(buff), "\x9c%02d:%02d", seconds / 60, seconds % 60);
+    max7456Write(22, 13, buff);
+    max7456Write(1, 14, "\x9a" "0.00");
+    max7456Write(22, 14, "\x07" "0");
+
+    // the number of chars that changed
+    int changed = 0;
+    for (int i = 0; i < maxScreenSize; i++) {
+        changed += max7456GetScreenBuffer()[i] != displayMemory[i];
+    }
+    return changed;
+}
+
+TEST_F(Max7456Test, TypicalOsdLayout)
+{
+    // given
+    const int changed = osdLayout(168, 0);
+
+    // when
+    const int bytes = drawScreen();
+
+    // then
+    EXPECT_TRUE(displayMatchesScreen());
+    EXPECT_EQ(38, changed);
+    EXPECT_EQ(154, bytes); // 228 bytes when written a char at a time
+
+    // and when a second goes by
+    const int changedNextSecond = osdLayout(167, 1);
+    const int bytesNextSecond = drawScreen();
+    EXPECT_TRUE(displayMatchesScreen());
+    EXPECT_EQ(2, changedNextSecond);
+    EXPECT_EQ(changedNextSecond * 6, bytesNextSecond);
+}
+
+TEST_F(Max7456Test, StatsPageIsDrawnInOneCall)
+{
+    // given
+    const char *stats[] = {
+        "  --- STATS ---",
+        "FLY TIME            :  04:12",
+        "MIN BATTERY         :  14.8V",
+        "MIN RSSI            :  73%",
+        "MAX CURRENT         :  58A",
+        "USED MAH            :  1146",
+        "MAX ALTITUDE        :  43.1M",
+        "BLACKBOX            :  37%",
+        "BLACKBOX LOG        :  12",
+    };
+    for (unsigned i = 0; i < ARRAYLEN(stats); i++) {
+        max7456Write(2, 2 + i, stats[i]);
+    }
+
+    // expect
+    drawScreen();
+    EXPECT_TRUE(displayMatchesScreen());
+}
+
+TEST_F(Max7456Test, FullScreenTakesTwoCalls)
+{
+    // given
+    char line[CHARS_PER_LINE + 1];
+    memset(line, 'X', CHARS_PER_LINE);
+    line[CHARS_PER_LINE] = 0;
+    for (int y = 0; y < VIDEO_LINES_PAL; y++) {
+        max7456Write(0, y, line);
+    }
+
+    // when
+    const int bytes = drawScreen() + drawScreen();
+
+    // then
+    EXPECT_TRUE(displayMatchesScreen());
+    EXPECT_LT(bytes, VIDEO_BUFFER_CHARS_PAL * 6 / 2);
+    EXPECT_EQ(0, drawScreen());
+}
+
+// STUBS
+
+extern "C" {
+
+uint8_t spiTransferByte(SPI_TypeDef *instance, uint8_t in)
+{
+    UNUSED(instance);
+    EXPECT_TRUE(csLow);
+    spiBytes++;
+    return max7456Model(in);
+}
+
+void spiSetDivisor(SPI_TypeDef *instance, uint16_t divisor)
+{
+    UNUSED(instance);
+    UNUSED(divisor);
+}
+
+IO_t IOGetByTag(ioTag_t tag)
+{
+    UNUSED(tag);
+    return NULL;
+}
+
+void IOInit(IO_t io, resourceOwner_e owner, uint8_t index)
+{
+    UNUSED(io);
+    UNUSED(owner);
+    UNUSED(index);
+}
+
+void IOConfigGPIO(IO_t io, ioConfig_t cfg)
+{
+    UNUSED(io);
+    UNUSED(cfg);
+}
+
+void IOLo(IO_t io)
+{
+    UNUSED(io);
+    csLow = true;
+    addressByte = -1;
+}
+
+void IOHi(IO_t io)
+{
+    UNUSED(io);
+    csLow = false;
+}
+
+void IOToggle(IO_t io)
+{
+    UNUSED(io);
+}
+
+uint32_t millis(void)
+{
+    return 0;
+}
+
+void delay(uint32_t ms)
+{
+    UNUSED(ms);
+}
+
+}
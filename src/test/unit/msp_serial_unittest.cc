@@ -0,0 +1,500 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "common/maths.h"
+    #include "common/streambuf.h"
+    #include "common/utils.h"
+
+    #include "drivers/serial.h"
+
+    #include "io/serial.h"
+
+    #include "msp/msp.h"
+    #include "msp/msp_protocol.h"
+    #include "msp/msp_serial.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+#define TEST_CMD_V1 101
+#define TEST_CMD_V2 0x1001
+
+// The bytes sent to the port by the client, and the bytes the port sent back
+static serialPort_t testPort;
+static uint8_t rxData[2 * MSP_PORT_INBUF_SIZE + 64];
+static int rxLen;
+static int rxPos;
+static int readLimit; // the most bytes serialReadBuf() returns at once, zero for no limit
+static uint8_t txData[2 * MSP_PORT_INBUF_SIZE];
+static int txLen;
+
+// The commands that were processed
+static int commandCount;
+static uint16_t lastCmd;
+static int lastSize;
+static uint8_t lastPayload[MSP_PORT_INBUF_SIZE];
+
+static uint8_t nonMspData[16]; // the bytes given to serialEvaluateNonMspData()
+static int nonMspDataLen;
+
+static mspResult_e testProcessCommand(mspPacket_t *cmd, mspPacket_t *reply, mspPostProcessFnPtr *mspPostProcessFn)
+{
+    UNUSED(mspPostProcessFn);
+
+    commandCount++;
+    lastCmd = cmd->cmd;
+    lastSize = sbufBytesRemaining(&cmd->buf);
+    memcpy(lastPayload, sbufPtr(&cmd->buf), lastSize);
+
+    reply->cmd = cmd->cmd;
+    sbufWriteU8(&reply->buf, 0x42);
+    return MSP_RESULT_ACK;
+}
+
+static void testProcessReply(mspPacket_t *cmd)
+{
+    UNUSED(cmd);
+}
+
+static void feed(const uint8_t *data, int len)
+{
+    ASSERT_LE(rxLen + len, (int)sizeof(rxData));
+    memcpy(&rxData[rxLen], data, len);
+    rxLen += len;
+}
+
+static void process(void)
+{
+    mspSerialProcess(MSP_SKIP_NON_MSP_DATA, testProcessCommand, testProcessReply);
+}
+
+// Returns the length of the frame
+static int v2Frame(uint8_t *frame, uint16_t cmd, const uint8_t *payload, uint16_t size)
+{
+    frame[0] = '$';
+    frame[1] = 'X';
+    frame[2] = '<';
+    frame[3] = 0; // flags
+    frame[4] = cmd & 0xff;
+    frame[5] = cmd >> 8;
+    frame[6] = size & 0xff;
+    frame[7] = size >> 8;
+    memcpy(&frame[8], payload, size);
+    frame[8 + size] = crc8_dvb_s2_update(0, &frame[3], 5 + size);
+    return 9 + size;
+}
+
+static int v1Frame(uint8_t *frame, uint8_t cmd, const uint8_t *payload, uint8_t size)
+{
+    frame[0] = '$';
+    frame[1] = 'M';
+    frame[2] = '<';
+    frame[3] = size;
+    frame[4] = cmd;
+    memcpy(&frame[5], payload, size);
+    uint8_t checksum = 0;
+    for (int i = 3; i < 5 + size; i++) {
+        checksum ^= frame[i];
+    }
+    frame[5 + size] = checksum;
+    return 6 + size;
+}
+
+class MspSerialTest : public ::testing::Test {
+protected:
+    uint8_t payload[MSP_PORT_INBUF_SIZE];
+    uint8_t frame[MSP_PORT_INBUF_SIZE + 16];
+
+    virtual void SetUp() {
+        rxLen = rxPos = readLimit = txLen = 0;
+        nonMspDataLen = 0;
+        commandCount = 0;
+        lastCmd = 0;
+        lastSize = -1;
+        for (unsigned i = 0; i < sizeof(payload); i++) {
+            payload[i] = i * 7 + 1;
+        }
+        mspSerialInit();
+    }
+};
+
+TEST_F(MspSerialTest, V2CommandIsProcessed)
+{
+    // given a payload that doesn't fit in a v1 frame
+    const int frameLen = v2Frame(frame, TEST_CMD_V2, payload, 300);
+    feed(frame, frameLen);
+
+    // when
+    process();
+
+    // then
+    EXPECT_EQ(1, commandCount);
+    EXPECT_EQ(TEST_CMD_V2, lastCmd);
+    EXPECT_EQ(300, lastSize);
+    EXPECT_EQ(0, memcmp(payload, lastPayload, 300));
+
+    // and the reply is a v2 frame
+    uint8_t expected[16];
+    const uint8_t replyPayload[] = { 0x42 };
+    const int expectedLen = v2Frame(expected, TEST_CMD_V2, replyPayload, 1);
+    expected[2] = '>';
+    expected[expectedLen - 1] = crc8_dvb_s2_update(0, &expected[3], expectedLen - 4);
+    EXPECT_EQ(expectedLen, txLen);
+    EXPECT_EQ(0, memcmp(expected, txData, expectedLen));
+}
+
+TEST_F(MspSerialTest, V2FrameSplitAcrossReads)
+{
+    const int frameLen = v2Frame(frame, TEST_CMD_V2, payload, 40);
+
+    for (int split = 1; split < frameLen; split++) {
+        // given the frame arriving in pieces of split bytes
+        SetUp();
+        for (int pos = 0; pos < frameLen; pos += split) {
+            EXPECT_EQ(0, commandCount);
+            feed(&frame[pos], MIN(split, frameLen - pos));
+            process();
+        }
+
+        // then
+        EXPECT_EQ(1, commandCount) << "split " << split;
+        EXPECT_EQ(TEST_CMD_V2, lastCmd);
+        EXPECT_EQ(40, lastSize);
+        EXPECT_EQ(0, memcmp(payload, lastPayload, 40));
+    }
+}
+
+TEST_F(MspSerialTest, V2FrameReadInShortSpans)
+{
+    // given a port that returns no more than a few bytes from each read
+    const int frameLen = v2Frame(frame, TEST_CMD_V2, payload, 100);
+    feed(frame, frameLen);
+    readLimit = 3;
+
+    // when
+    process();
+
+    // then
+    EXPECT_EQ(1, commandCount);
+    EXPECT_EQ(100, lastSize);
+    EXPECT_EQ(0, memcmp(payload, lastPayload, 100));
+}
+
+TEST_F(MspSerialTest, V2FrameWithBadCrcIsDropped)
+{
+    // given
+    int frameLen = v2Frame(frame, TEST_CMD_V2, payload, 20);
+    frame[frameLen - 1] ^= 0x01;
+    feed(frame, frameLen);
+
+    // when
+    process();
+
+    // then
+    EXPECT_EQ(0, commandCount);
+    EXPECT_EQ(0, txLen);
+
+    // and the next frame is received
+    frameLen = v2Frame(frame, TEST_CMD_V2 + 1, payload, 20);
+    feed(frame, frameLen);
+    process();
+    EXPECT_EQ(1, commandCount);
+    EXPECT_EQ(TEST_CMD_V2 + 1, lastCmd);
+}
+
+TEST_F(MspSerialTest, V2FrameLargerThanInBufIsDropped)
+{
+    // given a header with a size that doesn't fit in inBuf, followed by part of its payload
+    frame[0] = '$';
+    frame[1] = 'X';
+    frame[2] = '<';
+    frame[3] = 0;
+    frame[4] = TEST_CMD_V2 & 0xff;
+    frame[5] = TEST_CMD_V2 >> 8;
+    frame[6] = (MSP_PORT_INBUF_SIZE + 1) & 0xff;
+    frame[7] = (MSP_PORT_INBUF_SIZE + 1) >> 8;
+    feed(frame, 8);
+    feed(payload, 64);
+
+    // when
+    process();
+
+    // then
+    EXPECT_EQ(0, commandCount);
+
+    // and the next frame is received
+    const int frameLen = v2Frame(frame, TEST_CMD_V2 + 2, payload, 10);
+    feed(frame, frameLen);
+    process();
+    EXPECT_EQ(1, commandCount);
+    EXPECT_EQ(TEST_CMD_V2 + 2, lastCmd);
+}
+
+TEST_F(MspSerialTest, V2FrameFillingInBufIsProcessed)
+{
+    // given
+    const int frameLen = v2Frame(frame, TEST_CMD_V2, payload, MSP_PORT_INBUF_SIZE);
+    feed(frame, frameLen);
+
+    // when
+    process();
+
+    // then
+    EXPECT_EQ(1, commandCount);
+    EXPECT_EQ(MSP_PORT_INBUF_SIZE, lastSize);
+    EXPECT_EQ(0, memcmp(payload, lastPayload, MSP_PORT_INBUF_SIZE));
+}
+
+TEST_F(MspSerialTest, V1AndV2FramesAreProcessedInTurn)
+{
+    // given both versions in one read, with some noise in between
+    int frameLen = v1Frame(frame, TEST_CMD_V1, payload, 5);
+    feed(frame, frameLen);
+    const uint8_t noise[] = { 'X', '<', 0, '$', 'Q' };
+    feed(noise, sizeof(noise));
+    frameLen = v2Frame(frame, TEST_CMD_V2, payload, 7);
+    feed(frame, frameLen);
+
+    // when
+    process();
+
+    // then one command is processed at a time
+    EXPECT_EQ(1, commandCount);
+    EXPECT_EQ(TEST_CMD_V1, lastCmd);
+    EXPECT_EQ(5, lastSize);
+
+    // and
+    process();
+    EXPECT_EQ(2, commandCount);
+    EXPECT_EQ(TEST_CMD_V2, lastCmd);
+    EXPECT_EQ(7, lastSize);
+}
+
+TEST_F(MspSerialTest, V1FrameSplitAcrossReads)
+{
+    const int frameLen = v1Frame(frame, TEST_CMD_V1, payload, 20);
+
+    for (int split = 1; split < frameLen; split++) {
+        // given the frame arriving in pieces of split bytes
+        SetUp();
+        for (int pos = 0; pos < frameLen; pos += split) {
+            EXPECT_EQ(0, commandCount);
+            feed(&frame[pos], MIN(split, frameLen - pos));
+            process();
+        }
+
+        // then
+        EXPECT_EQ(1, commandCount) << "split " << split;
+        EXPECT_EQ(TEST_CMD_V1, lastCmd);
+        EXPECT_EQ(20, lastSize);
+        EXPECT_EQ(0, memcmp(payload, lastPayload, 20));
+    }
+}
+
+TEST_F(MspSerialTest, FramesBackToBackInOneRead)
+{
+    // given two frames of each version with nothing in between, the shortest possible first
+    int frameLen = v1Frame(frame, TEST_CMD_V1, payload, 0);
+    feed(frame, frameLen);
+    frameLen = v1Frame(frame, TEST_CMD_V1 + 1, payload, 3);
+    feed(frame, frameLen);
+    frameLen = v2Frame(frame, TEST_CMD_V2, payload, 0);
+    feed(frame, frameLen);
+    frameLen = v2Frame(frame, TEST_CMD_V2 + 1, payload, 3);
+    feed(frame, frameLen);
+
+    // expect each call to process the next one, intact
+    const uint16_t cmds[] = { TEST_CMD_V1, TEST_CMD_V1 + 1, TEST_CMD_V2, TEST_CMD_V2 + 1 };
+    const int sizes[] = { 0, 3, 0, 3 };
+    for (int ii = 0; ii < 4; ii++) {
+        process();
+        EXPECT_EQ(ii + 1, commandCount);
+        EXPECT_EQ(cmds[ii], lastCmd);
+        EXPECT_EQ(sizes[ii], lastSize);
+        EXPECT_EQ(0, memcmp(payload, lastPayload, sizes[ii]));
+    }
+    EXPECT_EQ(rxLen, rxPos);
+
+    // and a reply is sent for each of them
+    process();
+    EXPECT_EQ(4, commandCount);
+    EXPECT_EQ(2 * (6 + 1) + 2 * (9 + 1), txLen);
+}
+
+TEST_F(MspSerialTest, NonMspDataAfterFrameIsNotConsumed)
+{
+    // given a frame followed by the start of a CLI session
+    const int frameLen = v1Frame(frame, TEST_CMD_V1, payload, 4);
+    feed(frame, frameLen);
+    const uint8_t cli[] = { '#', '\r', '\n' };
+    feed(cli, sizeof(cli));
+
+    // when
+    mspSerialProcess(MSP_EVALUATE_NON_MSP_DATA, testProcessCommand, testProcessReply);
+
+    // then the frame is processed, and the bytes after it are left on the port
+    EXPECT_EQ(1, commandCount);
+    EXPECT_EQ(frameLen, rxPos);
+    EXPECT_EQ(0, nonMspDataLen);
+
+    // when
+    mspSerialProcess(MSP_EVALUATE_NON_MSP_DATA, testProcessCommand, testProcessReply);
+
+    // then they are handed over as non MSP data
+    EXPECT_EQ(1, commandCount);
+    ASSERT_EQ((int)sizeof(cli), nonMspDataLen);
+    EXPECT_EQ(0, memcmp(cli, nonMspData, sizeof(cli)));
+}
+
+static bool testProcessOutCommand(uint16_t cmdMSP, sbuf_t *dst)
+{
+    sbufWriteU16(dst, cmdMSP);
+    return true;
+}
+
+TEST_F(MspSerialTest, StreamIsDueWithoutInput)
+{
+    // expect
+    EXPECT_FALSE(mspSerialStreamDue(0));
+
+    // given a stream of one reply every 100ms
+    uint8_t setStream[4];
+    setStream[0] = 100;
+    setStream[1] = 0;
+    setStream[2] = TEST_CMD_V1;
+    setStream[3] = 0;
+    const int frameLen = v1Frame(frame, MSP_SET_STREAM, setStream, sizeof(setStream));
+    feed(frame, frameLen);
+    process();
+    EXPECT_EQ(0, commandCount);
+
+    // then it is due straight away, with no more input
+    EXPECT_TRUE(mspSerialStreamDue(0));
+    txLen = 0;
+    mspSerialProcessStreams(0, testProcessOutCommand);
+    EXPECT_GT(txLen, 0);
+
+    // and again after the interval
+    EXPECT_FALSE(mspSerialStreamDue(50000));
+    EXPECT_TRUE(mspSerialStreamDue(100000));
+}
+
+// STUBS
+
+extern "C" {
+
+const uint32_t baudRates[] = { 0, 115200 };
+
+static serialPortConfig_t testPortConfig = { FUNCTION_MSP, SERIAL_PORT_USART1, 1, 0, 0, 0 };
+
+serialPortConfig_t *findSerialPortConfig(serialPortFunction_e function)
+{
+    UNUSED(function);
+    return &testPortConfig;
+}
+
+serialPortConfig_t *findNextSerialPortConfig(serialPortFunction_e function)
+{
+    UNUSED(function);
+    return NULL;
+}
+
+serialPort_t *openSerialPort(serialPortIdentifier_e identifier, serialPortFunction_e function, serialReceiveCallbackPtr rxCallback,
+    uint32_t baudrate, portMode_t mode, portOptions_t options)
+{
+    UNUSED(function);
+    UNUSED(rxCallback);
+    UNUSED(baudrate);
+    UNUSED(mode);
+    UNUSED(options);
+    testPort.identifier = identifier;
+    return &testPort;
+}
+
+void closeSerialPort(serialPort_t *serialPort)
+{
+    UNUSED(serialPort);
+}
+
+void waitForSerialPortToFinishTransmitting(serialPort_t *serialPort)
+{
+    UNUSED(serialPort);
+}
+
+void serialEvaluateNonMspData(serialPort_t *serialPort, uint8_t receivedChar)
+{
+    UNUSED(serialPort);
+    if (nonMspDataLen < (int)sizeof(nonMspData)) {
+        nonMspData[nonMspDataLen++] = receivedChar;
+    }
+}
+
+uint32_t serialRxBytesWaiting(const serialPort_t *instance)
+{
+    UNUSED(instance);
+    return rxLen - rxPos;
+}
+
+int serialReadBuf(serialPort_t *instance, uint8_t *data, int count)
+{
+    UNUSED(instance);
+    if (readLimit && count > readLimit) {
+        count = readLimit;
+    }
+    count = MIN(count, rxLen - rxPos);
+    memcpy(data, &rxData[rxPos], count);
+    rxPos += count;
+    return count;
+}
+
+uint32_t serialTxBytesFree(const serialPort_t *instance)
+{
+    UNUSED(instance);
+    return sizeof(txData) - txLen;
+}
+
+void serialWriteBuf(serialPort_t *instance, const uint8_t *data, int count)
+{
+    UNUSED(instance);
+    EXPECT_LE(txLen + count, (int)sizeof(txData));
+    memcpy(&txData[txLen], data, count);
+    txLen += count;
+}
+
+void serialBeginWrite(serialPort_t *instance)
+{
+    UNUSED(instance);
+}
+
+void serialEndWrite(serialPort_t *instance)
+{
+    UNUSED(instance);
+}
+
+uint32_t micros(void)
+{
+    return 0;
+}
+
+}
@@ -0,0 +1,486 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "blackbox/blackbox.h"
+
+    #include "build/debug.h"
+
+    #include "common/time.h"
+
+    #include "config/parameter_group.h"
+    #include "config/parameter_group_ids.h"
+
+    #include "drivers/display.h"
+    #include "drivers/max7456_symbols.h"
+    #include "drivers/serial.h"
+
+    #include "fc/config.h"
+    #include "fc/rc_controls.h"
+    #include "fc/runtime_config.h"
+
+    #include "flight/imu.h"
+    #include "flight/pid.h"
+
+    #include "io/gps.h"
+    #include "io/osd.h"
+
+    #include "rx/rx.h"
+
+    #include "sensors/battery.h"
+    #include "sensors/sensors.h"
+
+    void osdDrawElements(void);
+    void pgResetFn_osdConfig(osdConfig_t *osdProfile);
+
+    PG_REGISTER(batteryConfig_t, batteryConfig, PG_BATTERY_CONFIG, 0);
+    PG_REGISTER(blackboxConfig_t, blackboxConfig, PG_BLACKBOX_CONFIG, 0);
+    PG_REGISTER(systemConfig_t, systemConfig, PG_SYSTEM_CONFIG, 0);
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+// A PAL screen which remembers what's on it, and how often each cell has been written since the last reset
+
+#define TEST_SCREEN_ROWS 16
+#define TEST_SCREEN_COLS 30
+#define TEST_SCREEN_PAL (TEST_SCREEN_ROWS * TEST_SCREEN_COLS)
+#define TEST_SCREEN_NTSC (13 * TEST_SCREEN_COLS)
+
+typedef struct testScreen_s {
+    uint8_t cells[TEST_SCREEN_ROWS][TEST_SCREEN_COLS];
+} testScreen_t;
+
+static displayPort_t testDisplayPort;
+static testScreen_t testScreen;
+static int testScreenSize = TEST_SCREEN_PAL;
+static int testCellWrites[TEST_SCREEN_ROWS][TEST_SCREEN_COLS];
+static int testScreenClears;
+
+static pidProfile_t testPidProfile;
+
+static timeUs_t simulationTime;
+static int16_t simulationBatteryVoltage;
+static uint32_t simulationSensors;
+
+static void testWriteCell(uint8_t x, uint8_t y, uint8_t c)
+{
+    if (y < TEST_SCREEN_ROWS && x < TEST_SCREEN_COLS) {
+        testScreen.cells[y][x] = c;
+        testCellWrites[y][x]++;
+    }
+}
+
+static int displayPortTestGrab(displayPort_t *displayPort)
+{
+    UNUSED(displayPort);
+    return 0;
+}
+
+static int displayPortTestRelease(displayPort_t *displayPort)
+{
+    UNUSED(displayPort);
+    return 0;
+}
+
+static int displayPortTestClearScreen(displayPort_t *displayPort)
+{
+    UNUSED(displayPort);
+    memset(&testScreen, ' ', sizeof(testScreen));
+    testScreenClears++;
+    return 0;
+}
+
+static int displayPortTestDrawScreen(displayPort_t *displayPort)
+{
+    UNUSED(displayPort);
+    return 0;
+}
+
+static int displayPortTestScreenSize(const displayPort_t *displayPort)
+{
+    UNUSED(displayPort);
+    return testScreenSize;
+}
+
+static int displayPortTestWrite(displayPort_t *displayPort, uint8_t x, uint8_t y, const char *s)
+{
+    UNUSED(displayPort);
+    for (; *s; s++) {
+        testWriteCell(x++, y, *s);
+    }
+    return 0;
+}
+
+static int displayPortTestWriteChar(displayPort_t *displayPort, uint8_t x, uint8_t y, uint8_t c)
+{
+    UNUSED(displayPort);
+    testWriteCell(x, y, c);
+    return 0;
+}
+
+static bool displayPortTestIsTransferInProgress(const displayPort_t *displayPort)
+{
+    UNUSED(displayPort);
+    return false;
+}
+
+static int displayPortTestHeartbeat(displayPort_t *displayPort)
+{
+    UNUSED(displayPort);
+    return 0;
+}
+
+static void displayPortTestResync(displayPort_t *displayPort)
+{
+    UNUSED(displayPort);
+}
+
+static uint32_t displayPortTestTxBytesFree(const displayPort_t *displayPort)
+{
+    UNUSED(displayPort);
+    return 0;
+}
+
+static const displayPortVTable_t testDisplayPortVTable = {
+    .grab = displayPortTestGrab,
+    .release = displayPortTestRelease,
+    .clearScreen = displayPortTestClearScreen,
+    .drawScreen = displayPortTestDrawScreen,
+    .screenSize = displayPortTestScreenSize,
+    .write = displayPortTestWrite,
+    .writeChar = displayPortTestWriteChar,
+    .isTransferInProgress = displayPortTestIsTransferInProgress,
+    .heartbeat = displayPortTestHeartbeat,
+    .resync = displayPortTestResync,
+    .txBytesFree = displayPortTestTxBytesFree
+};
+
+static void resetCellWrites(void)
+{
+    memset(testCellWrites, 0, sizeof(testCellWrites));
+    testScreenClears = 0;
+}
+
+static int totalCellWrites(void)
+{
+    int total = 0;
+    for (int y = 0; y < TEST_SCREEN_ROWS; y++) {
+        for (int x = 0; x < TEST_SCREEN_COLS; x++) {
+            total += testCellWrites[y][x];
+        }
+    }
+    return total;
+}
+
+// Starts the OSD over and draws the elements onto a cleared screen
+static testScreen_t coldDraw(void)
+{
+    osdInit(&testDisplayPort);
+    osdDrawElements();
+    return testScreen;
+}
+
+// Runs the OSD task until it has refreshed once
+static void osdUpdateOnce(timeUs_t currentTimeUs)
+{
+    simulationTime = currentTimeUs;
+    // a refresh is every tenth call, the others only draw the screen
+    for (int i = 0; i < 10; i++) {
+        osdUpdate(currentTimeUs);
+    }
+}
+
+static bool screensMatch(const testScreen_t &a, const testScreen_t &b)
+{
+    return memcmp(&a, &b, sizeof(testScreen_t)) == 0;
+}
+
+class OsdTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        displayInit(&testDisplayPort, &testDisplayPortVTable);
+        testScreenSize = TEST_SCREEN_PAL;
+
+        pgResetFn_osdConfig(osdConfigMutable());
+        batteryConfigMutable()->vbatmincellvoltage = 33;
+        batteryConfigMutable()->vbatmaxcellvoltage = 43;
+        strcpy(systemConfigMutable()->name, "TEST");
+
+        currentPidProfile = &testPidProfile;
+
+        simulationTime = 0;
+        simulationBatteryVoltage = 168;
+        simulationSensors = SENSOR_ACC;
+        rssi = 1024;
+        rcData[THROTTLE] = 1500;
+        attitude.values.roll = 0;
+        attitude.values.pitch = 0;
+
+        coldDraw();
+        resetCellWrites();
+    }
+};
+
+TEST_F(OsdTest, OnlyChangedElementIsRewritten)
+{
+    // given
+    const testScreen_t before = testScreen;
+
+    // when the throttle goes from 50% to 60%
+    rcData[THROTTLE] = 1600;
+    osdDrawElements();
+
+    // then only the throttle element's cells are written
+    EXPECT_EQ(0, testScreenClears);
+    EXPECT_EQ(4, totalCellWrites());
+    EXPECT_EQ(SYM_THR, testScreen.cells[7][1]);
+    EXPECT_EQ(SYM_THR1, testScreen.cells[7][2]);
+    EXPECT_EQ('6', testScreen.cells[7][3]);
+    EXPECT_EQ('0', testScreen.cells[7][4]);
+
+    // and the rest of the screen is left as it was
+    testScreen_t after = testScreen;
+    memcpy(&after.cells[7][1], &before.cells[7][1], 4);
+    EXPECT_TRUE(screensMatch(before, after));
+    EXPECT_TRUE(screensMatch(testScreen, coldDraw()));
+}
+
+TEST_F(OsdTest, UnchangedElementsAreNotRewritten)
+{
+    // when
+    osdDrawElements();
+
+    // then
+    EXPECT_EQ(0, testScreenClears);
+    EXPECT_EQ(0, totalCellWrites());
+}
+
+TEST_F(OsdTest, ShrinkingElementClearsStaleCells)
+{
+    // given the throttle at 100%
+    rcData[THROTTLE] = 2000;
+    osdDrawElements();
+    EXPECT_EQ('0', testScreen.cells[7][5]);
+    resetCellWrites();
+
+    // when it drops to 50%
+    rcData[THROTTLE] = 1500;
+    osdDrawElements();
+
+    // then the cell the shorter text no longer covers is blanked
+    EXPECT_EQ('5', testScreen.cells[7][3]);
+    EXPECT_EQ('0', testScreen.cells[7][4]);
+    EXPECT_EQ(' ', testScreen.cells[7][5]);
+    EXPECT_EQ(5, totalCellWrites());
+    EXPECT_TRUE(screensMatch(testScreen, coldDraw()));
+}
+
+TEST_F(OsdTest, HiddenElementIsErased)
+{
+    // when the craft name is turned off
+    osdConfigMutable()->item_pos[OSD_CRAFT_NAME] &= ~VISIBLE_FLAG;
+    osdDrawElements();
+
+    // then the cells it covered are blanked, and nothing else is written
+    for (int x = 10; x < 14; x++) {
+        EXPECT_EQ(' ', testScreen.cells[11][x]);
+        EXPECT_EQ(1, testCellWrites[11][x]);
+    }
+    EXPECT_EQ(4, totalCellWrites());
+    EXPECT_TRUE(screensMatch(testScreen, coldDraw()));
+}
+
+TEST_F(OsdTest, MovedElementIsErasedFromItsOldPosition)
+{
+    // when the craft name is moved up the screen
+    osdConfigMutable()->item_pos[OSD_CRAFT_NAME] = (5 << 5 | 10) | VISIBLE_FLAG; // x 10, y 5
+    osdDrawElements();
+
+    // then
+    for (int x = 10; x < 14; x++) {
+        EXPECT_EQ(' ', testScreen.cells[11][x]);
+    }
+    EXPECT_EQ('T', testScreen.cells[5][10]);
+    EXPECT_EQ(8, totalCellWrites());
+    EXPECT_TRUE(screensMatch(testScreen, coldDraw()));
+}
+
+TEST_F(OsdTest, ArtificialHorizonErasesPreviousBars)
+{
+    // given a level horizon across the centre row
+    for (int x = 10; x <= 18; x++) {
+        if (x < 13 || x > 15) { // the crosshairs are drawn over the middle
+            EXPECT_EQ(SYM_AH_BAR9_0 + 5, testScreen.cells[7][x]);
+        }
+    }
+
+    // when the craft rolls
+    attitude.values.roll = 300;
+    osdDrawElements();
+
+    // then the bars that moved have left nothing behind
+    EXPECT_EQ(0, testScreenClears);
+    EXPECT_NE(SYM_AH_BAR9_0 + 5, testScreen.cells[7][10]);
+    EXPECT_NE(SYM_AH_BAR9_0 + 5, testScreen.cells[7][18]);
+    EXPECT_TRUE(screensMatch(testScreen, coldDraw()));
+
+    // when the craft pitches the horizon off the top of the AH area
+    attitude.values.roll = 0;
+    attitude.values.pitch = -200;
+    osdDrawElements();
+
+    // then
+    EXPECT_TRUE(screensMatch(testScreen, coldDraw()));
+}
+
+TEST_F(OsdTest, ArtificialHorizonAndSidebarsAreErasedWhenHidden)
+{
+    // given
+    EXPECT_EQ(SYM_AH_LEFT, testScreen.cells[7][8]);
+    EXPECT_EQ(SYM_AH_RIGHT, testScreen.cells[7][20]);
+    EXPECT_EQ(SYM_AH_DECORATION, testScreen.cells[4][7]);
+    EXPECT_EQ(SYM_AH_DECORATION, testScreen.cells[10][21]);
+
+    // when the accelerometer is lost
+    simulationSensors = 0;
+    osdDrawElements();
+
+    // then the bars and sidebars are erased, and the crosshairs stay
+    EXPECT_EQ(0, testScreenClears);
+    EXPECT_EQ(' ', testScreen.cells[7][10]);
+    EXPECT_EQ(' ', testScreen.cells[7][18]);
+    EXPECT_EQ(' ', testScreen.cells[7][8]);
+    EXPECT_EQ(' ', testScreen.cells[7][20]);
+    for (int y = 4; y <= 10; y++) {
+        EXPECT_EQ(' ', testScreen.cells[y][7]);
+        EXPECT_EQ(' ', testScreen.cells[y][21]);
+    }
+    EXPECT_EQ(SYM_AH_CENTER, testScreen.cells[7][14]);
+    EXPECT_TRUE(screensMatch(testScreen, coldDraw()));
+}
+
+TEST_F(OsdTest, SidebarsEraseTheirPreviousPosition)
+{
+    // when the video system changes to NTSC, which moves the AH up a row
+    testScreenSize = TEST_SCREEN_NTSC;
+    osdDrawElements();
+
+    // then the bottom of the old sidebars is erased
+    EXPECT_EQ(' ', testScreen.cells[10][7]);
+    EXPECT_EQ(' ', testScreen.cells[10][21]);
+    EXPECT_EQ(SYM_AH_DECORATION, testScreen.cells[3][7]);
+    EXPECT_EQ(SYM_AH_LEFT, testScreen.cells[6][8]);
+    EXPECT_TRUE(screensMatch(testScreen, coldDraw()));
+}
+
+TEST_F(OsdTest, PeriodicRedrawMatchesColdDraw)
+{
+    // given the OSD task running, past the splash screen
+    timeUs_t now = 5000000;
+    osdUpdateOnce(now);
+    EXPECT_EQ(1, testScreenClears);
+
+    // and a display that has lost some of what was drawn on it
+    const testScreen_t drawn = testScreen;
+    testScreen.cells[1][12] = ' ';
+    testScreen.cells[7][10] = ' ';
+    testScreen.cells[11][10] = 'X';
+    testScreen.cells[7][8] = ' ';
+
+    // when it refreshes within the second
+    now += 500000;
+    resetCellWrites();
+    osdUpdateOnce(now);
+
+    // then only what's changed is redrawn
+    EXPECT_EQ(0, testScreenClears);
+    EXPECT_EQ(0, totalCellWrites());
+    EXPECT_FALSE(screensMatch(testScreen, drawn));
+
+    // when a second has passed since the last full redraw
+    now += 600000;
+    osdUpdateOnce(now);
+
+    // then the screen is cleared and drawn again, just as it would be from cold
+    EXPECT_EQ(1, testScreenClears);
+    EXPECT_EQ(SYM_AH_LEFT, testScreen.cells[7][8]);
+    const testScreen_t redrawn = testScreen;
+    EXPECT_TRUE(screensMatch(redrawn, coldDraw()));
+}
+
+// STUBS
+
+extern "C" {
+
+int16_t debug[DEBUG16_VALUE_COUNT];
+uint8_t debugMode;
+
+uint8_t armingFlags;
+uint16_t flightModeFlags;
+uint8_t stateFlags;
+
+uint32_t rcModeActivationMask;
+int16_t rcData[MAX_SUPPORTED_RC_CHANNEL_COUNT];
+uint16_t rssi;
+
+attitudeEulerAngles_t attitude;
+
+pidProfile_t *currentPidProfile;
+
+int32_t GPS_coord[2];
+uint16_t GPS_speed;
+uint8_t GPS_numSat;
+
+uint32_t micros(void) { return simulationTime; }
+
+bool sensors(uint32_t mask) { return simulationSensors & mask; }
+
+bool isAirmodeActive(void) { return false; }
+uint8_t getCurrentPidProfileIndex(void) { return 0; }
+uint8_t getCurrentControlRateProfileIndex(void) { return 0; }
+
+uint16_t getBatteryVoltage(void) { return simulationBatteryVoltage; }
+uint8_t getBatteryCellCount(void) { return 4; }
+batteryState_e getBatteryState(void) { return BATTERY_OK; }
+int32_t getAmperage(void) { return 0; }
+int32_t getMAhDrawn(void) { return 0; }
+
+int32_t getEstimatedAltitude(void) { return 0; }
+
+void cmsDisplayPortRegister(displayPort_t *pDisplay) { UNUSED(pDisplay); }
+
+void serialWrite(serialPort_t *instance, uint8_t ch)
+{
+    UNUSED(instance);
+    UNUSED(ch);
+}
+
+bool isSerialTransmitBufferEmpty(const serialPort_t *instance)
+{
+    UNUSED(instance);
+    return true;
+}
+
+}
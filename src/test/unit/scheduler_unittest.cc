@@ -0,0 +1,444 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "common/utils.h"
+
+    #include "scheduler/scheduler.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+// The scheduler is built with USE_SCHEDULER_READY_QUEUE, these tests check the deadline ordered heap and that it
+// chooses the same tasks as the scan of every enabled task that it replaced.
+
+extern "C" {
+    extern cfTask_t *timerHeap[];
+    extern int timerHeapSize;
+    extern int8_t timerHeapPos[];
+    extern cfTask_t *eventTaskList[];
+    extern int eventTaskCount;
+
+    void queueClear(void);
+    bool queueContains(cfTask_t *task);
+    bool queueAdd(cfTask_t *task);
+    bool queueRemove(cfTask_t *task);
+    cfTask_t *queueFirst(void);
+    cfTask_t *queueNext(void);
+
+    static void testTaskFunc(timeUs_t currentTimeUs);
+    static bool testCheckFunc(timeUs_t currentTimeUs, timeDelta_t currentDeltaTimeUs);
+
+    cfTask_t cfTasks[TASK_COUNT] = {
+        { "SYSTEM", NULL, NULL, testTaskFunc, 100000, TASK_PRIORITY_MEDIUM_HIGH },
+        { "PID", NULL, NULL, testTaskFunc, 125, TASK_PRIORITY_REALTIME },
+        { "ACC", NULL, NULL, testTaskFunc, 1000, TASK_PRIORITY_MEDIUM },
+        { "ATTITUDE", NULL, NULL, testTaskFunc, 10000, TASK_PRIORITY_MEDIUM },
+        { "RX", NULL, testCheckFunc, testTaskFunc, 20000, TASK_PRIORITY_HIGH },
+        { "SERIAL", NULL, NULL, testTaskFunc, 10000, TASK_PRIORITY_LOW },
+        { "DISPATCH", NULL, NULL, testTaskFunc, 1000, TASK_PRIORITY_HIGH },
+        { "BATTERY_VOLTAGE", NULL, NULL, testTaskFunc, 20000, TASK_PRIORITY_MEDIUM },
+        { "BATTERY_CURRENT", NULL, NULL, testTaskFunc, 20000, TASK_PRIORITY_MEDIUM },
+        { "BATTERY_ALERTS", NULL, NULL, testTaskFunc, 200000, TASK_PRIORITY_MEDIUM },
+        { "GPS", NULL, NULL, testTaskFunc, 10000, TASK_PRIORITY_MEDIUM },
+        { "COMPASS", NULL, NULL, testTaskFunc, 100000, TASK_PRIORITY_LOW },
+        { "BARO", NULL, NULL, testTaskFunc, 50000, TASK_PRIORITY_LOW },
+        { "ALTITUDE", NULL, NULL, testTaskFunc, 25000, TASK_PRIORITY_LOW },
+        { "DASHBOARD", NULL, NULL, testTaskFunc, 100000, TASK_PRIORITY_LOW },
+        { "TELEMETRY", NULL, NULL, testTaskFunc, 4000, TASK_PRIORITY_LOW },
+        { "LEDSTRIP", NULL, NULL, testTaskFunc, 10000, TASK_PRIORITY_IDLE },
+        { "TRANSPONDER", NULL, NULL, testTaskFunc, 4000, TASK_PRIORITY_LOW },
+        { "CMS", NULL, NULL, testTaskFunc, 16666, TASK_PRIORITY_LOW },
+    };
+}
+
+static timeDelta_t taskPeriod[TASK_COUNT];
+static timeUs_t simulatedTime;
+static timeUs_t taskExecutionTime[TASK_COUNT];
+static bool rxSignalled;
+static int checkFuncCalls;
+static int disableSelfTask;
+static int rescheduleSelfTask;
+static timeDelta_t rescheduleSelfPeriod;
+
+// Only one task runs on each pass and time moves on every pass, so the task that ran is the one last run at that time
+static int taskRanAt(timeUs_t currentTimeUs)
+{
+    for (int taskId = 0; taskId < TASK_COUNT; taskId++) {
+        if (cfTasks[taskId].lastExecutedAt == currentTimeUs) {
+            return taskId;
+        }
+    }
+    return -1;
+}
+
+static void testTaskFunc(timeUs_t currentTimeUs)
+{
+    const int taskId = taskRanAt(currentTimeUs);
+    ASSERT_GE(taskId, 0);
+    if (taskId == disableSelfTask) {
+        setTaskEnabled(TASK_SELF, false);
+    }
+    if (taskId == rescheduleSelfTask) {
+        rescheduleTask(TASK_SELF, rescheduleSelfPeriod);
+        rescheduleSelfTask = -1;
+    }
+    simulatedTime += taskExecutionTime[taskId];
+}
+
+static bool testCheckFunc(timeUs_t currentTimeUs, timeDelta_t currentDeltaTimeUs)
+{
+    UNUSED(currentTimeUs);
+    UNUSED(currentDeltaTimeUs);
+    checkFuncCalls++;
+    return rxSignalled;
+}
+
+static timeUs_t dueAt(const cfTask_t *task)
+{
+    return task->lastExecutedAt + task->desiredPeriod;
+}
+
+static bool isInHeap(const cfTask_t *task)
+{
+    for (int pos = 0; pos < timerHeapSize; pos++) {
+        if (timerHeap[pos] == task) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Every task is due no earlier than its parent, and knows its position
+static void expectHeapIsValid(void)
+{
+    for (int pos = 0; pos < timerHeapSize; pos++) {
+        const cfTask_t *task = timerHeap[pos];
+        EXPECT_EQ(pos, timerHeapPos[task - cfTasks]) << task->taskName;
+        EXPECT_EQ(NULL, task->checkFunc) << task->taskName;
+        if (pos > 0) {
+            const cfTask_t *parent = timerHeap[(pos - 1) / 2];
+            EXPECT_GE((timeDelta_t)(dueAt(task) - dueAt(parent)), 0) << task->taskName << " before " << parent->taskName;
+        }
+    }
+}
+
+static const cfTask_t *earliestDueTask(void)
+{
+    const cfTask_t *earliest = NULL;
+    for (cfTask_t *task = queueFirst(); task != NULL; task = queueNext()) {
+        if (!task->checkFunc && (!earliest || (timeDelta_t)(dueAt(task) - dueAt(earliest)) < 0)) {
+            earliest = task;
+        }
+    }
+    return earliest;
+}
+
+/*
+ * The choice the scheduler made before the ready queue, the scan of every enabled task in priority order. It works on
+ * copies of the dynamic priorities, so the scheduler still sees the tasks as they are.
+ */
+static int linearScanSelectTask(timeUs_t currentTimeUs)
+{
+    bool outsideRealtimeGuardInterval = true;
+    for (const cfTask_t *task = queueFirst(); task != NULL && task->staticPriority >= TASK_PRIORITY_REALTIME; task = queueNext()) {
+        if ((timeDelta_t)(currentTimeUs - dueAt(task)) >= 0) {
+            outsideRealtimeGuardInterval = false;
+            break;
+        }
+    }
+
+    int selectedTaskId = -1;
+    uint16_t selectedTaskDynamicPriority = 0;
+    for (const cfTask_t *task = queueFirst(); task != NULL; task = queueNext()) {
+        uint16_t dynamicPriority = task->dynamicPriority;
+        uint16_t taskAgeCycles = task->taskAgeCycles;
+        if (task->checkFunc) {
+            if (dynamicPriority > 0) {
+                taskAgeCycles = 1 + ((currentTimeUs - task->lastSignaledAt) / task->desiredPeriod);
+                dynamicPriority = 1 + task->staticPriority * taskAgeCycles;
+            } else if (rxSignalled) {
+                taskAgeCycles = 1;
+                dynamicPriority = 1 + task->staticPriority;
+            } else {
+                taskAgeCycles = 0;
+            }
+        } else {
+            taskAgeCycles = ((currentTimeUs - task->lastExecutedAt) / task->desiredPeriod);
+            if (taskAgeCycles > 0) {
+                dynamicPriority = 1 + task->staticPriority * taskAgeCycles;
+            }
+        }
+
+        if (dynamicPriority > selectedTaskDynamicPriority
+            && (outsideRealtimeGuardInterval || taskAgeCycles > 1 || task->staticPriority == TASK_PRIORITY_REALTIME)) {
+            selectedTaskDynamicPriority = dynamicPriority;
+            selectedTaskId = task - cfTasks;
+        }
+    }
+    return selectedTaskId;
+}
+
+// Returns the task that ran, or -1
+static int runScheduler(void)
+{
+    const timeUs_t passTime = simulatedTime;
+    scheduler();
+    const int taskId = taskRanAt(passTime);
+    if (simulatedTime == passTime) {
+        simulatedTime += 5; // the time the scheduler takes to find that nothing is due
+    }
+    return taskId;
+}
+
+class SchedulerTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        for (int taskId = 0; taskId < TASK_COUNT; taskId++) {
+            cfTask_t *task = &cfTasks[taskId];
+            if (taskPeriod[taskId] == 0) {
+                taskPeriod[taskId] = task->desiredPeriod;
+            }
+            task->desiredPeriod = taskPeriod[taskId];
+            task->dynamicPriority = 0;
+            task->taskAgeCycles = 0;
+            task->lastExecutedAt = 0;
+            task->lastSignaledAt = 0;
+            taskExecutionTime[taskId] = 10 + taskId;
+        }
+        taskExecutionTime[TASK_GYROPID] = 60;
+        simulatedTime = 1000;
+        rxSignalled = false;
+        checkFuncCalls = 0;
+        disableSelfTask = -1;
+        rescheduleSelfTask = -1;
+
+        schedulerInit();
+        for (int taskId = 0; taskId < TASK_COUNT; taskId++) {
+            if (taskId != TASK_DASHBOARD) {
+                setTaskEnabled((cfTaskId_e)taskId, true);
+            }
+        }
+    }
+};
+
+TEST_F(SchedulerTest, TimeDrivenTasksAreInTheHeap)
+{
+    // expect
+    EXPECT_EQ(TASK_COUNT - 2, timerHeapSize);
+    EXPECT_EQ(1, eventTaskCount);
+    EXPECT_EQ(&cfTasks[TASK_RX], eventTaskList[0]);
+    EXPECT_FALSE(isInHeap(&cfTasks[TASK_DASHBOARD]));
+    expectHeapIsValid();
+}
+
+TEST_F(SchedulerTest, HeapOrderUnderReschedule)
+{
+    // given tasks that were last run at different times
+    for (int taskId = 0; taskId < TASK_COUNT; taskId++) {
+        cfTasks[taskId].lastExecutedAt = 1000 + taskId * 37;
+        rescheduleTask((cfTaskId_e)taskId, cfTasks[taskId].desiredPeriod);
+    }
+    expectHeapIsValid();
+    EXPECT_EQ(earliestDueTask(), timerHeap[0]);
+
+    // when the task that is due last is made due first
+    cfTasks[TASK_BATTERY_ALERTS].lastExecutedAt = 0;
+    rescheduleTask(TASK_BATTERY_ALERTS, 50);
+
+    // then it goes to the top of the heap
+    expectHeapIsValid();
+    EXPECT_EQ(&cfTasks[TASK_BATTERY_ALERTS], timerHeap[0]);
+
+    // and its period is no shorter than the limit
+    rescheduleTask(TASK_BATTERY_ALERTS, 1);
+    EXPECT_EQ(SCHEDULER_DELAY_LIMIT, cfTasks[TASK_BATTERY_ALERTS].desiredPeriod);
+
+    // and it goes back down when it gets a long period
+    rescheduleTask(TASK_BATTERY_ALERTS, 1000000);
+    expectHeapIsValid();
+    EXPECT_EQ(earliestDueTask(), timerHeap[0]);
+    EXPECT_NE(&cfTasks[TASK_BATTERY_ALERTS], timerHeap[0]);
+
+    // and rescheduling a task that isn't enabled doesn't put it in the heap
+    const int heapSize = timerHeapSize;
+    rescheduleTask(TASK_DASHBOARD, 500);
+    EXPECT_EQ(heapSize, timerHeapSize);
+    EXPECT_FALSE(isInHeap(&cfTasks[TASK_DASHBOARD]));
+}
+
+TEST_F(SchedulerTest, RescheduleBeforeInit)
+{
+    // given the state before queueClear() has set up the heap positions
+    memset(timerHeapPos, 0, TASK_COUNT);
+    timerHeapSize = 0;
+
+    // when
+    rescheduleTask(TASK_ACCEL, 2000);
+
+    // then
+    EXPECT_EQ(0, timerHeapSize);
+    EXPECT_EQ(2000, cfTasks[TASK_ACCEL].desiredPeriod);
+}
+
+TEST_F(SchedulerTest, EnableAndDisableWhileQueued)
+{
+    // when a task in the middle of the heap is disabled
+    setTaskEnabled(TASK_GPS, false);
+
+    // then
+    EXPECT_EQ(TASK_COUNT - 3, timerHeapSize);
+    EXPECT_FALSE(isInHeap(&cfTasks[TASK_GPS]));
+    EXPECT_FALSE(queueContains(&cfTasks[TASK_GPS]));
+    expectHeapIsValid();
+
+    // and disabling it again changes nothing
+    setTaskEnabled(TASK_GPS, false);
+    EXPECT_EQ(TASK_COUNT - 3, timerHeapSize);
+
+    // and enabling it twice only adds it once
+    setTaskEnabled(TASK_GPS, true);
+    setTaskEnabled(TASK_GPS, true);
+    EXPECT_EQ(TASK_COUNT - 2, timerHeapSize);
+    EXPECT_TRUE(isInHeap(&cfTasks[TASK_GPS]));
+    expectHeapIsValid();
+
+    // and the event driven task comes off its list
+    setTaskEnabled(TASK_RX, false);
+    EXPECT_EQ(0, eventTaskCount);
+    EXPECT_EQ(TASK_COUNT - 2, timerHeapSize);
+    setTaskEnabled(TASK_RX, true);
+    EXPECT_EQ(1, eventTaskCount);
+}
+
+TEST_F(SchedulerTest, TaskDisablingItselfStaysOutOfTheHeap)
+{
+    // given
+    disableSelfTask = TASK_TELEMETRY;
+
+    // when the scheduler runs until the task has run
+    int ran = -1;
+    for (int pass = 0; pass < 1000 && ran != TASK_TELEMETRY; pass++) {
+        ran = runScheduler();
+        expectHeapIsValid();
+    }
+
+    // then
+    EXPECT_EQ(TASK_TELEMETRY, ran);
+    EXPECT_FALSE(isInHeap(&cfTasks[TASK_TELEMETRY]));
+    EXPECT_FALSE(queueContains(&cfTasks[TASK_TELEMETRY]));
+    EXPECT_EQ(TASK_COUNT - 3, timerHeapSize);
+
+    // and the other tasks that run go back in the heap
+    disableSelfTask = -1;
+    for (int pass = 0; pass < 1000; pass++) {
+        EXPECT_NE(TASK_TELEMETRY, runScheduler());
+    }
+    EXPECT_EQ(TASK_COUNT - 3, timerHeapSize);
+    expectHeapIsValid();
+}
+
+TEST_F(SchedulerTest, EventTaskIsPolled)
+{
+    // given only the event driven task and the system task
+    for (int taskId = 0; taskId < TASK_COUNT; taskId++) {
+        if (taskId != TASK_RX && taskId != TASK_SYSTEM) {
+            setTaskEnabled((cfTaskId_e)taskId, false);
+        }
+    }
+    cfTasks[TASK_SYSTEM].lastExecutedAt = simulatedTime - 1;
+    rescheduleTask(TASK_SYSTEM, cfTasks[TASK_SYSTEM].desiredPeriod);
+
+    // when nothing is signalled
+    for (int pass = 0; pass < 10; pass++) {
+        EXPECT_EQ(-1, runScheduler());
+    }
+
+    // then the check function is called on every pass
+    EXPECT_EQ(10, checkFuncCalls);
+
+    // and the task runs when the check function says so
+    rxSignalled = true;
+    const timeUs_t signalledAt = simulatedTime;
+    EXPECT_EQ(TASK_RX, runScheduler());
+    EXPECT_EQ(signalledAt, cfTasks[TASK_RX].lastSignaledAt);
+    EXPECT_EQ(0, cfTasks[TASK_RX].dynamicPriority);
+    EXPECT_EQ(1, timerHeapSize);
+    EXPECT_FALSE(isInHeap(&cfTasks[TASK_RX]));
+}
+
+TEST_F(SchedulerTest, MatchesLinearScan)
+{
+    int runs[TASK_COUNT] = { 0 };
+    int idlePasses = 0;
+
+    for (int pass = 0; pass < 50000; pass++) {
+        rxSignalled = pass % 7 == 0 || pass % 11 == 0;
+
+        // change the task set now and then, the way the flight controller does
+        if (pass % 5000 == 1000) {
+            setTaskEnabled(TASK_GPS, false);
+            rescheduleTask(TASK_TRANSPONDER, 2000);
+            rescheduleSelfTask = TASK_TELEMETRY;
+            rescheduleSelfPeriod = 2000;
+        } else if (pass % 5000 == 3000) {
+            setTaskEnabled(TASK_GPS, true);
+            rescheduleSelfTask = TASK_TELEMETRY;
+            rescheduleSelfPeriod = 4000;
+        }
+        if (pass == 20000) {
+            // overload, so tasks age for more than one period and the realtime guard matters
+            taskExecutionTime[TASK_ATTITUDE] = 400;
+            taskExecutionTime[TASK_SERIAL] = 300;
+        }
+
+        const int expected = linearScanSelectTask(simulatedTime);
+        const int ran = runScheduler();
+        ASSERT_EQ(expected, ran) << "pass " << pass << " at " << simulatedTime;
+        if (ran >= 0) {
+            runs[ran]++;
+        } else {
+            idlePasses++;
+        }
+    }
+
+    // every enabled task got to run
+    for (int taskId = 0; taskId < TASK_COUNT; taskId++) {
+        if (taskId != TASK_DASHBOARD) {
+            EXPECT_GT(runs[taskId], 0) << cfTasks[taskId].taskName;
+        }
+    }
+    EXPECT_GT(idlePasses, 0);
+    expectHeapIsValid();
+}
+
+// STUBS
+
+extern "C" {
+
+timeUs_t micros(void)
+{
+    return simulatedTime;
+}
+
+}
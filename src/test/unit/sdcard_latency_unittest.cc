@@ -0,0 +1,163 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "drivers/sdcard.h"
+    #include "drivers/sdcard_latency.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+static sdcard_profilerCallback_c profilerCallback;
+
+static void completeOperations(sdcardBlockOperation_e operation, uint32_t durationUs, uint32_t count)
+{
+    for (uint32_t ii = 0; ii < count; ii++) {
+        profilerCallback(operation, ii, durationUs);
+    }
+}
+
+class SdcardLatencyTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        profilerCallback = NULL;
+        sdcardLatencyInit();
+        ASSERT_TRUE(profilerCallback != NULL);
+    }
+};
+
+TEST_F(SdcardLatencyTest, OperationsAreCountedInLogScaleBuckets)
+{
+    // when
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 0, 1);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 127, 1);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 128, 1);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 255, 1);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 256, 1);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 100000, 1);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 0xFFFFFFFF, 1);
+    completeOperations(SDCARD_BLOCK_OPERATION_READ, 300, 2);
+    completeOperations(SDCARD_BLOCK_OPERATION_ERASE, 300, 1);
+
+    // then each bucket holds the operations shorter than its upper limit and at least as long as the previous one's
+    const sdcardLatencyStats_t *stats = sdcardLatencyGetStats();
+    EXPECT_EQ(2u, stats->count[SDCARD_LATENCY_WRITE][0]);
+    EXPECT_EQ(2u, stats->count[SDCARD_LATENCY_WRITE][1]);
+    EXPECT_EQ(1u, stats->count[SDCARD_LATENCY_WRITE][2]);
+    EXPECT_EQ(1u, stats->count[SDCARD_LATENCY_WRITE][10]); // 2^16..2^17us
+    EXPECT_EQ(1u, stats->count[SDCARD_LATENCY_WRITE][SDCARD_LATENCY_BUCKET_COUNT - 1]);
+    EXPECT_EQ(7u, sdcardLatencyGetCount(SDCARD_LATENCY_WRITE));
+    EXPECT_EQ(0xFFFFFFFFu, stats->maxUs[SDCARD_LATENCY_WRITE]);
+
+    EXPECT_EQ(128u, sdcardLatencyBucketUpperUs(0));
+    EXPECT_EQ(256u, sdcardLatencyBucketUpperUs(1));
+    EXPECT_EQ(131072u, sdcardLatencyBucketUpperUs(10));
+
+    // and reads are counted apart from writes, and erases not at all
+    EXPECT_EQ(2u, stats->count[SDCARD_LATENCY_READ][2]);
+    EXPECT_EQ(2u, sdcardLatencyGetCount(SDCARD_LATENCY_READ));
+    EXPECT_EQ(300u, stats->maxUs[SDCARD_LATENCY_READ]);
+}
+
+TEST_F(SdcardLatencyTest, PercentileIsBucketUpperLimit)
+{
+    // given
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 100, 90);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 1000, 9);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 20000, 1);
+
+    // then
+    EXPECT_EQ(128u, sdcardLatencyPercentileUs(SDCARD_LATENCY_WRITE, 50));
+    EXPECT_EQ(128u, sdcardLatencyPercentileUs(SDCARD_LATENCY_WRITE, 90));
+    EXPECT_EQ(1024u, sdcardLatencyPercentileUs(SDCARD_LATENCY_WRITE, 91));
+    EXPECT_EQ(1024u, sdcardLatencyPercentileUs(SDCARD_LATENCY_WRITE, 99));
+
+    // and the slowest operation is reported rather than the limit of its bucket
+    EXPECT_EQ(20000u, sdcardLatencyPercentileUs(SDCARD_LATENCY_WRITE, 100));
+}
+
+TEST_F(SdcardLatencyTest, PercentileOfFewOperationsRoundsUp)
+{
+    // given
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 100, 3);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 5000, 1);
+
+    // then the 99th percentile of a few operations is the slowest of them
+    EXPECT_EQ(5000u, sdcardLatencyPercentileUs(SDCARD_LATENCY_WRITE, 99));
+    EXPECT_EQ(128u, sdcardLatencyPercentileUs(SDCARD_LATENCY_WRITE, 75));
+}
+
+TEST_F(SdcardLatencyTest, PercentileOfNoOperationsIsZero)
+{
+    EXPECT_EQ(0u, sdcardLatencyPercentileUs(SDCARD_LATENCY_READ, 99));
+}
+
+TEST_F(SdcardLatencyTest, PercentileOfManyOperations)
+{
+    // given more operations than the count times the percentage fits in 32 bits, as a long flight can have
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 100, 44000000);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 1000, 1000000);
+
+    // then
+    EXPECT_EQ(128u, sdcardLatencyPercentileUs(SDCARD_LATENCY_WRITE, 97));
+    EXPECT_EQ(1000u, sdcardLatencyPercentileUs(SDCARD_LATENCY_WRITE, 98));
+    EXPECT_EQ(1000u, sdcardLatencyPercentileUs(SDCARD_LATENCY_WRITE, 99));
+}
+
+TEST_F(SdcardLatencyTest, WriteAfterDroppedDataIsAStall)
+{
+    // given
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 500, 1);
+
+    // when
+    sdcardLatencyNoteDroppedData(100);
+    sdcardLatencyNoteDroppedData(50);
+    completeOperations(SDCARD_BLOCK_OPERATION_READ, 90000, 1);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 40000, 1);
+    completeOperations(SDCARD_BLOCK_OPERATION_WRITE, 60000, 1);
+
+    // then only the write that was in progress is counted as a stall
+    const sdcardLatencyStats_t *stats = sdcardLatencyGetStats();
+    EXPECT_EQ(1u, stats->stalls);
+    EXPECT_EQ(40000u, stats->stallMaxUs);
+    EXPECT_EQ(150u, stats->droppedBytes);
+
+    // when
+    sdcardLatencyReset();
+
+    // then
+    EXPECT_EQ(0u, stats->stalls);
+    EXPECT_EQ(0u, stats->droppedBytes);
+    EXPECT_EQ(0u, sdcardLatencyGetCount(SDCARD_LATENCY_WRITE));
+}
+
+// STUBS
+
+extern "C" {
+
+void sdcard_setProfilerCallback(sdcard_profilerCallback_c callback)
+{
+    profilerCallback = callback;
+}
+
+}
@@ -0,0 +1,184 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "build/debug.h"
+
+    #include "common/axis.h"
+    #include "common/maths.h"
+
+    #include "config/parameter_group.h"
+    #include "config/parameter_group_ids.h"
+
+    #include "drivers/accgyro/accgyro.h"
+    #include "drivers/accgyro/accgyro_fake.h"
+    #include "drivers/sensor.h"
+
+    #include "io/beeper.h"
+
+    #include "scheduler/scheduler.h"
+
+    #include "sensors/gyro.h"
+    #include "sensors/sensors.h"
+
+    void gyroFuseRates(gyroFusion_e fusion, float rates[][XYZ_AXIS_COUNT], const float *noiseVariance, int sensorCount, float *gyroADCf);
+
+    extern gyroDev_t *fakeGyroDev;
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+TEST(SensorGyro, FuseSingleSensor)
+{
+    float rates[1][XYZ_AXIS_COUNT] = {{ 10.0f, -20.0f, 30.0f }};
+    const float noiseVariance[1] = { 1.0f };
+    float gyroADCf[XYZ_AXIS_COUNT];
+
+    for (int fusion = GYRO_FUSION_AVERAGE; fusion <= GYRO_FUSION_FAILOVER; fusion++) {
+        gyroFuseRates((gyroFusion_e)fusion, rates, noiseVariance, 1, gyroADCf);
+        EXPECT_FLOAT_EQ(10.0f, gyroADCf[X]);
+        EXPECT_FLOAT_EQ(-20.0f, gyroADCf[Y]);
+        EXPECT_FLOAT_EQ(30.0f, gyroADCf[Z]);
+    }
+}
+
+TEST(SensorGyro, FuseAverage)
+{
+    float rates[2][XYZ_AXIS_COUNT] = {{ 10.0f, -20.0f, 30.0f }, { 20.0f, -10.0f, 0.0f }};
+    const float noiseVariance[2] = { 1.0f, 4.0f };
+    float gyroADCf[XYZ_AXIS_COUNT];
+
+    gyroFuseRates(GYRO_FUSION_AVERAGE, rates, noiseVariance, 2, gyroADCf);
+    EXPECT_FLOAT_EQ(15.0f, gyroADCf[X]);
+    EXPECT_FLOAT_EQ(-15.0f, gyroADCf[Y]);
+    EXPECT_FLOAT_EQ(15.0f, gyroADCf[Z]);
+
+    // the median of two sensors is their average
+    gyroFuseRates(GYRO_FUSION_MEDIAN, rates, noiseVariance, 2, gyroADCf);
+    EXPECT_FLOAT_EQ(15.0f, gyroADCf[X]);
+}
+
+TEST(SensorGyro, FuseMedian)
+{
+    // the third sensor is way off on the roll axis and is out voted
+    float rates[3][XYZ_AXIS_COUNT] = {{ 10.0f, 1.0f, 5.0f }, { 12.0f, 3.0f, 4.0f }, { 500.0f, 2.0f, 6.0f }};
+    const float noiseVariance[3] = { 1.0f, 1.0f, 1.0f };
+    float gyroADCf[XYZ_AXIS_COUNT];
+
+    gyroFuseRates(GYRO_FUSION_MEDIAN, rates, noiseVariance, 3, gyroADCf);
+    EXPECT_FLOAT_EQ(12.0f, gyroADCf[X]);
+    EXPECT_FLOAT_EQ(2.0f, gyroADCf[Y]);
+    EXPECT_FLOAT_EQ(5.0f, gyroADCf[Z]);
+}
+
+TEST(SensorGyro, FuseWeighted)
+{
+    // the second sensor has three times the noise variance of the first, so a third of its weight
+    float rates[2][XYZ_AXIS_COUNT] = {{ 0.0f, 8.0f, 0.0f }, { 40.0f, 0.0f, 0.0f }};
+    const float noiseVariance[2] = { 1.0f, 3.0f };
+    float gyroADCf[XYZ_AXIS_COUNT];
+
+    gyroFuseRates(GYRO_FUSION_WEIGHTED, rates, noiseVariance, 2, gyroADCf);
+    EXPECT_FLOAT_EQ(10.0f, gyroADCf[X]);
+    EXPECT_FLOAT_EQ(6.0f, gyroADCf[Y]);
+    EXPECT_FLOAT_EQ(0.0f, gyroADCf[Z]);
+
+    // a sensor without any noise does not get an unbounded weight
+    const float noNoise[2] = { 0.0f, 0.0f };
+    gyroFuseRates(GYRO_FUSION_WEIGHTED, rates, noNoise, 2, gyroADCf);
+    EXPECT_FLOAT_EQ(20.0f, gyroADCf[X]);
+}
+
+TEST(SensorGyro, FuseFailover)
+{
+    float rates[2][XYZ_AXIS_COUNT] = {{ 10.0f, -20.0f, 30.0f }, { 20.0f, -10.0f, 0.0f }};
+    const float noiseVariance[2] = { 10.0f, 1.0f };
+    float gyroADCf[XYZ_AXIS_COUNT];
+
+    gyroFuseRates(GYRO_FUSION_FAILOVER, rates, noiseVariance, 2, gyroADCf);
+    EXPECT_FLOAT_EQ(10.0f, gyroADCf[X]);
+    EXPECT_FLOAT_EQ(-20.0f, gyroADCf[Y]);
+    EXPECT_FLOAT_EQ(30.0f, gyroADCf[Z]);
+}
+
+TEST(SensorGyro, InitSensorsToUse)
+{
+    pgResetAll(MAX_PROFILE_COUNT);
+
+    gyroConfigMutable()->gyro_to_use = 1;
+    EXPECT_TRUE(gyroInit());
+    EXPECT_EQ(1, gyroSensorCount());
+
+    gyroConfigMutable()->gyro_to_use = GYRO_TO_USE_ALL;
+    EXPECT_TRUE(gyroInit());
+    EXPECT_EQ(MAX_GYRO_COUNT, gyroSensorCount());
+    for (int ii = 0; ii < MAX_GYRO_COUNT; ii++) {
+        EXPECT_TRUE(gyroSensorIsHealthy(ii));
+    }
+    EXPECT_FALSE(gyroSensorIsHealthy(MAX_GYRO_COUNT));
+}
+
+TEST(SensorGyro, UpdateFailsOver)
+{
+    pgResetAll(MAX_PROFILE_COUNT);
+    gyroConfigMutable()->gyro_to_use = GYRO_TO_USE_ALL;
+    gyroConfigMutable()->gyro_fusion = GYRO_FUSION_AVERAGE;
+    gyroConfigMutable()->gyro_soft_lpf_hz = 0;
+    gyroConfigMutable()->gyro_soft_notch_hz_1 = 0;
+    gyroConfigMutable()->gyro_soft_notch_hz_2 = 0;
+    gyroConfigMutable()->gyroMovementCalibrationThreshold = 0;
+    EXPECT_TRUE(gyroInit());
+    gyroInitFilters();
+
+    // only the last fake gyro initialised receives data, reads of the others fail
+    gyroStartCalibration();
+    for (int ii = 0; ii < 100000 && !isGyroCalibrationComplete(); ii++) {
+        fakeGyroSet(fakeGyroDev, 0, 0, 0);
+        gyroUpdate();
+    }
+    EXPECT_TRUE(isGyroCalibrationComplete());
+    EXPECT_FALSE(gyroSensorIsHealthy(0));
+    EXPECT_FALSE(gyroSensorIsHealthy(1));
+    EXPECT_TRUE(gyroSensorIsHealthy(2));
+
+    // the failed sensors do not contribute to the average
+    fakeGyroSet(fakeGyroDev, 100, -200, 300);
+    gyroUpdate();
+    EXPECT_FLOAT_EQ(100 * fakeGyroDev->scale, gyro.gyroADCf[X]);
+    EXPECT_FLOAT_EQ(-200 * fakeGyroDev->scale, gyro.gyroADCf[Y]);
+    EXPECT_FLOAT_EQ(300 * fakeGyroDev->scale, gyro.gyroADCf[Z]);
+}
+
+// STUBS
+
+extern "C" {
+
+uint8_t detectedSensors[SENSOR_INDEX_COUNT];
+
+void sensorsSet(uint32_t) {}
+void beeper(beeperMode_e) {}
+void schedulerResetTaskStatistics(cfTaskId_e) {}
+void delay(timeMs_t) {}
+void delayMicroseconds(timeUs_t) {}
+}
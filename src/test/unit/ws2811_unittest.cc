@@ -0,0 +1,161 @@
+/*
+ * This file is part of Cleanflight.
+ *
+ * Cleanflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Cleanflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Cleanflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <limits.h>
+
+extern "C" {
+    #include "platform.h"
+
+    #include "build/build_config.h"
+
+    #include "common/color.h"
+    #include "common/utils.h"
+
+    #include "drivers/light_ws2811strip.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+extern "C" {
+STATIC_UNIT_TESTED void ws2811EncodeLed(ledStripDMAElement_t *dst, const rgbColor24bpp_t *color);
+}
+
+#define TEST_PERIOD 30 // 24MHz timer and 800kHz carrier
+
+// The bit at a time expansion the encoder replaced
+static void referenceEncodeLed(ledStripDMAElement_t *dst, const rgbColor24bpp_t *color)
+{
+    const uint32_t grb = (color->rgb.g << 16) | (color->rgb.r << 8) | (color->rgb.b);
+
+    for (int8_t index = 23; index >= 0; index--) {
+        *dst++ = (grb & (1 << index)) ? BIT_COMPARE_1 : BIT_COMPARE_0;
+    }
+}
+
+TEST(WS2812, updateDMABuffer) {
+    // given
+    rgbColor24bpp_t color1 = { .raw = {0xFF,0xAA,0x55} };
+    ws2811SetBitCompare(TEST_PERIOD);
+
+    // when
+    ledStripDMAElement_t buffer[WS2811_BITS_PER_LED];
+    ws2811EncodeLed(buffer, &color1);
+
+    // then
+    EXPECT_EQ(20, BIT_COMPARE_1);
+    EXPECT_EQ(10, BIT_COMPARE_0);
+
+    // and
+    uint8_t byteIndex = 0;
+
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 0]);
+    EXPECT_EQ(BIT_COMPARE_0, buffer[(byteIndex * 8) + 1]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 2]);
+    EXPECT_EQ(BIT_COMPARE_0, buffer[(byteIndex * 8) + 3]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 4]);
+    EXPECT_EQ(BIT_COMPARE_0, buffer[(byteIndex * 8) + 5]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 6]);
+    EXPECT_EQ(BIT_COMPARE_0, buffer[(byteIndex * 8) + 7]);
+    byteIndex++;
+
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 0]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 1]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 2]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 3]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 4]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 5]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 6]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 7]);
+    byteIndex++;
+
+    EXPECT_EQ(BIT_COMPARE_0, buffer[(byteIndex * 8) + 0]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 1]);
+    EXPECT_EQ(BIT_COMPARE_0, buffer[(byteIndex * 8) + 2]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 3]);
+    EXPECT_EQ(BIT_COMPARE_0, buffer[(byteIndex * 8) + 4]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 5]);
+    EXPECT_EQ(BIT_COMPARE_0, buffer[(byteIndex * 8) + 6]);
+    EXPECT_EQ(BIT_COMPARE_1, buffer[(byteIndex * 8) + 7]);
+    byteIndex++;
+}
+
+TEST(WS2812, encodeMatchesBitAtATime) {
+    const uint16_t periods[] = { TEST_PERIOD, 29, 105 };
+
+    for (unsigned p = 0; p < ARRAYLEN(periods); p++) {
+        // given
+        ws2811SetBitCompare(periods[p]);
+
+        for (int value = 0; value < 256; value++) {
+            const rgbColor24bpp_t color = { .raw = { (uint8_t)value, (uint8_t)(value ^ 0x5a), (uint8_t)~value } };
+
+            // when
+            ledStripDMAElement_t buffer[WS2811_BITS_PER_LED];
+            ledStripDMAElement_t expected[WS2811_BITS_PER_LED];
+            ws2811EncodeLed(buffer, &color);
+            referenceEncodeLed(expected, &color);
+
+            // then
+            EXPECT_EQ(0, memcmp(expected, buffer, sizeof(buffer))) << "period " << periods[p] << " value " << value;
+        }
+    }
+}
+
+TEST(WS2812, updateStripEncodesChangedLeds) {
+    // given
+    ws2811LedStripInit(IO_TAG_NONE);
+    const hsvColor_t red = { 0, 0, 255 };
+    const hsvColor_t blue = { 240, 0, 128 };
+    setStripColor(&red);
+    ws2811UpdateStrip();
+
+    // when
+    setLedHsv(3, &blue);
+    ws2811UpdateStrip();
+
+    // then
+    for (int ledIndex = 0; ledIndex < WS2811_LED_STRIP_LENGTH; ledIndex++) {
+        const rgbColor24bpp_t rgb = ledIndex == 3 ? (rgbColor24bpp_t){ .raw = { 0, 0, 128 } } : (rgbColor24bpp_t){ .raw = { 255, 0, 0 } };
+        ledStripDMAElement_t expected[WS2811_BITS_PER_LED];
+        referenceEncodeLed(expected, &rgb);
+        EXPECT_EQ(0, memcmp(expected, &ledStripDMABuffer[ledIndex * WS2811_BITS_PER_LED], sizeof(expected))) << "led " << ledIndex;
+    }
+
+    // and the delay after the LEDs is left low
+    for (int i = WS2811_DATA_BUFFER_SIZE; i < WS2811_DMA_BUFFER_SIZE; i++) {
+        EXPECT_EQ(0u, ledStripDMABuffer[i]);
+    }
+}
+
+// STUBS
+
+extern "C" {
+void ws2811LedStripHardwareInit(ioTag_t ioTag)
+{
+    UNUSED(ioTag);
+    ws2811SetBitCompare(TEST_PERIOD);
+}
+
+void ws2811LedStripDMAEnable(void)
+{
+    ws2811LedDataTransferInProgress = 0;
+}
+}